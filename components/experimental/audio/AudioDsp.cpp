@@ -0,0 +1,252 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Audio Recorder.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "AudioDsp.h"
+
+#include <math.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+AudioDsp::AudioDsp()
+    : mActive(PR_FALSE)
+    , mChannels(0)
+    , mMaxFrames(0)
+    , mScratch(nsnull)
+    , mOut(nsnull)
+{
+}
+
+AudioDsp::~AudioDsp()
+{
+    Release();
+}
+
+static float
+DbToLinear(float db)
+{
+    return (float)pow(10.0, db / 20.0);
+}
+
+nsresult
+AudioDsp::Configure(const DspSettings *settings, int channels, int rate,
+    long maxFrames)
+{
+    Release();
+    if (channels < 1 || channels > DSP_MAX_CHANNELS)
+        return NS_ERROR_INVALID_ARG;
+
+    mHighPass = settings->highPassHz > 0 &&
+        settings->highPassHz < (PRUint32)rate / 2;
+    mGate = settings->gateDb < 0;
+    if (settings->gainDb == 0 && !mHighPass && !mGate)
+        return NS_OK;
+
+    mScratch = (float *)BufferArena::Alloc(BufferArena::ARENA_SAMPLES,
+        maxFrames * channels * sizeof(float));
+    mOut = BufferArena::Alloc(BufferArena::ARENA_SAMPLES,
+        maxFrames * channels * sizeof(int));
+    if (!mScratch || !mOut) {
+        Release();
+        return NS_ERROR_OUT_OF_MEMORY;
+    }
+    mChannels = channels;
+    mMaxFrames = maxFrames;
+    mGain = DbToLinear(settings->gainDb);
+
+    /* RBJ cookbook high-pass, Q of 1/sqrt(2) */
+    if (mHighPass) {
+        double w0 = 2 * M_PI * settings->highPassHz / rate;
+        double alpha = sin(w0) / (2 * 0.70710678);
+        double cw = cos(w0);
+        double a0 = 1 + alpha;
+        mB0 = (float)((1 + cw) / 2 / a0);
+        mB1 = (float)(-(1 + cw) / a0);
+        mB2 = mB0;
+        mA1 = (float)(-2 * cw / a0);
+        mA2 = (float)((1 - alpha) / a0);
+    }
+    memset(mZ1, 0, sizeof(mZ1));
+    memset(mZ2, 0, sizeof(mZ2));
+
+    /* Levels are compared as mean squares, so square the thresholds */
+    if (mGate) {
+        mOpenAt = DbToLinear(settings->gateDb);
+        mOpenAt *= mOpenAt;
+        mCloseAt = DbToLinear(settings->gateDb - DSP_GATE_HYSTERESIS);
+        mCloseAt *= mCloseAt;
+        mAttack = 1.0f - (float)exp(-1000.0 / (DSP_GATE_ATTACK_MS * rate));
+        mRelease = 1.0f - (float)exp(-1000.0 / (DSP_GATE_RELEASE_MS * rate));
+        mGateGain = 0;
+        mGateOpen = PR_FALSE;
+    }
+
+    mActive = PR_TRUE;
+    return NS_OK;
+}
+
+void
+AudioDsp::Release()
+{
+    BufferArena::Free(mScratch);
+    BufferArena::Free(mOut);
+    mScratch = nsnull;
+    mOut = nsnull;
+    mActive = PR_FALSE;
+}
+
+/*
+ * The stages over mScratch, one pass each
+ */
+void
+AudioDsp::Run(long count)
+{
+    long n = count * mChannels;
+    float *s = mScratch;
+
+    if (mGain != 1.0f) {
+        long i = 0;
+#ifdef __SSE2__
+        const __m128 gain = _mm_set1_ps(mGain);
+        for (; i + 4 <= n; i += 4)
+            _mm_storeu_ps(s + i, _mm_mul_ps(_mm_loadu_ps(s + i), gain));
+#endif
+        for (; i < n; i++)
+            s[i] *= mGain;
+    }
+
+    /* Transposed direct form II, each channel with its own state */
+    if (mHighPass) {
+        for (int c = 0; c < mChannels; c++) {
+            float z1 = mZ1[c], z2 = mZ2[c];
+            for (long i = c; i < n; i += mChannels) {
+                float x = s[i];
+                float y = mB0 * x + z1;
+                z1 = mB1 * x - mA1 * y + z2;
+                z2 = mB2 * x - mA2 * y;
+                s[i] = y;
+            }
+            /* Keep denormals out of the feedback once input goes quiet */
+            mZ1[c] = fabsf(z1) < 1e-20f ? 0 : z1;
+            mZ2[c] = fabsf(z2) < 1e-20f ? 0 : z2;
+        }
+    }
+
+    if (mGate) {
+        float sum = 0, target, coef, g = mGateGain;
+        for (long i = 0; i < n; i++)
+            sum += s[i] * s[i];
+        sum /= n;
+        if (sum >= mOpenAt)
+            mGateOpen = PR_TRUE;
+        else if (sum < mCloseAt)
+            mGateOpen = PR_FALSE;
+        target = mGateOpen ? 1.0f : 0.0f;
+        coef = mGateOpen ? mAttack : mRelease;
+        for (long i = 0; i < n; i += mChannels) {
+            g += (target - g) * coef;
+            for (int c = 0; c < mChannels; c++)
+                s[i + c] *= g;
+        }
+        mGateGain = g;
+    }
+}
+
+const int *
+AudioDsp::Process(const int *frames, long count)
+{
+    long n = count * mChannels;
+    int *out = (int *)mOut;
+
+    if (!mActive || count > mMaxFrames || count <= 0)
+        return frames;
+    long i = 0;
+#ifdef __SSE2__
+    const __m128 in = _mm_set1_ps(1.0f / 2147483648.0f);
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(mScratch + i, _mm_mul_ps(in,
+            _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(frames + i)))));
+#endif
+    for (; i < n; i++)
+        mScratch[i] = frames[i] * (1.0f / 2147483648.0f);
+    Run(count);
+    i = 0;
+#ifdef __SSE2__
+    /* cvttps gives 0x80000000 for anything out of range, which is right
+     * below -1; flip it to 0x7fffffff at and above 1 */
+    const __m128 scale = _mm_set1_ps(2147483648.0f);
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_mul_ps(_mm_loadu_ps(mScratch + i), scale);
+        __m128i over = _mm_castps_si128(_mm_cmpge_ps(x, scale));
+        _mm_storeu_si128((__m128i *)(out + i),
+            _mm_xor_si128(_mm_cvttps_epi32(x), over));
+    }
+#endif
+    for (; i < n; i++) {
+        float x = mScratch[i];
+        if (x >= 1.0f)
+            out[i] = 2147483647;
+        else if (x < -1.0f)
+            out[i] = -2147483647 - 1;
+        else
+            out[i] = (int)(x * 2147483648.0f);
+    }
+    return out;
+}
+
+const short *
+AudioDsp::Process(const short *frames, long count)
+{
+    long n = count * mChannels;
+    short *out = (short *)mOut;
+
+    if (!mActive || count > mMaxFrames || count <= 0)
+        return frames;
+    for (long i = 0; i < n; i++)
+        mScratch[i] = frames[i] * (1.0f / 32768.0f);
+    Run(count);
+    for (long i = 0; i < n; i++) {
+        float x = mScratch[i] * 32768.0f;
+        out[i] = (short)(x > 32767.0f ? 32767 : x < -32768.0f ? -32768 : x);
+    }
+    return out;
+}
@@ -0,0 +1,111 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Audio Recorder.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef AudioDsp_h_
+#define AudioDsp_h_
+
+#include "prtypes.h"
+#include "nscore.h"
+#include "BufferArena.h"
+
+#define DSP_MAX_CHANNELS    (2)
+/* Gate timing: opens within a couple of milliseconds, fades out over about
+ * a tenth of a second, and closes this far below where it opens */
+#define DSP_GATE_ATTACK_MS  (2)
+#define DSP_GATE_RELEASE_MS (100)
+#define DSP_GATE_HYSTERESIS (6.0f)
+
+/* What script asked for; a gain of 0 dB, a high-pass of 0 Hz and a gate
+ * threshold of 0 dBFS each leave that stage out */
+struct DspSettings {
+    float gainDb;
+    PRUint32 highPassHz;
+    float gateDb;
+};
+
+/*
+ * Cleans up captured audio once per buffer, ahead of whatever it goes to:
+ * a gain, a second order Butterworth high-pass that also takes out any DC,
+ * and a noise gate driven by the level of each buffer. Samples are
+ * converted to float into a scratch buffer, every stage runs over the
+ * whole buffer in turn, then they are converted back. With SSE2 the gain
+ * and the 32 bit conversions go four samples at a time. The capture
+ * callback only ever sees Process(); everything else is done on the
+ * media thread while no stream is running.
+ */
+class AudioDsp
+{
+public:
+    AudioDsp();
+    ~AudioDsp();
+
+    /* For buffers of at most maxFrames; does nothing when no stage is on */
+    nsresult Configure(const DspSettings *settings, int channels, int rate,
+        long maxFrames);
+    void Release();
+    PRBool Active() { return mActive; }
+
+    /* Processed copies of interleaved frames, valid until the next call.
+     * Buffers longer than configured come back untouched. */
+    const int *Process(const int *frames, long count);
+    const short *Process(const short *frames, long count);
+
+private:
+    void Run(long count);
+
+    PRBool mActive;
+    int mChannels;
+    long mMaxFrames;
+    float *mScratch;
+    void *mOut;
+
+    float mGain;
+    PRBool mHighPass;
+    float mB0, mB1, mB2, mA1, mA2;
+    float mZ1[DSP_MAX_CHANNELS];
+    float mZ2[DSP_MAX_CHANNELS];
+
+    PRBool mGate;
+    float mOpenAt;
+    float mCloseAt;
+    float mAttack;
+    float mRelease;
+    float mGateGain;
+    PRBool mGateOpen;
+};
+
+#endif
@@ -42,35 +42,12 @@ NS_IMPL_ISUPPORTS1(AudioEncoder, IAudioEncoder)
 AudioEncoder::AudioEncoder()
 {
     encoding = 0;
-    outfile = NULL;
 }
 
 AudioEncoder::~AudioEncoder()
 {
 }
 
-/*
- * This code is ripped from profile/src/nsProfile.cpp and is further
- * duplicated in uriloader/exthandler.  this should probably be moved
- * into xpcom or some other shared library.
- */ 
-static void
-MakeRandomString(char *buf, PRInt32 bufLen)
-{
-    // turn PR_Now() into milliseconds since epoch
-    // and salt rand with that.
-    double fpTime;
-    LL_L2D(fpTime, PR_Now());
-
-    // use 1e-6, granularity of PR_Now() on the mac is seconds
-    srand((uint)(fpTime * 1e-6 + 0.5));   
-    PRInt32 i;
-    for (i=0;i<bufLen;i++) {
-        *buf++ = table[rand()%TABLE_SIZE];
-    }
-    *buf = 0;
-}
-
 /*
  * Create and open OGG file
  */
@@ -83,37 +60,12 @@ AudioEncoder::CreateOgg(nsACString& file)
 	}
 	
 	nsresult rv;
-	nsCOMPtr<nsIFile> o;
-
-    /* Allocate OGG file */
-    char buf[13];
     nsCAutoString path;
 
-    rv = NS_GetSpecialDirectory(NS_OS_TEMP_DIR, getter_AddRefs(o));
+    /* Create OGG file */
+    rv = outfile.Create(path, NUM_CHANNELS, SAMPLE_RATE);
     if (NS_FAILED(rv)) return rv;
 
-    MakeRandomString(buf, 8);
-    memcpy(buf + 8, ".ogg", 5);
-    rv = o->AppendNative(nsDependentCString(buf, 12));
-    if (NS_FAILED(rv)) return rv;
-    rv = o->CreateUnique(nsIFile::NORMAL_FILE_TYPE, 0600);
-    if (NS_FAILED(rv)) return rv;
-    rv = o->GetNativePath(path);
-    if (NS_FAILED(rv)) return rv;
-    rv = o->Remove(PR_FALSE);
-    if (NS_FAILED(rv)) return rv;
-
-    /* Open file in libsndfile */
-    SF_INFO info;
-    info.channels = NUM_CHANNELS;
-    info.samplerate = SAMPLE_RATE;
-    info.format = SF_FORMAT_OGG | SF_FORMAT_VORBIS;
-
-    if (!(outfile = sf_open(path.get(), SFM_WRITE, &info))) {
-        sf_perror(NULL);
-        return NS_ERROR_FAILURE;
-    }
-
 	file.Assign(path.get(), strlen(path.get()));
 	
 	encoding = 1;
@@ -137,8 +89,10 @@ AudioEncoder::AppendFrames(PRInt32 *frames, PRUint32 numBytes)
         return NS_ERROR_FAILURE;
     }
 
+    /* Scripts can append faster than real time, wait for the encoder
+     * rather than lose any of it */
     PRUint32 fr = numBytes / (NUM_CHANNELS * sizeof(SAMPLE));
-    if (sf_writef_int(outfile, (const SAMPLE *)frames, fr) != fr) {
+    if (NS_FAILED(outfile.WriteAll((const SAMPLE *)frames, fr))) {
         fprintf(stderr, "JEP Audio:: Could not append frames!\n");
         return NS_ERROR_FAILURE;
     }
@@ -146,7 +100,7 @@ AudioEncoder::AppendFrames(PRInt32 *frames, PRUint32 numBytes)
 }
 
 /*
- * Close SNDFILE
+ * Close the OGG file, filling in its seek index
  */
 NS_IMETHODIMP
 AudioEncoder::Finalize()
@@ -156,9 +110,8 @@ AudioEncoder::Finalize()
 		return NS_ERROR_FAILURE;
 	}
 	
-	sf_close(outfile);
+	nsresult rv = outfile.Close();
 	
 	encoding = 0;
-	outfile = NULL;
-	return NS_OK;
+	return rv;
 }
\ No newline at end of file
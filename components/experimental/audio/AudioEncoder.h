@@ -40,10 +40,7 @@
 
 #include "IAudioEncoder.h"
 
-// MSVC Weirdness
-#define __int64_t __int64
-#include "sndfile.h"
-#undef __int64_t
+#include "OggVorbisFile.h"
 
 #include "prmem.h"
 #include "nsIFile.h"
@@ -81,16 +78,8 @@ public:
 private:
     ~AudioEncoder();
     int encoding;
-    SNDFILE *outfile;
+    OggVorbisFile outfile;
 
 };
 
-#define TABLE_SIZE 36
-static const char table[] = {
-    'a','b','c','d','e','f','g','h','i','j',
-    'k','l','m','n','o','p','q','r','s','t',
-    'u','v','w','x','y','z','0','1','2','3',
-    '4','5','6','7','8','9' 
-};
-
 #endif
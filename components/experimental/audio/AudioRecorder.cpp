@@ -39,6 +39,65 @@
 
 NS_IMPL_ISUPPORTS1(AudioRecorder, IAudioRecorder)
 
+/*
+ * Starts or stops the stream on the media thread, then tells the
+ * script's callback how it went
+ */
+class AudioTask : public MediaTask
+{
+public:
+    enum { START, STOP, WARM_UP, REFRESH };
+
+    AudioTask(AudioRecorder *recorder, int op, PRUint32 generation,
+        IAudioRecorderCallback *callback)
+        : mFile(NULL)
+        , mRecorder(recorder)
+        , mOp(op)
+        , mGeneration(generation)
+        , mCallback(callback)
+    {
+    }
+
+    /* Where a START records to, one or the other */
+    nsCOMPtr<nsIAsyncOutputStream> mPipe;
+    FILE *mFile;
+    nsCString mPath;
+    PipeFormat mFormat;
+    DspSettings mDsp;
+
+protected:
+    nsresult Perform()
+    {
+        switch (mOp) {
+        case STOP:
+            return mRecorder->CloseStream();
+        case WARM_UP:
+            return mRecorder->EnsureBackend();
+        case REFRESH:
+            return mRecorder->Rescan();
+        }
+        return mRecorder->OpenStream(mPipe, mFile, mPath, &mFormat,
+            &mDsp);
+    }
+
+    void Complete(nsresult status)
+    {
+        nsCOMPtr<IAudioRecorderCallback> callback;
+        
+        if (mOp == START)
+            mRecorder->Started(mGeneration, status);
+        callback.swap(mCallback);
+        if (callback)
+            callback->OnComplete(status);
+    }
+
+private:
+    AudioRecorder *mRecorder;
+    int mOp;
+    PRUint32 mGeneration;
+    nsCOMPtr<IAudioRecorderCallback> mCallback;
+};
+
 AudioRecorder *AudioRecorder::gAudioRecordingService = nsnull;
 
 AudioRecorder *
@@ -64,57 +123,83 @@ AudioRecorder::Init()
 {   
     stream = NULL;
     recording = 0;
+    generation = 0;
+    voiceEncoder = nsnull;
+    pipeFormat.voice = PR_FALSE;
+    pipeFormat.vorbis = PR_FALSE;
+    pipeFormat.flushMs = PIPE_FLUSH_INTERVAL;
+    dspSettings.gainDb = 0;
+    dspSettings.highPassHz = 0;
+    dspSettings.gateDb = 0;
+    pipeFormat.bitrate = VOICE_BITRATE;
+    pipeFormat.frameMs = VOICE_FRAME_MS;
+    
+    /* PortAudio is brought up on first use, or by warmUp() */
+    backendTried = PR_FALSE;
+    backendStatus = NS_OK;
+    return devices.Init();
+}
 
-    PaError err;
-    err = Pa_Initialize();
+/*
+ * Initialize PortAudio, which goes through every host API and device.
+ * Runs on the media thread, once.
+ */
+nsresult
+AudioRecorder::EnsureBackend()
+{
+    if (backendTried)
+        return backendStatus;
+    
+    backendTried = PR_TRUE;
+    backendStatus = NS_OK;
+    PaError err = Pa_Initialize();
     if (err != paNoError) {
         fprintf(stderr, "JEP Audio:: Could not initialize PortAudio! %d\n", err);
-        return NS_ERROR_FAILURE;
+        backendStatus = NS_ERROR_FAILURE;
+    } else {
+        devices.Scan();
     }
+    return backendStatus;
+}
+
+/*
+ * PortAudio only finds devices plugged in since it started by starting
+ * over. Media thread, and not while the device is open.
+ */
+nsresult
+AudioRecorder::Rescan()
+{
+    PaError err;
     
-    return NS_OK;
+    if (stream) {
+        fprintf(stderr, "Recording in progress!\n");
+        return NS_ERROR_FAILURE;
+    }
+    if (backendTried && NS_SUCCEEDED(backendStatus)) {
+        devices.Clear();
+        if ((err = Pa_Terminate()) != paNoError)
+            fprintf(stderr, "JEP Audio:: Could not terminate PortAudio! %d\n", err);
+    }
+    backendTried = PR_FALSE;
+    return EnsureBackend();
 }
 
 AudioRecorder::~AudioRecorder()
 {   
+    /* Let anything still queued finish before PortAudio goes away, and
+     * finish off a recording nobody stopped so it is still playable */
+    media.Shutdown();
+    CloseStream();
+    
     PaError err;
-    if ((err = Pa_Terminate()) != paNoError) {
+    if (backendTried && NS_SUCCEEDED(backendStatus) &&
+        (err = Pa_Terminate()) != paNoError) {
         fprintf(stderr, "JEP Audio:: Could not terminate PortAudio! %d\n", err);
     }
     
     gAudioRecordingService = nsnull;
 }
 
-#define TABLE_SIZE 36
-static const char table[] = {
-    'a','b','c','d','e','f','g','h','i','j',
-    'k','l','m','n','o','p','q','r','s','t',
-    'u','v','w','x','y','z','0','1','2','3',
-    '4','5','6','7','8','9' 
-};
-
-/*
- * This code is ripped from profile/src/nsProfile.cpp and is further
- * duplicated in uriloader/exthandler.  this should probably be moved
- * into xpcom or some other shared library.
- */ 
-static void
-MakeRandomString(char *buf, PRInt32 bufLen)
-{
-    // turn PR_Now() into milliseconds since epoch
-    // and salt rand with that.
-    double fpTime;
-    LL_L2D(fpTime, PR_Now());
-
-    // use 1e-6, granularity of PR_Now() on the mac is seconds
-    srand((uint)(fpTime * 1e-6 + 0.5));   
-    PRInt32 i;
-    for (i=0;i<bufLen;i++) {
-        *buf++ = table[rand()%TABLE_SIZE];
-    }
-    *buf = 0;
-}
-
 /*
  * This replaces \ with \\ so that Windows paths are sane
  */
@@ -140,39 +225,6 @@ EscapeBackslash(nsACString& str)
 	}
 }
 
-/*
- * Try to intelligently fetch a default input device
- */
-static PaDeviceIndex
-GetDefaultInputDevice()
-{
-    int i, numDevices;
-    PaDeviceIndex def;
-    const PaDeviceInfo *deviceInfo;
-    
-    numDevices = Pa_GetDeviceCount();
-    if (numDevices < 0) {
-        fprintf(stderr, "JEP Audio:: No audio devices found!\n");
-        return paNoDevice;
-    }
-    
-    /* Try default input */
-    if ((def = Pa_GetDefaultInputDevice()) != paNoDevice) {
-        return def;
-    }
-    
-    /* No luck, iterate and check for API specific input device */
-    for (i = 0; i < numDevices; i++) {
-        deviceInfo = Pa_GetDeviceInfo(i);
-        if (i == Pa_GetHostApiInfo(deviceInfo->hostApi)->defaultInputDevice) {
-            return i;
-        }
-    }
-    
-    /* No device :( */
-    return paNoDevice;
-}
-
 int
 AudioRecorder::RecordCallback(const void *input, void *output,
         unsigned long framesPerBuffer,
@@ -181,9 +233,11 @@ AudioRecorder::RecordCallback(const void *input, void *output,
         void *userData)
 {
     PRUint32 written;
-    nsIAsyncOutputStream *op = static_cast<AudioRecorder*>(userData)->mPipeOut;
+    AudioRecorder *rec = static_cast<AudioRecorder*>(userData);
+    nsIAsyncOutputStream *op = rec->mPipeOut;
 
     if (input != NULL) {
+        input = rec->dsp.Process((const SAMPLE *)input, framesPerBuffer);
         op->Write((const char *)input,
             (PRUint32)(sizeof(SAMPLE) * NUM_CHANNELS * framesPerBuffer),
                 &written);
@@ -199,189 +253,601 @@ AudioRecorder::RecordToFileCallback(const void *input, void *output,
         PaStreamCallbackFlags statusFlags,
         void *userData)
 {
-    SNDFILE *out = static_cast<AudioRecorder*>(userData)->outfile;
+    AudioRecorder *rec = static_cast<AudioRecorder*>(userData);
 
+    TRACE_THREAD("audio capture");
     if (input != NULL) {
-        sf_writef_int(out, (const SAMPLE *)input, framesPerBuffer);
-    }
+        TRACE_BEGIN("queue samples", framesPerBuffer);
+        rec->outfile.Write(
+            rec->dsp.Process((const SAMPLE *)input, framesPerBuffer),
+            framesPerBuffer);
+        TRACE_END("queue samples", framesPerBuffer);
+    } else
+        TRACE_INSTANT("dropout", framesPerBuffer);
     
     return paContinue;
 }
 
+int
+AudioRecorder::VoiceCallback(const void *input, void *output,
+        unsigned long framesPerBuffer,
+        const PaStreamCallbackTimeInfo* timeInfo,
+        PaStreamCallbackFlags statusFlags,
+        void *userData)
+{
+    AudioRecorder *rec = static_cast<AudioRecorder*>(userData);
+
+    TRACE_THREAD("audio capture");
+    if (input != NULL) {
+        TRACE_BEGIN("queue samples", framesPerBuffer);
+        rec->voiceEncoder->Write(
+            rec->dsp.Process((const short *)input, framesPerBuffer),
+            framesPerBuffer);
+        TRACE_END("queue samples", framesPerBuffer);
+    } else
+        TRACE_INSTANT("dropout", framesPerBuffer);
+    return paContinue;
+}
+
+void
+AudioRecorder::OnVoicePage(void *data, ogg_page *og)
+{
+    static_cast<AudioRecorder*>(data)->voiceWriter.WritePage(og);
+}
+
 /*
- * Start recording
+ * Set up Opus into the pipe, headers first. Media thread; CloseStream()
+ * cleans up after a failure.
  */
-NS_IMETHODIMP
-AudioRecorder::Start(nsIAsyncInputStream** out)
+nsresult
+AudioRecorder::OpenVoice(nsIAsyncOutputStream *pipe,
+    const PipeFormat *fmt)
 {
-    if (recording) {
-        fprintf(stderr, "JEP Audio:: Recording in progress!\n");
-        return NS_ERROR_FAILURE;
-    }
-
-    /* Create pipe: NS_NewPipe2 is not exported by XPCOM */
-    nsCOMPtr<nsIPipe> pipe = do_CreateInstance("@mozilla.org/pipe;1");
-    if (!pipe)
+    nsresult rv;
+    
+    mPipeOut = pipe;
+    if (!(voiceEncoder = new VoiceEncoder()))
         return NS_ERROR_OUT_OF_MEMORY;
-
-    nsresult rv = pipe->Init(PR_TRUE, PR_TRUE, 0, PR_UINT32_MAX, NULL);
+    rv = voiceEncoder->Init(fmt->bitrate, fmt->frameMs, OnVoicePage,
+        this);
     if (NS_FAILED(rv)) return rv;
+    rv = voiceWriter.OpenStream(pipe, WRITE_HIGH_WATER);
+    if (NS_FAILED(rv)) return rv;
+    voiceEncoder->WriteHeaders();
+    /* Encoding and paging happen there, not in PortAudio's callback */
+    return voiceEncoder->Start();
+}
 
-    pipe->GetInputStream(&mPipeIn);
-    pipe->GetOutputStream(&mPipeOut);
-
-    recording = 1;
-    *out = mPipeIn;
-
-    /* Check for audio input device */
+/*
+ * Open the default input and start it feeding the pipe or the file.
+ * Runs on the media thread; on failure the pipe is closed so whoever
+ * holds the other end is not left waiting, and the file is removed.
+ */
+nsresult
+AudioRecorder::OpenStream(nsIAsyncOutputStream *pipe, FILE *file,
+    const nsACString &path, const PipeFormat *fmt,
+    const DspSettings *dspSettings)
+{
+    nsresult rv;
+    PaError err;
+    PaTime latency;
     PaDeviceIndex dev;
-    dev = GetDefaultInputDevice();
+    PaStreamCallback *callback;
+    int channels = NUM_CHANNELS;
+    double rate = SAMPLE_RATE;
+    unsigned long frames = FRAMES_PER_BUFFER;
+    PaSampleFormat format = PA_SAMPLE_TYPE;
+    
+    rv = EnsureBackend();
+    if (NS_FAILED(rv)) {
+        if (file)
+            OutputFile::Discard(file, path);
+        else
+            pipe->Close();
+        return rv;
+    }
+    
+    if (file) {
+        rv = outfile.Open(file, path, NUM_CHANNELS, SAMPLE_RATE);
+        if (NS_FAILED(rv)) return rv;
+        callback = this->RecordToFileCallback;
+    } else if (fmt->voice) {
+        /* One Opus frame per buffer, so each goes out as it is captured */
+        rv = OpenVoice(pipe, fmt);
+        if (NS_FAILED(rv)) {
+            AbortStream();
+            return rv;
+        }
+        channels = VOICE_CHANNELS;
+        rate = VOICE_RATE;
+        frames = voiceEncoder->FrameSize();
+        format = paInt16;
+        callback = this->VoiceCallback;
+    } else if (fmt->vorbis) {
+        /* Same encoder thread as a file, its pages go down the pipe */
+        mPipeOut = pipe;
+        rv = outfile.OpenStream(pipe, NUM_CHANNELS, SAMPLE_RATE,
+            fmt->flushMs);
+        if (NS_FAILED(rv)) {
+            AbortStream();
+            return rv;
+        }
+        callback = this->RecordToFileCallback;
+    } else {
+        mPipeOut = pipe;
+        callback = this->RecordCallback;
+    }
+    
+    /* Whatever the buffers go to, they are cleaned up first */
+    rv = dsp.Configure(dspSettings, channels, (int)rate, frames);
+    if (NS_FAILED(rv)) {
+        AbortStream();
+        return rv;
+    }
+    
+    /* Check for audio input device, as found when PortAudio started */
+    dev = devices.DefaultInput(&latency);
     if (dev == paNoDevice) {
         fprintf(stderr, "JEP Audio:: Could not find input device!\n");
+        AbortStream();
         return NS_ERROR_UNEXPECTED;
     }
     
     /* Open stream */
-    PaError err;
     PaStreamParameters inputParameters;    
     inputParameters.device = dev;
-    inputParameters.channelCount = 2;
-    inputParameters.sampleFormat = PA_SAMPLE_TYPE;
-    inputParameters.suggestedLatency =
-        Pa_GetDeviceInfo(dev)->defaultLowInputLatency;
+    inputParameters.channelCount = channels;
+    inputParameters.sampleFormat = format;
+    inputParameters.suggestedLatency = latency;
     inputParameters.hostApiSpecificStreamInfo = NULL;
 
     err = Pa_OpenStream(
             &stream,
             &inputParameters,
             NULL,
-            SAMPLE_RATE,
-            FRAMES_PER_BUFFER,
+            rate,
+            frames,
             paClipOff,
-            this->RecordCallback,
+            callback,
             this
     );
     if (err != paNoError) {
-        fprintf(stderr, "JEP Audio:: Could not open stream! %d", err);
+        fprintf(stderr, "JEP Audio:: Could not open stream! %d\n", err);
+        stream = NULL;
+        AbortStream();
+        return NS_ERROR_FAILURE;
     }
     
     /* Start recording */
     err = Pa_StartStream(stream);
     if (err != paNoError) {
-        fprintf(stderr, "JEP Audio:: Could not start stream! %d", err);
+        fprintf(stderr, "JEP Audio:: Could not start stream! %d\n", err);
+        AbortStream();
         return NS_ERROR_FAILURE;
     }
     return NS_OK;
 }
 
 /*
- * Start recording to file
+ * Stop the device, then finish the pipe or file it was feeding. Runs on
+ * the media thread.
+ */
+nsresult
+AudioRecorder::CloseStream()
+{
+    nsresult rv = NS_OK;
+    
+    if (stream) {
+        /* Don't wait for the host to play out its buffers, what was
+         * captured is already with us. Once this returns the callback
+         * will not run again. */
+        PaError err = Pa_AbortStream(stream);
+        if (err != paNoError) {
+            fprintf(stderr, "JEP Audio:: Could not stop stream! %d\n", err);
+            rv = NS_ERROR_FAILURE;
+        }
+        err = Pa_CloseStream(stream);
+        if (err != paNoError) {
+            fprintf(stderr, "JEP Audio:: Could not close stream! %d\n", err);
+            rv = NS_ERROR_FAILURE;
+        }
+        stream = NULL;
+    }
+    dsp.Release();
+    
+    /* The callback is done with the pipe or file, finish them. Closing
+     * the file encodes what is still queued and writes the index; the
+     * pipe goes last, a compressed one still has pages to take. */
+    if (voiceEncoder) {
+        voiceEncoder->Finish();
+        delete voiceEncoder;
+        voiceEncoder = nsnull;
+        voiceWriter.Close();
+    }
+    if (outfile.IsOpen() && NS_FAILED(outfile.Close()))
+        rv = NS_ERROR_FAILURE;
+    if (mPipeOut) {
+        mPipeOut->Close();
+        mPipeOut = nsnull;
+    }
+    return rv;
+}
+
+/*
+ * Undo an OpenStream() that failed part way. Capture never started, so
+ * there is nothing in the file worth keeping.
+ */
+void
+AudioRecorder::AbortStream()
+{
+    outfile.Discard();
+    CloseStream();
+}
+
+/*
+ * A start that failed leaves nothing to stop, unless script has moved
+ * on to another recording since
+ */
+void
+AudioRecorder::Started(PRUint32 gen, nsresult status)
+{
+    if (NS_FAILED(status) && gen == generation)
+        recording = 0;
+}
+
+/*
+ * Start recording to a pipe
  */
 NS_IMETHODIMP
-AudioRecorder::StartRecordToFile(nsACString& file)
+AudioRecorder::Start(IAudioRecorderCallback *callback,
+    nsIAsyncInputStream** out)
 {
     if (recording) {
         fprintf(stderr, "JEP Audio:: Recording in progress!\n");
         return NS_ERROR_FAILURE;
     }
 
-    /* Check for audio input device */
-    nsresult rv;
-    PaDeviceIndex dev;
-	nsCOMPtr<nsIFile> o;
-
-    dev = GetDefaultInputDevice();
-    if (dev == paNoDevice) {
-        fprintf(stderr, "JEP Audio:: Could not find input device!\n");
-        return NS_ERROR_UNEXPECTED;
-    }
-    
-    /* Allocate OGG file */
-    char buf[13];
-    nsCAutoString path;
+    /* Create pipe: NS_NewPipe2 is not exported by XPCOM */
+    nsCOMPtr<nsIPipe> pipe = do_CreateInstance("@mozilla.org/pipe;1");
+    if (!pipe)
+        return NS_ERROR_OUT_OF_MEMORY;
 
-    rv = NS_GetSpecialDirectory(NS_OS_TEMP_DIR, getter_AddRefs(o));
+    /* Unbounded but for the memory budget: once segments are refused
+     * the callback's writes fail and that audio is dropped */
+    nsCOMPtr<nsIMemory> arena = new ArenaMemory(BufferArena::ARENA_PIPE);
+    if (!arena)
+        return NS_ERROR_OUT_OF_MEMORY;
+    nsresult rv = pipe->Init(PR_TRUE, PR_TRUE, 0, PR_UINT32_MAX, arena);
     if (NS_FAILED(rv)) return rv;
 
-    MakeRandomString(buf, 8);
-    memcpy(buf + 8, ".ogg", 5);
-    rv = o->AppendNative(nsDependentCString(buf, 12));
-    if (NS_FAILED(rv)) return rv;
-    rv = o->CreateUnique(nsIFile::NORMAL_FILE_TYPE, 0600);
-    if (NS_FAILED(rv)) return rv;
-    rv = o->GetNativePath(path);
-    if (NS_FAILED(rv)) return rv;
-    rv = o->Remove(PR_FALSE);
+    nsCOMPtr<nsIAsyncInputStream> pipeIn;
+    nsRefPtr<AudioTask> task =
+        new AudioTask(this, AudioTask::START, generation + 1, callback);
+    if (!task)
+        return NS_ERROR_OUT_OF_MEMORY;
+    task->mFormat = pipeFormat;
+    task->mDsp = dspSettings;
+    pipe->GetInputStream(getter_AddRefs(pipeIn));
+    pipe->GetOutputStream(getter_AddRefs(task->mPipe));
+    
+    rv = media.Dispatch(task);
     if (NS_FAILED(rv)) return rv;
+    
+    generation++;
+    recording = 1;
+    NS_ADDREF(*out = pipeIn);
+    return NS_OK;
+}
 
-    /* Open file in libsndfile */
-    SF_INFO info;
-    info.channels = NUM_CHANNELS;
-    info.samplerate = SAMPLE_RATE;
-    info.format = SF_FORMAT_OGG | SF_FORMAT_VORBIS;
-
-    if (!(outfile = sf_open(path.get(), SFM_WRITE, &info))) {
-        sf_perror(NULL);
+/*
+ * Start recording to file
+ */
+NS_IMETHODIMP
+AudioRecorder::StartRecordToFile(IAudioRecorderCallback *callback,
+    nsACString& file)
+{
+    if (recording) {
+        fprintf(stderr, "JEP Audio:: Recording in progress!\n");
         return NS_ERROR_FAILURE;
     }
 
-    EscapeBackslash(path);
-	file.Assign(path.get(), strlen(path.get()));
-
-    /* Open stream */
-    PaError err;
-    PaStreamParameters inputParameters;    
-    inputParameters.device = dev;
-    inputParameters.channelCount = 2;
-    inputParameters.sampleFormat = PA_SAMPLE_TYPE;
-    inputParameters.suggestedLatency =
-        Pa_GetDeviceInfo(dev)->defaultLowInputLatency;
-    inputParameters.hostApiSpecificStreamInfo = NULL;
-
-    err = Pa_OpenStream(
-            &stream,
-            &inputParameters,
-            NULL,
-            SAMPLE_RATE,
-            FRAMES_PER_BUFFER,
-            paClipOff,
-            this->RecordToFileCallback,
-            this
-    );
-    if (err != paNoError) {
-        fprintf(stderr, "JEP Audio:: Could not open stream! %d", err);
+    nsresult rv;
+    nsRefPtr<AudioTask> task =
+        new AudioTask(this, AudioTask::START, generation + 1, callback);
+    if (!task)
+        return NS_ERROR_OUT_OF_MEMORY;
+    task->mFormat.voice = PR_FALSE;
+    task->mFormat.vorbis = PR_FALSE;
+    task->mDsp = dspSettings;
+    
+    /* Create OGG file, the encoder is set up on the media thread */
+    rv = OutputFile::Create("audio", ".ogg", FILE_RESERVE, task->mPath,
+        &task->mFile);
+    if (NS_FAILED(rv)) {
+        fprintf(stderr, "JEP Audio:: Could not open OGG file\n");
+        return rv;
     }
     
-    /* Start recording */
-    err = Pa_StartStream(stream);
-    if (err != paNoError) {
-        fprintf(stderr, "JEP Audio:: Could not start stream! %d", err);
-        return NS_ERROR_FAILURE;
+    nsCAutoString path(task->mPath);
+    rv = media.Dispatch(task);
+    if (NS_FAILED(rv)) {
+        OutputFile::Discard(task->mFile, path);
+        return rv;
     }
-	recording = 2;
+    
+    generation++;
+    recording = 2;
+    EscapeBackslash(path);
+	file.Assign(path.get(), strlen(path.get()));
     return NS_OK;
 }
 
 /*
- * Stop stream recording
+ * Stop recording, the file is complete once callback hears about it
  */
 NS_IMETHODIMP
-AudioRecorder::Stop()
+AudioRecorder::Stop(IAudioRecorderCallback *callback)
 {
     if (!recording) {
         fprintf(stderr, "JEP Audio:: No recording in progress!\n");
         return NS_ERROR_FAILURE;    
     }
     
-    PaError err = Pa_StopStream(stream);
-    if (err != paNoError) {
-        fprintf(stderr, "JEP Audio:: Could not close stream!\n");
+    nsRefPtr<AudioTask> task =
+        new AudioTask(this, AudioTask::STOP, generation, callback);
+    if (!task)
+        return NS_ERROR_OUT_OF_MEMORY;
+    nsresult rv = media.Dispatch(task);
+    if (NS_FAILED(rv)) return rv;
+    
+    recording = 0;
+    return NS_OK;
+}
+
+/*
+ * Bring PortAudio up on the media thread, so that the first recording
+ * does not have to wait for it
+ */
+NS_IMETHODIMP
+AudioRecorder::WarmUp(IAudioRecorderCallback *callback)
+{
+    nsRefPtr<AudioTask> task =
+        new AudioTask(this, AudioTask::WARM_UP, generation, callback);
+    if (!task)
+        return NS_ERROR_OUT_OF_MEMORY;
+    return media.Dispatch(task);
+}
+
+NS_IMETHODIMP
+AudioRecorder::RefreshDevices(IAudioRecorderCallback *callback)
+{
+    if (recording) {
+        fprintf(stderr, "Recording in progress!\n");
         return NS_ERROR_FAILURE;
     }
     
-	if (recording == 1) {
-		mPipeOut->Close();
-	}
-    recording = 0;
+    nsRefPtr<AudioTask> task =
+        new AudioTask(this, AudioTask::REFRESH, generation, callback);
+    if (!task)
+        return NS_ERROR_OUT_OF_MEMORY;
+    return media.Dispatch(task);
+}
+
+NS_IMETHODIMP
+AudioRecorder::GetMemoryBudget(PRUint32 *retval)
+{
+    *retval = BufferArena::Budget();
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+AudioRecorder::SetMemoryBudget(PRUint32 value)
+{
+    BufferArena::SetBudget(value);
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+AudioRecorder::GetMemoryStats(nsACString &retval)
+{
+    retval.Truncate();
+    BufferArena::AppendStats(retval);
+    return NS_OK;
+}
+
+/*
+ * Opus for speech down the pipe, and its bitrate and frame length
+ */
+NS_IMETHODIMP
+AudioRecorder::GetVoiceMode(PRBool *retval)
+{
+    *retval = pipeFormat.voice;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+AudioRecorder::SetVoiceMode(PRBool value)
+{
+    if (recording) {
+        fprintf(stderr, "JEP Audio:: Recording in progress!\n");
+        return NS_ERROR_FAILURE;
+    }
+    pipeFormat.voice = value;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+AudioRecorder::GetVoiceBitrate(PRUint32 *retval)
+{
+    *retval = pipeFormat.bitrate;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+AudioRecorder::SetVoiceBitrate(PRUint32 value)
+{
+    if (recording) {
+        fprintf(stderr, "JEP Audio:: Recording in progress!\n");
+        return NS_ERROR_FAILURE;
+    }
+    /* What Opus itself allows */
+    if (value < 6000 || value > 510000)
+        return NS_ERROR_INVALID_ARG;
+    pipeFormat.bitrate = value;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+AudioRecorder::GetVoiceFrameMs(PRUint32 *retval)
+{
+    *retval = pipeFormat.frameMs;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+AudioRecorder::SetVoiceFrameMs(PRUint32 value)
+{
+    if (recording) {
+        fprintf(stderr, "JEP Audio:: Recording in progress!\n");
+        return NS_ERROR_FAILURE;
+    }
+    if (value != 10 && value != 20)
+        return NS_ERROR_INVALID_ARG;
+    pipeFormat.frameMs = value;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+AudioRecorder::GetCompressStream(PRBool *retval)
+{
+    *retval = pipeFormat.vorbis;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+AudioRecorder::SetCompressStream(PRBool value)
+{
+    if (recording) {
+        fprintf(stderr, "JEP Audio:: Recording in progress!\n");
+        return NS_ERROR_FAILURE;
+    }
+    pipeFormat.vorbis = value;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+AudioRecorder::GetStreamFlushInterval(PRUint32 *retval)
+{
+    *retval = pipeFormat.flushMs;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+AudioRecorder::SetStreamFlushInterval(PRUint32 value)
+{
+    if (recording) {
+        fprintf(stderr, "JEP Audio:: Recording in progress!\n");
+        return NS_ERROR_FAILURE;
+    }
+    if (value > PIPE_FLUSH_MAX)
+        return NS_ERROR_INVALID_ARG;
+    pipeFormat.flushMs = value;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+AudioRecorder::GetInputGain(float *retval)
+{
+    *retval = dspSettings.gainDb;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+AudioRecorder::SetInputGain(float value)
+{
+    if (recording) {
+        fprintf(stderr, "JEP Audio:: Recording in progress!\n");
+        return NS_ERROR_FAILURE;
+    }
+    if (value < -60 || value > 40)
+        return NS_ERROR_INVALID_ARG;
+    dspSettings.gainDb = value;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+AudioRecorder::GetHighPassFrequency(PRUint32 *retval)
+{
+    *retval = dspSettings.highPassHz;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+AudioRecorder::SetHighPassFrequency(PRUint32 value)
+{
+    if (recording) {
+        fprintf(stderr, "JEP Audio:: Recording in progress!\n");
+        return NS_ERROR_FAILURE;
+    }
+    /* Well under the lowest rate we record at */
+    if (value > 8000)
+        return NS_ERROR_INVALID_ARG;
+    dspSettings.highPassHz = value;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+AudioRecorder::GetNoiseGateThreshold(float *retval)
+{
+    *retval = dspSettings.gateDb;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+AudioRecorder::SetNoiseGateThreshold(float value)
+{
+    if (recording) {
+        fprintf(stderr, "JEP Audio:: Recording in progress!\n");
+        return NS_ERROR_FAILURE;
+    }
+    if (value < -120 || value > 0)
+        return NS_ERROR_INVALID_ARG;
+    dspSettings.gateDb = value;
+    return NS_OK;
+}
+
+/*
+ * Trace the capture callback, the encoder and the writer
+ */
+NS_IMETHODIMP
+AudioRecorder::StartTrace()
+{
+    TraceRing::Start();
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+AudioRecorder::StopTrace()
+{
+    TraceRing::Stop();
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+AudioRecorder::GetTrace(nsACString &retval)
+{
+    retval.Truncate();
+    TraceRing::AppendJSON(retval);
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+AudioRecorder::GetDevices(nsACString &retval)
+{
+    /* An empty list would look like there are no devices at all */
+    if (!devices.Scanned())
+        return NS_ERROR_NOT_AVAILABLE;
+    retval.Truncate();
+    devices.AppendJSON(retval);
     return NS_OK;
 }
@@ -41,10 +41,13 @@
 #include "IAudioRecorder.h"
 #include "portaudio.h"
 
-// MSVC Weirdness
-#define __int64_t __int64
-#include "sndfile.h"
-#undef __int64_t
+#include "OggVorbisFile.h"
+#include "VoiceEncoder.h"
+#include "AudioDsp.h"
+#include "DeviceRegistry.h"
+#include "OutputFile.h"
+#include "BufferArena.h"
+#include "MediaThread.h"
 
 #include "prmem.h"
 #include "nsIPipe.h"
@@ -76,6 +79,20 @@
 typedef int SAMPLE;
 #endif
 
+/* Page flush interval of a compressed pipe, in milliseconds */
+#define PIPE_FLUSH_INTERVAL (100)
+#define PIPE_FLUSH_MAX      (5000)
+
+/* What start() puts into the pipe: raw frames, Ogg/Vorbis, or Opus in
+ * voice mode, which wins if both are asked for */
+struct PipeFormat {
+    PRBool voice;
+    PRUint32 bitrate;
+    PRUint32 frameMs;
+    PRBool vorbis;
+    PRUint32 flushMs;
+};
+
 class AudioRecorder : public IAudioRecorder
 {
 public:
@@ -87,16 +104,49 @@ public:
     virtual ~AudioRecorder();
     AudioRecorder(){}
     
-    nsIAsyncInputStream *mPipeIn;
-    nsIAsyncOutputStream *mPipeOut;
+    /* On the media thread: bring PortAudio up, open the device and start
+     * recording to the pipe or the file, and stop it again */
+    nsresult EnsureBackend();
+    nsresult Rescan();
+    nsresult OpenStream(nsIAsyncOutputStream *pipe, FILE *file,
+        const nsACString &path, const PipeFormat *fmt,
+        const DspSettings *dspSettings);
+    nsresult CloseStream();
+    void AbortStream();
+    /* Back on the main thread once a start has been tried */
+    void Started(PRUint32 generation, nsresult status);
 
 private:
+    /* What script last asked for, main thread only */
     int recording;
+    PRUint32 generation;
+    PipeFormat pipeFormat;
+    DspSettings dspSettings;
+    MediaThread media;
+    
+    /* Media thread only */
+    PRBool backendTried;
+    nsresult backendStatus;
+    /* Filled in on the media thread, read from any */
+    DeviceRegistry devices;
     PaStream *stream;
-	SNDFILE *outfile;
+    nsCOMPtr<nsIAsyncOutputStream> mPipeOut;
+    OggVorbisFile outfile;
+    VoiceEncoder *voiceEncoder;
+    OggWriter voiceWriter;
+    AudioDsp dsp;
     static AudioRecorder *gAudioRecordingService;
     
 protected:
+    nsresult OpenVoice(nsIAsyncOutputStream *pipe,
+        const PipeFormat *fmt);
+    static void OnVoicePage(void *data, ogg_page *og);
+    static int VoiceCallback(const void *input, void *output,
+        unsigned long framesPerBuffer,
+        const PaStreamCallbackTimeInfo* timeInfo,
+        PaStreamCallbackFlags statusFlags,
+        void *userData
+    );
     static int RecordCallback(const void *input, void *output,
         unsigned long framesPerBuffer,
         const PaStreamCallbackTimeInfo* timeInfo,
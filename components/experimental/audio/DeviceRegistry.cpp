@@ -0,0 +1,192 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Audio Recorder.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "DeviceRegistry.h"
+#include "prprf.h"
+
+#include <stdio.h>
+#include <string.h>
+
+DeviceRegistry::DeviceRegistry()
+    : mLock(nsnull)
+    , mDevices(nsnull)
+    , mCount(0)
+    , mScanned(PR_FALSE)
+    , mDefault(-1)
+    , mDefaultIndex(paNoDevice)
+    , mLatency(0)
+{
+}
+
+DeviceRegistry::~DeviceRegistry()
+{
+    PR_Free(mDevices);
+    if (mLock)
+        PR_DestroyLock(mLock);
+}
+
+nsresult
+DeviceRegistry::Init()
+{
+    if (!(mLock = PR_NewLock()))
+        return NS_ERROR_OUT_OF_MEMORY;
+    return NS_OK;
+}
+
+void
+DeviceRegistry::Clear()
+{
+    PR_Lock(mLock);
+    PR_Free(mDevices);
+    mDevices = nsnull;
+    mCount = 0;
+    mScanned = PR_FALSE;
+    mDefault = -1;
+    mDefaultIndex = paNoDevice;
+    PR_Unlock(mLock);
+}
+
+/*
+ * Go through the devices PortAudio knows about, keeping the ones with
+ * inputs. The default input is the system's, failing that the first
+ * device some host API calls its default input.
+ */
+void
+DeviceRegistry::Scan()
+{
+    int i, numDevices, count = 0, def = -1;
+    PaDeviceIndex defIndex, index = paNoDevice;
+    const PaDeviceInfo *deviceInfo;
+    const PaHostApiInfo *apiInfo;
+    AudioDevice *devices = nsnull;
+    
+    /* Finding nothing still counts as having looked */
+    numDevices = Pa_GetDeviceCount();
+    if (numDevices <= 0) {
+        fprintf(stderr, "JEP Audio:: No audio devices found!\n");
+        numDevices = 0;
+    } else if (!(devices = (AudioDevice *)
+        PR_Calloc(numDevices, sizeof(AudioDevice)))) {
+        numDevices = 0;
+    }
+    
+    defIndex = Pa_GetDefaultInputDevice();
+    for (i = 0; i < numDevices; i++) {
+        deviceInfo = Pa_GetDeviceInfo(i);
+        if (!deviceInfo || deviceInfo->maxInputChannels <= 0)
+            continue;
+        apiInfo = Pa_GetHostApiInfo(deviceInfo->hostApi);
+        
+        if (i == defIndex || (defIndex == paNoDevice && def < 0 &&
+            apiInfo && i == apiInfo->defaultInputDevice)) {
+            def = count;
+            index = i;
+        }
+        PR_snprintf(devices[count].name, DEVICE_NAME_LENGTH, "%s",
+            deviceInfo->name);
+        PR_snprintf(devices[count].hostApi, DEVICE_NAME_LENGTH, "%s",
+            apiInfo ? apiInfo->name : "");
+        devices[count].channels = deviceInfo->maxInputChannels;
+        devices[count].sampleRate = deviceInfo->defaultSampleRate;
+        count++;
+    }
+    
+    PR_Lock(mLock);
+    PR_Free(mDevices);
+    mDevices = devices;
+    mCount = count;
+    mScanned = PR_TRUE;
+    mDefault = def;
+    mDefaultIndex = index;
+    if (index != paNoDevice)
+        mLatency = Pa_GetDeviceInfo(index)->defaultLowInputLatency;
+    PR_Unlock(mLock);
+}
+
+PaDeviceIndex
+DeviceRegistry::DefaultInput(PaTime *latency)
+{
+    PR_Lock(mLock);
+    PaDeviceIndex index = mDefaultIndex;
+    *latency = mLatency;
+    PR_Unlock(mLock);
+    return index;
+}
+
+void
+DeviceRegistry::AppendString(nsACString &out, const char *str)
+{
+    out.Append("\"");
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\')
+            out.Append("\\");
+        if ((unsigned char)*str >= ' ')
+            out.Append(*str);
+    }
+    out.Append("\"");
+}
+
+PRBool
+DeviceRegistry::Scanned()
+{
+    PR_Lock(mLock);
+    PRBool scanned = mScanned;
+    PR_Unlock(mLock);
+    return scanned;
+}
+
+void
+DeviceRegistry::AppendJSON(nsACString &out)
+{
+    char buf[128];
+    
+    out.Append("[");
+    PR_Lock(mLock);
+    for (int i = 0; i < mCount; i++) {
+        out.Append(i ? ",{\"name\":" : "{\"name\":");
+        AppendString(out, mDevices[i].name);
+        out.Append(",\"hostApi\":");
+        AppendString(out, mDevices[i].hostApi);
+        PR_snprintf(buf, sizeof(buf),
+            ",\"channels\":%d,\"sampleRate\":%d,\"default\":%s}",
+            mDevices[i].channels, (int)mDevices[i].sampleRate,
+            i == mDefault ? "true" : "false");
+        out.Append(buf);
+    }
+    PR_Unlock(mLock);
+    out.Append("]");
+}
@@ -0,0 +1,95 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Audio Recorder.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef DeviceRegistry_h_
+#define DeviceRegistry_h_
+
+#include "portaudio.h"
+
+#include "prmem.h"
+#include "prlock.h"
+#include "nscore.h"
+#include "nsStringAPI.h"
+
+#define DEVICE_NAME_LENGTH  (256)
+
+struct AudioDevice {
+    char name[DEVICE_NAME_LENGTH];
+    char hostApi[DEVICE_NAME_LENGTH];
+    int channels;
+    double sampleRate;
+};
+
+/*
+ * The input devices PortAudio found, and which one we record from, so
+ * that starting a recording does not go looking again. PortAudio only
+ * looks for devices when it is initialized and cannot tell us when one
+ * is plugged in, so Scan() is run each time it has been (re)initialized,
+ * on the media thread; the rest may be called from any thread.
+ */
+class DeviceRegistry
+{
+public:
+    DeviceRegistry();
+    ~DeviceRegistry();
+
+    nsresult Init();
+    /* Forget everything, PortAudio is going away */
+    void Clear();
+    void Scan();
+    /* Whether Scan() has run since PortAudio (re)started */
+    PRBool Scanned();
+
+    /* Where to record from and at what latency, paNoDevice if nowhere */
+    PaDeviceIndex DefaultInput(PaTime *latency);
+    /* The input devices as a JSON array */
+    void AppendJSON(nsACString &out);
+
+private:
+    static void AppendString(nsACString &out, const char *str);
+
+    PRLock *mLock;
+    AudioDevice *mDevices;
+    int mCount;
+    PRBool mScanned;
+    /* Index into mDevices of the default, and its PortAudio index */
+    int mDefault;
+    PaDeviceIndex mDefaultIndex;
+    PaTime mLatency;
+};
+
+#endif
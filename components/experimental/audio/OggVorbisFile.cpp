@@ -0,0 +1,233 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Audio Recorder.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "OggVorbisFile.h"
+
+OggVorbisFile::OggVorbisFile()
+    : mFile(NULL)
+    , mStreaming(PR_FALSE)
+    , mVorbis(nsnull)
+    , mIndexed(PR_FALSE)
+{
+}
+
+OggVorbisFile::~OggVorbisFile()
+{
+    Close();
+}
+
+void
+OggVorbisFile::OnPage(void *data, ogg_page *og)
+{
+    static_cast<OggVorbisFile*>(data)->mWriter.WritePage(og);
+}
+
+nsresult
+OggVorbisFile::Create(nsACString &path, int channels, int rate)
+{
+    nsresult rv;
+    FILE *file;
+    
+    if (mFile)
+        return NS_ERROR_ALREADY_INITIALIZED;
+    rv = OutputFile::Create("audio", ".ogg", FILE_RESERVE, path, &file);
+    if (NS_FAILED(rv)) {
+        fprintf(stderr, "JEP Audio:: Could not open OGG file\n");
+        return rv;
+    }
+    return Open(file, path, channels, rate);
+}
+
+nsresult
+OggVorbisFile::Open(FILE *file, const nsACString &path, int channels,
+    int rate)
+{
+    nsresult rv;
+    
+    if (IsOpen())
+        return NS_ERROR_ALREADY_INITIALIZED;
+    mFile = file;
+    mPath.Assign(path);
+    rv = mWriter.Open(mFile, WRITE_FLUSH_INTERVAL, WRITE_HIGH_WATER);
+    if (NS_FAILED(rv)) {
+        OutputFile::Discard(mFile, path);
+        mFile = NULL;
+        return rv;
+    }
+    
+    rv = InitEncoder(channels, rate);
+    if (NS_FAILED(rv)) {
+        Discard();
+        return rv;
+    }
+    
+    /* Skeleton BOS, Vorbis BOS, skeleton and Vorbis headers, then the
+     * skeleton's EOS ahead of the audio */
+    rv = mSkeleton.Init();
+    if (NS_SUCCEEDED(rv))
+        rv = mSkeleton.AddStream(mVorbis->Serial(), rate, 1, 0, 2, 3,
+            "audio/vorbis", PR_FALSE);
+    mIndexed = NS_SUCCEEDED(rv);
+    if (mIndexed) {
+        mWriter.SetSkeleton(&mSkeleton);
+        mSkeleton.WriteBOS(&mWriter);
+    } else
+        fprintf(stderr, "JEP Audio:: Recording without a seek index\n");
+    
+    mVorbis->WriteBOS();
+    if (mIndexed)
+        mSkeleton.WriteHeaders(&mWriter);
+    mVorbis->WriteHeaders();
+    if (mIndexed)
+        mSkeleton.WriteEOS(&mWriter);
+    
+    return StartEncoder(channels);
+}
+
+nsresult
+OggVorbisFile::OpenStream(nsIAsyncOutputStream *stream, int channels,
+    int rate, PRUint32 flushMs)
+{
+    nsresult rv;
+    
+    if (IsOpen())
+        return NS_ERROR_ALREADY_INITIALIZED;
+    rv = mWriter.OpenStream(stream, WRITE_HIGH_WATER);
+    if (NS_FAILED(rv))
+        return rv;
+    mStreaming = PR_TRUE;
+    
+    rv = InitEncoder(channels, rate);
+    if (NS_FAILED(rv)) {
+        Close();
+        return rv;
+    }
+    if (flushMs)
+        mVorbis->SetFlushInterval(flushMs);
+    else
+        mVorbis->SetLowLatency(PR_TRUE);
+    
+    mVorbis->WriteBOS();
+    mVorbis->WriteHeaders();
+    return StartEncoder(channels);
+}
+
+nsresult
+OggVorbisFile::InitEncoder(int channels, int rate)
+{
+    mVorbis = new VorbisEncoder();
+    if (!mVorbis)
+        return NS_ERROR_OUT_OF_MEMORY;
+    return mVorbis->Init(channels, rate, VORBIS_QUALITY, OnPage, this);
+}
+
+/*
+ * From here on audio goes through the queue to the encoder thread
+ */
+nsresult
+OggVorbisFile::StartEncoder(int channels)
+{
+    nsresult rv = mQueue.Start(mVorbis, channels);
+    if (NS_FAILED(rv)) {
+        fprintf(stderr, "JEP Audio:: Could not start encoder thread!\n");
+        Discard();
+    }
+    return rv;
+}
+
+nsresult
+OggVorbisFile::Write(const int *frames, long count)
+{
+    return mQueue.Write(frames, count);
+}
+
+nsresult
+OggVorbisFile::WriteAll(const int *frames, long count)
+{
+    return mQueue.WriteAll(frames, count);
+}
+
+/*
+ * Flush the encoder and the writer, then fill in the index
+ */
+nsresult
+OggVorbisFile::Close()
+{
+    nsresult rv;
+    
+    if (!IsOpen())
+        return NS_ERROR_NOT_INITIALIZED;
+    /* Encode what is left in the queue */
+    mQueue.Stop();
+    if (mVorbis) {
+        mVorbis->Finish();
+        delete mVorbis;
+        mVorbis = nsnull;
+    }
+    rv = mWriter.Close();
+    mWriter.SetSkeleton(nsnull);
+    if (mIndexed && NS_SUCCEEDED(rv) && NS_FAILED(mSkeleton.Finish(mFile)))
+        fprintf(stderr, "JEP Audio:: Could not write the seek index\n");
+    mIndexed = PR_FALSE;
+    mStreaming = PR_FALSE;
+    if (!mFile)
+        return rv;
+    if (NS_FAILED(OutputFile::Close(mFile)) && NS_SUCCEEDED(rv))
+        rv = NS_ERROR_FAILURE;
+    mFile = NULL;
+    return rv;
+}
+
+void
+OggVorbisFile::Discard()
+{
+    FILE *file = mFile;
+    
+    if (!IsOpen())
+        return;
+    /* Nothing worth encoding was queued, but the thread must be gone */
+    mQueue.Stop();
+    delete mVorbis;
+    mVorbis = nsnull;
+    mWriter.Close();
+    mWriter.SetSkeleton(nsnull);
+    mIndexed = PR_FALSE;
+    mStreaming = PR_FALSE;
+    mFile = NULL;
+    if (file)
+        OutputFile::Discard(file, mPath);
+}
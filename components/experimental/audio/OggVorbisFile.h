@@ -0,0 +1,112 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Audio Recorder.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef OggVorbisFile_h_
+#define OggVorbisFile_h_
+
+#include <stdio.h>
+
+#include "nscore.h"
+#include "OggWriter.h"
+#include "OutputFile.h"
+#include "OggSkeleton.h"
+#include "VorbisEncoder.h"
+#include "VorbisQueue.h"
+
+/* What libsndfile used to pick for us */
+#define VORBIS_QUALITY      (0.4f)
+#define WRITE_FLUSH_INTERVAL (1000)
+#define WRITE_HIGH_WATER    (1024 * 1024)
+/* About a minute of audio at that quality */
+#define FILE_RESERVE        (1024 * 1024)
+
+/*
+ * An Ogg/Vorbis file with a skeleton seek index. Write() only copies the
+ * frames into a VorbisQueue, so the capture callback never waits on
+ * Vorbis; what the queue cannot take is dropped. WriteAll() waits for
+ * room instead, for callers that must not lose audio. Frames are encoded
+ * on the queue's thread and written out on the writer's.
+ *
+ * Close() encodes whatever is still queued, then fills in the index, so
+ * the file is complete as soon as it returns. Only one thread may write
+ * at a time, and none once Close() has been called.
+ *
+ * Create() makes the file itself, in the profile's jetpack/audio
+ * directory, and hands back its path; Open() takes one already made.
+ *
+ * OpenStream() encodes the same way into a non-blocking stream instead,
+ * for a live consumer: no index, and pages are flushed at least every
+ * so often rather than only once full.
+ */
+class OggVorbisFile
+{
+public:
+    OggVorbisFile();
+    ~OggVorbisFile();
+
+    nsresult Create(nsACString &path, int channels, int rate);
+    /* Same, on a file already made with OutputFile::Create() */
+    nsresult Open(FILE *file, const nsACString &path, int channels,
+        int rate);
+    /* flushMs of 0 puts out a page for every packet */
+    nsresult OpenStream(nsIAsyncOutputStream *stream, int channels,
+        int rate, PRUint32 flushMs);
+    /* Interleaved 32 bit frames */
+    nsresult Write(const int *frames, long count);
+    nsresult WriteAll(const int *frames, long count);
+    nsresult Close();
+    /* Close, and remove the file if there is one, for a recording that
+     * never got going */
+    void Discard();
+    PRBool IsOpen() { return mFile != NULL || mStreaming; }
+
+private:
+    nsresult InitEncoder(int channels, int rate);
+    nsresult StartEncoder(int channels);
+    static void OnPage(void *data, ogg_page *og);
+
+    FILE *mFile;
+    nsCString mPath;
+    PRBool mStreaming;
+    OggWriter mWriter;
+    OggSkeleton mSkeleton;
+    VorbisEncoder *mVorbis;
+    PRBool mIndexed;
+    VorbisQueue mQueue;
+};
+
+#endif
@@ -0,0 +1,367 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Audio Recorder.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "VoiceEncoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+VoiceEncoder::VoiceEncoder()
+    : mEncoder(nsnull)
+    , mOpen(PR_FALSE)
+    , mCallback(nsnull)
+    , mData(nsnull)
+    , mFrame(nsnull)
+    , mFrameSize(0)
+    , mFill(0)
+    , mPreSkip(0)
+    , mSamples(0)
+    , mDecoded(0)
+    , mPacketNo(0)
+    , mQueue(nsnull)
+    , mQueued(0)
+    , mEncoded(0)
+    , mDropped(0)
+    , mThread(nsnull)
+    , mLock(nsnull)
+    , mCond(nsnull)
+    , mClosing(PR_FALSE)
+{
+}
+
+VoiceEncoder::~VoiceEncoder()
+{
+    Stop();
+    if (mCond)
+        PR_DestroyCondVar(mCond);
+    if (mLock)
+        PR_DestroyLock(mLock);
+    if (mOpen)
+        ogg_stream_clear(&mStream);
+    if (mEncoder)
+        opus_encoder_destroy(mEncoder);
+    PR_Free(mFrame);
+}
+
+nsresult
+VoiceEncoder::Init(int bitrate, int frameMs, PageCallback cb, void *data)
+{
+    int err;
+    opus_int32 lookahead = 0;
+
+    if (mOpen)
+        return NS_ERROR_ALREADY_INITIALIZED;
+    if (frameMs != 10 && frameMs != 20)
+        return NS_ERROR_INVALID_ARG;
+
+    mCallback = cb;
+    mData = data;
+    mFrameSize = VOICE_RATE / 1000 * frameMs;
+    if (!(mFrame = (short *)PR_Calloc(mFrameSize, sizeof(short))))
+        return NS_ERROR_OUT_OF_MEMORY;
+
+    mEncoder = opus_encoder_create(VOICE_RATE, VOICE_CHANNELS,
+        OPUS_APPLICATION_VOIP, &err);
+    if (err != OPUS_OK || !mEncoder) {
+        fprintf(stderr, "Could not initialize Opus encoder! %d\n", err);
+        mEncoder = nsnull;
+        return NS_ERROR_FAILURE;
+    }
+    opus_encoder_ctl(mEncoder, OPUS_SET_BITRATE(bitrate));
+    opus_encoder_ctl(mEncoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+    opus_encoder_ctl(mEncoder, OPUS_GET_LOOKAHEAD(&lookahead));
+    mPreSkip = lookahead;
+
+    ogg_stream_init(&mStream, rand());
+    mOpen = PR_TRUE;
+    return NS_OK;
+}
+
+static void
+PutLE16(unsigned char *p, int v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+}
+
+static void
+PutLE32(unsigned char *p, PRUint32 v)
+{
+    PutLE16(p, v & 0xffff);
+    PutLE16(p + 2, v >> 16);
+}
+
+/*
+ * OpusHead on the BOS page, then OpusTags on a page of its own, as RFC
+ * 7845 has it
+ */
+void
+VoiceEncoder::WriteHeaders()
+{
+    ogg_packet op;
+    unsigned char head[19];
+    unsigned char tags[64];
+    const char *vendor = opus_get_version_string();
+    int vendorLen = strlen(vendor);
+
+    if (vendorLen > (int)sizeof(tags) - 20)
+        vendorLen = sizeof(tags) - 20;
+
+    memcpy(head, "OpusHead", 8);
+    head[8] = 1;
+    head[9] = VOICE_CHANNELS;
+    PutLE16(head + 10, mPreSkip);
+    PutLE32(head + 12, VOICE_RATE);
+    PutLE16(head + 16, 0);
+    head[18] = 0;
+
+    op.packet = head;
+    op.bytes = sizeof(head);
+    op.b_o_s = 1;
+    op.e_o_s = 0;
+    op.granulepos = 0;
+    op.packetno = mPacketNo++;
+    Emit(&op);
+
+    memcpy(tags, "OpusTags", 8);
+    PutLE32(tags + 8, vendorLen);
+    memcpy(tags + 12, vendor, vendorLen);
+    PutLE32(tags + 12 + vendorLen, 0);
+
+    op.packet = tags;
+    op.bytes = 16 + vendorLen;
+    op.b_o_s = 0;
+    op.packetno = mPacketNo++;
+    Emit(&op);
+}
+
+nsresult
+VoiceEncoder::Start()
+{
+    if (!mOpen)
+        return NS_ERROR_NOT_INITIALIZED;
+    if (mThread)
+        return NS_ERROR_ALREADY_INITIALIZED;
+    if (!mLock && !(mLock = PR_NewLock()))
+        return NS_ERROR_OUT_OF_MEMORY;
+    if (!mCond && !(mCond = PR_NewCondVar(mLock)))
+        return NS_ERROR_OUT_OF_MEMORY;
+    if (!(mQueue = (short *)BufferArena::Alloc(BufferArena::ARENA_SAMPLES,
+        VOICE_QUEUE_SAMPLES * sizeof(short))))
+        return NS_ERROR_OUT_OF_MEMORY;
+
+    mQueued = mEncoded = 0;
+    mDropped = 0;
+    mClosing = PR_FALSE;
+
+    mThread = PR_CreateThread(PR_USER_THREAD, Run, this,
+        PR_PRIORITY_NORMAL, PR_GLOBAL_THREAD, PR_JOINABLE_THREAD, 0);
+    if (!mThread) {
+        fprintf(stderr, "Could not start Opus encoder thread!\n");
+        BufferArena::Free(mQueue);
+        mQueue = nsnull;
+        return NS_ERROR_FAILURE;
+    }
+    return NS_OK;
+}
+
+nsresult
+VoiceEncoder::Write(const short *samples, long count)
+{
+    PRUint32 in, out, at, first;
+
+    if (!mThread)
+        return NS_ERROR_NOT_INITIALIZED;
+
+    in = (PRUint32)mQueued;
+    out = (PRUint32)PR_AtomicAdd(&mEncoded, 0);
+    if (count > (long)(VOICE_QUEUE_SAMPLES - (in - out))) {
+        /* The encoder has fallen too far behind, lose this buffer */
+        mDropped += count;
+        return NS_ERROR_FAILURE;
+    }
+
+    at = in & (VOICE_QUEUE_SAMPLES - 1);
+    first = PR_MIN((PRUint32)count, VOICE_QUEUE_SAMPLES - at);
+    memcpy(mQueue + at, samples, first * sizeof(short));
+    memcpy(mQueue, samples + first, (count - first) * sizeof(short));
+    PR_AtomicSet(&mQueued, (PRInt32)(in + count));
+    return NS_OK;
+}
+
+/*
+ * Encode everything queued so far, in at most two runs
+ */
+void
+VoiceEncoder::Drain()
+{
+    PRUint32 in, out, at, run;
+
+    out = (PRUint32)mEncoded;
+    in = (PRUint32)PR_AtomicAdd(&mQueued, 0);
+    if (out == in)
+        return;
+    TRACE_BEGIN("voice encode", in - out);
+    while (out != in) {
+        at = out & (VOICE_QUEUE_SAMPLES - 1);
+        run = PR_MIN(in - out, VOICE_QUEUE_SAMPLES - at);
+        Encode(mQueue + at, run);
+        out += run;
+        PR_AtomicSet(&mEncoded, (PRInt32)out);
+    }
+    TRACE_END("voice encode", 0);
+}
+
+/*
+ * The capture callback must not block, so it does not signal us; we
+ * look every VOICE_QUEUE_INTERVAL, and once more after being told to
+ * stop
+ */
+void
+VoiceEncoder::Run(void *arg)
+{
+    VoiceEncoder *self = static_cast<VoiceEncoder*>(arg);
+    PRBool closing;
+
+    do {
+        TRACE_THREAD("opus");
+        PR_Lock(self->mLock);
+        if (!self->mClosing)
+            PR_WaitCondVar(self->mCond,
+                PR_MillisecondsToInterval(VOICE_QUEUE_INTERVAL));
+        closing = self->mClosing;
+        PR_Unlock(self->mLock);
+        self->Drain();
+    } while (!closing);
+}
+
+void
+VoiceEncoder::Stop()
+{
+    if (!mThread)
+        return;
+
+    PR_Lock(mLock);
+    mClosing = PR_TRUE;
+    PR_NotifyAllCondVar(mCond);
+    PR_Unlock(mLock);
+    PR_JoinThread(mThread);
+    mThread = nsnull;
+    if (mDropped)
+        fprintf(stderr, "Dropped %u voice samples the encoder could not "
+            "keep up with\n", mDropped);
+
+    BufferArena::Free(mQueue);
+    mQueue = nsnull;
+}
+
+void
+VoiceEncoder::Encode(const short *samples, long count)
+{
+    while (count > 0) {
+        long n = mFrameSize - mFill;
+        if (n > count)
+            n = count;
+        memcpy(mFrame + mFill, samples, n * sizeof(short));
+        mFill += n;
+        mSamples += n;
+        samples += n;
+        count -= n;
+        if (mFill == mFrameSize)
+            EncodeFrame(PR_FALSE);
+    }
+}
+
+/*
+ * The encoder runs pre-skip samples behind, so silence is fed in until
+ * everything recorded has come out the other end. The last page's
+ * granule position only counts what was really recorded (plus the
+ * pre-skip), which tells players to trim the padding.
+ */
+void
+VoiceEncoder::Finish()
+{
+    PRBool last;
+
+    if (!mOpen)
+        return;
+
+    /* Whatever the callback queued last goes in ahead of the padding */
+    Stop();
+    do {
+        memset(mFrame + mFill, 0, (mFrameSize - mFill) * sizeof(short));
+        last = mDecoded + mFrameSize >= mSamples + mPreSkip;
+        EncodeFrame(last);
+    } while (!last);
+}
+
+void
+VoiceEncoder::EncodeFrame(PRBool last)
+{
+    ogg_packet op;
+    opus_int32 len;
+
+    len = opus_encode(mEncoder, mFrame, mFrameSize, mPacket,
+        VOICE_MAX_PACKET);
+    if (len < 0) {
+        fprintf(stderr, "Could not encode voice frame! %s\n",
+            opus_strerror(len));
+        /* Keep the granule positions going, a reader just hears a gap */
+        len = 0;
+    }
+
+    mDecoded += mFrameSize;
+    mFill = 0;
+
+    op.packet = mPacket;
+    op.bytes = len;
+    op.b_o_s = 0;
+    op.e_o_s = last;
+    op.granulepos = last ? mSamples + mPreSkip : mDecoded;
+    op.packetno = mPacketNo++;
+    Emit(&op);
+}
+
+void
+VoiceEncoder::Emit(ogg_packet *op)
+{
+    ogg_page og;
+
+    ogg_stream_packetin(&mStream, op);
+    while (ogg_stream_flush(&mStream, &og))
+        mCallback(mData, &og);
+}
@@ -0,0 +1,139 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Audio Recorder.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef VoiceEncoder_h_
+#define VoiceEncoder_h_
+
+#include <stdio.h>
+#include <ogg/ogg.h>
+#include <opus/opus.h>
+
+#include "prtypes.h"
+#include "prmem.h"
+#include "prlock.h"
+#include "prcvar.h"
+#include "pratom.h"
+#include "prthread.h"
+#include "prinrval.h"
+#include "nscore.h"
+#include "VorbisEncoder.h"
+#include "BufferArena.h"
+#include "TraceRing.h"
+
+/* Opus always works at 48kHz; voice is recorded in mono */
+#define VOICE_RATE          (48000)
+#define VOICE_CHANNELS      (1)
+#define VOICE_BITRATE       (24000)
+#define VOICE_FRAME_MS      (20)
+/* Largest packet we let the encoder make, per the Opus spec's advice */
+#define VOICE_MAX_PACKET    (1275)
+/* How far capture may get ahead of the encoder, in samples (a power of
+ * two, over a second), and how often the encoder looks, well inside a
+ * frame so the queue adds little latency */
+#define VOICE_QUEUE_SAMPLES (1 << 16)
+#define VOICE_QUEUE_INTERVAL (5)
+
+/*
+ * Encodes 16 bit mono speech into an Ogg/Opus logical stream, a packet
+ * of 10 or 20ms at a time, for when latency and bandwidth matter more
+ * than fidelity. Every packet goes out on a page of its own as soon as
+ * it is encoded, so a reader is never more than a frame behind the
+ * microphone.
+ *
+ * Write() only copies the samples into a queue and never waits, so it is
+ * safe from an audio callback; what does not fit is dropped and counted.
+ * They are encoded on a thread of the encoder's own, started by Start()
+ * once the headers are out, and pages come out of the callback there.
+ * Finish() encodes what is still queued and stops the thread.
+ */
+class VoiceEncoder
+{
+public:
+    VoiceEncoder();
+    ~VoiceEncoder();
+
+    nsresult Init(int bitrate, int frameMs, PageCallback cb, void *data);
+    /* The ID and comment header pages */
+    void WriteHeaders();
+    nsresult Start();
+
+    /* From the capture callback, one thread at a time */
+    nsresult Write(const short *samples, long count);
+    /* Encode what is left, padded to a frame, and end the stream */
+    void Finish();
+
+    /* Samples per packet */
+    int FrameSize() { return mFrameSize; }
+
+private:
+    static void Run(void *arg);
+    void Drain();
+    void Stop();
+    void Encode(const short *samples, long count);
+    void EncodeFrame(PRBool last);
+    void Emit(ogg_packet *op);
+
+    OpusEncoder *mEncoder;
+    ogg_stream_state mStream;
+    PRBool mOpen;
+
+    PageCallback mCallback;
+    void *mData;
+
+    short *mFrame;
+    int mFrameSize;
+    int mFill;
+    int mPreSkip;
+    /* Samples recorded, and samples a decoder will have got out */
+    ogg_int64_t mSamples;
+    ogg_int64_t mDecoded;
+    ogg_int64_t mPacketNo;
+    unsigned char mPacket[VOICE_MAX_PACKET];
+
+    /* Samples in and out of the queue so far, as in VorbisQueue */
+    short *mQueue;
+    PRInt32 mQueued;
+    PRInt32 mEncoded;
+    PRUint32 mDropped;
+
+    PRThread *mThread;
+    PRLock *mLock;
+    PRCondVar *mCond;
+    PRBool mClosing;
+};
+
+#endif
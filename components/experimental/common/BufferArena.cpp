@@ -0,0 +1,285 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "BufferArena.h"
+#include "prinit.h"
+#include "prprf.h"
+
+#include <string.h>
+
+/*
+ * Sits in front of every buffer; 16 bytes so what follows stays as
+ * aligned as PR_Malloc() made it
+ */
+union ArenaHeader {
+    struct {
+        PRUint32 size;
+        PRInt16 cls;
+        PRInt16 consumer;
+        ArenaHeader *next;
+    } h;
+    char pad[16];
+};
+
+struct ArenaUsage {
+    PRUint32 inUse;
+    PRUint32 peak;
+    PRUint32 allocs;
+    PRUint32 refused;
+};
+
+static const char *gConsumerNames[BufferArena::ARENA_CONSUMERS] = {
+    "pipe", "writer", "frames", "samples"
+};
+
+static PRCallOnceType gOnce;
+static PRLock *gLock;
+static ArenaHeader *gFree[ARENA_CLASSES];
+static PRUint32 gCached;
+static PRUint32 gBudget = ARENA_BUDGET;
+static PRUint32 gInUse;
+static ArenaUsage gUsage[BufferArena::ARENA_CONSUMERS];
+
+static PRStatus
+InitArena()
+{
+    return (gLock = PR_NewLock()) ? PR_SUCCESS : PR_FAILURE;
+}
+
+/* Size class for a request, -1 if it is too big for any */
+static int
+ClassOf(PRUint32 size)
+{
+    int cls = 0;
+    while (cls < ARENA_CLASSES &&
+           ((PRUint32)1 << (ARENA_MIN_SHIFT + cls)) < size)
+        cls++;
+    return cls < ARENA_CLASSES ? cls : -1;
+}
+
+/* What a buffer costs against the budget */
+static PRUint32
+Bytes(int cls, PRUint32 size)
+{
+    return cls < 0 ? size : (PRUint32)1 << (ARENA_MIN_SHIFT + cls);
+}
+
+void *
+BufferArena::Alloc(int consumer, PRUint32 size)
+{
+    ArenaHeader *h = nsnull;
+    ArenaUsage *usage = &gUsage[consumer];
+    
+    if (PR_CallOnce(&gOnce, InitArena) != PR_SUCCESS)
+        return nsnull;
+    
+    int cls = ClassOf(size);
+    PRUint32 bytes = Bytes(cls, size);
+    
+    PR_Lock(gLock);
+    if (bytes > gBudget || gInUse > gBudget - bytes) {
+        usage->refused++;
+        PR_Unlock(gLock);
+        return nsnull;
+    }
+    if (cls >= 0 && (h = gFree[cls])) {
+        gFree[cls] = h->h.next;
+        gCached -= bytes;
+    }
+    gInUse += bytes;
+    usage->inUse += bytes;
+    usage->allocs++;
+    if (usage->inUse > usage->peak)
+        usage->peak = usage->inUse;
+    PR_Unlock(gLock);
+    
+    if (!h && !(h = (ArenaHeader *)PR_Malloc(sizeof(ArenaHeader) + bytes))) {
+        PR_Lock(gLock);
+        gInUse -= bytes;
+        usage->inUse -= bytes;
+        usage->refused++;
+        PR_Unlock(gLock);
+        return nsnull;
+    }
+    h->h.size = size;
+    h->h.cls = cls;
+    h->h.consumer = consumer;
+    return h + 1;
+}
+
+void
+BufferArena::Free(void *ptr)
+{
+    if (!ptr)
+        return;
+    
+    ArenaHeader *h = (ArenaHeader *)ptr - 1;
+    int cls = h->h.cls;
+    PRUint32 bytes = Bytes(cls, h->h.size);
+    
+    PR_Lock(gLock);
+    gInUse -= bytes;
+    gUsage[h->h.consumer].inUse -= bytes;
+    if (cls >= 0 && gCached + bytes <= ARENA_CACHE) {
+        h->h.next = gFree[cls];
+        gFree[cls] = h;
+        gCached += bytes;
+        h = nsnull;
+    }
+    PR_Unlock(gLock);
+    PR_Free(h);
+}
+
+PRUint32
+BufferArena::Size(void *ptr)
+{
+    return ((ArenaHeader *)ptr - 1)->h.size;
+}
+
+void
+BufferArena::SetBudget(PRUint32 budget)
+{
+    if (PR_CallOnce(&gOnce, InitArena) != PR_SUCCESS)
+        return;
+    PR_Lock(gLock);
+    gBudget = budget;
+    PR_Unlock(gLock);
+}
+
+PRUint32
+BufferArena::Budget()
+{
+    return gBudget;
+}
+
+PRBool
+BufferArena::Pressed()
+{
+    if (PR_CallOnce(&gOnce, InitArena) != PR_SUCCESS)
+        return PR_FALSE;
+    PR_Lock(gLock);
+    PRBool pressed = gInUse > gBudget - gBudget / 8;
+    PR_Unlock(gLock);
+    return pressed;
+}
+
+void
+BufferArena::Trim()
+{
+    ArenaHeader *list[ARENA_CLASSES];
+    
+    if (PR_CallOnce(&gOnce, InitArena) != PR_SUCCESS)
+        return;
+    PR_Lock(gLock);
+    memcpy(list, gFree, sizeof(list));
+    memset(gFree, 0, sizeof(gFree));
+    gCached = 0;
+    PR_Unlock(gLock);
+    
+    for (int i = 0; i < ARENA_CLASSES; i++) {
+        while (list[i]) {
+            ArenaHeader *h = list[i];
+            list[i] = h->h.next;
+            PR_Free(h);
+        }
+    }
+}
+
+void
+BufferArena::AppendStats(nsACString &out)
+{
+    char buf[256];
+    
+    if (PR_CallOnce(&gOnce, InitArena) != PR_SUCCESS)
+        return;
+    PR_Lock(gLock);
+    PR_snprintf(buf, sizeof(buf),
+        "{\"budget\":%u,\"inUse\":%u,\"cached\":%u",
+        gBudget, gInUse, gCached);
+    out.Append(buf);
+    for (int i = 0; i < ARENA_CONSUMERS; i++) {
+        PR_snprintf(buf, sizeof(buf),
+            ",\"%s\":{\"inUse\":%u,\"peak\":%u,\"allocs\":%u,"
+            "\"refused\":%u}", gConsumerNames[i], gUsage[i].inUse,
+            gUsage[i].peak, gUsage[i].allocs, gUsage[i].refused);
+        out.Append(buf);
+    }
+    PR_Unlock(gLock);
+    out.Append("}");
+}
+
+NS_IMPL_THREADSAFE_ISUPPORTS1(ArenaMemory, nsIMemory)
+
+NS_IMETHODIMP_(void *)
+ArenaMemory::Alloc(size_t size)
+{
+    return BufferArena::Alloc(mConsumer, size);
+}
+
+NS_IMETHODIMP_(void *)
+ArenaMemory::Realloc(void *ptr, size_t size)
+{
+    if (!ptr)
+        return Alloc(size);
+    
+    void *grown = BufferArena::Alloc(mConsumer, size);
+    if (grown) {
+        memcpy(grown, ptr, PR_MIN(BufferArena::Size(ptr), size));
+        BufferArena::Free(ptr);
+    }
+    return grown;
+}
+
+NS_IMETHODIMP_(void)
+ArenaMemory::Free(void *ptr)
+{
+    BufferArena::Free(ptr);
+}
+
+NS_IMETHODIMP
+ArenaMemory::HeapMinimize(PRBool immediate)
+{
+    BufferArena::Trim();
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+ArenaMemory::IsLowMemory(PRBool *retval)
+{
+    *retval = BufferArena::Pressed();
+    return NS_OK;
+}
@@ -0,0 +1,118 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef BufferArena_h_
+#define BufferArena_h_
+
+#include "prtypes.h"
+#include "prlock.h"
+#include "prmem.h"
+#include "nscore.h"
+#include "nsIMemory.h"
+#include "nsStringAPI.h"
+
+/* Smallest size class, and how many there are (64 bytes to 4M) */
+#define ARENA_MIN_SHIFT     (6)
+#define ARENA_CLASSES       (17)
+/* What everything together may hold by default */
+#define ARENA_BUDGET        (96 * 1024 * 1024)
+/* How much freed memory is kept around for reuse */
+#define ARENA_CACHE         (16 * 1024 * 1024)
+
+/*
+ * Where the recorders' and encoders' bulk buffers come from: pipe
+ * segments, encoder queues, frame chunks and the writer's blocks. Sizes
+ * are rounded up to a power of two and freed buffers are kept on a list
+ * per size for the next one to ask, up to ARENA_CACHE in all; anything
+ * over the largest class goes straight to the heap.
+ *
+ * Everything handed out counts against the budget. Alloc() returns
+ * NULL rather than go over it, so each consumer has to be ready to drop
+ * what it was going to store (or hold off its producer) instead, and
+ * Pressed() says when it is getting close so they can back off early.
+ * Usage is kept per consumer for the stats.
+ *
+ * The arena is built into each component that uses it, so the audio
+ * and video recorders each have their own, budget and cache included,
+ * and what one holds does not count against the other.
+ */
+class BufferArena
+{
+public:
+    enum Consumer {
+        ARENA_PIPE,     /* segments of pipes script reads from */
+        ARENA_WRITER,   /* blocks waiting to be written to a file */
+        ARENA_FRAMES,   /* raw frames waiting to be encoded */
+        ARENA_SAMPLES,  /* audio waiting to be encoded */
+        ARENA_CONSUMERS
+    };
+
+    static void *Alloc(int consumer, PRUint32 size);
+    static void Free(void *ptr);
+    /* Size the buffer was asked for */
+    static PRUint32 Size(void *ptr);
+
+    /* In bytes; lowering it below what is in use only stops new ones */
+    static void SetBudget(PRUint32 budget);
+    static PRUint32 Budget();
+    /* More than seven eighths of the budget is in use */
+    static PRBool Pressed();
+
+    /* Give the cached buffers back to the heap */
+    static void Trim();
+
+    /* Per consumer usage as a JSON object */
+    static void AppendStats(nsACString &out);
+};
+
+/*
+ * The arena as an nsIMemory, for nsIPipe to take its segments from
+ */
+class ArenaMemory : public nsIMemory
+{
+public:
+    NS_DECL_ISUPPORTS
+    NS_DECL_NSIMEMORY
+
+    ArenaMemory(int consumer) : mConsumer(consumer) {}
+
+private:
+    ~ArenaMemory() {}
+    int mConsumer;
+};
+
+#endif
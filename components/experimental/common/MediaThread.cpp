@@ -0,0 +1,88 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include <stdio.h>
+
+#include "MediaThread.h"
+
+MediaTask::MediaTask()
+    : mPerformed(PR_FALSE)
+    , mStatus(NS_OK)
+{
+}
+
+NS_IMETHODIMP
+MediaTask::Run()
+{
+    if (!mPerformed) {
+        TRACE_THREAD("media");
+        TRACE_BEGIN("media task", 0);
+        mStatus = Perform();
+        TRACE_END("media task", 0);
+        mPerformed = PR_TRUE;
+        return NS_DispatchToMainThread(this);
+    }
+    Complete(mStatus);
+    return NS_OK;
+}
+
+/*
+ * The thread is started the first time there is something for it to do
+ */
+nsresult
+MediaThread::Dispatch(MediaTask *task)
+{
+    nsresult rv;
+
+    if (!mThread) {
+        rv = NS_NewThread(getter_AddRefs(mThread));
+        if (NS_FAILED(rv)) {
+            fprintf(stderr, "Could not start media thread!\n");
+            return rv;
+        }
+    }
+    return mThread->Dispatch(task, NS_DISPATCH_NORMAL);
+}
+
+void
+MediaThread::Shutdown()
+{
+    if (mThread) {
+        mThread->Shutdown();
+        mThread = nsnull;
+    }
+}
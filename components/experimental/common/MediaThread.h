@@ -0,0 +1,86 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef MediaThread_h_
+#define MediaThread_h_
+
+#include "nscore.h"
+#include "TraceRing.h"
+#include "nsCOMPtr.h"
+#include "nsThreadUtils.h"
+
+/*
+ * Work for the media thread. Run() calls Perform() there, then bounces
+ * back to the main thread and calls Complete() with its result. Anything
+ * the task holds that must not be released off the main thread, like a
+ * script callback or a canvas, has to be dropped in Complete().
+ */
+class MediaTask : public nsRunnable
+{
+public:
+    MediaTask();
+    NS_IMETHOD Run();
+
+protected:
+    virtual nsresult Perform() = 0;
+    virtual void Complete(nsresult status) = 0;
+
+private:
+    PRBool mPerformed;
+    nsresult mStatus;
+};
+
+/*
+ * Opening, starting and stopping a device can each take hundreds of
+ * milliseconds, so the recorders leave all of that, and the encoder
+ * state that goes with it, to a thread of their own and keep the main
+ * thread free. Tasks run one at a time in the order they were
+ * dispatched, so a stop always finds the start before it finished.
+ */
+class MediaThread
+{
+public:
+    nsresult Dispatch(MediaTask *task);
+    /* Waits for everything dispatched so far to be performed and
+     * completed */
+    void Shutdown();
+
+private:
+    nsCOMPtr<nsIThread> mThread;
+};
+
+#endif
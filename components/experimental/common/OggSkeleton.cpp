@@ -0,0 +1,466 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "OggSkeleton.h"
+#include "prmem.h"
+#include "prprf.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SKELETON_HEAD_SIZE 80
+#define SKELETON_BONE_SIZE 180
+#define SKELETON_INDEX_HEADER 42
+
+static void
+PutLE(unsigned char *p, PRUint64 v, int bytes)
+{
+    for (int i = 0; i < bytes; i++, v >>= 8)
+        p[i] = (unsigned char)(v & 0xff);
+}
+
+/* Seven bits a byte, least significant first, top bit marks the last */
+static long
+PutVarint(unsigned char *p, const unsigned char *limit, PRUint64 v)
+{
+    long n = 0;
+    do {
+        if (p + n >= limit)
+            return -1;
+        unsigned char b = (unsigned char)(v & 0x7f);
+        v >>= 7;
+        if (!v)
+            b |= 0x80;
+        p[n++] = b;
+    } while (v);
+    return n;
+}
+
+OggSkeleton::OggSkeleton()
+    : mLock(nsnull)
+    , mSerial(0)
+    , mPacketNo(0)
+    , mNumStreams(0)
+{
+    memset(&mStream, 0, sizeof(mStream));
+    memset(mStreams, 0, sizeof(mStreams));
+}
+
+OggSkeleton::~OggSkeleton()
+{
+    for (int i = 0; i < mNumStreams; i++)
+        PR_Free(mStreams[i].points);
+    ogg_stream_clear(&mStream);
+    if (mLock)
+        PR_DestroyLock(mLock);
+}
+
+nsresult
+OggSkeleton::Init()
+{
+    if (!mLock && !(mLock = PR_NewLock()))
+        return NS_ERROR_OUT_OF_MEMORY;
+
+    for (int i = 0; i < mNumStreams; i++)
+        PR_Free(mStreams[i].points);
+    memset(mStreams, 0, sizeof(mStreams));
+    mNumStreams = 0;
+    mPacketNo = 0;
+    mBOSOffset = mHeaderOffset = mContentOffset = -1;
+    mHeaderBytes = 0;
+
+    ogg_stream_clear(&mStream);
+    mSerial = rand();
+    if (ogg_stream_init(&mStream, mSerial)) {
+        fprintf(stderr, "Failed ogg_stream_init!\n");
+        return NS_ERROR_FAILURE;
+    }
+    return NS_OK;
+}
+
+nsresult
+OggSkeleton::AddStream(int serial, ogg_int64_t rateN, ogg_int64_t rateD,
+    int shift, PRUint32 preroll, PRUint32 headers, const char *type,
+    PRBool keyframes)
+{
+    if (mNumStreams == SKELETON_MAX_STREAMS || rateN <= 0 || rateD <= 0)
+        return NS_ERROR_INVALID_ARG;
+    if (serial == mSerial) {
+        fprintf(stderr, "Skeleton serial number clash!\n");
+        return NS_ERROR_FAILURE;
+    }
+
+    Stream *s = &mStreams[mNumStreams++];
+    s->serial = serial;
+    s->rateN = rateN;
+    s->rateD = rateD;
+    s->shift = shift;
+    s->preroll = preroll;
+    s->headers = headers;
+    s->type = type;
+    s->keyframes = keyframes;
+    return NS_OK;
+}
+
+OggSkeleton::Stream *
+OggSkeleton::Find(int serial)
+{
+    for (int i = 0; i < mNumStreams; i++) {
+        if (mStreams[i].serial == serial)
+            return &mStreams[i];
+    }
+    return nsnull;
+}
+
+/* Called with mLock held */
+nsresult
+OggSkeleton::AddPoint(Stream *s, PRInt64 offset, ogg_int64_t units,
+    long pageno)
+{
+    if (s->count == s->max) {
+        PRUint32 max = s->max ? s->max * 2 : 256;
+        Keypoint *points = (Keypoint *)
+            PR_Realloc(s->points, max * sizeof(Keypoint));
+        if (!points)
+            return NS_ERROR_OUT_OF_MEMORY;
+        s->points = points;
+        s->max = max;
+    }
+    Keypoint *k = &s->points[s->count++];
+    k->offset = offset;
+    k->units = units;
+    k->pageno = pageno;
+    return NS_OK;
+}
+
+void
+OggSkeleton::PacketIn(ogg_stream_state *os, unsigned char *data, long len,
+    PRBool bos, PRBool eos)
+{
+    ogg_packet op;
+
+    op.packet = data;
+    op.bytes = len;
+    op.b_o_s = bos ? 1 : 0;
+    op.e_o_s = eos ? 1 : 0;
+    op.granulepos = 0;
+    op.packetno = mPacketNo++;
+    ogg_stream_packetin(os, &op);
+}
+
+/*
+ * fishead: version 4.0, times in milliseconds, then the length of the
+ * file and where the first data page is, both unknown until Finish()
+ */
+long
+OggSkeleton::MakeHead(unsigned char *buf, PRInt64 length, PRInt64 content)
+{
+    memset(buf, 0, SKELETON_HEAD_SIZE);
+    memcpy(buf, "fishead", 8);
+    PutLE(buf + 8, 4, 2);
+    PutLE(buf + 10, 0, 2);
+    PutLE(buf + 12, 0, 8);
+    PutLE(buf + 20, 1000, 8);
+    PutLE(buf + 28, 0, 8);
+    PutLE(buf + 36, 1000, 8);
+    PutLE(buf + 64, length, 8);
+    PutLE(buf + 72, content, 8);
+    return SKELETON_HEAD_SIZE;
+}
+
+long
+OggSkeleton::MakeBone(Stream *s, unsigned char *buf)
+{
+    memset(buf, 0, SKELETON_BONE_SIZE);
+    memcpy(buf, "fisbone", 8);
+    PutLE(buf + 8, 44, 4);
+    PutLE(buf + 12, s->serial, 4);
+    PutLE(buf + 16, s->headers, 4);
+    PutLE(buf + 20, s->rateN, 8);
+    PutLE(buf + 28, s->rateD, 8);
+    PutLE(buf + 36, 0, 8);
+    PutLE(buf + 44, s->preroll, 4);
+    buf[48] = (unsigned char)s->shift;
+    
+    const char *role = strncmp(s->type, "video/", 6) ? "audio/main" :
+        "video/main";
+    return 52 + PR_snprintf((char *)buf + 52, SKELETON_BONE_SIZE - 52,
+        "Content-Type: %s\r\nRole: %s\r\n", s->type, role);
+}
+
+/*
+ * index: keypoints as (offset, time) deltas from the previous one, time
+ * in units of the granule rate. If they don't all fit, keep every
+ * second one, then every fourth, and so on; a player then reads a little
+ * further from the keypoint it lands on. The rest of the packet stays
+ * zero, players stop after the number of keypoints given.
+ */
+void
+OggSkeleton::MakeIndex(Stream *s, unsigned char *buf)
+{
+    const unsigned char *limit = buf + SKELETON_INDEX_SIZE;
+    PRUint32 step = 1;
+    PRUint64 count;
+    
+    for (;;) {
+        unsigned char *p = buf + SKELETON_INDEX_HEADER;
+        PRInt64 lastOffset = 0;
+        ogg_int64_t lastTime = 0;
+        PRUint32 valid = 0;
+        PRBool fits = PR_TRUE;
+        
+        memset(buf, 0, SKELETON_INDEX_SIZE);
+        count = 0;
+        for (PRUint32 i = 0; i < s->count && fits; i++) {
+            Keypoint *k = &s->points[i];
+            if (k->offset < 0 || valid++ % step)
+                continue;
+            ogg_int64_t time = k->units * s->rateD;
+            long n = PutVarint(p, limit, k->offset - lastOffset);
+            long m = n < 0 ? -1 : PutVarint(p + n, limit, time - lastTime);
+            if (m < 0) {
+                fits = PR_FALSE;
+                break;
+            }
+            p += n + m;
+            lastOffset = k->offset;
+            lastTime = time;
+            count++;
+        }
+        if (fits)
+            break;
+        step *= 2;
+    }
+    
+    memcpy(buf, "index", 6);
+    PutLE(buf + 6, s->serial, 4);
+    PutLE(buf + 10, count, 8);
+    PutLE(buf + 18, s->rateN, 8);
+    PutLE(buf + 26, 0, 8);
+    PutLE(buf + 34, s->end * s->rateD, 8);
+}
+
+void
+OggSkeleton::WriteBOS(OggWriter *writer)
+{
+    unsigned char head[SKELETON_HEAD_SIZE];
+    ogg_page og;
+    
+    PacketIn(&mStream, head, MakeHead(head, 0, 0), PR_TRUE, PR_FALSE);
+    while (ogg_stream_flush(&mStream, &og))
+        writer->WritePage(&og);
+}
+
+void
+OggSkeleton::WriteHeaders(OggWriter *writer)
+{
+    unsigned char bone[SKELETON_BONE_SIZE];
+    ogg_page og;
+    
+    unsigned char *index = (unsigned char *)PR_Malloc(SKELETON_INDEX_SIZE);
+    if (!index) {
+        fprintf(stderr, "Could not allocate skeleton index!\n");
+        return;
+    }
+    
+    /* libogg copies packets in, so the buffers can be reused */
+    for (int i = 0; i < mNumStreams; i++)
+        PacketIn(&mStream, bone, MakeBone(&mStreams[i], bone),
+            PR_FALSE, PR_FALSE);
+    for (int i = 0; i < mNumStreams; i++) {
+        MakeIndex(&mStreams[i], index);
+        PacketIn(&mStream, index, SKELETON_INDEX_SIZE, PR_FALSE, PR_FALSE);
+    }
+    PR_Free(index);
+    
+    while (ogg_stream_flush(&mStream, &og))
+        writer->WritePage(&og);
+}
+
+void
+OggSkeleton::WriteEOS(OggWriter *writer)
+{
+    ogg_page og;
+    
+    PacketIn(&mStream, NULL, 0, PR_FALSE, PR_TRUE);
+    while (ogg_stream_flush(&mStream, &og))
+        writer->WritePage(&og);
+}
+
+void
+OggSkeleton::Keyframe(int serial, long pageno, ogg_int64_t units)
+{
+    if (!mLock)
+        return;
+    PR_Lock(mLock);
+    Stream *s = Find(serial);
+    if (s && s->keyframes)
+        AddPoint(s, -1, units, pageno);
+    PR_Unlock(mLock);
+}
+
+void
+OggSkeleton::OnPage(ogg_page *og, PRInt64 offset)
+{
+    int serial = ogg_page_serialno(og);
+    long pageno = ogg_page_pageno(og);
+    long len = og->header_len + og->body_len;
+    
+    PR_Lock(mLock);
+    if (serial == mSerial) {
+        if (pageno == 0)
+            mBOSOffset = offset;
+        else if (ogg_page_eos(og))
+            mContentOffset = offset + len;
+        else {
+            if (mHeaderOffset < 0)
+                mHeaderOffset = offset;
+            mHeaderBytes += len;
+        }
+        PR_Unlock(mLock);
+        return;
+    }
+    
+    Stream *s = Find(serial);
+    if (!s) {
+        PR_Unlock(mLock);
+        return;
+    }
+    
+    if (s->keyframes) {
+        /* Pages come in order, so do the keyframes waiting for them */
+        while (s->resolved < s->count &&
+               s->points[s->resolved].pageno < pageno)
+            s->resolved++;
+        if (s->resolved < s->count &&
+            s->points[s->resolved].pageno == pageno) {
+            s->points[s->resolved].offset = offset;
+            s->resolved++;
+        }
+    } else if (mContentOffset >= 0 && offset >= mContentOffset &&
+               !ogg_page_continued(og)) {
+        /* Decoding can start here at what the previous page ended with */
+        ogg_int64_t interval = (ogg_int64_t)SKELETON_KEYPOINT_INTERVAL *
+            s->rateN / (s->rateD * 1000);
+        if (!s->count || s->end - s->points[s->count - 1].units >= interval)
+            AddPoint(s, offset, s->end, pageno);
+    }
+    
+    ogg_int64_t granule = ogg_page_granulepos(og);
+    if (granule > 0) {
+        ogg_int64_t mask = ((ogg_int64_t)1 << s->shift) - 1;
+        s->end = (granule >> s->shift) + (granule & mask);
+    }
+    PR_Unlock(mLock);
+}
+
+/*
+ * Page the skeleton headers again with what we know now and write them
+ * over the placeholders. Nothing is written unless the new pages come
+ * out exactly as long as the old ones.
+ */
+nsresult
+OggSkeleton::Finish(FILE *file)
+{
+    unsigned char head[SKELETON_HEAD_SIZE];
+    unsigned char bone[SKELETON_BONE_SIZE];
+    ogg_stream_state os;
+    ogg_page og;
+    nsresult rv = NS_OK;
+    
+    if (!mLock || mBOSOffset < 0 || mHeaderOffset < 0 || mContentOffset < 0)
+        return NS_ERROR_NOT_INITIALIZED;
+    
+    if (fflush(file) || fseek(file, 0, SEEK_END))
+        return NS_ERROR_FAILURE;
+    PRInt64 length = ftell(file);
+    
+    unsigned char *headers = (unsigned char *)PR_Malloc(mHeaderBytes);
+    unsigned char *index = (unsigned char *)PR_Malloc(SKELETON_INDEX_SIZE);
+    if (!headers || !index) {
+        PR_Free(headers);
+        PR_Free(index);
+        return NS_ERROR_OUT_OF_MEMORY;
+    }
+    
+    PR_Lock(mLock);
+    ogg_stream_init(&os, mSerial);
+    mPacketNo = 0;
+    
+    PacketIn(&os, head, MakeHead(head, length, mContentOffset),
+        PR_TRUE, PR_FALSE);
+    if (ogg_stream_flush(&os, &og) && !fseek(file, mBOSOffset, SEEK_SET)) {
+        if (fwrite(og.header, 1, og.header_len, file) != (size_t)og.header_len ||
+            fwrite(og.body, 1, og.body_len, file) != (size_t)og.body_len)
+            rv = NS_ERROR_FAILURE;
+    } else
+        rv = NS_ERROR_FAILURE;
+    
+    for (int i = 0; i < mNumStreams; i++)
+        PacketIn(&os, bone, MakeBone(&mStreams[i], bone), PR_FALSE, PR_FALSE);
+    for (int i = 0; i < mNumStreams; i++) {
+        MakeIndex(&mStreams[i], index);
+        PacketIn(&os, index, SKELETON_INDEX_SIZE, PR_FALSE, PR_FALSE);
+    }
+    
+    PRInt64 done = 0;
+    while (NS_SUCCEEDED(rv) && ogg_stream_flush(&os, &og)) {
+        if (done + og.header_len + og.body_len > mHeaderBytes) {
+            rv = NS_ERROR_UNEXPECTED;
+            break;
+        }
+        memcpy(headers + done, og.header, og.header_len);
+        memcpy(headers + done + og.header_len, og.body, og.body_len);
+        done += og.header_len + og.body_len;
+    }
+    if (NS_SUCCEEDED(rv) && done != mHeaderBytes)
+        rv = NS_ERROR_UNEXPECTED;
+    if (NS_SUCCEEDED(rv) && (fseek(file, mHeaderOffset, SEEK_SET) ||
+        fwrite(headers, 1, done, file) != (size_t)done))
+        rv = NS_ERROR_FAILURE;
+    if (rv == NS_ERROR_UNEXPECTED)
+        fprintf(stderr, "Skeleton pages changed size, index not written!\n");
+    
+    ogg_stream_clear(&os);
+    PR_Unlock(mLock);
+    
+    PR_Free(headers);
+    PR_Free(index);
+    fflush(file);
+    fseek(file, 0, SEEK_END);
+    return rv;
+}
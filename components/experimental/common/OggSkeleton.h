@@ -0,0 +1,146 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef OggSkeleton_h_
+#define OggSkeleton_h_
+
+#include <stdio.h>
+#include <ogg/ogg.h>
+
+#include "prtypes.h"
+#include "prlock.h"
+#include "nscore.h"
+#include "OggWriter.h"
+
+/* Bytes set aside for each stream's index packet. The index is written
+ * in place once the file is done, thinned out if it does not fit. */
+#define SKELETON_INDEX_SIZE (32 * 1024)
+#define SKELETON_MAX_STREAMS 4
+/* Keypoint spacing for streams where every packet is a keyframe */
+#define SKELETON_KEYPOINT_INTERVAL 2000
+
+/*
+ * An Ogg Skeleton 4.0 track with a keyframe index per stream, so players
+ * can seek in a recording with a single read instead of bisecting it.
+ *
+ * The skeleton's header pages go out like any other stream's, with the
+ * index packets at a fixed size. The writer reports the file offset of
+ * every page it is given (see OggWriter::SetSkeleton), which is how
+ * keyframes get their offsets. When the file is complete Finish() pages
+ * the headers again with the real segment length and indexes and writes
+ * them over the placeholders; packet sizes are unchanged so the pages
+ * come out the same size.
+ *
+ * Streams that signal keyframes (Theora) call Keyframe() with the page
+ * number the keyframe packet will start; the caller flushes the stream
+ * first so that it does start a page. Other streams (Vorbis) get a
+ * keypoint on the first fresh page every SKELETON_KEYPOINT_INTERVAL.
+ */
+class OggSkeleton
+{
+public:
+    OggSkeleton();
+    ~OggSkeleton();
+
+    nsresult Init();
+    /* Describe a stream, before WriteBOS. Its time base is the granule
+     * rate: 'units' below are frames or samples. */
+    nsresult AddStream(int serial, ogg_int64_t rateN, ogg_int64_t rateD,
+        int shift, PRUint32 preroll, PRUint32 headers, const char *type,
+        PRBool keyframes);
+
+    /* Must be the first page of the file */
+    void WriteBOS(OggWriter *writer);
+    /* After the other streams' BOS pages */
+    void WriteHeaders(OggWriter *writer);
+    /* After every other header page, data follows */
+    void WriteEOS(OggWriter *writer);
+
+    /* A keyframe at 'units' starts on page 'pageno' of 'serial' */
+    void Keyframe(int serial, long pageno, ogg_int64_t units);
+    /* Called by the writer for every page, with its file offset */
+    void OnPage(ogg_page *og, PRInt64 offset);
+
+    /* Rewrite the headers of the finished, closed-for-writing file */
+    nsresult Finish(FILE *file);
+
+private:
+    struct Keypoint {
+        PRInt64 offset;
+        ogg_int64_t units;
+        long pageno;
+    };
+
+    struct Stream {
+        int serial;
+        ogg_int64_t rateN;
+        ogg_int64_t rateD;
+        int shift;
+        PRUint32 preroll;
+        PRUint32 headers;
+        const char *type;
+        PRBool keyframes;
+        ogg_int64_t end;
+        Keypoint *points;
+        PRUint32 count;
+        PRUint32 max;
+        PRUint32 resolved;
+    };
+
+    Stream *Find(int serial);
+    nsresult AddPoint(Stream *s, PRInt64 offset, ogg_int64_t units,
+        long pageno);
+    long MakeHead(unsigned char *buf, PRInt64 length, PRInt64 content);
+    long MakeBone(Stream *s, unsigned char *buf);
+    void MakeIndex(Stream *s, unsigned char *buf);
+    void PacketIn(ogg_stream_state *os, unsigned char *data, long len,
+        PRBool bos, PRBool eos);
+
+    PRLock *mLock;
+    int mSerial;
+    ogg_stream_state mStream;
+    PRInt64 mPacketNo;
+    Stream mStreams[SKELETON_MAX_STREAMS];
+    int mNumStreams;
+
+    PRInt64 mBOSOffset;
+    PRInt64 mHeaderOffset;
+    PRInt64 mHeaderBytes;
+    PRInt64 mContentOffset;
+};
+
+#endif
@@ -0,0 +1,448 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "OggWriter.h"
+#include "OggSkeleton.h"
+#include "BufferArena.h"
+
+OggWriter::OggWriter()
+    : mFile(nsnull)
+    , mStats(nsnull)
+    , mSkeleton(nsnull)
+    , mThread(nsnull)
+    , mLock(nsnull)
+    , mCond(nsnull)
+    , mClosing(PR_FALSE)
+    , mError(PR_FALSE)
+    , mDropped(0)
+    , mInterval(0)
+    , mHighWater(0)
+    , mFull(nsnull)
+    , mFullTail(nsnull)
+    , mTail(nsnull)
+    , mTailSince(0)
+    , mSpare(nsnull)
+    , mOffset(0)
+    , mQueued(0)
+    , mPending(nsnull)
+    , mPendingLen(0)
+    , mPendingMax(0)
+{
+}
+
+OggWriter::~OggWriter()
+{
+    Close();
+
+    while (mSpare) {
+        Block *b = mSpare;
+        mSpare = b->next;
+        BufferArena::Free(b);
+    }
+    PR_Free(mPending);
+    if (mCond)
+        PR_DestroyCondVar(mCond);
+    if (mLock)
+        PR_DestroyLock(mLock);
+}
+
+nsresult
+OggWriter::Open(FILE *file, PRUint32 flushInterval, PRUint32 highWater)
+{
+    if (mThread)
+        return NS_ERROR_ALREADY_INITIALIZED;
+
+    if (!mLock && !(mLock = PR_NewLock()))
+        return NS_ERROR_OUT_OF_MEMORY;
+    if (!mCond && !(mCond = PR_NewCondVar(mLock)))
+        return NS_ERROR_OUT_OF_MEMORY;
+
+    /* We do our own buffering */
+    setvbuf(file, NULL, _IONBF, 0);
+
+    mFile = file;
+    mInterval = PR_MillisecondsToInterval(flushInterval);
+    mHighWater = highWater;
+    mClosing = PR_FALSE;
+    mError = PR_FALSE;
+    mDropped = 0;
+    mOffset = 0;
+    mQueued = 0;
+
+    mThread = PR_CreateThread(PR_USER_THREAD, Run, this,
+        PR_PRIORITY_NORMAL, PR_GLOBAL_THREAD, PR_JOINABLE_THREAD, 0);
+    if (!mThread) {
+        fprintf(stderr, "Could not start writer thread!\n");
+        return NS_ERROR_FAILURE;
+    }
+    return NS_OK;
+}
+
+nsresult
+OggWriter::OpenStream(nsIAsyncOutputStream *stream, PRUint32 highWater)
+{
+    if (mThread || mStream)
+        return NS_ERROR_ALREADY_INITIALIZED;
+
+    if (!mLock && !(mLock = PR_NewLock()))
+        return NS_ERROR_OUT_OF_MEMORY;
+
+    mStream = stream;
+    mHighWater = highWater;
+    mError = PR_FALSE;
+    mDropped = 0;
+    mPendingLen = 0;
+    return NS_OK;
+}
+
+nsresult
+OggWriter::Close()
+{
+    if (mStream) {
+        /* Give the consumer a moment to take the last pages */
+        PRIntervalTime start = PR_IntervalNow();
+        PR_Lock(mLock);
+        while (!FlushPending() && !mError &&
+               (PRIntervalTime)(PR_IntervalNow() - start) <
+                   PR_MillisecondsToInterval(1000)) {
+            PR_Unlock(mLock);
+            PR_Sleep(PR_MillisecondsToInterval(10));
+            PR_Lock(mLock);
+        }
+        if (mPendingLen) {
+            fprintf(stderr, "Dropped %u bytes the consumer did not read!\n",
+                mPendingLen);
+            mPendingLen = 0;
+        }
+        if (mDropped)
+            fprintf(stderr, "Dropped %u pages the consumer fell behind on!\n",
+                mDropped);
+        mStream = nsnull;
+        PR_Unlock(mLock);
+        return mError ? NS_ERROR_FAILURE : NS_OK;
+    }
+
+    if (!mThread)
+        return NS_OK;
+
+    PR_Lock(mLock);
+    mClosing = PR_TRUE;
+    PR_NotifyCondVar(mCond);
+    PR_Unlock(mLock);
+
+    PR_JoinThread(mThread);
+    mThread = nsnull;
+    mFile = nsnull;
+    if (mDropped)
+        fprintf(stderr, "Dropped %u pages over the memory budget!\n",
+            mDropped);
+
+    return mError ? NS_ERROR_FAILURE : NS_OK;
+}
+
+PRBool
+OggWriter::Congested()
+{
+    if (!mLock)
+        return PR_FALSE;
+    PR_Lock(mLock);
+    PRBool congested = mStream ? !FlushPending() : (mQueued > mHighWater);
+    PR_Unlock(mLock);
+    return congested || BufferArena::Pressed();
+}
+
+PRUint32
+OggWriter::Queued()
+{
+    if (!mLock)
+        return 0;
+    PR_Lock(mLock);
+    PRUint32 queued = mStream ? mPendingLen : mQueued;
+    PR_Unlock(mLock);
+    return queued;
+}
+
+nsresult
+OggWriter::WritePage(ogg_page *og)
+{
+    if (!mLock)
+        return NS_ERROR_NOT_INITIALIZED;
+    PR_Lock(mLock);
+    if (mError || (!mThread && !mStream)) {
+        PR_Unlock(mLock);
+        return NS_ERROR_FAILURE;
+    }
+    if (mStream) {
+        if (!FlushPending() &&
+            mPendingLen + og->header_len + og->body_len > mHighWater) {
+            /* Over the high-water mark: lose the page, not the stream */
+            mDropped++;
+            PR_Unlock(mLock);
+            return NS_ERROR_OUT_OF_MEMORY;
+        }
+        WriteStream(og->header, og->header_len);
+        WriteStream(og->body, og->body_len);
+    } else {
+        if (!Reserve(og->header_len + og->body_len)) {
+            /* Over the memory budget: lose the page, not the recording */
+            mDropped++;
+            PR_Unlock(mLock);
+            return NS_ERROR_OUT_OF_MEMORY;
+        }
+        if (mSkeleton)
+            mSkeleton->OnPage(og, mOffset);
+        Append(og->header, og->header_len);
+        Append(og->body, og->body_len);
+    }
+    PR_Unlock(mLock);
+
+    return NS_OK;
+}
+
+/*
+ * Try to hand held back data to the stream, returns whether it all went.
+ * Called with mLock held.
+ */
+PRBool
+OggWriter::FlushPending()
+{
+    PRUint32 written = 0;
+
+    if (!mPendingLen)
+        return PR_TRUE;
+
+    nsresult rv = mStream->Write((const char *)mPending, mPendingLen, &written);
+    if (NS_FAILED(rv)) {
+        if (rv != NS_BASE_STREAM_WOULD_BLOCK)
+            mError = PR_TRUE;
+        return PR_FALSE;
+    }
+
+    mPendingLen -= written;
+    memmove(mPending, mPending + written, mPendingLen);
+    return (mPendingLen == 0);
+}
+
+/* Called with mLock held */
+void
+OggWriter::WriteStream(const unsigned char *data, long len)
+{
+    PRUint32 written = 0;
+
+    /* Keep the byte order, nothing overtakes what is held back */
+    if (FlushPending()) {
+        PRTime begin = PR_Now();
+        nsresult rv = mStream->Write((const char *)data, len, &written);
+        if (mStats)
+            mStats->Time(PipelineStats::STAGE_WRITE, PR_Now() - begin);
+        if (NS_FAILED(rv)) {
+            if (rv != NS_BASE_STREAM_WOULD_BLOCK) {
+                mError = PR_TRUE;
+                return;
+            }
+            written = 0;
+        }
+    }
+    if (written == (PRUint32)len)
+        return;
+
+    PRUint32 rest = len - written;
+    if (mPendingLen + rest > mPendingMax) {
+        PRUint32 max = mPendingMax ? mPendingMax : WRITE_BLOCK_SIZE;
+        while (mPendingLen + rest > max)
+            max *= 2;
+        unsigned char *pending = (unsigned char *)PR_Realloc(mPending, max);
+        if (!pending) {
+            mError = PR_TRUE;
+            return;
+        }
+        mPending = pending;
+        mPendingMax = max;
+    }
+    memcpy(mPending + mPendingLen, data + written, rest);
+    mPendingLen += rest;
+}
+
+/* Called with mLock held */
+OggWriter::Block *
+OggWriter::NewBlock()
+{
+    Block *b = mSpare;
+    if (b)
+        mSpare = b->next;
+    else if (!(b = (Block *)
+        BufferArena::Alloc(BufferArena::ARENA_WRITER, sizeof(Block))))
+        return nsnull;
+
+    /* Size the block so that it ends on a block boundary of the file */
+    b->len = 0;
+    b->cap = WRITE_BLOCK_SIZE - (PRUint32)(mOffset % WRITE_BLOCK_SIZE);
+    b->next = nsnull;
+    return b;
+}
+
+/*
+ * Make sure there are enough spare blocks for 'len' more bytes, so that
+ * a page is either queued whole or not at all. Called with mLock held.
+ */
+PRBool
+OggWriter::Reserve(long len)
+{
+    int need, have = 0;
+    Block *b;
+
+    if (mTail)
+        len -= mTail->cap - mTail->len;
+    if (len <= 0)
+        return PR_TRUE;
+    /* The first new block may be short, to end on a boundary */
+    need = len / WRITE_BLOCK_SIZE + 2;
+    for (b = mSpare; b && have < need; b = b->next)
+        have++;
+    for (; have < need; have++) {
+        if (!(b = (Block *)
+            BufferArena::Alloc(BufferArena::ARENA_WRITER, sizeof(Block))))
+            return PR_FALSE;
+        b->next = mSpare;
+        mSpare = b;
+    }
+    return PR_TRUE;
+}
+
+/* Called with mLock held */
+void
+OggWriter::Append(const unsigned char *data, long len)
+{
+    while (len > 0) {
+        if (!mTail) {
+            if (!(mTail = NewBlock())) {
+                fprintf(stderr, "Could not allocate write buffer!\n");
+                mError = PR_TRUE;
+                return;
+            }
+            mTailSince = PR_IntervalNow();
+        }
+
+        PRUint32 n = mTail->cap - mTail->len;
+        if ((long)n > len)
+            n = (PRUint32)len;
+        memcpy(mTail->data + mTail->len, data, n);
+        mTail->len += n;
+        mOffset += n;
+        mQueued += n;
+        data += n;
+        len -= n;
+
+        /* Without a flush interval every page goes out right away */
+        if (mTail->len == mTail->cap || !mInterval) {
+            if (mFullTail)
+                mFullTail->next = mTail;
+            else
+                mFull = mTail;
+            mFullTail = mTail;
+            mTail = nsnull;
+            PR_NotifyCondVar(mCond);
+        }
+    }
+}
+
+void
+OggWriter::Run(void *arg)
+{
+    OggWriter *w = static_cast<OggWriter*>(arg);
+
+    PR_Lock(w->mLock);
+    for (;;) {
+        TRACE_THREAD("writer");
+        PRBool closing = w->mClosing;
+        PRBool stale = w->mTail && w->mTail->len &&
+            (PRIntervalTime)(PR_IntervalNow() - w->mTailSince) >= w->mInterval;
+
+        if (!w->mFull && !stale && !closing) {
+            PR_WaitCondVar(w->mCond, w->mInterval ?
+                w->mInterval : PR_INTERVAL_NO_TIMEOUT);
+            continue;
+        }
+
+        /* Take everything that is due, the partial block included */
+        Block *list = w->mFull;
+        Block *last = w->mFullTail;
+        w->mFull = w->mFullTail = nsnull;
+        if ((stale || closing) && w->mTail) {
+            if (last)
+                last->next = w->mTail;
+            else
+                list = w->mTail;
+            w->mTail = nsnull;
+        }
+        PR_Unlock(w->mLock);
+
+        PRBool failed = PR_FALSE;
+        PRUint32 written = 0;
+        Block *b = list;
+        TRACE_BEGIN("write", (PRUint32)w->mOffset);
+        while (b) {
+            PRTime begin = PR_Now();
+            if (!failed && fwrite(b->data, 1, b->len, w->mFile) != b->len) {
+                fprintf(stderr, "Could not write to file!\n");
+                failed = PR_TRUE;
+            }
+            if (w->mStats)
+                w->mStats->Time(PipelineStats::STAGE_WRITE, PR_Now() - begin);
+            written += b->len;
+            b = b->next;
+        }
+        if (closing)
+            fflush(w->mFile);
+        TRACE_END("write", (PRUint32)w->mOffset);
+
+        PR_Lock(w->mLock);
+        if (failed)
+            w->mError = PR_TRUE;
+        w->mQueued -= written;
+        while (list) {
+            b = list;
+            list = b->next;
+            b->next = w->mSpare;
+            w->mSpare = b;
+        }
+
+        if (closing && !w->mFull && !w->mTail)
+            break;
+    }
+    PR_Unlock(w->mLock);
+}
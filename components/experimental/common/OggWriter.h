@@ -0,0 +1,147 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef OggWriter_h_
+#define OggWriter_h_
+
+#include <stdio.h>
+#include <string.h>
+#include <ogg/ogg.h>
+
+#include "prmem.h"
+#include "prlock.h"
+#include "prcvar.h"
+#include "prthread.h"
+#include "prinrval.h"
+#include "nscore.h"
+#include "nsCOMPtr.h"
+#include "nsIAsyncOutputStream.h"
+#include "PipelineStats.h"
+#include "TraceRing.h"
+
+#define WRITE_BLOCK_SIZE (64 * 1024)
+
+class OggSkeleton;
+
+/*
+ * Writes Ogg pages to a file from a thread of its own, so a slow disk never
+ * holds up whoever produces the pages. Pages are packed into blocks that
+ * end on WRITE_BLOCK_SIZE boundaries of the file; full blocks are written
+ * as soon as they fill, a partial one once it is older than the flush
+ * interval. Congested() reports when more than the high-water mark is
+ * waiting to be written, so producers can shed load instead of queueing
+ * without bound.
+ *
+ * Pages can also go to a non-blocking stream, such as the output end of a
+ * pipe read by a live consumer. Those are written as they come, anything
+ * the stream does not take right away is held back and the writer reports
+ * itself congested until the consumer has caught up. No more than the
+ * high-water mark is held back; past it pages are dropped whole, as they
+ * are over the memory budget.
+ *
+ * Blocks come from the BufferArena. When it is close to its budget the
+ * writer reports itself congested as well; once there is no room at all
+ * pages are dropped whole rather than failing the file.
+ */
+class OggWriter
+{
+public:
+    OggWriter();
+    ~OggWriter();
+
+    nsresult Open(FILE *file, PRUint32 flushInterval, PRUint32 highWater);
+    nsresult OpenStream(nsIAsyncOutputStream *stream, PRUint32 highWater);
+    nsresult WritePage(ogg_page *og);
+    /* Write out everything queued and stop the thread */
+    nsresult Close();
+
+    PRBool Congested();
+    PRUint32 Queued();
+    PRUint32 Dropped() { return mDropped; }
+    /* Time file writes into 'stats', which must outlive the writer */
+    void SetStats(PipelineStats *stats) { mStats = stats; }
+    /* Tell 'skeleton' where in the file each page lands */
+    void SetSkeleton(OggSkeleton *skeleton) { mSkeleton = skeleton; }
+
+private:
+    struct Block {
+        PRUint32 len;
+        PRUint32 cap;
+        Block *next;
+        unsigned char data[WRITE_BLOCK_SIZE];
+    };
+
+    static void Run(void *arg);
+    void Append(const unsigned char *data, long len);
+    Block *NewBlock();
+    PRBool Reserve(long len);
+    void WriteStream(const unsigned char *data, long len);
+    PRBool FlushPending();
+
+    FILE *mFile;
+    PipelineStats *mStats;
+    OggSkeleton *mSkeleton;
+    PRThread *mThread;
+    PRLock *mLock;
+    PRCondVar *mCond;
+    PRBool mClosing;
+    PRBool mError;
+    /* Pages lost to the memory budget or a stream that fell behind */
+    PRUint32 mDropped;
+
+    PRIntervalTime mInterval;
+    PRUint32 mHighWater;
+
+    /* Blocks ready to be written, oldest first */
+    Block *mFull;
+    Block *mFullTail;
+    /* Block currently being filled and when it was started */
+    Block *mTail;
+    PRIntervalTime mTailSince;
+    Block *mSpare;
+
+    PRInt64 mOffset;
+    PRUint32 mQueued;
+
+    /* What the stream has not taken yet */
+    nsCOMPtr<nsIAsyncOutputStream> mStream;
+    unsigned char *mPending;
+    PRUint32 mPendingLen;
+    PRUint32 mPendingMax;
+};
+
+#endif
@@ -0,0 +1,227 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef XP_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/falloc.h>
+#endif
+
+#include "OutputFile.h"
+#include "prrng.h"
+#include "prtime.h"
+#include "pratom.h"
+#include "nsCOMPtr.h"
+#include "nsIFile.h"
+#include "nsDirectoryServiceUtils.h"
+#include "nsAppDirectoryServiceDefs.h"
+
+#define NAME_LENGTH     8
+#define CREATE_ATTEMPTS 16
+
+static PRInt32 gCounter = 0;
+
+/*
+ * Base 36 digits of a hash over some noise, the time and a counter, so
+ * two files made in the same microsecond still get different names
+ */
+void
+OutputFile::MakeName(char *buf, PRUint32 len)
+{
+    static const char digits[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    unsigned char noise[16];
+    PRUint64 hash = 14695981039346656037ULL;
+    PRUint32 i, got;
+    PRTime now = PR_Now();
+    PRInt32 count = PR_AtomicIncrement(&gCounter);
+
+    got = PR_GetRandomNoise(noise, sizeof(noise));
+    for (i = 0; i < got; i++)
+        hash = (hash ^ noise[i]) * 1099511628211ULL;
+    for (i = 0; i < sizeof(now); i++)
+        hash = (hash ^ ((now >> (i * 8)) & 0xff)) * 1099511628211ULL;
+    for (i = 0; i < sizeof(count); i++)
+        hash = (hash ^ ((count >> (i * 8)) & 0xff)) * 1099511628211ULL;
+
+    for (i = 0; i < len; i++) {
+        buf[i] = digits[hash % 36];
+        hash /= 36;
+    }
+    buf[len] = 0;
+}
+
+/*
+ * Ask the filesystem for the space up front, without changing the size of
+ * the file. This is only a hint: where it is not supported the file just
+ * grows as it is written.
+ */
+void
+OutputFile::Reserve(FILE *file, PRInt64 reserve)
+{
+    if (reserve <= 0)
+        return;
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+    fallocate(fileno(file), FALLOC_FL_KEEP_SIZE, 0, (off_t)reserve);
+#elif defined(F_PREALLOCATE)
+    fstore_t store = { F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, (off_t)reserve };
+    if (fcntl(fileno(file), F_PREALLOCATE, &store) == -1) {
+        store.fst_flags = F_ALLOCATEALL;
+        fcntl(fileno(file), F_PREALLOCATE, &store);
+    }
+#endif
+}
+
+/*
+ * Create a new file in the profile's jetpack/<kind> directory, open for
+ * reading and writing
+ */
+nsresult
+OutputFile::Create(const char *kind, const char *ext, PRInt64 reserve,
+    nsACString &path, FILE **file)
+{
+    int fd;
+    nsresult rv;
+    char name[NAME_LENGTH + 1];
+    nsCAutoString full;
+    nsCOMPtr<nsIFile> dir;
+    nsCOMPtr<nsIFile> o;
+
+    *file = NULL;
+    rv = NS_GetSpecialDirectory(NS_APP_USER_PROFILE_50_DIR,
+        getter_AddRefs(dir));
+    if (NS_FAILED(rv)) return rv;
+
+    rv = dir->AppendNative(nsDependentCString("jetpack"));
+    if (NS_FAILED(rv)) return rv;
+    rv = dir->Create(nsIFile::DIRECTORY_TYPE, 0755);
+    if (NS_FAILED(rv) && rv != NS_ERROR_FILE_ALREADY_EXISTS) return rv;
+    rv = dir->AppendNative(nsDependentCString(kind));
+    if (NS_FAILED(rv)) return rv;
+    rv = dir->Create(nsIFile::DIRECTORY_TYPE, 0755);
+    if (NS_FAILED(rv) && rv != NS_ERROR_FILE_ALREADY_EXISTS) return rv;
+
+    for (int i = 0; i < CREATE_ATTEMPTS; i++) {
+        rv = dir->Clone(getter_AddRefs(o));
+        if (NS_FAILED(rv)) return rv;
+
+        MakeName(name, NAME_LENGTH);
+        nsCAutoString leaf(name);
+        leaf.Append(ext);
+        rv = o->AppendNative(leaf);
+        if (NS_FAILED(rv)) return rv;
+        rv = o->GetNativePath(full);
+        if (NS_FAILED(rv)) return rv;
+
+#ifdef XP_WIN
+        fd = _open(full.get(),
+            _O_CREAT | _O_EXCL | _O_RDWR | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+        fd = open(full.get(), O_CREAT | O_EXCL | O_RDWR, 0600);
+#endif
+        if (fd == -1) {
+            if (errno == EEXIST)
+                continue;
+            fprintf(stderr, "Could not create %s\n", full.get());
+            return NS_ERROR_FAILURE;
+        }
+
+#ifdef XP_WIN
+        *file = _fdopen(fd, "w+b");
+#else
+        *file = fdopen(fd, "w+b");
+#endif
+        if (!*file) {
+#ifdef XP_WIN
+            _close(fd);
+            _unlink(full.get());
+#else
+            close(fd);
+            unlink(full.get());
+#endif
+            return NS_ERROR_OUT_OF_MEMORY;
+        }
+        Reserve(*file, reserve);
+        path.Assign(full);
+        return NS_OK;
+    }
+
+    fprintf(stderr, "Could not find a free name in jetpack/%s\n", kind);
+    return NS_ERROR_FILE_ALREADY_EXISTS;
+}
+
+/*
+ * Flush the file and trim it back to what was actually written, letting
+ * go of any space reserved beyond that
+ */
+nsresult
+OutputFile::Close(FILE *file)
+{
+    nsresult rv = NS_OK;
+
+    if (!file)
+        return NS_ERROR_NULL_POINTER;
+    if (fflush(file))
+        rv = NS_ERROR_FAILURE;
+#ifndef XP_WIN
+    struct stat st;
+    if (fstat(fileno(file), &st) == 0)
+        ftruncate(fileno(file), st.st_size);
+#endif
+    if (fclose(file))
+        rv = NS_ERROR_FAILURE;
+    return rv;
+}
+
+void
+OutputFile::Discard(FILE *file, const nsACString &path)
+{
+    nsCString p(path);
+
+    if (file)
+        fclose(file);
+#ifdef XP_WIN
+    _unlink(p.get());
+#else
+    unlink(p.get());
+#endif
+}
@@ -0,0 +1,70 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef OutputFile_h_
+#define OutputFile_h_
+
+#include <stdio.h>
+
+#include "prtypes.h"
+#include "nscore.h"
+#include "nsStringAPI.h"
+
+/*
+ * Recordings are written straight into the profile directory where script
+ * expects to find them (jetpack/<kind>/), instead of into the temporary
+ * directory and copied over afterwards. The file is created under a fresh
+ * name with an exclusive open, so there is no window between picking the
+ * name and owning the file, and as much space as the caller expects to use
+ * is reserved up front so the file stays contiguous as it grows. Close()
+ * gives back whatever part of the reservation went unused.
+ */
+class OutputFile
+{
+public:
+    static nsresult Create(const char *kind, const char *ext,
+        PRInt64 reserve, nsACString &path, FILE **file);
+    static nsresult Close(FILE *file);
+    /* Close and remove a file that will not be handed out after all */
+    static void Discard(FILE *file, const nsACString &path);
+
+private:
+    static void MakeName(char *buf, PRUint32 len);
+    static void Reserve(FILE *file, PRInt64 reserve);
+};
+
+#endif
@@ -0,0 +1,164 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "PipelineStats.h"
+
+#include <string.h>
+#include "prprf.h"
+
+static const char *stageNames[] = {
+    "capture", "convert", "encode", "packet", "write", "paint"
+};
+
+static const char *queueNames[] = {
+    "chunks", "writeKB"
+};
+
+PipelineStats::PipelineStats()
+    : mLock(nsnull)
+{
+    Reset();
+}
+
+PipelineStats::~PipelineStats()
+{
+    if (mLock)
+        PR_DestroyLock(mLock);
+}
+
+nsresult
+PipelineStats::Init()
+{
+    if (!(mLock = PR_NewLock()))
+        return NS_ERROR_OUT_OF_MEMORY;
+    return NS_OK;
+}
+
+void
+PipelineStats::Reset()
+{
+    if (mLock)
+        PR_Lock(mLock);
+    memset(mStages, 0, sizeof(mStages));
+    memset(mQueues, 0, sizeof(mQueues));
+    if (mLock)
+        PR_Unlock(mLock);
+}
+
+void
+PipelineStats::Add(Histogram *h, PRUint32 value)
+{
+    int bucket = 0;
+    PRUint32 v = value;
+    while (v && bucket < STATS_BUCKETS - 1) {
+        v >>= 1;
+        bucket++;
+    }
+
+    h->count++;
+    h->sum += value;
+    if (value > h->max)
+        h->max = value;
+    h->buckets[bucket]++;
+}
+
+void
+PipelineStats::Time(Stage s, PRTime usec)
+{
+    if (usec < 0)
+        usec = 0;
+    else if (usec > PR_UINT32_MAX)
+        usec = PR_UINT32_MAX;
+
+    PR_Lock(mLock);
+    Add(&mStages[s], (PRUint32)usec);
+    PR_Unlock(mLock);
+}
+
+void
+PipelineStats::Depth(Queue q, PRUint32 value)
+{
+    PR_Lock(mLock);
+    Add(&mQueues[q], value);
+    PR_Unlock(mLock);
+}
+
+/*
+ * "name":{"count":n,"mean":n,"max":n,"buckets":[...]}, with trailing
+ * empty buckets left out
+ */
+void
+PipelineStats::AppendHistogram(nsACString &out, const char *name,
+    Histogram *h)
+{
+    char buf[128];
+    int last = STATS_BUCKETS - 1;
+    while (last > 0 && !h->buckets[last])
+        last--;
+
+    PR_snprintf(buf, sizeof(buf),
+        "\"%s\":{\"count\":%u,\"mean\":%llu,\"max\":%u,\"buckets\":[",
+        name, h->count, h->count ? h->sum / h->count : 0, h->max);
+    out.Append(buf);
+    for (int i = 0; i <= last; i++) {
+        PR_snprintf(buf, sizeof(buf), i ? ",%u" : "%u", h->buckets[i]);
+        out.Append(buf);
+    }
+    out.Append("]}");
+}
+
+void
+PipelineStats::Append(nsACString &out)
+{
+    int i;
+
+    PR_Lock(mLock);
+    out.Append("\"stages\":{");
+    for (i = 0; i < STAGE_COUNT; i++) {
+        if (i)
+            out.Append(",");
+        AppendHistogram(out, stageNames[i], &mStages[i]);
+    }
+    out.Append("},\"queues\":{");
+    for (i = 0; i < QUEUE_COUNT; i++) {
+        if (i)
+            out.Append(",");
+        AppendHistogram(out, queueNames[i], &mQueues[i]);
+    }
+    out.Append("}");
+    PR_Unlock(mLock);
+}
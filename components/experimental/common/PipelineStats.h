@@ -0,0 +1,105 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef PipelineStats_h_
+#define PipelineStats_h_
+
+#include "prtypes.h"
+#include "prtime.h"
+#include "prlock.h"
+#include "nscore.h"
+#include "nsStringAPI.h"
+
+#define STATS_BUCKETS 32
+
+/*
+ * Timing histograms for each stage a frame passes through, and samples
+ * of how deep the queues between them are. Buckets are powers of two:
+ * bucket n counts values v with 2^(n-1) <= v < 2^n, bucket 0 counts
+ * zeroes. Stages are timed on whichever thread runs them, so everything
+ * goes through one lock; at camera frame rates that costs nothing.
+ */
+class PipelineStats
+{
+public:
+    enum Stage {
+        STAGE_CAPTURE,  /* capture time to callback */
+        STAGE_CONVERT,  /* camera format to I420 */
+        STAGE_ENCODE,   /* th_encode_ycbcr_in */
+        STAGE_PACKET,   /* packet and page out */
+        STAGE_WRITE,    /* one write to the file */
+        STAGE_PAINT,    /* preview paint */
+        STAGE_COUNT
+    };
+
+    enum Queue {
+        QUEUE_CHUNKS,   /* chunks waiting for or being encoded */
+        QUEUE_WRITE,    /* kilobytes waiting to be written */
+        QUEUE_COUNT
+    };
+
+    PipelineStats();
+    ~PipelineStats();
+
+    nsresult Init();
+    void Reset();
+
+    /* Record 'usec' spent in stage 's' */
+    void Time(Stage s, PRTime usec);
+    void Depth(Queue q, PRUint32 value);
+
+    /* Append the histograms as JSON object members */
+    void Append(nsACString &out);
+
+private:
+    struct Histogram {
+        PRUint32 count;
+        PRUint32 max;
+        PRUint64 sum;
+        PRUint32 buckets[STATS_BUCKETS];
+    };
+
+    static void Add(Histogram *h, PRUint32 value);
+    static void AppendHistogram(nsACString &out, const char *name,
+        Histogram *h);
+
+    PRLock *mLock;
+    Histogram mStages[STAGE_COUNT];
+    Histogram mQueues[QUEUE_COUNT];
+};
+
+#endif
@@ -0,0 +1,209 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "TraceRing.h"
+#include "prmem.h"
+#include "prlock.h"
+#include "prinit.h"
+#include "pratom.h"
+#include "prthread.h"
+#include "prprf.h"
+
+#include <string.h>
+
+struct TraceEvent {
+    PRTime ts;
+    const char *name;
+    PRUint32 id;
+    char phase;
+};
+
+/*
+ * One thread's events. Only the owning thread writes them; the count
+ * is set atomically after each so readers see whole events.
+ */
+struct TraceThread {
+    TraceEvent events[TRACE_EVENTS];
+    PRInt32 count;
+    PRInt32 epoch;
+    PRThread *owner;
+    PRUint32 tid;
+    const char *name;
+    TraceThread *next;
+};
+
+PRInt32 gTraceEnabled = 0;
+
+static PRCallOnceType gOnce;
+static PRLock *gLock;
+static PRUintn gIndex;
+static TraceThread *gThreads;
+static PRUint32 gNumThreads;
+/* Bumped by Start(), rings from before are up for grabs */
+static PRInt32 gEpoch;
+static PRTime gStart;
+
+static PRStatus
+InitTrace()
+{
+    if (PR_NewThreadPrivateIndex(&gIndex, NULL) != PR_SUCCESS)
+        return PR_FAILURE;
+    return (gLock = PR_NewLock()) ? PR_SUCCESS : PR_FAILURE;
+}
+
+/*
+ * This thread's ring for the current Start(): taken over from a thread
+ * traced before it, or made. Rings are never freed, threads come and go
+ * (PortAudio makes one per stream) so they are recycled instead.
+ */
+static TraceThread *
+CurrentThread()
+{
+    TraceThread *t = (TraceThread *)PR_GetThreadPrivate(gIndex);
+    PRThread *self = PR_GetCurrentThread();
+    PRInt32 epoch = gEpoch;
+    
+    /* Since the last Start() another thread may have taken it over */
+    if (t && t->epoch == epoch && t->owner == self)
+        return t;
+    
+    PR_Lock(gLock);
+    for (t = gThreads; t && t->epoch == epoch; t = t->next)
+        ;
+    if (!t && gNumThreads < TRACE_MAX_THREADS &&
+        (t = (TraceThread *)PR_Calloc(1, sizeof(TraceThread)))) {
+        t->tid = ++gNumThreads;
+        t->next = gThreads;
+        gThreads = t;
+    }
+    if (t) {
+        t->count = 0;
+        t->name = nsnull;
+        t->epoch = epoch;
+        t->owner = self;
+    }
+    PR_Unlock(gLock);
+    
+    PR_SetThreadPrivate(gIndex, t);
+    return t;
+}
+
+void
+TraceRing::Start()
+{
+    if (PR_CallOnce(&gOnce, InitTrace) != PR_SUCCESS)
+        return;
+    PR_Lock(gLock);
+    gStart = PR_Now();
+    PR_AtomicIncrement(&gEpoch);
+    PR_Unlock(gLock);
+    PR_AtomicSet(&gTraceEnabled, 1);
+}
+
+void
+TraceRing::Stop()
+{
+    PR_AtomicSet(&gTraceEnabled, 0);
+}
+
+void
+TraceRing::NameThread(const char *name)
+{
+    TraceThread *t = CurrentThread();
+    if (t && !t->name)
+        t->name = name;
+}
+
+void
+TraceRing::Event(const char *name, char phase, PRUint32 id)
+{
+    TraceThread *t = CurrentThread();
+    if (!t)
+        return;
+    
+    PRInt32 n = t->count;
+    TraceEvent *e = &t->events[n & (TRACE_EVENTS - 1)];
+    e->ts = PR_Now();
+    e->name = name;
+    e->id = id;
+    e->phase = phase;
+    PR_AtomicSet(&t->count, n + 1);
+}
+
+void
+TraceRing::AppendJSON(nsACString &out)
+{
+    char buf[256];
+    PRBool first = PR_TRUE;
+    
+    out.Append("{\"traceEvents\":[");
+    if (PR_CallOnce(&gOnce, InitTrace) != PR_SUCCESS) {
+        out.Append("]}");
+        return;
+    }
+    
+    PR_Lock(gLock);
+    for (TraceThread *t = gThreads; t; t = t->next) {
+        if (t->epoch != gEpoch)
+            continue;
+        
+        if (t->name) {
+            PR_snprintf(buf, sizeof(buf),
+                "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                "\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",", t->tid, t->name);
+            out.Append(buf);
+            first = PR_FALSE;
+        }
+        
+        PRInt32 end = PR_AtomicAdd(&t->count, 0);
+        PRInt32 i = end > TRACE_EVENTS ? end - TRACE_EVENTS : 0;
+        for (; i < end; i++) {
+            TraceEvent *e = &t->events[i & (TRACE_EVENTS - 1)];
+            PR_snprintf(buf, sizeof(buf),
+                "%s{\"name\":\"%s\",\"cat\":\"media\",\"ph\":\"%c\","
+                "\"ts\":%lld,\"pid\":1,\"tid\":%u,\"id\":%u,"
+                "\"args\":{\"id\":%u}}",
+                first ? "" : ",", e->name, e->phase, e->ts - gStart,
+                t->tid, e->id, e->id);
+            out.Append(buf);
+            first = PR_FALSE;
+        }
+    }
+    PR_Unlock(gLock);
+    out.Append("]}");
+}
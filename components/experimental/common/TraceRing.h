@@ -0,0 +1,97 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef TraceRing_h_
+#define TraceRing_h_
+
+#include "prtypes.h"
+#include "prtime.h"
+#include "nscore.h"
+#include "nsStringAPI.h"
+
+/* Events kept per thread (a power of two), and threads traced at once */
+#define TRACE_EVENTS        (8192)
+#define TRACE_MAX_THREADS   (64)
+
+/* Set while tracing; the macros below cost one load and a branch if not */
+extern PRInt32 gTraceEnabled;
+
+/*
+ * Timestamped events from the media threads, for following single
+ * frames and buffers through capture, queueing, encoding, paging and
+ * writing in a timeline viewer (chrome://tracing and the like).
+ *
+ * Every thread that records an event gets a ring of its own, so
+ * recording is a few stores and an atomic set of the ring's count, no
+ * locks; a thread only takes the lock the first time it traces after
+ * Start(). When a ring is full the oldest events are overwritten.
+ * AppendJSON() reads the rings while they may still be written to:
+ * call Stop() first for a snapshot that holds still.
+ *
+ * Names must be string literals, only the pointer is kept.
+ */
+class TraceRing
+{
+public:
+    /* Forget what was recorded and start again */
+    static void Start();
+    static void Stop();
+
+    /* What this thread is called in the timeline, once per Start() */
+    static void NameThread(const char *name);
+    static void Event(const char *name, char phase, PRUint32 id);
+
+    /* Everything recorded, in Chrome's trace event format */
+    static void AppendJSON(nsACString &out);
+};
+
+/* A span on the calling thread */
+#define TRACE_BEGIN(name, id) \
+    do { if (gTraceEnabled) TraceRing::Event(name, 'B', id); } while (0)
+#define TRACE_END(name, id) \
+    do { if (gTraceEnabled) TraceRing::Event(name, 'E', id); } while (0)
+/* A span that may end on another thread than it began, matched by id */
+#define TRACE_ASYNC_BEGIN(name, id) \
+    do { if (gTraceEnabled) TraceRing::Event(name, 'b', id); } while (0)
+#define TRACE_ASYNC_END(name, id) \
+    do { if (gTraceEnabled) TraceRing::Event(name, 'e', id); } while (0)
+#define TRACE_INSTANT(name, id) \
+    do { if (gTraceEnabled) TraceRing::Event(name, 'i', id); } while (0)
+#define TRACE_THREAD(name) \
+    do { if (gTraceEnabled) TraceRing::NameThread(name); } while (0)
+
+#endif
@@ -0,0 +1,195 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "VorbisEncoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+VorbisEncoder::VorbisEncoder()
+    : mChannels(0)
+    , mRate(0)
+    , mOpen(PR_FALSE)
+    , mLowLatency(PR_FALSE)
+    , mFlushGranules(0)
+    , mGranule(0)
+    , mFlushedAt(0)
+    , mCallback(nsnull)
+    , mData(nsnull)
+{
+}
+
+VorbisEncoder::~VorbisEncoder()
+{
+    if (mOpen) {
+        ogg_stream_clear(&mStream);
+        vorbis_block_clear(&mBlock);
+        vorbis_dsp_clear(&mDsp);
+        vorbis_comment_clear(&mComment);
+        vorbis_info_clear(&mInfo);
+    }
+}
+
+nsresult
+VorbisEncoder::Init(int channels, int rate, float quality,
+    PageCallback cb, void *data)
+{
+    if (mOpen)
+        return NS_ERROR_ALREADY_INITIALIZED;
+
+    mChannels = channels;
+    mRate = rate;
+    mCallback = cb;
+    mData = data;
+
+    vorbis_info_init(&mInfo);
+    if (vorbis_encode_init_vbr(&mInfo, channels, rate, quality)) {
+        fprintf(stderr, "Could not initialize Vorbis encoder!\n");
+        vorbis_info_clear(&mInfo);
+        return NS_ERROR_FAILURE;
+    }
+    vorbis_comment_init(&mComment);
+    vorbis_analysis_init(&mDsp, &mInfo);
+    vorbis_block_init(&mDsp, &mBlock);
+    ogg_stream_init(&mStream, rand());
+
+    mOpen = PR_TRUE;
+    return NS_OK;
+}
+
+void
+VorbisEncoder::WriteBOS()
+{
+    ogg_page og;
+    ogg_packet id, comment, code;
+
+    vorbis_analysis_headerout(&mDsp, &mComment, &id, &comment, &code);
+    ogg_stream_packetin(&mStream, &id);
+    while (ogg_stream_flush(&mStream, &og))
+        mCallback(mData, &og);
+
+    /* Held back until WriteHeaders */
+    ogg_stream_packetin(&mStream, &comment);
+    ogg_stream_packetin(&mStream, &code);
+}
+
+void
+VorbisEncoder::WriteHeaders()
+{
+    ogg_page og;
+
+    while (ogg_stream_flush(&mStream, &og))
+        mCallback(mData, &og);
+}
+
+void
+VorbisEncoder::SetFlushInterval(PRUint32 ms)
+{
+    mFlushGranules = (ogg_int64_t)mRate * ms / 1000;
+}
+
+nsresult
+VorbisEncoder::Encode(const int *frames, long count)
+{
+    if (!mOpen)
+        return NS_ERROR_NOT_INITIALIZED;
+
+    float **buf = vorbis_analysis_buffer(&mDsp, count);
+    for (long i = 0; i < count; i++) {
+        for (int c = 0; c < mChannels; c++)
+            buf[c][i] = frames[i * mChannels + c] / 2147483648.0f;
+    }
+    vorbis_analysis_wrote(&mDsp, count);
+
+    Drain(PR_FALSE);
+    return NS_OK;
+}
+
+nsresult
+VorbisEncoder::EncodeSilence(long count)
+{
+    if (!mOpen)
+        return NS_ERROR_NOT_INITIALIZED;
+
+    float **buf = vorbis_analysis_buffer(&mDsp, count);
+    for (int c = 0; c < mChannels; c++)
+        memset(buf[c], 0, count * sizeof(float));
+    vorbis_analysis_wrote(&mDsp, count);
+
+    Drain(PR_FALSE);
+    return NS_OK;
+}
+
+void
+VorbisEncoder::Finish()
+{
+    if (!mOpen)
+        return;
+
+    vorbis_analysis_wrote(&mDsp, 0);
+    Drain(PR_TRUE);
+}
+
+void
+VorbisEncoder::Drain(PRBool flush)
+{
+    ogg_page og;
+    ogg_packet op;
+
+    while (vorbis_analysis_blockout(&mDsp, &mBlock) == 1) {
+        vorbis_analysis(&mBlock, NULL);
+        vorbis_bitrate_addblock(&mBlock);
+        while (vorbis_bitrate_flushpacket(&mDsp, &op)) {
+            ogg_stream_packetin(&mStream, &op);
+            mGranule = op.granulepos;
+        }
+    }
+
+    while (ogg_stream_pageout(&mStream, &og)) {
+        if (ogg_page_granulepos(&og) >= 0)
+            mFlushedAt = ogg_page_granulepos(&og);
+        mCallback(mData, &og);
+    }
+    /* Don't let a part-filled page sit longer than the interval */
+    if (mFlushGranules && mGranule - mFlushedAt >= mFlushGranules)
+        flush = PR_TRUE;
+    if (flush || mLowLatency) {
+        while (ogg_stream_flush(&mStream, &og))
+            mCallback(mData, &og);
+        mFlushedAt = mGranule;
+    }
+}
@@ -0,0 +1,104 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef VorbisEncoder_h_
+#define VorbisEncoder_h_
+
+#include <stdio.h>
+#include <ogg/ogg.h>
+#include <vorbis/vorbisenc.h>
+
+#include "prtypes.h"
+#include "nscore.h"
+
+typedef void (*PageCallback)(void *data, ogg_page *og);
+
+/*
+ * Encodes interleaved 32 bit PCM into an Ogg/Vorbis logical stream and
+ * passes every page to a callback, leaving it to the caller to put the
+ * pages into a file, possibly next to other streams. Headers are split so
+ * the BOS page can go out ahead of the other streams' secondary headers.
+ */
+class VorbisEncoder
+{
+public:
+    VorbisEncoder();
+    ~VorbisEncoder();
+
+    nsresult Init(int channels, int rate, float quality,
+        PageCallback cb, void *data);
+    /* Page holding the identification header */
+    void WriteBOS();
+    /* Pages holding the comment and setup headers */
+    void WriteHeaders();
+
+    nsresult Encode(const int *frames, long count);
+    nsresult EncodeSilence(long count);
+    /* Flush the remaining audio and end the stream */
+    void Finish();
+
+    int Rate() { return mRate; }
+    int Serial() { return mStream.serialno; }
+    /* Put out a page as soon as there is a packet, instead of filling it */
+    void SetLowLatency(PRBool lowLatency) { mLowLatency = lowLatency; }
+    /* Or at least once every so many milliseconds of audio */
+    void SetFlushInterval(PRUint32 ms);
+
+private:
+    void Drain(PRBool flush);
+
+    int mChannels;
+    int mRate;
+    PRBool mOpen;
+    PRBool mLowLatency;
+    /* In samples: how often to flush, the last packet in, and the last
+     * one that went out on a page */
+    ogg_int64_t mFlushGranules;
+    ogg_int64_t mGranule;
+    ogg_int64_t mFlushedAt;
+
+    PageCallback mCallback;
+    void *mData;
+
+    vorbis_info mInfo;
+    vorbis_comment mComment;
+    vorbis_dsp_state mDsp;
+    vorbis_block mBlock;
+    ogg_stream_state mStream;
+};
+
+#endif
@@ -0,0 +1,236 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "VorbisQueue.h"
+
+#include <stdio.h>
+#include <string.h>
+
+VorbisQueue::VorbisQueue()
+    : mVorbis(nsnull)
+    , mChannels(0)
+    , mQueue(nsnull)
+    , mQueued(0)
+    , mEncoded(0)
+    , mDropped(0)
+    , mThread(nsnull)
+    , mLock(nsnull)
+    , mCond(nsnull)
+    , mClosing(PR_FALSE)
+{
+}
+
+VorbisQueue::~VorbisQueue()
+{
+    Stop();
+    if (mCond)
+        PR_DestroyCondVar(mCond);
+    if (mLock)
+        PR_DestroyLock(mLock);
+}
+
+nsresult
+VorbisQueue::Start(VorbisEncoder *vorbis, int channels)
+{
+    if (mThread)
+        return NS_ERROR_ALREADY_INITIALIZED;
+    if (!mLock && !(mLock = PR_NewLock()))
+        return NS_ERROR_OUT_OF_MEMORY;
+    if (!mCond && !(mCond = PR_NewCondVar(mLock)))
+        return NS_ERROR_OUT_OF_MEMORY;
+    if (!(mQueue = (int *)BufferArena::Alloc(BufferArena::ARENA_SAMPLES,
+        VORBIS_QUEUE_FRAMES * channels * sizeof(int))))
+        return NS_ERROR_OUT_OF_MEMORY;
+
+    mVorbis = vorbis;
+    mChannels = channels;
+    mQueued = mEncoded = 0;
+    mDropped = 0;
+    mClosing = PR_FALSE;
+
+    mThread = PR_CreateThread(PR_USER_THREAD, Run, this,
+        PR_PRIORITY_NORMAL, PR_GLOBAL_THREAD, PR_JOINABLE_THREAD, 0);
+    if (!mThread) {
+        fprintf(stderr, "Could not start Vorbis encoder thread!\n");
+        BufferArena::Free(mQueue);
+        mQueue = nsnull;
+        return NS_ERROR_FAILURE;
+    }
+    return NS_OK;
+}
+
+/*
+ * Copy in frames known to fit, then let the encoder have them
+ */
+void
+VorbisQueue::Copy(const int *frames, long count)
+{
+    PRUint32 in = (PRUint32)mQueued;
+    PRUint32 at = in & (VORBIS_QUEUE_FRAMES - 1);
+    PRUint32 first = PR_MIN((PRUint32)count, VORBIS_QUEUE_FRAMES - at);
+
+    if (frames) {
+        memcpy(mQueue + at * mChannels, frames,
+            first * mChannels * sizeof(int));
+        memcpy(mQueue, frames + first * mChannels,
+            (count - first) * mChannels * sizeof(int));
+    } else {
+        memset(mQueue + at * mChannels, 0, first * mChannels * sizeof(int));
+        memset(mQueue, 0, (count - first) * mChannels * sizeof(int));
+    }
+    PR_AtomicSet(&mQueued, (PRInt32)(in + count));
+}
+
+nsresult
+VorbisQueue::Write(const int *frames, long count)
+{
+    PRUint32 in, out;
+
+    if (!mThread)
+        return NS_ERROR_NOT_INITIALIZED;
+
+    in = (PRUint32)mQueued;
+    out = (PRUint32)PR_AtomicAdd(&mEncoded, 0);
+    if (count > (long)(VORBIS_QUEUE_FRAMES - (in - out))) {
+        /* The encoder has fallen too far behind, lose this buffer */
+        mDropped += count;
+        return NS_ERROR_FAILURE;
+    }
+    Copy(frames, count);
+    return NS_OK;
+}
+
+nsresult
+VorbisQueue::WriteAll(const int *frames, long count)
+{
+    PRUint32 in, out, room;
+    long run;
+
+    if (!mThread)
+        return NS_ERROR_NOT_INITIALIZED;
+
+    /* In pieces the queue can hold, waiting for the encoder to make
+     * room for each */
+    while (count > 0) {
+        in = (PRUint32)mQueued;
+        out = (PRUint32)PR_AtomicAdd(&mEncoded, 0);
+        room = VORBIS_QUEUE_FRAMES - (in - out);
+        if (!room) {
+            PR_Lock(mLock);
+            PR_NotifyCondVar(mCond);
+            PR_WaitCondVar(mCond,
+                PR_MillisecondsToInterval(VORBIS_QUEUE_INTERVAL));
+            PR_Unlock(mLock);
+            continue;
+        }
+        run = PR_MIN((long)room, count);
+        Copy(frames, run);
+        if (frames)
+            frames += run * mChannels;
+        count -= run;
+    }
+    return NS_OK;
+}
+
+/*
+ * Encode everything queued so far, in at most two runs
+ */
+void
+VorbisQueue::Drain()
+{
+    PRUint32 in, out, at, run;
+
+    out = (PRUint32)mEncoded;
+    in = (PRUint32)PR_AtomicAdd(&mQueued, 0);
+    if (out == in)
+        return;
+    TRACE_BEGIN("vorbis encode", in - out);
+    while (out != in) {
+        at = out & (VORBIS_QUEUE_FRAMES - 1);
+        run = PR_MIN(in - out, VORBIS_QUEUE_FRAMES - at);
+        mVorbis->Encode(mQueue + at * mChannels, run);
+        out += run;
+        PR_AtomicSet(&mEncoded, (PRInt32)out);
+    }
+    TRACE_END("vorbis encode", 0);
+}
+
+/*
+ * An audio callback must not block, so writers do not signal us; we
+ * look every VORBIS_QUEUE_INTERVAL, and once more after being told to
+ * stop. A writer waiting for room is woken once some has been made.
+ */
+void
+VorbisQueue::Run(void *arg)
+{
+    VorbisQueue *self = static_cast<VorbisQueue*>(arg);
+    PRBool closing;
+
+    do {
+        TRACE_THREAD("vorbis");
+        PR_Lock(self->mLock);
+        if (!self->mClosing)
+            PR_WaitCondVar(self->mCond,
+                PR_MillisecondsToInterval(VORBIS_QUEUE_INTERVAL));
+        closing = self->mClosing;
+        PR_Unlock(self->mLock);
+        self->Drain();
+        PR_Lock(self->mLock);
+        PR_NotifyAllCondVar(self->mCond);
+        PR_Unlock(self->mLock);
+    } while (!closing);
+}
+
+void
+VorbisQueue::Stop()
+{
+    if (!mThread)
+        return;
+
+    PR_Lock(mLock);
+    mClosing = PR_TRUE;
+    PR_NotifyAllCondVar(mCond);
+    PR_Unlock(mLock);
+    PR_JoinThread(mThread);
+    mThread = nsnull;
+    if (mDropped)
+        fprintf(stderr, "Dropped %u audio frames the encoder could not "
+            "keep up with\n", mDropped);
+
+    BufferArena::Free(mQueue);
+    mQueue = nsnull;
+}
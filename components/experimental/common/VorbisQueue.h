@@ -0,0 +1,103 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef VorbisQueue_h_
+#define VorbisQueue_h_
+
+#include "prlock.h"
+#include "prcvar.h"
+#include "pratom.h"
+#include "prthread.h"
+#include "prinrval.h"
+#include "nscore.h"
+#include "VorbisEncoder.h"
+#include "BufferArena.h"
+#include "TraceRing.h"
+
+/* How far the writer may get ahead of the encoder, in frames (a power of
+ * two, about three seconds), and how often the encoder looks */
+#define VORBIS_QUEUE_FRAMES (1 << 17)
+#define VORBIS_QUEUE_INTERVAL (10)
+
+/*
+ * Frames queued ahead of a VorbisEncoder, which encodes them on a thread
+ * of the queue's own. Write() only copies into the queue and never waits,
+ * so it is safe from an audio callback; what does not fit is dropped and
+ * counted. WriteAll() waits for room instead, for writers that must not
+ * lose anything. Only one thread may write at a time, and none once
+ * Stop() has been called. Pages come out of the encoder's callback on
+ * the queue's thread.
+ */
+class VorbisQueue
+{
+public:
+    VorbisQueue();
+    ~VorbisQueue();
+
+    nsresult Start(VorbisEncoder *vorbis, int channels);
+    /* Interleaved 32 bit frames, or silence if frames is null */
+    nsresult Write(const int *frames, long count);
+    nsresult WriteAll(const int *frames, long count);
+    /* Encode what is still queued and stop the thread; finishing the
+     * encoder is left to the caller */
+    void Stop();
+
+    PRBool IsRunning() { return mThread != nsnull; }
+    PRUint32 Dropped() { return mDropped; }
+
+private:
+    static void Run(void *arg);
+    void Copy(const int *frames, long count);
+    void Drain();
+
+    VorbisEncoder *mVorbis;
+    int mChannels;
+
+    /* Frames in and out of the queue so far; each side only moves its
+     * own, and the other reads it atomically */
+    int *mQueue;
+    PRInt32 mQueued;
+    PRInt32 mEncoded;
+    PRUint32 mDropped;
+
+    PRThread *mThread;
+    PRLock *mLock;
+    PRCondVar *mCond;
+    PRBool mClosing;
+};
+
+#endif
@@ -0,0 +1,146 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Jetpack Music Interface.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "FolderLibrary.h"
+#include "prenv.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sndfile.h>
+
+/* What is worth opening; libsndfile finds out the rest */
+static const char *kExtensions[] = {
+    ".ogg", ".oga", ".flac", ".wav", ".aif", ".aiff", ".au", ".caf", nsnull
+};
+
+FolderLibrary::FolderLibrary()
+{
+}
+
+void
+FolderLibrary::SetFolder(const nsACString &folder)
+{
+    mFolder.Assign(folder);
+}
+
+nsresult
+FolderLibrary::Collect()
+{
+    nsCString folder(mFolder);
+    struct stat st;
+
+    if (folder.IsEmpty()) {
+        const char *home = PR_GetEnv("HOME");
+        if (!home)
+            return NS_ERROR_FILE_NOT_FOUND;
+        folder.Assign(home);
+        folder.Append("/Music");
+    }
+    if (stat(folder.get(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "JEP Music:: No music folder at %s\n", folder.get());
+        return NS_ERROR_FILE_NOT_FOUND;
+    }
+
+    Walk(folder, 0);
+    return NS_OK;
+}
+
+void
+FolderLibrary::Walk(const nsACString &dir, int depth)
+{
+    DIR *d;
+    struct dirent *e;
+    struct stat st;
+
+    if (depth > FOLDER_MAX_DEPTH)
+        return;
+    if (!(d = opendir(PromiseFlatCString(dir).get())))
+        return;
+
+    while ((e = readdir(d))) {
+        /* Hidden files and folders, and . and .. */
+        if (e->d_name[0] == '.')
+            continue;
+
+        nsCString path(dir);
+        path.Append('/');
+        path.Append(e->d_name);
+        if (stat(path.get(), &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            Walk(path, depth + 1);
+        else if (S_ISREG(st.st_mode))
+            AddFile(path, e->d_name);
+    }
+    closedir(d);
+}
+
+void
+FolderLibrary::AddFile(const nsACString &path, const char *name)
+{
+    const char *ext = strrchr(name, '.');
+    SNDFILE *sf;
+    SF_INFO info;
+    int i;
+
+    if (!ext)
+        return;
+    for (i = 0; kExtensions[i]; i++) {
+        if (!strcasecmp(ext, kExtensions[i]))
+            break;
+    }
+    if (!kExtensions[i])
+        return;
+
+    /* Only what we will be able to play */
+    memset(&info, 0, sizeof(info));
+    if (!(sf = sf_open(PromiseFlatCString(path).get(), SFM_READ, &info)))
+        return;
+
+    const char *title = sf_get_string(sf, SF_STR_TITLE);
+    nsCString fallback;
+    if (!title || !*title) {
+        fallback.Assign(name, (PRUint32)(ext - name));
+        title = fallback.get();
+    }
+    Add(PromiseFlatCString(path).get(), title,
+        sf_get_string(sf, SF_STR_ALBUM), sf_get_string(sf, SF_STR_ARTIST));
+    sf_close(sf);
+}
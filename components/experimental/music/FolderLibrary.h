@@ -0,0 +1,71 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Jetpack Music Interface.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef FolderLibrary_h_
+#define FolderLibrary_h_
+
+#include "MusicLibrary.h"
+
+/* How far below the folder to look, so a symlink loop ends somewhere */
+#define FOLDER_MAX_DEPTH    (16)
+
+/*
+ * The tracks in a folder of audio files and everything below it, for
+ * where there is no player application to ask. Tags are read with
+ * libsndfile from the files themselves; a track without a title is known
+ * by its file name. Without a folder set, it is the Music folder in the
+ * user's home.
+ */
+class FolderLibrary : public MusicLibrary
+{
+public:
+    FolderLibrary();
+
+    /* Takes effect on the next Scan(), on the same thread */
+    void SetFolder(const nsACString &folder);
+
+protected:
+    nsresult Collect();
+
+private:
+    void Walk(const nsACString &dir, int depth);
+    void AddFile(const nsACString &path, const char *name);
+
+    nsCString mFolder;
+};
+
+#endif
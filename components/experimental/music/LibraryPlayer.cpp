@@ -0,0 +1,410 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Jetpack Music Interface.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "LibraryPlayer.h"
+#include "MusicTrack.h"
+
+#include <stdio.h>
+
+NS_IMPL_THREADSAFE_ISUPPORTS2(LibraryPlayer, IMusicPlayer, IMusicLibrary)
+
+/*
+ * Indexes, opens, pauses or closes on the media thread
+ */
+class PlayerTask : public MediaTask
+{
+public:
+    enum { SCAN, OPEN, PAUSE, RESUME, CLOSE };
+
+    PlayerTask(LibraryPlayer *player, int op, const nsACString &arg,
+        PRUint32 generation)
+        : mPlayer(player)
+        , mOp(op)
+        , mArg(arg)
+        , mGeneration(generation)
+    {
+    }
+
+protected:
+    nsresult Perform()
+    {
+        switch (mOp) {
+        case SCAN:
+            return mPlayer->Scan(mArg);
+        case OPEN:
+            return mPlayer->OpenTrack(mArg, mGeneration);
+        case PAUSE:
+            return mPlayer->PauseTrack(PR_TRUE);
+        case RESUME:
+            return mPlayer->PauseTrack(PR_FALSE);
+        }
+        return mPlayer->CloseTrack();
+    }
+
+    void Complete(nsresult status)
+    {
+        if (mOp == OPEN)
+            mPlayer->Opened(mGeneration, status);
+    }
+
+private:
+    LibraryPlayer *mPlayer;
+    int mOp;
+    nsCString mArg;
+    PRUint32 mGeneration;
+};
+
+/*
+ * A track played out, from PortAudio's thread
+ */
+class TrackEndedEvent : public nsRunnable
+{
+public:
+    TrackEndedEvent(LibraryPlayer *player, PRUint32 generation)
+        : mPlayer(player)
+        , mGeneration(generation)
+    {
+    }
+
+    NS_IMETHOD Run()
+    {
+        /* The player may have gone away in the meantime */
+        if (LibraryPlayer::GetService() == mPlayer)
+            mPlayer->Ended(mGeneration);
+        return NS_OK;
+    }
+
+private:
+    LibraryPlayer *mPlayer;
+    PRUint32 mGeneration;
+};
+
+LibraryPlayer *LibraryPlayer::gLibraryService = nsnull;
+
+LibraryPlayer *
+LibraryPlayer::GetSingleton()
+{
+    if (gLibraryService) {
+        NS_ADDREF(gLibraryService);
+        return gLibraryService;
+    }
+    
+    gLibraryService = new LibraryPlayer();
+    if (gLibraryService) {
+        NS_ADDREF(gLibraryService);
+        if (NS_FAILED(gLibraryService->Init()))
+            NS_RELEASE(gLibraryService);
+    }
+    
+    return gLibraryService;
+}
+
+nsresult
+LibraryPlayer::Init()
+{
+    nsresult rv;
+    
+    state = STOPPED;
+    current = -1;
+    generation = 0;
+    playingGeneration = 0;
+    backendTried = PR_FALSE;
+    backendStatus = NS_OK;
+    
+    rv = library.Init();
+    if (NS_FAILED(rv)) return rv;
+    /* Index the default folder in the background from the start */
+    return Post(PlayerTask::SCAN, folder);
+}
+
+LibraryPlayer::~LibraryPlayer()
+{
+    /* Let anything queued finish, then let go of the device */
+    media.Shutdown();
+    CloseTrack();
+    
+    PaError err;
+    if (backendTried && NS_SUCCEEDED(backendStatus) &&
+        (err = Pa_Terminate()) != paNoError) {
+        fprintf(stderr, "JEP Music:: Could not terminate PortAudio! %d\n", err);
+    }
+    
+    gLibraryService = nsnull;
+}
+
+nsresult
+LibraryPlayer::Post(int op, const nsACString &arg)
+{
+    nsRefPtr<PlayerTask> task = new PlayerTask(this, op, arg, generation);
+    if (!task)
+        return NS_ERROR_OUT_OF_MEMORY;
+    return media.Dispatch(task);
+}
+
+/*
+ * Media thread: PortAudio goes through every device when it starts, so
+ * that waits for the first track
+ */
+nsresult
+LibraryPlayer::EnsureBackend()
+{
+    PaError err;
+    
+    if (backendTried)
+        return backendStatus;
+    backendTried = PR_TRUE;
+    err = Pa_Initialize();
+    if (err != paNoError) {
+        fprintf(stderr, "JEP Music:: Could not initialize PortAudio! %d\n",
+            err);
+        backendStatus = NS_ERROR_FAILURE;
+    }
+    return backendStatus;
+}
+
+nsresult
+LibraryPlayer::Scan(const nsACString &dir)
+{
+    library.SetFolder(dir);
+    return library.Scan();
+}
+
+void
+LibraryPlayer::OnTrackEnded(void *data)
+{
+    LibraryPlayer *self = static_cast<LibraryPlayer *>(data);
+    nsCOMPtr<nsIRunnable> event =
+        new TrackEndedEvent(self, self->playingGeneration);
+    if (event)
+        NS_DispatchToMainThread(event);
+}
+
+nsresult
+LibraryPlayer::OpenTrack(const nsACString &path, PRUint32 gen)
+{
+    nsresult rv = EnsureBackend();
+    if (NS_FAILED(rv)) return rv;
+    
+    if (track.IsOpen())
+        track.Close();
+    playingGeneration = gen;
+    return track.Open(path, OnTrackEnded, this);
+}
+
+nsresult
+LibraryPlayer::CloseTrack()
+{
+    if (!track.IsOpen())
+        return NS_OK;
+    return track.Close();
+}
+
+nsresult
+LibraryPlayer::PauseTrack(PRBool paused)
+{
+    if (!track.IsOpen())
+        return NS_ERROR_NOT_INITIALIZED;
+    track.Pause(paused);
+    return NS_OK;
+}
+
+/*
+ * A track that could not be opened leaves nothing playing, unless
+ * another one has been asked for since
+ */
+void
+LibraryPlayer::Opened(PRUint32 gen, nsresult status)
+{
+    if (NS_FAILED(status) && gen == generation)
+        state = STOPPED;
+}
+
+/*
+ * Carry on with the next track in the library, if there is one
+ */
+void
+LibraryPlayer::Ended(PRUint32 gen)
+{
+    if (gen != generation || state != PLAYING)
+        return;
+    if ((PRUint32)(current + 1) < library.Count())
+        StartTrack(current + 1);
+    else
+        Stop();
+}
+
+nsresult
+LibraryPlayer::StartTrack(PRInt32 index)
+{
+    nsresult rv;
+    nsCString path;
+    
+    rv = library.GetData(index, path);
+    if (NS_FAILED(rv)) return rv;
+    
+    current = index;
+    generation++;
+    rv = Post(PlayerTask::OPEN, path);
+    if (NS_FAILED(rv)) return rv;
+    state = PLAYING;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+LibraryPlayer::Play()
+{
+    switch (state) {
+    case PLAYING:
+        return NS_OK;
+    case PAUSED:
+        state = PLAYING;
+        return Post(PlayerTask::RESUME, nsCString());
+    }
+    if (!library.Count())
+        return NS_ERROR_NOT_AVAILABLE;
+    return StartTrack(current < 0 ? 0 : current);
+}
+
+NS_IMETHODIMP
+LibraryPlayer::Stop()
+{
+    if (state == STOPPED)
+        return NS_OK;
+    state = STOPPED;
+    generation++;
+    return Post(PlayerTask::CLOSE, nsCString());
+}
+
+NS_IMETHODIMP
+LibraryPlayer::Pause()
+{
+    if (state != PLAYING)
+        return NS_OK;
+    state = PAUSED;
+    return Post(PlayerTask::PAUSE, nsCString());
+}
+
+NS_IMETHODIMP
+LibraryPlayer::PlayTrack(IMusicTrack *tr)
+{
+    nsCAutoString data;
+    nsresult rv = tr->GetData(data);
+    NS_ENSURE_SUCCESS(rv, rv);
+    
+    PRInt32 index = library.Find(data);
+    if (index < 0)
+        return NS_ERROR_FAILURE;
+    return StartTrack(index);
+}
+
+NS_IMETHODIMP
+LibraryPlayer::Search(const nsACString &what, PRUint32 *count,
+    IMusicTrack ***retval)
+{
+    return library.Search(what, count, retval);
+}
+
+NS_IMETHODIMP
+LibraryPlayer::GetCurrentTrack(IMusicTrack **retval)
+{
+    return library.GetTrack(current, retval);
+}
+
+/*
+ * Like a player application, these only move along when stopped
+ */
+NS_IMETHODIMP
+LibraryPlayer::GotoNextTrack()
+{
+    PRUint32 count = library.Count();
+    
+    if (!count)
+        return NS_ERROR_NOT_AVAILABLE;
+    PRInt32 next = (PRUint32)(current + 1) < count ? current + 1 : 0;
+    if (state == STOPPED) {
+        current = next;
+        return NS_OK;
+    }
+    return StartTrack(next);
+}
+
+NS_IMETHODIMP
+LibraryPlayer::GotoPreviousTrack()
+{
+    PRUint32 count = library.Count();
+    
+    if (!count)
+        return NS_ERROR_NOT_AVAILABLE;
+    PRInt32 prev = current > 0 ? current - 1 : (PRInt32)count - 1;
+    if (state == STOPPED) {
+        current = prev;
+        return NS_OK;
+    }
+    return StartTrack(prev);
+}
+
+NS_IMETHODIMP
+LibraryPlayer::GetFolder(nsACString &value)
+{
+    value = folder;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+LibraryPlayer::SetFolder(const nsACString &value)
+{
+    /* What is playing comes from the old one */
+    Stop();
+    current = -1;
+    folder.Assign(value);
+    return Post(PlayerTask::SCAN, folder);
+}
+
+NS_IMETHODIMP
+LibraryPlayer::GetTrackCount(PRUint32 *retval)
+{
+    *retval = library.Count();
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+LibraryPlayer::Rescan()
+{
+    Stop();
+    current = -1;
+    return Post(PlayerTask::SCAN, folder);
+}
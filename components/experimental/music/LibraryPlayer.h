@@ -0,0 +1,113 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Jetpack Music Interface.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef LibraryPlayer_h_
+#define LibraryPlayer_h_
+
+#include "portaudio.h"
+
+#include "nsCOMPtr.h"
+#include "nsAutoPtr.h"
+#include "nsMemory.h"
+#include "nsStringAPI.h"
+#include "IMusicPlayer.h"
+#include "IMusicLibrary.h"
+#include "MediaThread.h"
+#include "FolderLibrary.h"
+#include "TrackStream.h"
+
+#define LIBRARY_PLAYER_CONTRACTID "@labs.mozilla.com/music/library;1"
+#define LIBRARY_PLAYER_CLASSNAME  "Music Library Player"
+#define LIBRARY_PLAYER_CID { 0x80297e49, 0xc4cf, 0x4c0a, \
+                           { 0xa1, 0x4e, 0xd8, 0xa8, 0x2d, 0xd6, 0x95, 0xe7 } }
+
+/*
+ * IMusicPlayer for where there is no player application to drive: tracks
+ * come from a MusicLibrary backend and are played here with PortAudio.
+ * Next and previous go through the library in order. Indexing, opening
+ * and closing files and the audio device are left to the media thread;
+ * the main thread only keeps track of what was last asked for.
+ */
+class LibraryPlayer : public IMusicPlayer, public IMusicLibrary
+{
+public:
+    NS_DECL_ISUPPORTS
+    NS_DECL_IMUSICPLAYER
+    NS_DECL_IMUSICLIBRARY
+
+    nsresult Init();
+    static LibraryPlayer *GetSingleton();
+    static LibraryPlayer *GetService() { return gLibraryService; }
+    virtual ~LibraryPlayer();
+    LibraryPlayer(){}
+
+    /* On the media thread */
+    nsresult EnsureBackend();
+    nsresult Scan(const nsACString &folder);
+    nsresult OpenTrack(const nsACString &path, PRUint32 generation);
+    nsresult CloseTrack();
+    nsresult PauseTrack(PRBool paused);
+    /* Back on the main thread */
+    void Opened(PRUint32 generation, nsresult status);
+    void Ended(PRUint32 generation);
+
+private:
+    enum { STOPPED, PLAYING, PAUSED };
+
+    nsresult Post(int op, const nsACString &arg);
+    nsresult StartTrack(PRInt32 index);
+    static void OnTrackEnded(void *data);
+
+    /* Main thread only */
+    int state;
+    PRInt32 current;
+    PRUint32 generation;
+    nsCString folder;
+    MediaThread media;
+
+    /* Media thread only, but for playingGeneration, which the output
+     * reads when the track runs out */
+    PRBool backendTried;
+    nsresult backendStatus;
+    TrackStream track;
+    PRUint32 playingGeneration;
+    /* Searched from the main thread, scanned on the media thread */
+    FolderLibrary library;
+    static LibraryPlayer *gLibraryService;
+};
+
+#endif
@@ -0,0 +1,270 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Jetpack Music Interface.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "MusicLibrary.h"
+#include "MusicTrack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/* What the pending index grows by */
+#define LIBRARY_GROW        (256)
+
+MusicLibrary::MusicLibrary()
+    : mLock(nsnull)
+    , mTracks(nsnull)
+    , mCount(0)
+    , mPending(nsnull)
+    , mPendingCount(0)
+    , mPendingSize(0)
+{
+}
+
+MusicLibrary::~MusicLibrary()
+{
+    Free(mTracks, mCount);
+    Free(mPending, mPendingCount);
+    if (mLock)
+        PR_DestroyLock(mLock);
+}
+
+nsresult
+MusicLibrary::Init()
+{
+    if (!(mLock = PR_NewLock()))
+        return NS_ERROR_OUT_OF_MEMORY;
+    return NS_OK;
+}
+
+void
+MusicLibrary::Free(LibraryTrack **tracks, PRUint32 count)
+{
+    for (PRUint32 i = 0; i < count; i++)
+        delete tracks[i];
+    PR_Free(tracks);
+}
+
+static void
+AppendLower(nsACString &out, const nsACString &in)
+{
+    const char *p = in.BeginReading(), *end = in.EndReading();
+
+    for (; p < end; p++)
+        out.Append((char)tolower((unsigned char)*p));
+}
+
+nsresult
+MusicLibrary::Add(const char *data, const char *title, const char *album,
+    const char *artist)
+{
+    LibraryTrack *t;
+
+    if (mPendingCount == mPendingSize) {
+        LibraryTrack **grown = (LibraryTrack **)PR_Realloc(mPending,
+            (mPendingSize + LIBRARY_GROW) * sizeof(LibraryTrack *));
+        if (!grown)
+            return NS_ERROR_OUT_OF_MEMORY;
+        mPending = grown;
+        mPendingSize += LIBRARY_GROW;
+    }
+    if (!(t = new LibraryTrack()))
+        return NS_ERROR_OUT_OF_MEMORY;
+
+    t->data.Assign(data);
+    t->title.Assign(title && *title ? title : "None");
+    t->album.Assign(album && *album ? album : "None");
+    t->artist.Assign(artist && *artist ? artist : "None");
+    AppendLower(t->key, t->title);
+    t->key.Append('\n');
+    AppendLower(t->key, t->album);
+    t->key.Append('\n');
+    AppendLower(t->key, t->artist);
+
+    mPending[mPendingCount++] = t;
+    return NS_OK;
+}
+
+int
+MusicLibrary::Compare(const void *a, const void *b)
+{
+    return strcmp((*(LibraryTrack * const *)a)->data.get(),
+        (*(LibraryTrack * const *)b)->data.get());
+}
+
+nsresult
+MusicLibrary::Scan()
+{
+    nsresult rv;
+    LibraryTrack **old;
+    PRUint32 oldCount;
+
+    rv = Collect();
+    if (NS_FAILED(rv)) {
+        Free(mPending, mPendingCount);
+        mPending = nsnull;
+        mPendingCount = mPendingSize = 0;
+        return rv;
+    }
+    /* In path order, so next and previous go through albums in turn */
+    if (mPendingCount)
+        qsort(mPending, mPendingCount, sizeof(LibraryTrack *), Compare);
+
+    PR_Lock(mLock);
+    old = mTracks;
+    oldCount = mCount;
+    mTracks = mPending;
+    mCount = mPendingCount;
+    PR_Unlock(mLock);
+
+    Free(old, oldCount);
+    mPending = nsnull;
+    mPendingCount = mPendingSize = 0;
+    return NS_OK;
+}
+
+PRUint32
+MusicLibrary::Count()
+{
+    PRUint32 count;
+
+    PR_Lock(mLock);
+    count = mCount;
+    PR_Unlock(mLock);
+    return count;
+}
+
+PRInt32
+MusicLibrary::Find(const nsACString &data)
+{
+    PRInt32 found = -1;
+
+    PR_Lock(mLock);
+    for (PRUint32 i = 0; i < mCount; i++) {
+        if (mTracks[i]->data.Equals(data)) {
+            found = (PRInt32)i;
+            break;
+        }
+    }
+    PR_Unlock(mLock);
+    return found;
+}
+
+nsresult
+MusicLibrary::GetData(PRInt32 index, nsACString &data)
+{
+    nsresult rv = NS_ERROR_INVALID_ARG;
+
+    PR_Lock(mLock);
+    if (index >= 0 && (PRUint32)index < mCount) {
+        data.Assign(mTracks[index]->data);
+        rv = NS_OK;
+    }
+    PR_Unlock(mLock);
+    return rv;
+}
+
+static MusicTrack *
+NewTrack(const LibraryTrack *t)
+{
+    MusicTrack *track = new MusicTrack();
+
+    if (track)
+        track->Init(t->title.get(), t->album.get(), t->artist.get(),
+            t->data.get());
+    return track;
+}
+
+nsresult
+MusicLibrary::GetTrack(PRInt32 index, IMusicTrack **track)
+{
+    MusicTrack *t = nsnull;
+
+    PR_Lock(mLock);
+    if (index >= 0 && (PRUint32)index < mCount)
+        t = NewTrack(mTracks[index]);
+    else
+        t = new MusicTrack();
+    PR_Unlock(mLock);
+
+    if (!t)
+        return NS_ERROR_OUT_OF_MEMORY;
+    NS_ADDREF(*track = t);
+    return NS_OK;
+}
+
+nsresult
+MusicLibrary::Search(const nsACString &what, PRUint32 *count,
+    IMusicTrack ***retval)
+{
+    nsCString term;
+    PRUint32 i, n = 0;
+    PRUint32 *hits;
+
+    AppendLower(term, what);
+
+    PR_Lock(mLock);
+    /* Note the matches first, so the array is only as big as needed */
+    hits = (PRUint32 *)PR_Malloc((mCount ? mCount : 1) * sizeof(PRUint32));
+    if (!hits) {
+        PR_Unlock(mLock);
+        return NS_ERROR_OUT_OF_MEMORY;
+    }
+    for (i = 0; i < mCount; i++) {
+        if (strstr(mTracks[i]->key.get(), term.get()))
+            hits[n++] = i;
+    }
+
+    *count = n;
+    *retval = static_cast<IMusicTrack**>
+        (nsMemory::Alloc((n ? n : 1) * sizeof(**retval)));
+    if (!*retval) {
+        PR_Unlock(mLock);
+        PR_Free(hits);
+        return NS_ERROR_OUT_OF_MEMORY;
+    }
+    for (i = 0; i < n; i++) {
+        MusicTrack *t = NewTrack(mTracks[hits[i]]);
+        NS_IF_ADDREF(t);
+        (*retval)[i] = t;
+    }
+    PR_Unlock(mLock);
+
+    PR_Free(hits);
+    return NS_OK;
+}
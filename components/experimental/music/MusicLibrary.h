@@ -0,0 +1,106 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Jetpack Music Interface.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef MusicLibrary_h_
+#define MusicLibrary_h_
+
+#include "prmem.h"
+#include "prlock.h"
+#include "nscore.h"
+#include "nsMemory.h"
+#include "nsStringAPI.h"
+#include "IMusicTrack.h"
+
+/* One entry in the index. data is what the backend knows the track by,
+ * and a file libsndfile can read; key is title, album and artist in lower
+ * case, for searching. */
+struct LibraryTrack {
+    nsCString data;
+    nsCString title;
+    nsCString album;
+    nsCString artist;
+    nsCString key;
+};
+
+/*
+ * An index of the tracks a backend knows about, and what IMusicPlayer
+ * needs from it: searching, looking tracks up and handing them out as
+ * IMusicTracks. A backend only has to say what tracks there are, by
+ * calling Add() for each from Collect(). Scan() does that into a new
+ * index and swaps it in once complete, so any thread may search while
+ * another scans; only one may scan at a time.
+ */
+class MusicLibrary
+{
+public:
+    MusicLibrary();
+    virtual ~MusicLibrary();
+
+    nsresult Init();
+    nsresult Scan();
+
+    PRUint32 Count();
+    /* Index of the track with this data, or -1 */
+    PRInt32 Find(const nsACString &data);
+    nsresult GetData(PRInt32 index, nsACString &data);
+    nsresult GetTrack(PRInt32 index, IMusicTrack **track);
+    /* Tracks with the term in their title, album or artist, in index
+     * order, ignoring case */
+    nsresult Search(const nsACString &what, PRUint32 *count,
+        IMusicTrack ***tracks);
+
+protected:
+    virtual nsresult Collect() = 0;
+    /* Any of the tags may be null or empty */
+    nsresult Add(const char *data, const char *title, const char *album,
+        const char *artist);
+
+private:
+    static void Free(LibraryTrack **tracks, PRUint32 count);
+    static int Compare(const void *a, const void *b);
+
+    PRLock *mLock;
+    LibraryTrack **mTracks;
+    PRUint32 mCount;
+
+    /* Being collected, Scan() only */
+    LibraryTrack **mPending;
+    PRUint32 mPendingCount;
+    PRUint32 mPendingSize;
+};
+
+#endif
@@ -0,0 +1,272 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Jetpack Music Interface.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "TrackStream.h"
+#include "prmem.h"
+
+#include <stdio.h>
+#include <string.h>
+
+TrackStream::TrackStream()
+    : mFile(NULL)
+    , mStream(NULL)
+    , mCallback(nsnull)
+    , mData(nsnull)
+    , mQueue(nsnull)
+    , mQueued(0)
+    , mPlayed(0)
+    , mDecoded(0)
+    , mPaused(0)
+    , mClosing(0)
+    , mThread(nsnull)
+    , mLock(nsnull)
+    , mCond(nsnull)
+{
+}
+
+TrackStream::~TrackStream()
+{
+    Close();
+    if (mCond)
+        PR_DestroyCondVar(mCond);
+    if (mLock)
+        PR_DestroyLock(mLock);
+}
+
+nsresult
+TrackStream::Open(const nsACString &path, TrackEndedCallback cb,
+    void *data)
+{
+    PaError err;
+    
+    if (mFile)
+        return NS_ERROR_ALREADY_INITIALIZED;
+    if (!mLock && !(mLock = PR_NewLock()))
+        return NS_ERROR_OUT_OF_MEMORY;
+    if (!mCond && !(mCond = PR_NewCondVar(mLock)))
+        return NS_ERROR_OUT_OF_MEMORY;
+    
+    memset(&mInfo, 0, sizeof(mInfo));
+    mFile = sf_open(PromiseFlatCString(path).get(), SFM_READ, &mInfo);
+    if (!mFile) {
+        fprintf(stderr, "JEP Music:: Could not open %s: %s\n",
+            PromiseFlatCString(path).get(), sf_strerror(NULL));
+        return NS_ERROR_FAILURE;
+    }
+    if (mInfo.channels < 1 || mInfo.channels > 2) {
+        fprintf(stderr, "JEP Music:: Can't play %d channels\n",
+            mInfo.channels);
+        Close();
+        return NS_ERROR_FAILURE;
+    }
+    
+    mQueue = (float *)PR_Malloc(PLAY_QUEUE_FRAMES * mInfo.channels *
+        sizeof(float));
+    if (!mQueue) {
+        Close();
+        return NS_ERROR_OUT_OF_MEMORY;
+    }
+    mCallback = cb;
+    mData = data;
+    mQueued = mPlayed = 0;
+    mDecoded = mPaused = mClosing = 0;
+    
+    /* Have some ready before the first callback asks */
+    Fill();
+    mThread = PR_CreateThread(PR_USER_THREAD, Run, this,
+        PR_PRIORITY_NORMAL, PR_GLOBAL_THREAD, PR_JOINABLE_THREAD, 0);
+    if (!mThread) {
+        fprintf(stderr, "JEP Music:: Could not start decoder thread!\n");
+        Close();
+        return NS_ERROR_FAILURE;
+    }
+    
+    err = Pa_OpenDefaultStream(&mStream, 0, mInfo.channels, paFloat32,
+        mInfo.samplerate, paFramesPerBufferUnspecified, PlayCallback, this);
+    if (err != paNoError) {
+        fprintf(stderr, "JEP Music:: Could not open stream! %d\n", err);
+        mStream = NULL;
+        Close();
+        return NS_ERROR_FAILURE;
+    }
+    Pa_SetStreamFinishedCallback(mStream, OnFinished);
+    err = Pa_StartStream(mStream);
+    if (err != paNoError) {
+        fprintf(stderr, "JEP Music:: Could not start stream! %d\n", err);
+        Close();
+        return NS_ERROR_FAILURE;
+    }
+    return NS_OK;
+}
+
+void
+TrackStream::Pause(PRBool paused)
+{
+    PR_AtomicSet(&mPaused, paused ? 1 : 0);
+}
+
+int
+TrackStream::PlayCallback(const void *input, void *output,
+        unsigned long framesPerBuffer,
+        const PaStreamCallbackTimeInfo* timeInfo,
+        PaStreamCallbackFlags statusFlags,
+        void *userData)
+{
+    TrackStream *self = static_cast<TrackStream*>(userData);
+    int channels = self->mInfo.channels;
+    float *out = (float *)output;
+    PRUint32 in, played, at, run, n;
+    
+    if (PR_AtomicAdd(&self->mPaused, 0)) {
+        memset(out, 0, framesPerBuffer * channels * sizeof(float));
+        return paContinue;
+    }
+    
+    played = (PRUint32)self->mPlayed;
+    in = (PRUint32)PR_AtomicAdd(&self->mQueued, 0);
+    n = PR_MIN(in - played, (PRUint32)framesPerBuffer);
+    while (n) {
+        at = played & (PLAY_QUEUE_FRAMES - 1);
+        run = PR_MIN(n, PLAY_QUEUE_FRAMES - at);
+        memcpy(out, self->mQueue + at * channels,
+            run * channels * sizeof(float));
+        out += run * channels;
+        played += run;
+        n -= run;
+    }
+    PR_AtomicSet(&self->mPlayed, (PRInt32)played);
+    
+    /* Short of what was asked for: either the end, or the decoder is
+     * behind and this comes out as a gap */
+    n = (PRUint32)(((float *)output + framesPerBuffer * channels - out) /
+        channels);
+    if (n) {
+        memset(out, 0, n * channels * sizeof(float));
+        if (PR_AtomicAdd(&self->mDecoded, 0) && played == in)
+            return paComplete;
+    }
+    return paContinue;
+}
+
+void
+TrackStream::OnFinished(void *data)
+{
+    TrackStream *self = static_cast<TrackStream*>(data);
+    
+    /* Not when we stopped it ourselves */
+    if (!PR_AtomicAdd(&self->mClosing, 0) && self->mCallback)
+        self->mCallback(self->mData);
+}
+
+/*
+ * Decode whatever fits in the queue, in chunks
+ */
+void
+TrackStream::Fill()
+{
+    PRUint32 in, out, at, want;
+    sf_count_t got;
+    int channels = mInfo.channels;
+    
+    in = (PRUint32)mQueued;
+    out = (PRUint32)PR_AtomicAdd(&mPlayed, 0);
+    while (!mDecoded && PLAY_QUEUE_FRAMES - (in - out) >= PLAY_CHUNK_FRAMES) {
+        at = in & (PLAY_QUEUE_FRAMES - 1);
+        want = PR_MIN(PLAY_CHUNK_FRAMES, PLAY_QUEUE_FRAMES - at);
+        got = sf_readf_float(mFile, mQueue + at * channels, want);
+        if (got > 0) {
+            in += (PRUint32)got;
+            PR_AtomicSet(&mQueued, (PRInt32)in);
+        }
+        if (got < (sf_count_t)want)
+            PR_AtomicSet(&mDecoded, 1);
+    }
+}
+
+void
+TrackStream::Run(void *arg)
+{
+    TrackStream *self = static_cast<TrackStream*>(arg);
+    PRBool closing;
+    
+    do {
+        PR_Lock(self->mLock);
+        if (!self->mClosing)
+            PR_WaitCondVar(self->mCond,
+                PR_MillisecondsToInterval(PLAY_INTERVAL));
+        closing = self->mClosing;
+        PR_Unlock(self->mLock);
+        if (!closing)
+            self->Fill();
+    } while (!closing && !self->mDecoded);
+}
+
+nsresult
+TrackStream::Close()
+{
+    nsresult rv = NS_OK;
+    PaError err;
+    
+    if (!mFile)
+        return NS_ERROR_NOT_INITIALIZED;
+    
+    PR_Lock(mLock);
+    PR_AtomicSet(&mClosing, 1);
+    PR_NotifyCondVar(mCond);
+    PR_Unlock(mLock);
+    if (mStream) {
+        err = Pa_AbortStream(mStream);
+        if (err != paNoError)
+            fprintf(stderr, "JEP Music:: Could not stop stream! %d\n", err);
+        err = Pa_CloseStream(mStream);
+        if (err != paNoError) {
+            fprintf(stderr, "JEP Music:: Could not close stream! %d\n", err);
+            rv = NS_ERROR_FAILURE;
+        }
+        mStream = NULL;
+    }
+    if (mThread) {
+        PR_JoinThread(mThread);
+        mThread = nsnull;
+    }
+    
+    PR_Free(mQueue);
+    mQueue = nsnull;
+    sf_close(mFile);
+    mFile = NULL;
+    return rv;
+}
@@ -0,0 +1,111 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Jetpack Music Interface.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef TrackStream_h_
+#define TrackStream_h_
+
+#include <sndfile.h>
+#include "portaudio.h"
+
+#include "prlock.h"
+#include "prcvar.h"
+#include "pratom.h"
+#include "prthread.h"
+#include "prinrval.h"
+#include "nscore.h"
+#include "nsStringAPI.h"
+
+/* Decoded audio waiting to be played, in frames (a power of two, about
+ * three quarters of a second at 44.1 kHz), how much is decoded at a time
+ * and how often the decoder looks */
+#define PLAY_QUEUE_FRAMES   (1 << 15)
+#define PLAY_CHUNK_FRAMES   (4096)
+#define PLAY_INTERVAL       (20)
+
+typedef void (*TrackEndedCallback)(void *data);
+
+/*
+ * Plays one file to the default output. A thread of the stream's own
+ * decodes it with libsndfile into a queue ahead of the PortAudio callback,
+ * which never touches the disk; when the callback runs dry at the end of
+ * the file, the ended callback is called on PortAudio's thread. Open(),
+ * Pause() and Close() are for one thread, where they may block.
+ */
+class TrackStream
+{
+public:
+    TrackStream();
+    ~TrackStream();
+
+    nsresult Open(const nsACString &path, TrackEndedCallback cb,
+        void *data);
+    /* The output keeps running, it just plays silence */
+    void Pause(PRBool paused);
+    nsresult Close();
+    PRBool IsOpen() { return mFile != NULL; }
+
+private:
+    static int PlayCallback(const void *input, void *output,
+        unsigned long framesPerBuffer,
+        const PaStreamCallbackTimeInfo* timeInfo,
+        PaStreamCallbackFlags statusFlags,
+        void *userData
+    );
+    static void OnFinished(void *data);
+    static void Run(void *arg);
+    void Fill();
+
+    SNDFILE *mFile;
+    SF_INFO mInfo;
+    PaStream *mStream;
+    TrackEndedCallback mCallback;
+    void *mData;
+
+    /* Frames in and out of the queue so far, as in VorbisQueue */
+    float *mQueue;
+    PRInt32 mQueued;
+    PRInt32 mPlayed;
+    PRInt32 mDecoded;
+    PRInt32 mPaused;
+    PRInt32 mClosing;
+
+    PRThread *mThread;
+    PRLock *mLock;
+    PRCondVar *mCond;
+};
+
+#endif
@@ -0,0 +1,216 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+/*
+ * Times ChunkedEncoder against a single inline th_enc_ctx on the same
+ * synthetic frames, at the size and quality VideoSession records with:
+ *
+ *   ./chunkbench [max threads] [frames]
+ *
+ * For each thread count it prints frames per second and the speedup over
+ * inline encoding, and checks the reassembled stream's packet numbers and
+ * granule positions are continuous.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prtime.h"
+#include "ChunkedEncoder.h"
+
+#define BENCH_WIDTH     640
+#define BENCH_HEIGHT    480
+#define BENCH_FPS       15
+#define BENCH_QUALITY   48
+#define BENCH_KEYFRAMES 64
+
+struct BenchSink {
+    PRInt64 bytes;
+    PRInt64 packets;
+    PRInt64 nextPacket;
+    PRBool ended;
+    PRBool broken;
+};
+
+static void
+OnPacket(void *data, ogg_packet *op)
+{
+    BenchSink *sink = static_cast<BenchSink*>(data);
+
+    /* Numbered in sequence, and only the last one ends the stream */
+    if (op->packetno != sink->nextPacket || sink->ended)
+        sink->broken = PR_TRUE;
+    sink->nextPacket = op->packetno + 1;
+    sink->ended = (op->e_o_s != 0);
+    sink->bytes += op->bytes;
+    /* An empty end of stream packet is not one of our frames */
+    if (op->bytes || !op->e_o_s)
+        sink->packets++;
+}
+
+/*
+ * A moving gradient with some noise on it, so the encoder has motion
+ * and detail to work on rather than a still picture
+ */
+static void
+MakeFrame(th_ycbcr_buffer ycbcr, unsigned char *yuv, int n)
+{
+    int w = BENCH_WIDTH, h = BENCH_HEIGHT;
+    unsigned char *y = yuv, *u = yuv + w * h, *v = u + w * h / 4;
+
+    for (int j = 0; j < h; j++) {
+        for (int i = 0; i < w; i++)
+            y[j * w + i] = (unsigned char)((i + j + n * 4) ^
+                (rand() & 0x0f));
+    }
+    for (int j = 0; j < h / 2; j++) {
+        for (int i = 0; i < w / 2; i++) {
+            u[j * w / 2 + i] = (unsigned char)(128 + ((i - n) & 0x3f));
+            v[j * w / 2 + i] = (unsigned char)(128 + ((j + n) & 0x3f));
+        }
+    }
+
+    ycbcr[0].width = w;
+    ycbcr[0].height = h;
+    ycbcr[0].stride = w;
+    ycbcr[0].data = y;
+    ycbcr[1].width = ycbcr[2].width = w / 2;
+    ycbcr[1].height = ycbcr[2].height = h / 2;
+    ycbcr[1].stride = ycbcr[2].stride = w / 2;
+    ycbcr[1].data = u;
+    ycbcr[2].data = v;
+}
+
+static void
+InitInfo(th_info *ti)
+{
+    th_info_init(ti);
+    ti->frame_width = ti->pic_width = BENCH_WIDTH;
+    ti->frame_height = ti->pic_height = BENCH_HEIGHT;
+    ti->fps_numerator = BENCH_FPS;
+    ti->fps_denominator = 1;
+    ti->colorspace = TH_CS_UNSPECIFIED;
+    ti->pixel_fmt = TH_PF_420;
+    ti->quality = BENCH_QUALITY;
+}
+
+static double
+Seconds(PRTime begin)
+{
+    return (PR_Now() - begin) / (double)PR_USEC_PER_SEC;
+}
+
+int
+main(int argc, char **argv)
+{
+    int maxThreads = argc > 1 ? atoi(argv[1]) : 4;
+    int frames = argc > 2 ? atoi(argv[2]) : 300;
+    int frameSize = BENCH_WIDTH * BENCH_HEIGHT * 3 / 2;
+    th_ycbcr_buffer *ycbcr;
+    unsigned char *yuv;
+    th_info ti;
+    th_comment tc;
+    ogg_packet op;
+    double inline_fps;
+
+    if (maxThreads < 1 || frames < 1) {
+        fprintf(stderr, "usage: %s [max threads] [frames]\n", argv[0]);
+        return 1;
+    }
+
+    /* Make every frame up front, so only encoding is timed */
+    ycbcr = (th_ycbcr_buffer *)malloc(frames * sizeof(th_ycbcr_buffer));
+    yuv = (unsigned char *)malloc((size_t)frames * frameSize);
+    if (!ycbcr || !yuv) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    srand(1);
+    for (int n = 0; n < frames; n++)
+        MakeFrame(ycbcr[n], yuv + (size_t)n * frameSize, n);
+
+    InitInfo(&ti);
+    th_enc_ctx *enc = th_encode_alloc(&ti);
+    ogg_uint32_t kf = BENCH_KEYFRAMES;
+    th_encode_ctl(enc, TH_ENCCTL_SET_KEYFRAME_FREQUENCY_FORCE, &kf,
+        sizeof(kf));
+    th_comment_init(&tc);
+    while (th_encode_flushheader(enc, &tc, &op) > 0)
+        ;
+    th_comment_clear(&tc);
+
+    PRInt64 inlineBytes = 0;
+    PRTime begin = PR_Now();
+    for (int n = 0; n < frames; n++) {
+        th_encode_ycbcr_in(enc, ycbcr[n]);
+        while (th_encode_packetout(enc, n == frames - 1, &op) > 0)
+            inlineBytes += op.bytes;
+    }
+    inline_fps = frames / Seconds(begin);
+    th_encode_free(enc);
+    printf("%dx%d q%d, %d frames\n", BENCH_WIDTH, BENCH_HEIGHT,
+        BENCH_QUALITY, frames);
+    printf("inline     %7.1f fps  %9lld bytes\n", inline_fps,
+        (long long)inlineBytes);
+
+    for (int threads = 1; threads <= maxThreads; threads++) {
+        ChunkedEncoder chunked;
+        BenchSink sink = { 0, 0, 3, PR_FALSE, PR_FALSE };
+
+        InitInfo(&ti);
+        if (NS_FAILED(chunked.Init(&ti, threads, BENCH_FPS, threads * 2,
+                OnPacket, &sink))) {
+            fprintf(stderr, "Could not start %d threads\n", threads);
+            return 1;
+        }
+        begin = PR_Now();
+        for (int n = 0; n < frames; n++)
+            chunked.PushFrame(ycbcr[n], 0, PR_TRUE);
+        chunked.Finish();
+        double fps = frames / Seconds(begin);
+
+        printf("%2d threads %7.1f fps  %9lld bytes  %.2fx  %.2fx/core%s\n",
+            threads, fps, (long long)sink.bytes, fps / inline_fps,
+            fps / inline_fps / threads,
+            sink.broken || !sink.ended || sink.packets != frames ? "  BROKEN STREAM" : "");
+    }
+
+    free(yuv);
+    free(ycbcr);
+    return 0;
+}
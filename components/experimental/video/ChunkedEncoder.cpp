@@ -0,0 +1,478 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "ChunkedEncoder.h"
+
+ChunkedEncoder::ChunkedEncoder()
+    : mChunkFrames(0)
+    , mFrameSize(0)
+    , mShift(6)
+    , mSpeed(-1)
+    , mQuality(-1)
+    , mCallback(nsnull)
+    , mData(nsnull)
+    , mStats(nsnull)
+    , mLock(nsnull)
+    , mWork(nsnull)
+    , mDone(nsnull)
+    , mShutdown(PR_FALSE)
+    , mFailed(PR_FALSE)
+    , mNumThreads(0)
+    , mThreads(nsnull)
+    , mNumChunks(0)
+    , mChunks(nsnull)
+    , mFilling(nsnull)
+    , mHead(nsnull)
+    , mTail(nsnull)
+    , mPending(0)
+    , mFrame(0)
+    , mLastKey(0)
+    , mPacketNo(3)
+{
+}
+
+ChunkedEncoder::~ChunkedEncoder()
+{
+    if (mThreads) {
+        PR_Lock(mLock);
+        mShutdown = PR_TRUE;
+        PR_NotifyAllCondVar(mWork);
+        PR_Unlock(mLock);
+        for (int i = 0; i < mNumThreads; i++) {
+            if (mThreads[i])
+                PR_JoinThread(mThreads[i]);
+        }
+        PR_Free(mThreads);
+    }
+
+    if (mChunks) {
+        for (int i = 0; i < mNumChunks; i++) {
+            PR_Free(mChunks[i].dups);
+            BufferArena::Free(mChunks[i].yuv);
+            PR_Free(mChunks[i].sizes);
+            PR_Free(mChunks[i].keys);
+            PR_Free(mChunks[i].data);
+        }
+        PR_Free(mChunks);
+    }
+
+    if (mDone)
+        PR_DestroyCondVar(mDone);
+    if (mWork)
+        PR_DestroyCondVar(mWork);
+    if (mLock)
+        PR_DestroyLock(mLock);
+}
+
+nsresult
+ChunkedEncoder::Init(th_info *ti, int threads, int chunkFrames,
+    int maxChunks, PacketCallback cb, void *data)
+{
+    if (threads < 1 || chunkFrames < 1 || maxChunks < threads)
+        return NS_ERROR_INVALID_ARG;
+
+    mInfo = *ti;
+    mShift = ti->keyframe_granule_shift;
+    mChunkFrames = chunkFrames;
+    mFrameSize = ti->frame_width * ti->frame_height * 3 / 2;
+    mCallback = cb;
+    mData = data;
+
+    if (!(mLock = PR_NewLock()))
+        return NS_ERROR_OUT_OF_MEMORY;
+    if (!(mWork = PR_NewCondVar(mLock)))
+        return NS_ERROR_OUT_OF_MEMORY;
+    if (!(mDone = PR_NewCondVar(mLock)))
+        return NS_ERROR_OUT_OF_MEMORY;
+
+    mNumChunks = maxChunks;
+    if (!(mChunks = (Chunk *)PR_Calloc(maxChunks, sizeof(Chunk))))
+        return NS_ERROR_OUT_OF_MEMORY;
+
+    for (int i = 0; i < maxChunks; i++) {
+        Chunk *c = &mChunks[i];
+        c->state = CHUNK_FREE;
+        c->dups = (int *)PR_Calloc(chunkFrames, sizeof(int));
+        c->yuv = (unsigned char *)BufferArena::Alloc(
+            BufferArena::ARENA_FRAMES, chunkFrames * mFrameSize);
+        if (!c->dups || !c->yuv)
+            return NS_ERROR_OUT_OF_MEMORY;
+    }
+
+    mNumThreads = threads;
+    if (!(mThreads = (PRThread **)PR_Calloc(threads, sizeof(PRThread *))))
+        return NS_ERROR_OUT_OF_MEMORY;
+
+    for (int i = 0; i < threads; i++) {
+        mThreads[i] = PR_CreateThread(PR_USER_THREAD, Worker, this,
+            PR_PRIORITY_NORMAL, PR_GLOBAL_THREAD, PR_JOINABLE_THREAD, 0);
+        if (!mThreads[i]) {
+            fprintf(stderr, "Could not start encoder thread!\n");
+            return NS_ERROR_FAILURE;
+        }
+    }
+
+    return NS_OK;
+}
+
+PRBool
+ChunkedEncoder::CanAccept()
+{
+    PRBool ok = PR_FALSE;
+
+    PR_Lock(mLock);
+    if (mFilling) {
+        ok = PR_TRUE;
+    } else {
+        for (int i = 0; i < mNumChunks && !ok; i++)
+            ok = (mChunks[i].state == CHUNK_FREE);
+    }
+    PR_Unlock(mLock);
+
+    return ok;
+}
+
+PRUint32
+ChunkedEncoder::Pending()
+{
+    PR_Lock(mLock);
+    PRUint32 pending = mPending;
+    PR_Unlock(mLock);
+    return pending;
+}
+
+nsresult
+ChunkedEncoder::PushFrame(th_ycbcr_buffer ycbcr, int dups, PRBool wait)
+{
+    PR_Lock(mLock);
+    if (mFailed) {
+        PR_Unlock(mLock);
+        return NS_ERROR_FAILURE;
+    }
+
+    while (!mFilling) {
+        for (int i = 0; i < mNumChunks; i++) {
+            if (mChunks[i].state == CHUNK_FREE) {
+                mFilling = &mChunks[i];
+                break;
+            }
+        }
+        if (mFilling)
+            break;
+        if (!wait) {
+            PR_Unlock(mLock);
+            return NS_ERROR_NOT_AVAILABLE;
+        }
+        PR_WaitCondVar(mDone, PR_INTERVAL_NO_TIMEOUT);
+    }
+
+    Chunk *c = mFilling;
+    if (c->state == CHUNK_FREE) {
+        c->state = CHUNK_FILLING;
+        c->last = PR_FALSE;
+        c->frames = 0;
+        c->packets = 0;
+        c->dataLen = 0;
+        c->failed = PR_FALSE;
+        c->next = nsnull;
+        c->speed = mSpeed;
+        c->quality = mQuality;
+    }
+    PR_Unlock(mLock);
+
+    /* Only this thread touches a filling chunk, copy without the lock */
+    unsigned char *dst = c->yuv + c->frames * mFrameSize;
+    for (int p = 0; p < 3; p++) {
+        for (int y = 0; y < ycbcr[p].height; y++) {
+            memcpy(dst, ycbcr[p].data + y * ycbcr[p].stride, ycbcr[p].width);
+            dst += ycbcr[p].width;
+        }
+    }
+    c->dups[c->frames++] = dups;
+
+    if (c->frames == mChunkFrames) {
+        PR_Lock(mLock);
+        Submit(c);
+        PR_Unlock(mLock);
+    }
+
+    return NS_OK;
+}
+
+void
+ChunkedEncoder::SetEffort(int speed, int quality)
+{
+    PR_Lock(mLock);
+    mSpeed = speed;
+    mQuality = quality;
+    PR_Unlock(mLock);
+}
+
+/* Called with mLock held */
+void
+ChunkedEncoder::Submit(Chunk *c)
+{
+    c->state = CHUNK_QUEUED;
+    if (mTail)
+        mTail->next = c;
+    else
+        mHead = c;
+    mTail = c;
+    mFilling = nsnull;
+    mPending++;
+    TRACE_ASYNC_BEGIN("chunk queued", c - mChunks);
+    PR_NotifyCondVar(mWork);
+}
+
+nsresult
+ChunkedEncoder::Finish()
+{
+    PR_Lock(mLock);
+    if (mFilling && mFilling->state == CHUNK_FILLING && mFilling->frames)
+        Submit(mFilling);
+    /* Chunks are only emitted under the lock, so the tail's packets are
+     * all still to come; if there is none, every packet has gone out
+     * already and the stream is ended with an empty one, a repeat of the
+     * last frame */
+    if (mTail)
+        mTail->last = PR_TRUE;
+    else if (mFrame && !mFailed)
+        EmitEOS();
+    while (mHead && !mFailed)
+        PR_WaitCondVar(mDone, PR_INTERVAL_NO_TIMEOUT);
+    nsresult rv = mFailed ? NS_ERROR_FAILURE : NS_OK;
+    PR_Unlock(mLock);
+
+    return rv;
+}
+
+void
+ChunkedEncoder::Worker(void *arg)
+{
+    ChunkedEncoder *ce = static_cast<ChunkedEncoder*>(arg);
+
+    PR_Lock(ce->mLock);
+    for (;;) {
+        Chunk *c = ce->mHead;
+        while (c && c->state != CHUNK_QUEUED)
+            c = c->next;
+
+        if (!c) {
+            if (ce->mShutdown)
+                break;
+            PR_WaitCondVar(ce->mWork, PR_INTERVAL_NO_TIMEOUT);
+            continue;
+        }
+
+        c->state = CHUNK_ENCODING;
+        PR_Unlock(ce->mLock);
+        TRACE_THREAD("encoder");
+        TRACE_ASYNC_END("chunk queued", c - ce->mChunks);
+        TRACE_BEGIN("encode chunk", c - ce->mChunks);
+        ce->EncodeChunk(c);
+        TRACE_END("encode chunk", c - ce->mChunks);
+        PR_Lock(ce->mLock);
+
+        c->state = CHUNK_DONE;
+        TRACE_BEGIN("emit chunks", 0);
+        ce->EmitReady();
+        TRACE_END("emit chunks", 0);
+        PR_NotifyAllCondVar(ce->mDone);
+    }
+    PR_Unlock(ce->mLock);
+}
+
+PRBool
+ChunkedEncoder::AddPacket(Chunk *c, ogg_packet *op)
+{
+    if (c->packets == c->maxPackets) {
+        int max = c->maxPackets ? c->maxPackets * 2 : mChunkFrames * 2;
+        long *sizes = (long *)PR_Realloc(c->sizes, max * sizeof(long));
+        if (sizes)
+            c->sizes = sizes;
+        PRBool *keys = (PRBool *)PR_Realloc(c->keys, max * sizeof(PRBool));
+        if (keys)
+            c->keys = keys;
+        if (!sizes || !keys)
+            return PR_FALSE;
+        c->maxPackets = max;
+    }
+
+    if (c->dataLen + op->bytes > c->dataMax) {
+        PRUint32 max = c->dataMax ? c->dataMax : 65536;
+        while (c->dataLen + op->bytes > max)
+            max *= 2;
+        unsigned char *data = (unsigned char *)PR_Realloc(c->data, max);
+        if (!data)
+            return PR_FALSE;
+        c->data = data;
+        c->dataMax = max;
+    }
+
+    memcpy(c->data + c->dataLen, op->packet, op->bytes);
+    c->dataLen += op->bytes;
+    c->sizes[c->packets] = op->bytes;
+    c->keys[c->packets] = (th_packet_iskeyframe(op) > 0);
+    c->packets++;
+    return PR_TRUE;
+}
+
+void
+ChunkedEncoder::EncodeChunk(Chunk *c)
+{
+    th_comment tc;
+    ogg_packet op;
+    th_ycbcr_buffer ycbcr;
+
+    th_enc_ctx *enc = th_encode_alloc(&mInfo);
+    if (!enc) {
+        c->failed = PR_TRUE;
+        return;
+    }
+
+    ogg_uint32_t kf = 1 << mShift;
+    th_encode_ctl(enc, TH_ENCCTL_SET_KEYFRAME_FREQUENCY_FORCE, &kf, sizeof(kf));
+    if (c->speed >= 0)
+        th_encode_ctl(enc, TH_ENCCTL_SET_SPLEVEL, &c->speed, sizeof(int));
+    if (c->quality >= 0)
+        th_encode_ctl(enc, TH_ENCCTL_SET_QUALITY, &c->quality, sizeof(int));
+
+    /* Headers come from the caller's context, just get them out of the way */
+    th_comment_init(&tc);
+    while (th_encode_flushheader(enc, &tc, &op) > 0)
+        ;
+    th_comment_clear(&tc);
+
+    /* The encoder takes whole frames, the picture region is within them */
+    int w = mInfo.frame_width;
+    int h = mInfo.frame_height;
+    ycbcr[0].width = w;
+    ycbcr[0].height = h;
+    ycbcr[0].stride = w;
+    ycbcr[1].width = w >> 1;
+    ycbcr[1].height = h >> 1;
+    ycbcr[1].stride = w >> 1;
+    ycbcr[2].width = w >> 1;
+    ycbcr[2].height = h >> 1;
+    ycbcr[2].stride = w >> 1;
+
+    for (int i = 0; i < c->frames && !c->failed; i++) {
+        ycbcr[0].data = c->yuv + i * mFrameSize;
+        ycbcr[1].data = ycbcr[0].data + w * h;
+        ycbcr[2].data = ycbcr[1].data + w * h / 4;
+
+        int dups = c->dups[i];
+        if (dups > 0)
+            th_encode_ctl(enc, TH_ENCCTL_SET_DUP_COUNT, &dups, sizeof(dups));
+        PRTime begin = PR_Now();
+        if (th_encode_ycbcr_in(enc, ycbcr) != 0) {
+            c->failed = PR_TRUE;
+            break;
+        }
+        PRTime encoded = PR_Now();
+        while (th_encode_packetout(enc, 0, &op) > 0) {
+            if (!AddPacket(c, &op)) {
+                c->failed = PR_TRUE;
+                break;
+            }
+        }
+        if (mStats) {
+            mStats->Time(PipelineStats::STAGE_ENCODE, encoded - begin);
+            mStats->Time(PipelineStats::STAGE_PACKET, PR_Now() - encoded);
+        }
+    }
+
+    th_encode_free(enc);
+}
+
+/*
+ * Hand finished chunks to the callback in stream order. Called with mLock
+ * held, which also serialises the callback.
+ */
+void
+ChunkedEncoder::EmitReady()
+{
+    ogg_packet op;
+
+    while (mHead && mHead->state == CHUNK_DONE) {
+        Chunk *c = mHead;
+
+        if (c->failed) {
+            fprintf(stderr, "Could not encode chunk!\n");
+            mFailed = PR_TRUE;
+        }
+
+        unsigned char *data = c->data;
+        for (int i = 0; i < c->packets && !mFailed; i++) {
+            if (c->keys[i])
+                mLastKey = mFrame;
+
+            op.packet = data;
+            op.bytes = c->sizes[i];
+            op.b_o_s = 0;
+            op.e_o_s = (c->last && i == c->packets - 1);
+            op.granulepos = ((mLastKey + 1) << mShift) + (mFrame - mLastKey);
+            op.packetno = mPacketNo++;
+            mCallback(mData, &op);
+
+            data += c->sizes[i];
+            mFrame++;
+        }
+
+        mHead = c->next;
+        if (!mHead)
+            mTail = nsnull;
+        c->state = CHUNK_FREE;
+        mPending--;
+    }
+}
+
+/* Called with mLock held */
+void
+ChunkedEncoder::EmitEOS()
+{
+    ogg_packet op;
+
+    op.packet = nsnull;
+    op.bytes = 0;
+    op.b_o_s = 0;
+    op.e_o_s = 1;
+    op.granulepos = ((mLastKey + 1) << mShift) + (mFrame - mLastKey);
+    op.packetno = mPacketNo++;
+    mCallback(mData, &op);
+    mFrame++;
+}
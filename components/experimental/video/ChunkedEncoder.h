@@ -0,0 +1,161 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef ChunkedEncoder_h_
+#define ChunkedEncoder_h_
+
+#include <stdio.h>
+#include <string.h>
+#include <ogg/ogg.h>
+#include <theora/theoraenc.h>
+
+#include "prmem.h"
+#include "prlock.h"
+#include "prcvar.h"
+#include "prthread.h"
+#include "nscore.h"
+#include "PipelineStats.h"
+#include "BufferArena.h"
+#include "TraceRing.h"
+
+typedef void (*PacketCallback)(void *data, ogg_packet *op);
+
+/*
+ * Encodes a Theora stream on several threads. Incoming frames are cut into
+ * chunks of a fixed number of frames, each chunk is encoded by a fresh
+ * th_enc_ctx on a worker (so it always starts on a keyframe), and the
+ * resulting packets are handed back in order with their granule positions
+ * rewritten to be continuous across chunks. Header packets are identical for
+ * every context created from the same th_info, so the caller writes them once
+ * from its own context.
+ *
+ * At most maxChunks chunks are in flight, which bounds both memory and the
+ * extra latency (maxChunks * chunkFrames frames) over inline encoding.
+ */
+class ChunkedEncoder
+{
+public:
+    ChunkedEncoder();
+    ~ChunkedEncoder();
+
+    nsresult Init(th_info *ti, int threads, int chunkFrames, int maxChunks,
+        PacketCallback cb, void *data);
+
+    /* Whether PushFrame can take a frame without blocking */
+    PRBool CanAccept();
+    /* Copy a frame (plus 'dups' repeats) into the current chunk. Blocks
+     * for a free chunk if 'wait' is set, fails otherwise. */
+    nsresult PushFrame(th_ycbcr_buffer ycbcr, int dups, PRBool wait);
+    /* Time the workers' encoding into 'stats' */
+    void SetStats(PipelineStats *stats) { mStats = stats; }
+    /* Speed level and quality for chunks started from now on */
+    void SetEffort(int speed, int quality);
+    /* Encode what is left, deliver every packet and stop the workers */
+    nsresult Finish();
+
+    PRUint32 Pending();
+    /* Every chunk starts with a keyframe */
+    int ChunkFrames() { return mChunkFrames; }
+
+private:
+    enum ChunkState { CHUNK_FREE, CHUNK_FILLING, CHUNK_QUEUED,
+                      CHUNK_ENCODING, CHUNK_DONE };
+
+    struct Chunk {
+        ChunkState state;
+        PRBool last;
+        int frames;
+        int *dups;
+        unsigned char *yuv;
+        int speed;
+        int quality;
+
+        int packets;
+        int maxPackets;
+        long *sizes;
+        PRBool *keys;
+        unsigned char *data;
+        PRUint32 dataLen;
+        PRUint32 dataMax;
+        PRBool failed;
+
+        Chunk *next;
+    };
+
+    static void Worker(void *arg);
+    void EncodeChunk(Chunk *c);
+    PRBool AddPacket(Chunk *c, ogg_packet *op);
+    void Submit(Chunk *c);
+    void EmitReady();
+    void EmitEOS();
+
+    th_info mInfo;
+    int mChunkFrames;
+    int mFrameSize;
+    int mShift;
+    int mSpeed;
+    int mQuality;
+
+    PacketCallback mCallback;
+    void *mData;
+    PipelineStats *mStats;
+
+    PRLock *mLock;
+    PRCondVar *mWork;
+    PRCondVar *mDone;
+    PRBool mShutdown;
+    PRBool mFailed;
+
+    int mNumThreads;
+    PRThread **mThreads;
+
+    int mNumChunks;
+    Chunk *mChunks;
+    Chunk *mFilling;
+    /* Submitted chunks, in stream order */
+    Chunk *mHead;
+    Chunk *mTail;
+    PRUint32 mPending;
+
+    /* Granule and packet numbering for the reassembled stream, whose
+     * three header packets the caller has already written */
+    PRInt64 mFrame;
+    PRInt64 mLastKey;
+    PRInt64 mPacketNo;
+};
+
+#endif
@@ -0,0 +1,109 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "FramePacer.h"
+
+FramePacer::FramePacer()
+{
+    Init(15, 1, 1);
+}
+
+void
+FramePacer::Init(int fpsN, int fpsD, int maxRepeat)
+{
+    mFpsN = fpsN;
+    mFpsD = fpsD;
+    mMaxRepeat = maxRepeat < 1 ? 1 : maxRepeat;
+    mInterval = ((PRTime)PR_USEC_PER_SEC * fpsD) / fpsN;
+    Reset();
+}
+
+void
+FramePacer::Reset()
+{
+    mStarted = PR_FALSE;
+    mStart = 0;
+    mLead = 0;
+    mDebt = 0;
+    mFrames = 0;
+    mDropped = 0;
+    mDuplicated = 0;
+}
+
+int
+FramePacer::Schedule(PRTime when)
+{
+    if (!mStarted) {
+        mStart = when - mLead;
+        mStarted = PR_TRUE;
+    }
+
+    /* Output slot this frame was captured in */
+    PRInt64 slot = ((when - mStart) * mFpsN) /
+        ((PRTime)PR_USEC_PER_SEC * mFpsD);
+
+    /* Source is overdelivering, the slot is already filled */
+    if (slot < mFrames) {
+        mDropped++;
+        return 0;
+    }
+
+    /* Encoder is behind, skip a frame and let a later one be repeated
+     * into this slot, which is much cheaper than encoding it */
+    if (mDebt >= mInterval) {
+        mDropped++;
+        return 0;
+    }
+
+    /* Fill every slot up to and including this one. Long gaps are spread
+     * over the following frames so a single repeat run stays bounded. */
+    PRInt64 count = slot - mFrames + 1;
+    if (count > mMaxRepeat)
+        count = mMaxRepeat;
+
+    mFrames += count;
+    mDuplicated += (PRUint32)(count - 1);
+    return (int)count;
+}
+
+void
+FramePacer::Account(PRTime busy)
+{
+    mDebt += busy - mInterval;
+    if (mDebt < 0)
+        mDebt = 0;
+}
@@ -0,0 +1,89 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef FramePacer_h_
+#define FramePacer_h_
+
+#include "prtypes.h"
+#include "prtime.h"
+
+/*
+ * Maps capture timestamps onto a fixed output frame rate. Each captured
+ * frame is assigned the output slots it covers: none if the source is
+ * running ahead of the target rate (or the encoder has fallen behind and
+ * needs to catch up), one normally, or several if the source skipped
+ * slots and the frame must be repeated to keep the stream in time.
+ */
+class FramePacer
+{
+public:
+    FramePacer();
+
+    void Init(int fpsN, int fpsD, int maxRepeat);
+    void Reset();
+    /* Start the stream this long before the first frame arrives, so it
+     * lines up with a clock shared with another stream */
+    void SetLead(PRTime lead) { mLead = lead; }
+    PRBool Started() { return mStarted; }
+
+    /* Number of output frames the captured frame at 'when' (usec) fills */
+    int Schedule(PRTime when);
+    /* Drop the frame at 'when' without scheduling it */
+    void Skip() { mDropped++; }
+    /* Time spent handling the last scheduled frame, dropped or not */
+    void Account(PRTime busy);
+
+    PRUint32 Dropped() { return mDropped; }
+    PRUint32 Duplicated() { return mDuplicated; }
+    PRInt64 Frames() { return mFrames; }
+    PRTime Interval() { return mInterval; }
+
+private:
+    int mFpsN;
+    int mFpsD;
+    int mMaxRepeat;
+    PRBool mStarted;
+    PRTime mStart;
+    PRTime mLead;
+    PRTime mInterval;
+    PRTime mDebt;
+    PRInt64 mFrames;
+    PRUint32 mDropped;
+    PRUint32 mDuplicated;
+};
+
+#endif
@@ -0,0 +1,191 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "OggMuxer.h"
+
+OggMuxer::OggMuxer()
+    : mWriter(nsnull)
+    , mLock(nsnull)
+    , mShift(6)
+    , mFpsN(1)
+    , mFpsD(1)
+    , mRate(1)
+{
+    memset(&mVideo, 0, sizeof(mVideo));
+    memset(&mAudio, 0, sizeof(mAudio));
+}
+
+OggMuxer::~OggMuxer()
+{
+    Page *p;
+    while ((p = mVideo.head)) {
+        mVideo.head = p->next;
+        PR_Free(p);
+    }
+    while ((p = mAudio.head)) {
+        mAudio.head = p->next;
+        PR_Free(p);
+    }
+    if (mLock)
+        PR_DestroyLock(mLock);
+}
+
+nsresult
+OggMuxer::Init(OggWriter *writer, int shift, int fpsN, int fpsD, int rate)
+{
+    if (!mLock && !(mLock = PR_NewLock()))
+        return NS_ERROR_OUT_OF_MEMORY;
+
+    mWriter = writer;
+    mShift = shift;
+    mFpsN = fpsN;
+    mFpsD = fpsD;
+    mRate = rate;
+    memset(&mVideo, 0, sizeof(mVideo));
+    memset(&mAudio, 0, sizeof(mAudio));
+    return NS_OK;
+}
+
+void
+OggMuxer::VideoPage(ogg_page *og)
+{
+    ogg_int64_t gp = ogg_page_granulepos(og);
+    double time = mVideo.last;
+
+    /* Pages without a finished packet end where the previous one did */
+    if (gp >= 0) {
+        ogg_int64_t key = gp >> mShift;
+        ogg_int64_t frames = key + (gp - (key << mShift));
+        time = (double)frames * mFpsD / mFpsN;
+    }
+
+    PR_Lock(mLock);
+    Push(&mVideo, og, time);
+    Drain(PR_FALSE);
+    PR_Unlock(mLock);
+}
+
+void
+OggMuxer::AudioPage(ogg_page *og)
+{
+    ogg_int64_t gp = ogg_page_granulepos(og);
+    double time = mAudio.last;
+
+    if (gp >= 0)
+        time = (double)gp / mRate;
+
+    PR_Lock(mLock);
+    Push(&mAudio, og, time);
+    Drain(PR_FALSE);
+    PR_Unlock(mLock);
+}
+
+void
+OggMuxer::Finish()
+{
+    PR_Lock(mLock);
+    Drain(PR_TRUE);
+    PR_Unlock(mLock);
+}
+
+/* Called with mLock held */
+void
+OggMuxer::Push(Queue *q, ogg_page *og, double time)
+{
+    long len = og->header_len + og->body_len;
+    Page *p = (Page *)PR_Malloc(sizeof(Page) + len);
+    if (!p) {
+        /* Better out of order than missing */
+        mWriter->WritePage(og);
+        return;
+    }
+
+    p->time = time;
+    p->header_len = og->header_len;
+    p->body_len = og->body_len;
+    p->next = nsnull;
+    memcpy(p->data, og->header, og->header_len);
+    memcpy(p->data + og->header_len, og->body, og->body_len);
+
+    if (q->tail)
+        q->tail->next = p;
+    else
+        q->head = p;
+    q->tail = p;
+    q->bytes += len;
+    q->last = time;
+}
+
+/* Called with mLock held */
+void
+OggMuxer::WriteHead(Queue *q)
+{
+    ogg_page og;
+    Page *p = q->head;
+
+    og.header = p->data;
+    og.header_len = p->header_len;
+    og.body = p->data + p->header_len;
+    og.body_len = p->body_len;
+    mWriter->WritePage(&og);
+
+    q->head = p->next;
+    if (!q->head)
+        q->tail = nsnull;
+    q->bytes -= p->header_len + p->body_len;
+    PR_Free(p);
+}
+
+/* Called with mLock held */
+void
+OggMuxer::Drain(PRBool all)
+{
+    for (;;) {
+        if (mVideo.head && mAudio.head) {
+            WriteHead(mVideo.head->time <= mAudio.head->time ?
+                &mVideo : &mAudio);
+        } else if (mVideo.head &&
+                   (all || mVideo.bytes > MUX_MAX_BUFFER)) {
+            WriteHead(&mVideo);
+        } else if (mAudio.head &&
+                   (all || mAudio.bytes > MUX_MAX_BUFFER)) {
+            WriteHead(&mAudio);
+        } else {
+            break;
+        }
+    }
+}
@@ -0,0 +1,102 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef OggMuxer_h_
+#define OggMuxer_h_
+
+#include <string.h>
+#include <ogg/ogg.h>
+
+#include "prmem.h"
+#include "prlock.h"
+#include "OggWriter.h"
+
+/* Write a stream's pages regardless once this much is waiting for the
+ * other stream, rather than buffering without bound */
+#define MUX_MAX_BUFFER (2 * 1024 * 1024)
+
+/*
+ * Interleaves the pages of a Theora and a Vorbis logical stream into one
+ * physical Ogg stream. Pages arrive from the capture threads of either
+ * stream and are held until the other stream has caught up, then written
+ * out in order of their end time.
+ */
+class OggMuxer
+{
+public:
+    OggMuxer();
+    ~OggMuxer();
+
+    nsresult Init(OggWriter *writer, int shift, int fpsN, int fpsD, int rate);
+    void VideoPage(ogg_page *og);
+    void AudioPage(ogg_page *og);
+    /* Write out everything still held back */
+    void Finish();
+
+private:
+    struct Page {
+        double time;
+        long header_len;
+        long body_len;
+        Page *next;
+        unsigned char data[1];
+    };
+
+    struct Queue {
+        Page *head;
+        Page *tail;
+        PRUint32 bytes;
+        double last;
+    };
+
+    void Push(Queue *q, ogg_page *og, double time);
+    void WriteHead(Queue *q);
+    void Drain(PRBool all);
+
+    OggWriter *mWriter;
+    PRLock *mLock;
+
+    int mShift;
+    int mFpsN;
+    int mFpsD;
+    int mRate;
+
+    Queue mVideo;
+    Queue mAudio;
+};
+
+#endif
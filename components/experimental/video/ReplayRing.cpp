@@ -0,0 +1,279 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "ReplayRing.h"
+
+ReplayRing::ReplayRing()
+    : mLock(nsnull)
+    , mShift(6)
+    , mNumHeaders(0)
+    , mEntries(nsnull)
+    , mMax(0)
+    , mHead(0)
+    , mCount(0)
+    , mBytes(0)
+    , mMaxBytes(0)
+{
+}
+
+ReplayRing::~ReplayRing()
+{
+    Clear();
+    PR_Free(mEntries);
+    if (mLock)
+        PR_DestroyLock(mLock);
+}
+
+nsresult
+ReplayRing::Init(int shift, PRUint32 frames, PRUint32 maxBytes)
+{
+    if (!frames)
+        return NS_ERROR_INVALID_ARG;
+
+    if (!mLock && !(mLock = PR_NewLock()))
+        return NS_ERROR_OUT_OF_MEMORY;
+
+    Clear();
+
+    /* A Save() from the last time round may still be running */
+    nsresult rv = NS_OK;
+    PR_Lock(mLock);
+    PR_Free(mEntries);
+
+    /* Room for a whole keyframe interval on top of what was asked for */
+    mShift = shift;
+    mMax = frames + (1 << shift);
+    if (!(mEntries = (Entry *)PR_Calloc(mMax, sizeof(Entry)))) {
+        mMax = 0;
+        rv = NS_ERROR_OUT_OF_MEMORY;
+    }
+    mMaxBytes = maxBytes;
+    PR_Unlock(mLock);
+    return rv;
+}
+
+void
+ReplayRing::Clear()
+{
+    if (mLock)
+        PR_Lock(mLock);
+    while (mCount) {
+        PR_Free(mEntries[mHead].data);
+        mHead = (mHead + 1) % mMax;
+        mCount--;
+    }
+    for (int i = 0; i < mNumHeaders; i++)
+        PR_Free(mHeaders[i].packet);
+    mNumHeaders = 0;
+    mHead = 0;
+    mBytes = 0;
+    if (mLock)
+        PR_Unlock(mLock);
+}
+
+nsresult
+ReplayRing::AddHeader(ogg_packet *op)
+{
+    if (mNumHeaders == REPLAY_MAX_HEADERS)
+        return NS_ERROR_FAILURE;
+
+    unsigned char *copy = (unsigned char *)PR_Malloc(op->bytes);
+    if (!copy)
+        return NS_ERROR_OUT_OF_MEMORY;
+    memcpy(copy, op->packet, op->bytes);
+
+    PR_Lock(mLock);
+    ogg_packet *h = &mHeaders[mNumHeaders++];
+    *h = *op;
+    h->packet = copy;
+    PR_Unlock(mLock);
+    return NS_OK;
+}
+
+/*
+ * Drop from the head up to the next keyframe. Called with mLock held.
+ */
+void
+ReplayRing::DropOldest()
+{
+    do {
+        Entry *e = &mEntries[mHead];
+        PR_Free(e->data);
+        e->data = nsnull;
+        mBytes -= e->bytes;
+        mHead = (mHead + 1) % mMax;
+        mCount--;
+    } while (mCount && !mEntries[mHead].key);
+}
+
+void
+ReplayRing::AddPacket(ogg_packet *op)
+{
+    PRBool key = (th_packet_iskeyframe(op) > 0);
+    unsigned char *copy = nsnull;
+
+    if (op->bytes) {
+        if (!(copy = (unsigned char *)PR_Malloc(op->bytes)))
+            return;
+        memcpy(copy, op->packet, op->bytes);
+    }
+
+    PR_Lock(mLock);
+    while (mCount && (mCount == mMax ||
+           mBytes + (PRUint32)op->bytes > mMaxBytes))
+        DropOldest();
+
+    /* Nothing before the first keyframe is decodable */
+    if (!mCount && !key) {
+        PR_Unlock(mLock);
+        PR_Free(copy);
+        return;
+    }
+
+    Entry *e = &mEntries[(mHead + mCount) % mMax];
+    e->bytes = op->bytes;
+    e->key = key;
+    e->data = copy;
+    mBytes += op->bytes;
+    mCount++;
+    PR_Unlock(mLock);
+}
+
+PRUint32
+ReplayRing::Frames()
+{
+    PR_Lock(mLock);
+    PRUint32 frames = mCount;
+    PR_Unlock(mLock);
+    return frames;
+}
+
+PRUint32
+ReplayRing::Bytes()
+{
+    PR_Lock(mLock);
+    PRUint32 bytes = mBytes;
+    PR_Unlock(mLock);
+    return bytes;
+}
+
+nsresult
+ReplayRing::AppendPage(ogg_page *og, unsigned char **buf, PRUint32 *len,
+    PRUint32 *max)
+{
+    PRUint32 need = *len + og->header_len + og->body_len;
+    if (need > *max) {
+        PRUint32 m = *max ? *max : 65536;
+        while (m < need)
+            m *= 2;
+        unsigned char *b = (unsigned char *)PR_Realloc(*buf, m);
+        if (!b)
+            return NS_ERROR_OUT_OF_MEMORY;
+        *buf = b;
+        *max = m;
+    }
+    memcpy(*buf + *len, og->header, og->header_len);
+    memcpy(*buf + *len + og->header_len, og->body, og->body_len);
+    *len = need;
+    return NS_OK;
+}
+
+/*
+ * Frames are renumbered from zero, so the saved stream starts at time
+ * zero on the keyframe at the head of the ring. The stream is framed in
+ * memory under the lock, which is quick; writing it out is the caller's.
+ */
+nsresult
+ReplayRing::Save(unsigned char **data, PRUint32 *len)
+{
+    int i;
+    ogg_page og;
+    ogg_packet op;
+    ogg_stream_state os;
+    nsresult rv = NS_OK;
+    PRUint32 max = 0;
+
+    *data = nsnull;
+    *len = 0;
+
+    if (ogg_stream_init(&os, rand()))
+        return NS_ERROR_FAILURE;
+
+    PR_Lock(mLock);
+    if (!mNumHeaders || !mCount) {
+        PR_Unlock(mLock);
+        ogg_stream_clear(&os);
+        return NS_ERROR_NOT_AVAILABLE;
+    }
+
+    /* Headers, with the data starting on a fresh page as per spec */
+    for (i = 0; i < mNumHeaders; i++) {
+        ogg_stream_packetin(&os, &mHeaders[i]);
+        if (i == 0 && ogg_stream_flush(&os, &og))
+            rv = AppendPage(&og, data, len, &max);
+    }
+    while (NS_SUCCEEDED(rv) && ogg_stream_flush(&os, &og))
+        rv = AppendPage(&og, data, len, &max);
+
+    PRInt64 lastKey = 0;
+    for (PRUint32 f = 0; f < mCount && NS_SUCCEEDED(rv); f++) {
+        Entry *e = &mEntries[(mHead + f) % mMax];
+        if (e->key)
+            lastKey = f;
+
+        op.packet = e->data;
+        op.bytes = e->bytes;
+        op.b_o_s = 0;
+        op.e_o_s = (f == mCount - 1);
+        op.granulepos = ((lastKey + 1) << mShift) + (f - lastKey);
+        op.packetno = mNumHeaders + f;
+        ogg_stream_packetin(&os, &op);
+        while (NS_SUCCEEDED(rv) && ogg_stream_pageout(&os, &og))
+            rv = AppendPage(&og, data, len, &max);
+    }
+    while (NS_SUCCEEDED(rv) && ogg_stream_flush(&os, &og))
+        rv = AppendPage(&og, data, len, &max);
+    PR_Unlock(mLock);
+
+    ogg_stream_clear(&os);
+    if (NS_FAILED(rv)) {
+        PR_Free(*data);
+        *data = nsnull;
+        *len = 0;
+    }
+    return rv;
+}
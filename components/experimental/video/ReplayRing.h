@@ -0,0 +1,108 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef ReplayRing_h_
+#define ReplayRing_h_
+
+#include <string.h>
+#include <stdlib.h>
+#include <ogg/ogg.h>
+#include <theora/theoraenc.h>
+
+#include "prmem.h"
+#include "prlock.h"
+#include "nscore.h"
+
+#define REPLAY_MAX_HEADERS 3
+
+/*
+ * Keeps the most recent encoded Theora packets in memory so the last few
+ * seconds can be saved on request. The ring always starts on a keyframe:
+ * when it is full, the oldest whole keyframe interval is dropped at once.
+ * It is sized to hold the requested number of frames plus one interval,
+ * so after an eviction at least that many frames remain. A byte limit
+ * caps memory regardless of how well the video compresses.
+ *
+ * Packets arrive from whichever thread emits them while Save() may run on
+ * another, the lock keeps the two apart.
+ */
+class ReplayRing
+{
+public:
+    ReplayRing();
+    ~ReplayRing();
+
+    nsresult Init(int shift, PRUint32 frames, PRUint32 maxBytes);
+    void Clear();
+
+    /* Header packets are kept apart and never evicted */
+    nsresult AddHeader(ogg_packet *op);
+    void AddPacket(ogg_packet *op);
+
+    /* A complete Ogg/Theora stream of what the ring holds now, in a
+     * PR_Malloc'd buffer the caller frees */
+    nsresult Save(unsigned char **data, PRUint32 *len);
+
+    PRUint32 Frames();
+    PRUint32 Bytes();
+
+private:
+    struct Entry {
+        long bytes;
+        PRBool key;
+        unsigned char *data;
+    };
+
+    void DropOldest();
+    static nsresult AppendPage(ogg_page *og, unsigned char **buf,
+        PRUint32 *len, PRUint32 *max);
+
+    PRLock *mLock;
+    int mShift;
+
+    ogg_packet mHeaders[REPLAY_MAX_HEADERS];
+    int mNumHeaders;
+
+    Entry *mEntries;
+    PRUint32 mMax;
+    PRUint32 mHead;
+    PRUint32 mCount;
+    PRUint32 mBytes;
+    PRUint32 mMaxBytes;
+};
+
+#endif
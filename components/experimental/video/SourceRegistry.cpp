@@ -0,0 +1,330 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "SourceRegistry.h"
+#include "nsMemory.h"
+#include "prprf.h"
+
+#include <stdio.h>
+
+SourceRegistry::SourceRegistry()
+    : mSapi(NULL)
+    , mLock(nsnull)
+    , mEntries(nsnull)
+    , mCount(0)
+{
+}
+
+SourceRegistry::~SourceRegistry()
+{
+    for (int i = 0; i < mCount; i++) {
+        PR_Free(mEntries[i]->formats);
+        PR_Free(mEntries[i]);
+    }
+    PR_Free(mEntries);
+    if (mLock)
+        PR_DestroyLock(mLock);
+}
+
+nsresult
+SourceRegistry::Init(vidcap_sapi *sapi)
+{
+    if (!mLock && !(mLock = PR_NewLock()))
+        return NS_ERROR_OUT_OF_MEMORY;
+    mSapi = sapi;
+    return Refresh();
+}
+
+/*
+ * Sources are matched up by identifier. One that is gone is only marked
+ * so, it keeps its entry (and formats) for when it comes back.
+ */
+nsresult
+SourceRegistry::Refresh()
+{
+    int i, j, num;
+    nsresult rv = NS_OK;
+    struct vidcap_src_info *list = NULL;
+    
+    num = vidcap_src_list_update(mSapi);
+    if (num < 0) {
+        fprintf(stderr, "Failed vidcap_src_list_update()\n");
+        return NS_ERROR_FAILURE;
+    }
+    if (num && !(list = (struct vidcap_src_info *)
+        PR_Calloc(num, sizeof(struct vidcap_src_info))))
+        return NS_ERROR_OUT_OF_MEMORY;
+    if (num && vidcap_src_list_get(mSapi, num, list)) {
+        PR_Free(list);
+        fprintf(stderr, "Failed vidcap_src_list_get()\n");
+        return NS_ERROR_FAILURE;
+    }
+    
+    PR_Lock(mLock);
+    for (j = 0; j < mCount; j++)
+        mEntries[j]->present = PR_FALSE;
+    
+    for (i = 0; i < num; i++) {
+        for (j = 0; j < mCount; j++) {
+            if (!strcmp(mEntries[j]->info.identifier, list[i].identifier))
+                break;
+        }
+        if (j < mCount) {
+            mEntries[j]->present = PR_TRUE;
+            continue;
+        }
+        
+        VideoSource **entries = (VideoSource **)
+            PR_Realloc(mEntries, (mCount + 1) * sizeof(VideoSource *));
+        if (!entries) {
+            rv = NS_ERROR_OUT_OF_MEMORY;
+            break;
+        }
+        mEntries = entries;
+        if (!(mEntries[mCount] = (VideoSource *)
+            PR_Calloc(1, sizeof(VideoSource)))) {
+            rv = NS_ERROR_OUT_OF_MEMORY;
+            break;
+        }
+        mEntries[mCount]->info = list[i];
+        mEntries[mCount]->present = PR_TRUE;
+        mCount++;
+    }
+    PR_Unlock(mLock);
+    
+    PR_Free(list);
+    return rv;
+}
+
+/*
+ * Only the media thread changes what has been probed, so it can look
+ * without the lock. A source that cannot be acquired now (in use by
+ * someone else, say) is left for its first recording to find out about.
+ */
+void
+SourceRegistry::Probe()
+{
+    int count = Count();
+    vidcap_src *src;
+    
+    for (int i = 0; i < count; i++) {
+        VideoSource *entry = Source(i);
+        if (entry->probed || !entry->present)
+            continue;
+        if (!(src = vidcap_src_acquire(mSapi, &entry->info)))
+            continue;
+        Learn(entry, src);
+        vidcap_src_release(src);
+    }
+}
+
+void
+SourceRegistry::Learn(VideoSource *entry, vidcap_src *src)
+{
+    struct vidcap_fmt_info *formats;
+    int count = Enumerate(src, &formats);
+    SetFormats(entry, formats, count);
+}
+
+int
+SourceRegistry::Enumerate(vidcap_src *src, struct vidcap_fmt_info **formats)
+{
+    int count = 0;
+    struct vidcap_fmt_info fmt, *grown;
+    
+    *formats = NULL;
+    while (!vidcap_format_enumerate(src, count, &fmt)) {
+        if (!(grown = (struct vidcap_fmt_info *)PR_Realloc(*formats,
+            (count + 1) * sizeof(struct vidcap_fmt_info))))
+            break;
+        *formats = grown;
+        (*formats)[count++] = fmt;
+    }
+    return count;
+}
+
+void
+SourceRegistry::SetFormats(VideoSource *entry,
+    struct vidcap_fmt_info *formats, int count)
+{
+    PR_Lock(mLock);
+    PR_Free(entry->formats);
+    entry->formats = formats;
+    entry->numFormats = count;
+    entry->probed = PR_TRUE;
+    PR_Unlock(mLock);
+}
+
+int
+SourceRegistry::Count()
+{
+    PR_Lock(mLock);
+    int count = mCount;
+    PR_Unlock(mLock);
+    return count;
+}
+
+VideoSource *
+SourceRegistry::Source(int i)
+{
+    PR_Lock(mLock);
+    VideoSource *entry = mEntries[i];
+    PR_Unlock(mLock);
+    return entry;
+}
+
+int
+SourceRegistry::Find(const nsACString &id)
+{
+    int found = -1;
+    
+    PR_Lock(mLock);
+    for (int i = 0; i < mCount; i++) {
+        if (mEntries[i]->present &&
+            (id.IsEmpty() || id.Equals(mEntries[i]->info.identifier))) {
+            found = i;
+            break;
+        }
+    }
+    PR_Unlock(mLock);
+    return found;
+}
+
+int
+SourceRegistry::CopyFormats(VideoSource *entry,
+    struct vidcap_fmt_info **formats)
+{
+    int count;
+    
+    PR_Lock(mLock);
+    count = entry->numFormats;
+    *formats = NULL;
+    if (count && (*formats = (struct vidcap_fmt_info *)
+        PR_Malloc(count * sizeof(struct vidcap_fmt_info))))
+        memcpy(*formats, entry->formats,
+            count * sizeof(struct vidcap_fmt_info));
+    else
+        count = 0;
+    PR_Unlock(mLock);
+    return count;
+}
+
+nsresult
+SourceRegistry::GetIds(PRUint32 *count, char ***ids)
+{
+    int i, n = 0;
+    nsresult rv = NS_OK;
+    
+    *count = 0;
+    *ids = nsnull;
+    PR_Lock(mLock);
+    for (i = 0; i < mCount; i++) {
+        if (mEntries[i]->present)
+            n++;
+    }
+    if (n && !(*ids = static_cast<char**>
+        (nsMemory::Alloc(n * sizeof(**ids))))) {
+        rv = NS_ERROR_OUT_OF_MEMORY;
+        n = 0;
+    }
+    for (i = 0; n && i < mCount; i++) {
+        if (!mEntries[i]->present)
+            continue;
+        const char *id = mEntries[i]->info.identifier;
+        (*ids)[(*count)++] = static_cast<char*>
+            (nsMemory::Clone(id, strlen(id) + 1));
+    }
+    PR_Unlock(mLock);
+    return rv;
+}
+
+nsresult
+SourceRegistry::GetDescription(const nsACString &id, nsACString &out)
+{
+    int i = Find(id);
+    
+    if (id.IsEmpty() || i < 0)
+        return NS_ERROR_INVALID_ARG;
+    out.Assign(Source(i)->info.description);
+    return NS_OK;
+}
+
+void
+SourceRegistry::AppendString(nsACString &out, const char *str)
+{
+    out.Append("\"");
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\')
+            out.Append("\\");
+        if ((unsigned char)*str >= ' ')
+            out.Append(*str);
+    }
+    out.Append("\"");
+}
+
+void
+SourceRegistry::AppendJSON(nsACString &out)
+{
+    char buf[128];
+    
+    out.Append("[");
+    PR_Lock(mLock);
+    for (int i = 0; i < mCount; i++) {
+        VideoSource *entry = mEntries[i];
+        if (i)
+            out.Append(",");
+        out.Append("{\"id\":");
+        AppendString(out, entry->info.identifier);
+        out.Append(",\"description\":");
+        AppendString(out, entry->info.description);
+        out.Append(entry->present ? ",\"present\":true,\"formats\":[" :
+            ",\"present\":false,\"formats\":[");
+        for (int j = 0; j < entry->numFormats; j++) {
+            struct vidcap_fmt_info *fmt = &entry->formats[j];
+            PR_snprintf(buf, sizeof(buf),
+                "%s{\"fourcc\":\"%s\",\"width\":%d,\"height\":%d,"
+                "\"fps\":[%d,%d]}", j ? "," : "",
+                vidcap_fourcc_string_get(fmt->fourcc),
+                fmt->width, fmt->height,
+                fmt->fps_numerator, fmt->fps_denominator);
+            out.Append(buf);
+        }
+        out.Append("]}");
+    }
+    PR_Unlock(mLock);
+    out.Append("]");
+}
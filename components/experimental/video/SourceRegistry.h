@@ -0,0 +1,115 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef SourceRegistry_h_
+#define SourceRegistry_h_
+
+#include <string.h>
+#include <vidcap/vidcap.h>
+
+#include "prmem.h"
+#include "prlock.h"
+#include "nscore.h"
+#include "nsStringAPI.h"
+
+/*
+ * One capture source as last seen. Entries are never freed while the
+ * registry lives, so a session can keep pointing at its source across
+ * unplugging and plugging back in.
+ */
+struct VideoSource {
+    struct vidcap_src_info info;
+    struct vidcap_fmt_info *formats;
+    int numFormats;
+    /* Formats have been asked for, whether or not any came back */
+    PRBool probed;
+    PRBool present;
+};
+
+/*
+ * The capture sources and the formats they offer, listed once and then
+ * kept up to date as cameras come and go, so that neither the script
+ * asking what there is nor a recording starting has to go to the
+ * driver for it.
+ *
+ * Refresh(), Probe() and Learn() talk to vidcap and run on the media
+ * thread (or under the backend lock while it is brought up); everything
+ * else only reads and may be called from any thread.
+ */
+class SourceRegistry
+{
+public:
+    SourceRegistry();
+    ~SourceRegistry();
+
+    nsresult Init(vidcap_sapi *sapi);
+
+    /* Relist the sources, keeping the ones we know and their formats */
+    nsresult Refresh();
+    /* Ask the sources we have no formats for yet what they offer */
+    void Probe();
+    /* Remember the formats of a source that is acquired already */
+    void Learn(VideoSource *entry, vidcap_src *src);
+
+    /* Entries, present or not; indexes never change */
+    int Count();
+    VideoSource *Source(int i);
+    /* Index of a present source, the first one if id is empty, or -1 */
+    int Find(const nsACString &id);
+    /* Copy of the formats of a source, to be PR_Free()d; the count */
+    int CopyFormats(VideoSource *entry, struct vidcap_fmt_info **formats);
+
+    /* Identifiers of the present sources, nsMemory allocated */
+    nsresult GetIds(PRUint32 *count, char ***ids);
+    nsresult GetDescription(const nsACString &id, nsACString &out);
+    /* Every source we have seen and its formats, as a JSON array */
+    void AppendJSON(nsACString &out);
+    /* A driver supplied string as a quoted and escaped JSON string */
+    static void AppendString(nsACString &out, const char *str);
+
+private:
+    static int Enumerate(vidcap_src *src, struct vidcap_fmt_info **formats);
+    void SetFormats(VideoSource *entry, struct vidcap_fmt_info *formats,
+        int count);
+
+    vidcap_sapi *mSapi;
+    PRLock *mLock;
+    VideoSource **mEntries;
+    int mCount;
+};
+
+#endif
@@ -0,0 +1,126 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "SpeedController.h"
+
+SpeedController::SpeedController()
+{
+    Init(0, 48, 48, 15);
+}
+
+void
+SpeedController::Init(int maxSpeed, int quality, int minQuality,
+    int holdFrames)
+{
+    mMaxSpeed = maxSpeed < 0 ? 0 : maxSpeed;
+    mMaxQuality = quality;
+    mMinQuality = minQuality > quality ? quality : minQuality;
+    mHold = holdFrames < 1 ? 1 : holdFrames;
+
+    mSpeed = 0;
+    mQuality = quality;
+    mLoad = 0;
+    mWait = mHold;
+    mRaised = 0;
+    mLowered = 0;
+}
+
+/* Cheaper encoding: speed first, as it costs the least quality */
+void
+SpeedController::StepUp()
+{
+    if (mSpeed < mMaxSpeed) {
+        mSpeed++;
+    } else if (mQuality > mMinQuality) {
+        mQuality -= QUALITY_STEP;
+        if (mQuality < mMinQuality)
+            mQuality = mMinQuality;
+    } else {
+        return;
+    }
+    mRaised++;
+}
+
+/* Better encoding: give back quality before slowing down again */
+void
+SpeedController::StepDown()
+{
+    if (mQuality < mMaxQuality) {
+        mQuality += QUALITY_STEP;
+        if (mQuality > mMaxQuality)
+            mQuality = mMaxQuality;
+    } else if (mSpeed > 0) {
+        mSpeed--;
+    } else {
+        return;
+    }
+    mLowered++;
+}
+
+PRBool
+SpeedController::Update(PRTime busy, PRTime interval, PRUint32 backlog)
+{
+    PRUint32 load = 0;
+    if (interval > 0 && busy > 0)
+        load = (PRUint32)((busy * 100) / interval);
+    if (backlog > load)
+        load = backlog;
+    if (load > 1000)
+        load = 1000;
+
+    /* load += (sample - load) / 8, in LOAD_SHIFT fixed point */
+    mLoad = mLoad - (mLoad >> 3) + ((load << LOAD_SHIFT) >> 3);
+
+    if (mWait > 0) {
+        mWait--;
+        return PR_FALSE;
+    }
+
+    int speed = mSpeed;
+    int quality = mQuality;
+    PRUint32 smooth = mLoad >> LOAD_SHIFT;
+    if (smooth >= LOAD_HIGH) {
+        StepUp();
+        mWait = mHold;
+    } else if (smooth <= LOAD_LOW) {
+        StepDown();
+        /* Recover more slowly than we back off */
+        mWait = mHold * 2;
+    }
+
+    return (speed != mSpeed || quality != mQuality);
+}
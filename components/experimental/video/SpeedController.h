@@ -0,0 +1,91 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef SpeedController_h_
+#define SpeedController_h_
+
+#include "prtypes.h"
+#include "prtime.h"
+
+/*
+ * Trades encoder effort for keeping up. Every handled frame reports how
+ * long it took against the frame interval and how full the queues behind
+ * the encoder are. When the smoothed load stays high the controller first
+ * raises Theora's speed level and, once that is exhausted, lowers the
+ * quality; when there is headroom again it undoes those steps in reverse
+ * order. Changes are spaced out by a hold-off so the controller does not
+ * oscillate on a single slow frame.
+ */
+class SpeedController
+{
+public:
+    SpeedController();
+
+    void Init(int maxSpeed, int quality, int minQuality, int holdFrames);
+
+    /* Returns PR_TRUE if Speed() or Quality() changed. 'backlog' is how
+     * full the fullest downstream queue is, in percent. */
+    PRBool Update(PRTime busy, PRTime interval, PRUint32 backlog);
+
+    int Speed() { return mSpeed; }
+    int Quality() { return mQuality; }
+    PRUint32 Load() { return mLoad >> LOAD_SHIFT; }
+    PRUint32 Raised() { return mRaised; }
+    PRUint32 Lowered() { return mLowered; }
+
+private:
+    enum { LOAD_SHIFT = 4, LOAD_HIGH = 90, LOAD_LOW = 50,
+           QUALITY_STEP = 8 };
+
+    void StepUp();
+    void StepDown();
+
+    int mMaxSpeed;
+    int mMaxQuality;
+    int mMinQuality;
+    int mHold;
+
+    int mSpeed;
+    int mQuality;
+    /* Percent, fixed point, exponentially smoothed over ~8 frames */
+    PRUint32 mLoad;
+    int mWait;
+    PRUint32 mRaised;
+    PRUint32 mLowered;
+};
+
+#endif
@@ -0,0 +1,121 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "StaticSceneDetector.h"
+
+#include <stdlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+StaticSceneDetector::StaticSceneDetector()
+{
+    mThreshold = 0;
+    mStatic = 0;
+    Init(0, 0, 0);
+}
+
+void
+StaticSceneDetector::Init(int width, int height, int stride)
+{
+    mWidth = width;
+    mHeight = height;
+    mStride = stride;
+}
+
+/*
+ * Sum of absolute differences over a w by h block
+ */
+PRUint32
+StaticSceneDetector::BlockSAD(const unsigned char *a,
+    const unsigned char *b, int stride, int w, int h)
+{
+    PRUint32 sad = 0;
+    int x, y;
+
+#ifdef __SSE2__
+    /* psadbw does a whole 16 pixel row in one go, leaving two partial
+     * sums in the low words of each 64-bit lane */
+    if (w == STATIC_BLOCK_SIZE) {
+        __m128i acc = _mm_setzero_si128();
+        for (y = 0; y < h; y++) {
+            __m128i ra = _mm_loadu_si128((const __m128i *)(a + y * stride));
+            __m128i rb = _mm_loadu_si128((const __m128i *)(b + y * stride));
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(ra, rb));
+        }
+        acc = _mm_add_epi64(acc, _mm_srli_si128(acc, 8));
+        return (PRUint32)_mm_cvtsi128_si32(acc);
+    }
+#endif
+
+    for (y = 0; y < h; y++) {
+        const unsigned char *ra = a + y * stride;
+        const unsigned char *rb = b + y * stride;
+        for (x = 0; x < w; x++)
+            sad += abs(ra[x] - rb[x]);
+    }
+    return sad;
+}
+
+PRBool
+StaticSceneDetector::IsStatic(const unsigned char *luma,
+    const unsigned char *ref)
+{
+    int x, y;
+
+    if (!mThreshold || !ref)
+        return PR_FALSE;
+
+    for (y = 0; y < mHeight; y += STATIC_BLOCK_SIZE) {
+        int h = mHeight - y;
+        if (h > STATIC_BLOCK_SIZE)
+            h = STATIC_BLOCK_SIZE;
+        for (x = 0; x < mWidth; x += STATIC_BLOCK_SIZE) {
+            int w = mWidth - x;
+            if (w > STATIC_BLOCK_SIZE)
+                w = STATIC_BLOCK_SIZE;
+            int off = y * mStride + x;
+            /* Bail out on the first block that moved */
+            if (BlockSAD(luma + off, ref + off, mStride, w, h) >
+                mThreshold * (PRUint32)(w * h))
+                return PR_FALSE;
+        }
+    }
+
+    mStatic++;
+    return PR_TRUE;
+}
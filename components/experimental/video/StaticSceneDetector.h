@@ -0,0 +1,80 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef StaticSceneDetector_h_
+#define StaticSceneDetector_h_
+
+#include "prtypes.h"
+
+#define STATIC_BLOCK_SIZE 16
+
+/*
+ * Decides whether a frame is close enough to a reference frame to be
+ * coded as a repeat of it. Luma is compared in 16x16 blocks and the
+ * frame only counts as static if every block is, so a small moving
+ * object (a mouse pointer, a blinking eye) is not averaged away by a
+ * large still background. The threshold is the mean absolute difference
+ * per pixel a block may have, which is what camera noise amounts to.
+ */
+class StaticSceneDetector
+{
+public:
+    StaticSceneDetector();
+
+    void Init(int width, int height, int stride);
+    void SetThreshold(PRUint32 threshold) { mThreshold = threshold; }
+    PRUint32 Threshold() { return mThreshold; }
+    PRBool Enabled() { return mThreshold > 0; }
+
+    /* Compare the luma planes of a new frame and the reference */
+    PRBool IsStatic(const unsigned char *luma, const unsigned char *ref);
+
+    PRUint32 Static() { return mStatic; }
+    void Reset() { mStatic = 0; }
+
+private:
+    static PRUint32 BlockSAD(const unsigned char *a,
+        const unsigned char *b, int stride, int w, int h);
+
+    int mWidth;
+    int mHeight;
+    int mStride;
+    PRUint32 mThreshold;
+    PRUint32 mStatic;
+};
+
+#endif
@@ -0,0 +1,269 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "ThumbnailSidecar.h"
+#include "VideoIngest.h"
+#include "prmem.h"
+#include "prprf.h"
+
+#include <string.h>
+
+static void
+PutLE(unsigned char *p, PRUint64 v, int bytes)
+{
+    for (int i = 0; i < bytes; i++, v >>= 8)
+        p[i] = (unsigned char)(v & 0xff);
+}
+
+static PRUint64
+GetLE(const unsigned char *p, int bytes)
+{
+    PRUint64 v = 0;
+    for (int i = bytes - 1; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+ThumbnailSidecar::ThumbnailSidecar()
+    : mFile(NULL)
+    , mCount(0)
+    , mRecord(NULL)
+{
+    mScratch[0] = mScratch[1] = NULL;
+}
+
+ThumbnailSidecar::~ThumbnailSidecar()
+{
+    Close();
+}
+
+nsresult
+ThumbnailSidecar::Open(const char *path, int width, int height,
+    int fpsN, int fpsD, int interval)
+{
+    unsigned char header[THUMB_HEADER_SIZE];
+    
+    Close();
+    mWidth = width;
+    mHeight = height;
+    mFpsN = fpsN;
+    mFpsD = fpsD;
+    mInterval = interval;
+    mNext = 0;
+    mCount = 0;
+    
+    /* Halving a plane at most quarters it, so two such buffers suffice */
+    int scratch = (width / 2) * (height / 2);
+    if (!(mScratch[0] = (unsigned char *)PR_Malloc(scratch)) ||
+        !(mScratch[1] = (unsigned char *)PR_Malloc(scratch)) ||
+        !(mRecord = (unsigned char *)PR_Malloc(RecordSize()))) {
+        Close();
+        return NS_ERROR_OUT_OF_MEMORY;
+    }
+    
+    if (!(mFile = fopen(path, "wb"))) {
+        fprintf(stderr, "Could not open thumbnail file\n");
+        Close();
+        return NS_ERROR_FAILURE;
+    }
+    
+    memcpy(header, THUMB_MAGIC, 8);
+    PutLE(header + 8, THUMB_WIDTH, 4);
+    PutLE(header + 12, THUMB_HEIGHT, 4);
+    PutLE(header + 16, fpsN, 4);
+    PutLE(header + 20, fpsD, 4);
+    if (fwrite(header, THUMB_HEADER_SIZE, 1, mFile) != 1) {
+        fprintf(stderr, "Could not write thumbnail header\n");
+        Close();
+        return NS_ERROR_FAILURE;
+    }
+    return NS_OK;
+}
+
+void
+ThumbnailSidecar::Close()
+{
+    if (mFile) {
+        fclose(mFile);
+        mFile = NULL;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (mScratch[i])
+            PR_Free(mScratch[i]);
+        mScratch[i] = NULL;
+    }
+    if (mRecord) {
+        PR_Free(mRecord);
+        mRecord = NULL;
+    }
+}
+
+PRBool
+ThumbnailSidecar::Due(PRInt64 frame, int dups, PRBool keyframe)
+{
+    if (!mFile)
+        return PR_FALSE;
+    if (!mInterval)
+        return keyframe;
+    return frame + dups >= mNext;
+}
+
+/*
+ * Halve with the box filter while that still leaves at least the target
+ * size, then resample the rest of the way. A single bilinear step from
+ * 640 to 160 would skip three pixels in four and alias badly.
+ */
+void
+ThumbnailSidecar::Shrink(const unsigned char *src, int sw, int sh,
+    unsigned char *dst, int dw, int dh)
+{
+    const unsigned char *cur = src;
+    int buf = 0;
+    
+    while (sw / 2 > dw && sh / 2 > dh) {
+        VideoIngest::ScalePlane(cur, sw, sh, mScratch[buf], sw / 2, sh / 2);
+        cur = mScratch[buf];
+        buf ^= 1;
+        sw /= 2;
+        sh /= 2;
+    }
+    VideoIngest::ScalePlane(cur, sw, sh, dst, dw, dh);
+}
+
+nsresult
+ThumbnailSidecar::Add(const unsigned char *yuv, PRInt64 frame, int dups)
+{
+    unsigned char *thumb = mRecord + THUMB_RECORD_HEADER;
+    int luma = mWidth * mHeight;
+    int thumbLuma = THUMB_WIDTH * THUMB_HEIGHT;
+    
+    if (!mFile)
+        return NS_ERROR_NOT_INITIALIZED;
+    
+    PutLE(mRecord, frame, 8);
+    PutLE(mRecord + 8, frame * 1000 * mFpsD / mFpsN, 8);
+    Shrink(yuv, mWidth, mHeight, thumb, THUMB_WIDTH, THUMB_HEIGHT);
+    Shrink(yuv + luma, mWidth / 2, mHeight / 2,
+        thumb + thumbLuma, THUMB_WIDTH / 2, THUMB_HEIGHT / 2);
+    Shrink(yuv + luma * 5 / 4, mWidth / 2, mHeight / 2,
+        thumb + thumbLuma * 5 / 4, THUMB_WIDTH / 2, THUMB_HEIGHT / 2);
+    
+    if (fwrite(mRecord, RecordSize(), 1, mFile) != 1) {
+        fprintf(stderr, "Could not write thumbnail, giving up on them\n");
+        fclose(mFile);
+        mFile = NULL;
+        return NS_ERROR_FAILURE;
+    }
+    mCount++;
+    if (mInterval)
+        mNext = ((frame + dups) / mInterval + 1) * mInterval;
+    return NS_OK;
+}
+
+/*
+ * Open a sidecar for reading and check its header
+ */
+static FILE *
+OpenSidecar(const char *path, PRUint32 *count)
+{
+    unsigned char header[THUMB_HEADER_SIZE];
+    FILE *f;
+    
+    if (!(f = fopen(path, "rb")))
+        return NULL;
+    if (fread(header, THUMB_HEADER_SIZE, 1, f) != 1 ||
+        memcmp(header, THUMB_MAGIC, 8) ||
+        GetLE(header + 8, 4) != THUMB_WIDTH ||
+        GetLE(header + 12, 4) != THUMB_HEIGHT) {
+        fprintf(stderr, "Not a thumbnail file!\n");
+        fclose(f);
+        return NULL;
+    }
+    
+    /* A record cut short by a crash is ignored */
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f) - THUMB_HEADER_SIZE;
+    *count = size > 0 ? size / ThumbnailSidecar::RecordSize() : 0;
+    return f;
+}
+
+nsresult
+ThumbnailSidecar::Index(const char *path, nsACString &json)
+{
+    unsigned char rec[THUMB_RECORD_HEADER];
+    char buf[64];
+    PRUint32 count;
+    FILE *f;
+    
+    if (!(f = OpenSidecar(path, &count)))
+        return NS_ERROR_FILE_NOT_FOUND;
+    
+    PR_snprintf(buf, sizeof(buf), "{\"width\":%d,\"height\":%d,\"thumbs\":[",
+        THUMB_WIDTH, THUMB_HEIGHT);
+    json.Assign(buf);
+    for (PRUint32 i = 0; i < count; i++) {
+        fseek(f, THUMB_HEADER_SIZE + (long)i * RecordSize(), SEEK_SET);
+        if (fread(rec, THUMB_RECORD_HEADER, 1, f) != 1)
+            break;
+        PR_snprintf(buf, sizeof(buf), "%s[%lld,%lld]", i ? "," : "",
+            (PRInt64)GetLE(rec, 8), (PRInt64)GetLE(rec + 8, 8));
+        json.Append(buf);
+    }
+    json.Append("]}");
+    fclose(f);
+    return NS_OK;
+}
+
+nsresult
+ThumbnailSidecar::Read(const char *path, PRUint32 index, unsigned char *yuv)
+{
+    PRUint32 count;
+    FILE *f;
+    
+    if (!(f = OpenSidecar(path, &count)))
+        return NS_ERROR_FILE_NOT_FOUND;
+    if (index >= count) {
+        fclose(f);
+        return NS_ERROR_INVALID_ARG;
+    }
+    
+    fseek(f, THUMB_HEADER_SIZE + (long)index * RecordSize() +
+        THUMB_RECORD_HEADER, SEEK_SET);
+    size_t read = fread(yuv, ThumbSize(), 1, f);
+    fclose(f);
+    return read == 1 ? NS_OK : NS_ERROR_FAILURE;
+}
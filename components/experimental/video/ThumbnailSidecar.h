@@ -0,0 +1,106 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef ThumbnailSidecar_h_
+#define ThumbnailSidecar_h_
+
+#include "prtypes.h"
+#include "nscore.h"
+#include "nsStringAPI.h"
+
+#include <stdio.h>
+
+#define THUMB_WIDTH 160
+#define THUMB_HEIGHT 120
+#define THUMB_MAGIC "OGTHUMB1"
+#define THUMB_HEADER_SIZE 24
+#define THUMB_RECORD_HEADER 16
+
+/*
+ * Writes small I420 thumbnails next to a recording, in <file>.thumbs, so
+ * a filmstrip or seek preview can be shown without decoding the video.
+ *
+ * The file is a 24 byte header (magic, thumbnail width and height, frame
+ * rate numerator and denominator) followed by fixed size records: the
+ * frame number, its time in milliseconds (both 64 bit), and the planes.
+ * All integers are little-endian. Fixed size records are their own
+ * index: record i is at THUMB_HEADER_SIZE + i * RecordSize().
+ */
+class ThumbnailSidecar
+{
+public:
+    ThumbnailSidecar();
+    ~ThumbnailSidecar();
+
+    /* interval is in frames; 0 takes one at every keyframe */
+    nsresult Open(const char *path, int width, int height,
+        int fpsN, int fpsD, int interval);
+    PRBool IsOpen() { return mFile != NULL; }
+    void Close();
+
+    /* Whether the frame starting at 'frame' and repeated 'dups' times
+     * should be kept; 'keyframe' is whether it is coded as one */
+    PRBool Due(PRInt64 frame, int dups, PRBool keyframe);
+    nsresult Add(const unsigned char *yuv, PRInt64 frame, int dups);
+    PRUint32 Count() { return mCount; }
+
+    static int RecordSize() { return THUMB_RECORD_HEADER + ThumbSize(); }
+    static int ThumbSize() { return THUMB_WIDTH * THUMB_HEIGHT * 3 / 2; }
+
+    /* JSON description of a sidecar: size and [frame, msec] per thumb */
+    static nsresult Index(const char *path, nsACString &json);
+    /* The I420 planes of one thumbnail */
+    static nsresult Read(const char *path, PRUint32 index,
+        unsigned char *yuv);
+
+private:
+    void Shrink(const unsigned char *src, int sw, int sh,
+        unsigned char *dst, int dw, int dh);
+
+    FILE *mFile;
+    int mWidth;
+    int mHeight;
+    int mFpsN;
+    int mFpsD;
+    int mInterval;
+    PRInt64 mNext;
+    PRUint32 mCount;
+    unsigned char *mScratch[2];
+    unsigned char *mRecord;
+};
+
+#endif
@@ -0,0 +1,703 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "Transcoder.h"
+#include "VideoSession.h"
+
+#include <stdlib.h>
+
+/*
+ * Carries the worker's progress to the main thread
+ */
+class TranscodeEvent : public nsRunnable
+{
+public:
+    TranscodeEvent(Transcoder *t, PRUint32 generation, PRBool done,
+        nsresult status, PRUint32 frames, double fraction, PRUint32 elapsed)
+        : mTranscoder(t)
+        , mGeneration(generation)
+        , mDone(done)
+        , mStatus(status)
+        , mFrames(frames)
+        , mFraction(fraction)
+        , mElapsed(elapsed)
+    {
+    }
+
+    NS_IMETHOD Run()
+    {
+        mTranscoder->Deliver(mGeneration, mDone, mStatus, mFrames,
+            mFraction, mElapsed);
+        return NS_OK;
+    }
+
+private:
+    Transcoder *mTranscoder;
+    PRUint32 mGeneration;
+    PRBool mDone;
+    nsresult mStatus;
+    PRUint32 mFrames;
+    double mFraction;
+    PRUint32 mElapsed;
+};
+
+/*
+ * Wakes the worker when a non-blocking input has more for it. It is
+ * refcounted on its own, so a callback that comes after the transcode
+ * is over still finds it.
+ */
+class TranscodeWaiter : public nsIInputStreamCallback
+{
+public:
+    NS_DECL_ISUPPORTS
+    NS_DECL_NSIINPUTSTREAMCALLBACK
+
+    TranscodeWaiter()
+        : mLock(nsnull)
+        , mCond(nsnull)
+        , mReady(PR_FALSE)
+    {
+    }
+
+    ~TranscodeWaiter()
+    {
+        if (mCond)
+            PR_DestroyCondVar(mCond);
+        if (mLock)
+            PR_DestroyLock(mLock);
+    }
+
+    nsresult Init()
+    {
+        if (!(mLock = PR_NewLock()) || !(mCond = PR_NewCondVar(mLock)))
+            return NS_ERROR_OUT_OF_MEMORY;
+        return NS_OK;
+    }
+
+    /* Sleep until the stream is readable or closed, or 'timeout' */
+    nsresult Wait(nsIAsyncInputStream *stream, PRIntervalTime timeout)
+    {
+        PR_Lock(mLock);
+        mReady = PR_FALSE;
+        PR_Unlock(mLock);
+
+        nsresult rv = stream->AsyncWait(this, 0, 0, nsnull);
+        if (NS_FAILED(rv))
+            return rv;
+
+        PR_Lock(mLock);
+        if (!mReady)
+            PR_WaitCondVar(mCond, timeout);
+        PR_Unlock(mLock);
+        return NS_OK;
+    }
+
+private:
+    PRLock *mLock;
+    PRCondVar *mCond;
+    PRBool mReady;
+};
+
+NS_IMPL_THREADSAFE_ISUPPORTS1(TranscodeWaiter, nsIInputStreamCallback)
+
+NS_IMETHODIMP
+TranscodeWaiter::OnInputStreamReady(nsIAsyncInputStream *stream)
+{
+    PR_Lock(mLock);
+    mReady = PR_TRUE;
+    PR_NotifyCondVar(mCond);
+    PR_Unlock(mLock);
+    return NS_OK;
+}
+
+Transcoder::Transcoder()
+    : mThread(nsnull)
+    , mLock(nsnull)
+    , mCancel(PR_FALSE)
+    , mGeneration(0)
+    , mIn(nsnull)
+    , mTotal(0)
+    , mRead(0)
+    , mY4M(PR_FALSE)
+    , mOut(nsnull)
+    , mEncoder(nsnull)
+    , mChunked(nsnull)
+    , mThreads(1)
+    , mFrame(nsnull)
+    , mFrames(0)
+    , mStart(0)
+{
+}
+
+Transcoder::~Transcoder()
+{
+    Cancel();
+    Join();
+    if (mLock)
+        PR_DestroyLock(mLock);
+}
+
+PRBool
+Transcoder::Running()
+{
+    return mThread != nsnull;
+}
+
+PRBool
+Transcoder::Cancelled()
+{
+    PR_Lock(mLock);
+    PRBool cancel = mCancel;
+    PR_Unlock(mLock);
+    return cancel;
+}
+
+void
+Transcoder::Join()
+{
+    if (mThread) {
+        PR_JoinThread(mThread);
+        mThread = nsnull;
+    }
+}
+
+nsresult
+Transcoder::Start(FILE *file, nsIInputStream *stream, PRUint32 width,
+    PRUint32 height, PRUint32 fpsN, PRUint32 fpsD, int threads,
+    FILE *out, IVideoTranscodeListener *listener)
+{
+    if (mThread) {
+        fprintf(stderr, "Transcode in progress!\n");
+        return NS_ERROR_FAILURE;
+    }
+    if (!mLock && !(mLock = PR_NewLock()))
+        return NS_ERROR_OUT_OF_MEMORY;
+
+    mY4M = (width == 0);
+    if (!mY4M && (!height || !fpsN || !fpsD))
+        return NS_ERROR_INVALID_ARG;
+
+    /* The worker can wait on a non-blocking stream only if it is async;
+     * an async one can also be closed under it to cancel */
+    mAsync = nsnull;
+    if (stream) {
+        PRBool nonBlocking = PR_FALSE;
+        if (NS_FAILED(stream->IsNonBlocking(&nonBlocking)))
+            return NS_ERROR_INVALID_ARG;
+        mAsync = do_QueryInterface(stream);
+        if (nonBlocking && !mAsync) {
+            fprintf(stderr, "Non-blocking transcode input must be async!\n");
+            return NS_ERROR_INVALID_ARG;
+        }
+        if (mAsync && !mWaiter) {
+            nsRefPtr<TranscodeWaiter> waiter = new TranscodeWaiter();
+            if (!waiter || NS_FAILED(waiter->Init()))
+                return NS_ERROR_OUT_OF_MEMORY;
+            mWaiter = waiter;
+        }
+    }
+
+    mIn = file;
+    mStream = stream;
+    mOut = out;
+    mListener = listener;
+    mWidth = width;
+    mHeight = height;
+    mFpsN = fpsN;
+    mFpsD = fpsD;
+    mAspectN = mAspectD = 0;
+    mThreads = threads;
+    mCancel = PR_FALSE;
+    mFrames = 0;
+    mRead = 0;
+    mGeneration++;
+
+    /* Size of the input, for the progress fraction */
+    mTotal = -1;
+    if (mIn) {
+        if (!fseek(mIn, 0, SEEK_END)) {
+            mTotal = ftell(mIn);
+            fseek(mIn, 0, SEEK_SET);
+        }
+    } else {
+        PRUint32 avail = 0;
+        if (NS_SUCCEEDED(mStream->Available(&avail)) && avail)
+            mTotal = avail;
+    }
+
+    mThread = PR_CreateThread(PR_USER_THREAD, Run, this,
+        PR_PRIORITY_LOW, PR_GLOBAL_THREAD, PR_JOINABLE_THREAD, 0);
+    if (!mThread) {
+        fprintf(stderr, "Could not start transcoder thread!\n");
+        mListener = nsnull;
+        mStream = nsnull;
+        mAsync = nsnull;
+        return NS_ERROR_FAILURE;
+    }
+    return NS_OK;
+}
+
+/*
+ * The worker notices between frames and while waiting for input. An
+ * async input is closed so a read blocked on it fails at once; any other
+ * read is left to finish.
+ */
+void
+Transcoder::Cancel()
+{
+    if (!mThread)
+        return;
+
+    PR_Lock(mLock);
+    mCancel = PR_TRUE;
+    nsCOMPtr<nsIAsyncInputStream> async = mAsync;
+    PR_Unlock(mLock);
+    if (async)
+        async->CloseWithStatus(NS_ERROR_ABORT);
+}
+
+void
+Transcoder::Deliver(PRUint32 generation, PRBool done, nsresult status,
+    PRUint32 frames, double fraction, PRUint32 elapsed)
+{
+    if (generation != mGeneration || !mListener)
+        return;
+
+    if (!done) {
+        if (!mCancel)
+            mListener->OnProgress(frames, fraction);
+        return;
+    }
+
+    /* The worker has posted its last event and is on its way out */
+    Join();
+    if (mCancel)
+        status = NS_ERROR_ABORT;
+    nsCOMPtr<IVideoTranscodeListener> listener = mListener;
+    mListener = nsnull;
+    listener->OnComplete(status, frames, elapsed);
+}
+
+void
+Transcoder::Post(PRBool done, nsresult status)
+{
+    double fraction = mTotal > 0 ? (double)mRead / (double)mTotal : -1;
+    nsCOMPtr<nsIRunnable> ev = new TranscodeEvent(this, mGeneration, done,
+        status, mFrames, fraction,
+        (PRUint32)((PR_Now() - mStart) / PR_USEC_PER_MSEC));
+    if (ev)
+        NS_DispatchToMainThread(ev);
+}
+
+void
+Transcoder::Run(void *arg)
+{
+    Transcoder *t = static_cast<Transcoder*>(arg);
+
+    t->mStart = PR_Now();
+    nsresult rv = t->Encode();
+
+    if (t->mIn) {
+        fclose(t->mIn);
+        t->mIn = nsnull;
+    } else {
+        /* Cancel() may be closing it too */
+        nsCOMPtr<nsIInputStream> stream;
+        PR_Lock(t->mLock);
+        stream.swap(t->mStream);
+        t->mAsync = nsnull;
+        PR_Unlock(t->mLock);
+        stream->Close();
+    }
+    if (t->mOut && NS_FAILED(OutputFile::Close(t->mOut)) &&
+        NS_SUCCEEDED(rv))
+        rv = NS_ERROR_FAILURE;
+    t->mOut = nsnull;
+
+    t->Post(PR_TRUE, rv);
+}
+
+nsresult
+Transcoder::Read(void *buf, PRUint32 len, PRUint32 *got)
+{
+    *got = 0;
+
+    if (mIn) {
+        *got = fread(buf, 1, len, mIn);
+        mRead += *got;
+        return (*got < len && ferror(mIn)) ? NS_ERROR_FAILURE : NS_OK;
+    }
+
+    while (*got < len) {
+        PRUint32 n = 0;
+        nsresult rv = mStream->Read((char *)buf + *got, len - *got, &n);
+        if (rv == NS_BASE_STREAM_WOULD_BLOCK && mAsync) {
+            if (Cancelled())
+                return NS_ERROR_ABORT;
+            rv = mWaiter->Wait(mAsync,
+                PR_MillisecondsToInterval(TRANSCODE_WAIT_INTERVAL));
+            if (NS_FAILED(rv))
+                return rv;
+            continue;
+        }
+        /* A pipe whose writer has closed reads as the end */
+        if (rv == NS_BASE_STREAM_CLOSED || (NS_SUCCEEDED(rv) && !n))
+            break;
+        if (NS_FAILED(rv)) {
+            fprintf(stderr, "Could not read transcode input!\n");
+            return rv;
+        }
+        *got += n;
+        mRead += n;
+    }
+    return NS_OK;
+}
+
+/*
+ * "YUV4MPEG2 W640 H480 F30000:1001 Ip A1:1 C420jpeg", only 4:2:0 input
+ * is taken as that is all the encoder is set up for
+ */
+nsresult
+Transcoder::ReadY4MHeader()
+{
+    char line[Y4M_MAX_HEADER];
+    PRUint32 len = 0, got;
+    nsresult rv;
+
+    while (len < sizeof(line) - 1) {
+        rv = Read(&line[len], 1, &got);
+        if (NS_FAILED(rv))
+            return rv;
+        if (got != 1)
+            return NS_ERROR_UNEXPECTED;
+        if (line[len] == '\n')
+            break;
+        len++;
+    }
+    line[len] = 0;
+
+    if (strncmp(line, "YUV4MPEG2 ", 10)) {
+        fprintf(stderr, "Not a YUV4MPEG2 stream!\n");
+        return NS_ERROR_UNEXPECTED;
+    }
+
+    char *tok = strtok(line + 10, " ");
+    while (tok) {
+        switch (tok[0]) {
+            case 'W':
+                mWidth = atoi(tok + 1);
+                break;
+            case 'H':
+                mHeight = atoi(tok + 1);
+                break;
+            case 'F':
+                sscanf(tok + 1, "%u:%u", &mFpsN, &mFpsD);
+                break;
+            case 'A':
+                sscanf(tok + 1, "%u:%u", &mAspectN, &mAspectD);
+                break;
+            case 'C':
+                if (strncmp(tok + 1, "420", 3)) {
+                    fprintf(stderr, "Unsupported Y4M colourspace %s!\n",
+                        tok + 1);
+                    return NS_ERROR_NOT_IMPLEMENTED;
+                }
+                break;
+        }
+        tok = strtok(NULL, " ");
+    }
+
+    if (!mWidth || !mHeight || !mFpsN || !mFpsD)
+        return NS_ERROR_UNEXPECTED;
+    return NS_OK;
+}
+
+/*
+ * Read the next frame into the picture region of mFrame
+ */
+nsresult
+Transcoder::ReadFrame(PRBool *eof)
+{
+    PRUint32 y, n;
+    nsresult rv;
+    *eof = PR_FALSE;
+
+    if (mY4M) {
+        char tag[6];
+        rv = Read(tag, 5, &n);
+        if (NS_FAILED(rv))
+            return rv;
+        if (n == 0) {
+            *eof = PR_TRUE;
+            return NS_OK;
+        }
+        tag[5] = 0;
+        if (n != 5 || strcmp(tag, "FRAME"))
+            return NS_ERROR_UNEXPECTED;
+        /* Skip any frame parameters */
+        do {
+            rv = Read(tag, 1, &n);
+            if (NS_FAILED(rv))
+                return rv;
+            if (n != 1) {
+                fprintf(stderr, "Truncated frame in transcode input!\n");
+                return NS_ERROR_UNEXPECTED;
+            }
+        } while (tag[0] != '\n');
+    }
+
+    unsigned char *planes[3];
+    PRUint32 widths[3], heights[3], strides[3];
+    planes[0] = mFrame;
+    planes[1] = mFrame + mFrameW * mFrameH;
+    planes[2] = planes[1] + (mFrameW >> 1) * (mFrameH >> 1);
+    widths[0] = mWidth;
+    heights[0] = mHeight;
+    strides[0] = mFrameW;
+    widths[1] = widths[2] = mWidth >> 1;
+    heights[1] = heights[2] = mHeight >> 1;
+    strides[1] = strides[2] = mFrameW >> 1;
+
+    for (int p = 0; p < 3; p++) {
+        for (y = 0; y < heights[p]; y++) {
+            rv = Read(planes[p] + y * strides[p], widths[p], &n);
+            if (NS_FAILED(rv))
+                return rv;
+            if (n != widths[p]) {
+                /* A clean end only happens between frames */
+                if (p == 0 && y == 0 && n == 0 && !mY4M) {
+                    *eof = PR_TRUE;
+                    return NS_OK;
+                }
+                fprintf(stderr, "Truncated frame in transcode input!\n");
+                return NS_ERROR_UNEXPECTED;
+            }
+        }
+    }
+    return NS_OK;
+}
+
+void
+Transcoder::WritePacket(ogg_packet *op)
+{
+    ogg_page og;
+
+    ogg_stream_packetin(&mOgg, op);
+    while (ogg_stream_pageout(&mOgg, &og))
+        mWriter.WritePage(&og);
+}
+
+void
+Transcoder::OnPacket(void *data, ogg_packet *op)
+{
+    static_cast<Transcoder*>(data)->WritePacket(op);
+}
+
+/*
+ * Create the encoder and write the headers
+ */
+nsresult
+Transcoder::Setup(th_info *ti)
+{
+    int ret;
+    th_comment tc;
+    ogg_page page;
+    ogg_packet packet;
+
+    th_info_init(ti);
+    /* Must be multiples of 16 */
+    ti->frame_width = mFrameW = ((mWidth + 15) >> 4) << 4;
+    ti->frame_height = mFrameH = ((mHeight + 15) >> 4) << 4;
+    ti->pic_width = mWidth;
+    ti->pic_height = mHeight;
+    ti->pic_x = 0;
+    ti->pic_y = 0;
+    ti->fps_numerator = mFpsN;
+    ti->fps_denominator = mFpsD;
+    ti->aspect_numerator = mAspectN;
+    ti->aspect_denominator = mAspectD;
+    ti->colorspace = TH_CS_UNSPECIFIED;
+    ti->pixel_fmt = TH_PF_420;
+    ti->target_bitrate = 0;
+    ti->quality = VIDEO_QUALITY;
+
+    if (!(mEncoder = th_encode_alloc(ti))) {
+        fprintf(stderr, "Could not create Theora encoder!\n");
+        return NS_ERROR_FAILURE;
+    }
+    ogg_uint32_t kf = KEYFRAME_FREQ;
+    th_encode_ctl(mEncoder, TH_ENCCTL_SET_KEYFRAME_FREQUENCY_FORCE,
+        &kf, sizeof(kf));
+
+    if (ogg_stream_init(&mOgg, rand())) {
+        fprintf(stderr, "Failed ogg_stream_init!\n");
+        return NS_ERROR_FAILURE;
+    }
+
+    /* First header on a page of its own, the rest flushed after it so
+     * the data starts on a fresh page */
+    th_comment_init(&tc);
+    for (int i = 0; ; i++) {
+        ret = th_encode_flushheader(mEncoder, &tc, &packet);
+        if (ret < 0) {
+            fprintf(stderr, "Internal Theora library error.\n");
+            th_comment_clear(&tc);
+            return NS_ERROR_FAILURE;
+        } else if (!ret) {
+            break;
+        }
+        ogg_stream_packetin(&mOgg, &packet);
+        if (i == 0 && ogg_stream_pageout(&mOgg, &page) == 1)
+            mWriter.WritePage(&page);
+    }
+    th_comment_clear(&tc);
+    while (ogg_stream_flush(&mOgg, &page))
+        mWriter.WritePage(&page);
+
+    return NS_OK;
+}
+
+nsresult
+Transcoder::Encode()
+{
+    th_info ti;
+    ogg_page page;
+    ogg_packet op;
+    nsresult rv;
+    PRBool eof = PR_FALSE;
+    /* Inline, a frame's packets are only taken once we know whether it
+     * was the last, so the last one can carry e_o_s */
+    PRBool queued = PR_FALSE;
+
+    if (mY4M && NS_FAILED(rv = ReadY4MHeader()))
+        return rv;
+    /* 4:2:0 needs whole chroma samples */
+    if ((mWidth & 1) || (mHeight & 1)) {
+        fprintf(stderr, "Frame size must be even!\n");
+        return NS_ERROR_INVALID_ARG;
+    }
+
+    rv = mWriter.Open(mOut, FLUSH_INTERVAL, WRITE_HIGH_WATER);
+    if (NS_FAILED(rv))
+        return rv;
+
+    rv = Setup(&ti);
+    if (NS_SUCCEEDED(rv) && mThreads > 1) {
+        int chunk = mFpsN / mFpsD;
+        mChunked = new ChunkedEncoder();
+        if (!mChunked)
+            rv = NS_ERROR_OUT_OF_MEMORY;
+        else
+            rv = mChunked->Init(&ti, mThreads, chunk > 0 ? chunk : 1,
+                mThreads * 2, OnPacket, this);
+        if (NS_FAILED(rv)) {
+            delete mChunked;
+            mChunked = nsnull;
+        }
+    }
+    th_info_clear(&ti);
+
+    if (NS_SUCCEEDED(rv) &&
+        !(mFrame = (unsigned char *)PR_Calloc(1, mFrameW * mFrameH * 3 / 2)))
+        rv = NS_ERROR_OUT_OF_MEMORY;
+
+    th_ycbcr_buffer ycbcr;
+    ycbcr[0].width = mFrameW;
+    ycbcr[0].height = mFrameH;
+    ycbcr[0].stride = mFrameW;
+    ycbcr[1].width = ycbcr[2].width = mFrameW >> 1;
+    ycbcr[1].height = ycbcr[2].height = mFrameH >> 1;
+    ycbcr[1].stride = ycbcr[2].stride = mFrameW >> 1;
+    ycbcr[0].data = mFrame;
+    ycbcr[1].data = mFrame + mFrameW * mFrameH;
+    ycbcr[2].data = ycbcr[1].data + (mFrameW >> 1) * (mFrameH >> 1);
+
+    while (NS_SUCCEEDED(rv)) {
+        if (Cancelled()) {
+            rv = NS_ERROR_ABORT;
+            break;
+        }
+
+        rv = ReadFrame(&eof);
+        if (NS_FAILED(rv))
+            break;
+        if (queued) {
+            while (th_encode_packetout(mEncoder, eof, &op) > 0)
+                WritePacket(&op);
+            queued = PR_FALSE;
+        }
+        if (eof)
+            break;
+
+        if (mChunked) {
+            rv = mChunked->PushFrame(ycbcr, 0, PR_TRUE);
+        } else if (th_encode_ycbcr_in(mEncoder, ycbcr) != 0) {
+            fprintf(stderr, "Could not encode frame!\n");
+            rv = NS_ERROR_FAILURE;
+        } else {
+            queued = PR_TRUE;
+        }
+        mFrames++;
+
+        /* Offline, so wait for the disk rather than drop anything */
+        while (mWriter.Congested() && !Cancelled())
+            PR_Sleep(PR_MillisecondsToInterval(10));
+
+        if (mFrames % TRANSCODE_PROGRESS_FRAMES == 0)
+            Post(PR_FALSE, NS_OK);
+    }
+
+    if (mChunked) {
+        nsresult frv = mChunked->Finish();
+        if (NS_SUCCEEDED(rv))
+            rv = frv;
+        delete mChunked;
+        mChunked = nsnull;
+    }
+    if (mEncoder) {
+        th_encode_free(mEncoder);
+        mEncoder = nsnull;
+        while (ogg_stream_flush(&mOgg, &page))
+            mWriter.WritePage(&page);
+        ogg_stream_clear(&mOgg);
+    }
+    PR_Free(mFrame);
+    mFrame = nsnull;
+
+    nsresult wrv = mWriter.Close();
+    return NS_SUCCEEDED(rv) ? wrv : rv;
+}
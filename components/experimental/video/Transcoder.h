@@ -0,0 +1,154 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef Transcoder_h_
+#define Transcoder_h_
+
+#include <stdio.h>
+#include <string.h>
+#include <ogg/ogg.h>
+#include <theora/theoraenc.h>
+
+#include "IVideoRecorder.h"
+#include "ChunkedEncoder.h"
+#include "OggWriter.h"
+#include "OutputFile.h"
+
+#include "prmem.h"
+#include "prlock.h"
+#include "prcvar.h"
+#include "prthread.h"
+#include "nsCOMPtr.h"
+#include "nsAutoPtr.h"
+#include "nsThreadUtils.h"
+#include "nsIInputStream.h"
+#include "nsIAsyncInputStream.h"
+
+/* Tell the listener how far we are every this many frames */
+#define TRANSCODE_PROGRESS_FRAMES 30
+#define Y4M_MAX_HEADER 256
+/* How often a worker waiting on a non-blocking input checks for cancel */
+#define TRANSCODE_WAIT_INTERVAL 100
+
+class TranscodeWaiter;
+
+/*
+ * Encodes a file or stream of uncompressed video to Ogg/Theora on a
+ * thread of its own, as fast as the encoder goes. Input is either
+ * YUV4MPEG2, which describes itself, or headerless I420 frames of a size
+ * and rate given by the caller. With more than one thread the chunked
+ * encoder is used, fed with blocking pushes so no frame is ever dropped.
+ *
+ * Streams are read on the worker, so they must be native and safe to use
+ * from any thread. A non-blocking one must be an nsIAsyncInputStream: the
+ * worker waits on it whenever it runs dry. Input that fails or ends part
+ * way through a frame fails the transcode.
+ *
+ * The listener is only ever touched on the main thread: the worker posts
+ * events there, and its last one completes the transcode. Events that
+ * belong to an earlier transcode are ignored.
+ */
+class Transcoder
+{
+public:
+    Transcoder();
+    ~Transcoder();
+
+    /* width == 0 means the input is Y4M */
+    nsresult Start(FILE *file, nsIInputStream *stream, PRUint32 width,
+        PRUint32 height, PRUint32 fpsN, PRUint32 fpsD, int threads,
+        FILE *out, IVideoTranscodeListener *listener);
+    /* Tell the worker (if any) to stop, without waiting for it; the
+     * listener hears NS_ERROR_ABORT once it has */
+    void Cancel();
+    PRBool Running();
+
+    /* Main thread end of the worker's events */
+    void Deliver(PRUint32 generation, PRBool done, nsresult status,
+        PRUint32 frames, double fraction, PRUint32 elapsed);
+
+private:
+    static void Run(void *arg);
+    nsresult Encode();
+    nsresult ReadY4MHeader();
+    nsresult ReadFrame(PRBool *eof);
+    /* Fewer than 'len' bytes in 'got' only at the end of the input */
+    nsresult Read(void *buf, PRUint32 len, PRUint32 *got);
+    nsresult Setup(th_info *ti);
+    void WritePacket(ogg_packet *op);
+    static void OnPacket(void *data, ogg_packet *op);
+    void Post(PRBool done, nsresult status);
+    void Join();
+    PRBool Cancelled();
+
+    PRThread *mThread;
+    PRLock *mLock;
+    PRBool mCancel;
+    PRUint32 mGeneration;
+    nsCOMPtr<IVideoTranscodeListener> mListener;
+
+    FILE *mIn;
+    nsCOMPtr<nsIInputStream> mStream;
+    /* mStream, if it is async */
+    nsCOMPtr<nsIAsyncInputStream> mAsync;
+    nsRefPtr<TranscodeWaiter> mWaiter;
+    PRInt64 mTotal;
+    PRInt64 mRead;
+    PRBool mY4M;
+
+    FILE *mOut;
+    OggWriter mWriter;
+    ogg_stream_state mOgg;
+    th_enc_ctx *mEncoder;
+    ChunkedEncoder *mChunked;
+    int mThreads;
+
+    PRUint32 mWidth;
+    PRUint32 mHeight;
+    PRUint32 mFpsN;
+    PRUint32 mFpsD;
+    PRUint32 mAspectN;
+    PRUint32 mAspectD;
+    /* One frame, padded out to the encoder's frame size */
+    unsigned char *mFrame;
+    PRUint32 mFrameW;
+    PRUint32 mFrameH;
+    PRUint32 mFrames;
+    PRTime mStart;
+};
+
+#endif
@@ -0,0 +1,580 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "VideoIngest.h"
+#include "prmem.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Widest plane the vector bilinear path keeps its tables for */
+#define SCALE_MAX_WIDTH 2048
+
+VideoIngest::VideoIngest()
+    : mFourcc(VIDCAP_FOURCC_I420)
+    , mInWidth(0)
+    , mInHeight(0)
+    , mCropX(0)
+    , mCropY(0)
+    , mCropWidth(0)
+    , mCropHeight(0)
+    , mWidth(0)
+    , mHeight(0)
+    , mFrameSize(0)
+    , mConverted(NULL)
+    , mScaled(NULL)
+    , mRow(NULL)
+{
+}
+
+VideoIngest::~VideoIngest()
+{
+    Free();
+}
+
+void
+VideoIngest::Free()
+{
+    if (mConverted)
+        PR_Free(mConverted);
+    if (mScaled)
+        PR_Free(mScaled);
+    if (mRow)
+        PR_Free(mRow);
+    mConverted = mScaled = mRow = NULL;
+}
+
+PRBool
+VideoIngest::Supported(int fourcc)
+{
+    return Rank(fourcc) >= 0;
+}
+
+/*
+ * Cheaper conversions first: I420 needs nothing, packed 4:2:2 only a
+ * shuffle and a vertical average, RGB a matrix multiply per pixel.
+ */
+int
+VideoIngest::Rank(int fourcc)
+{
+    switch (fourcc) {
+        case VIDCAP_FOURCC_I420:
+            return 0;
+        case VIDCAP_FOURCC_YUY2:
+        case VIDCAP_FOURCC_UYVY:
+        case VIDCAP_FOURCC_2VUY:
+            return 1;
+        case VIDCAP_FOURCC_RGB32:
+            return 2;
+        case VIDCAP_FOURCC_RGB24:
+            return 3;
+        default:
+            return -1;
+    }
+}
+
+int
+VideoIngest::InputSize(int fourcc, int w, int h)
+{
+    switch (fourcc) {
+        case VIDCAP_FOURCC_I420:
+            return w * h * 3 / 2;
+        case VIDCAP_FOURCC_YUY2:
+        case VIDCAP_FOURCC_UYVY:
+        case VIDCAP_FOURCC_2VUY:
+            return w * h * 2;
+        case VIDCAP_FOURCC_RGB32:
+            return w * h * 4;
+        case VIDCAP_FOURCC_RGB24:
+            return w * h * 3;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * Walk the formats the camera offers (as the source registry remembers
+ * them, asking the driver is slow) and bind the best one. The exact
+ * size wins, then the smallest size that covers it (downscaling loses
+ * nothing), then the largest one below it. Among equal sizes a rate that
+ * keeps up with ours beats one that doesn't, and a cheaper conversion
+ * beats a dearer one. If the camera lists nothing we understand we ask
+ * vidcap for I420 at our size as we always did.
+ */
+nsresult
+VideoIngest::Bind(vidcap_src *source, const struct vidcap_fmt_info *formats,
+    int count, int width, int height, int fpsN, int fpsD)
+{
+    struct vidcap_fmt_info fmt, best;
+    PRInt64 score, bestScore = -1;
+    PRInt64 area = (PRInt64)width * height;
+    
+    for (int i = 0; i < count; i++) {
+        fmt = formats[i];
+        if (!Supported(fmt.fourcc) || fmt.width < 2 || fmt.height < 2 ||
+            (fmt.width & 1) || (fmt.height & 1))
+            continue;
+        
+        PRInt64 fmtArea = (PRInt64)fmt.width * fmt.height;
+        if (fmt.width == width && fmt.height == height)
+            score = 0;
+        else if (fmt.width >= width && fmt.height >= height)
+            score = ((PRInt64)1 << 48) + ((fmtArea - area) << 16);
+        else
+            score = ((PRInt64)2 << 48) + ((area - fmtArea) << 16);
+        if (fmt.fps_denominator > 0 && (PRInt64)fmt.fps_numerator * fpsD <
+            (PRInt64)fpsN * fmt.fps_denominator)
+            score += 1 << 8;
+        score += Rank(fmt.fourcc);
+        
+        if (bestScore < 0 || score < bestScore) {
+            bestScore = score;
+            best = fmt;
+        }
+    }
+    
+    if (bestScore >= 0 && !vidcap_format_bind(source, &best))
+        return Init(best.fourcc, best.width, best.height, width, height);
+    
+    fmt.width = width;
+    fmt.height = height;
+    fmt.fourcc = VIDCAP_FOURCC_I420;
+    fmt.fps_numerator = fpsN;
+    fmt.fps_denominator = fpsD;
+    if (vidcap_format_bind(source, &fmt)) {
+        fprintf(stderr, "Failed vidcap_format_bind()\n");
+        return NS_ERROR_FAILURE;
+    }
+    return Init(VIDCAP_FOURCC_I420, width, height, width, height);
+}
+
+nsresult
+VideoIngest::Init(int fourcc, int inWidth, int inHeight,
+    int width, int height)
+{
+    Free();
+    if (!Supported(fourcc) || (inWidth & 1) || (inHeight & 1) ||
+        (width & 1) || (height & 1)) {
+        fprintf(stderr, "Unsupported capture format!\n");
+        return NS_ERROR_INVALID_ARG;
+    }
+    
+    mFourcc = fourcc;
+    mInWidth = inWidth;
+    mInHeight = inHeight;
+    mWidth = width;
+    mHeight = height;
+    mFrameSize = InputSize(fourcc, inWidth, inHeight);
+    
+    /* Cut the sides off a wider input, or the top and bottom off a
+       taller one, so that scaling keeps the picture's proportions */
+    mCropWidth = inWidth;
+    mCropHeight = inHeight;
+    if ((PRInt64)inWidth * height > (PRInt64)width * inHeight)
+        mCropWidth = (int)((PRInt64)inHeight * width / height) & ~1;
+    else if ((PRInt64)inWidth * height < (PRInt64)width * inHeight)
+        mCropHeight = (int)((PRInt64)inWidth * height / width) & ~1;
+    mCropX = ((inWidth - mCropWidth) / 2) & ~1;
+    mCropY = ((inHeight - mCropHeight) / 2) & ~1;
+    
+    if (fourcc != VIDCAP_FOURCC_I420 && !(mConverted = (unsigned char *)
+        PR_Malloc(inWidth * inHeight * 3 / 2)))
+        return NS_ERROR_OUT_OF_MEMORY;
+    if ((inWidth != width || inHeight != height) && !(mScaled =
+        (unsigned char *)PR_Malloc(width * height * 3 / 2)))
+        return NS_ERROR_OUT_OF_MEMORY;
+    if (fourcc == VIDCAP_FOURCC_RGB24 &&
+        !(mRow = (unsigned char *)PR_Malloc(inWidth * 4)))
+        return NS_ERROR_OUT_OF_MEMORY;
+    return NS_OK;
+}
+
+unsigned char *
+VideoIngest::Convert(const unsigned char *in)
+{
+    const unsigned char *yuv = in;
+    
+    switch (mFourcc) {
+        case VIDCAP_FOURCC_YUY2:
+            PackedToI420(in, mInWidth, mInHeight, 0, mConverted);
+            yuv = mConverted;
+            break;
+        case VIDCAP_FOURCC_UYVY:
+        case VIDCAP_FOURCC_2VUY:
+            PackedToI420(in, mInWidth, mInHeight, 1, mConverted);
+            yuv = mConverted;
+            break;
+        case VIDCAP_FOURCC_RGB32:
+            RGBToI420(in, mInWidth, mInHeight, 4, NULL, mConverted);
+            yuv = mConverted;
+            break;
+        case VIDCAP_FOURCC_RGB24:
+            RGBToI420(in, mInWidth, mInHeight, 3, mRow, mConverted);
+            yuv = mConverted;
+            break;
+    }
+    
+    if (!mScaled)
+        return (unsigned char *)yuv;
+    
+    int inLuma = mInWidth * mInHeight;
+    int luma = mWidth * mHeight;
+    int chroma = (mCropY / 2) * (mInWidth / 2) + mCropX / 2;
+    ScalePlane(yuv + mCropY * mInWidth + mCropX, mCropWidth, mCropHeight,
+        mInWidth, mScaled, mWidth, mHeight);
+    ScalePlane(yuv + inLuma + chroma, mCropWidth / 2, mCropHeight / 2,
+        mInWidth / 2, mScaled + luma, mWidth / 2, mHeight / 2);
+    ScalePlane(yuv + inLuma * 5 / 4 + chroma, mCropWidth / 2,
+        mCropHeight / 2, mInWidth / 2, mScaled + luma * 5 / 4,
+        mWidth / 2, mHeight / 2);
+    return mScaled;
+}
+
+/*
+ * YUY2 (Y0 U Y1 V) and UYVY (U Y0 V Y1) to I420, two rows at a time.
+ * yOffset is where luma sits in each byte pair. Chroma of the two rows
+ * is averaged, which is what 4:2:0 siting expects.
+ */
+void
+VideoIngest::PackedToI420(const unsigned char *in, int w, int h,
+    int yOffset, unsigned char *out)
+{
+    unsigned char *yp = out;
+    unsigned char *up = out + w * h;
+    unsigned char *vp = up + (w / 2) * (h / 2);
+    int cOffset = 1 - yOffset;
+    
+    for (int row = 0; row < h; row += 2) {
+        const unsigned char *r0 = in + row * w * 2;
+        const unsigned char *r1 = r0 + w * 2;
+        unsigned char *y0 = yp + row * w;
+        unsigned char *y1 = y0 + w;
+        unsigned char *u = up + (row / 2) * (w / 2);
+        unsigned char *v = vp + (row / 2) * (w / 2);
+        int x = 0;
+        
+#ifdef __SSE2__
+        const __m128i mask = _mm_set1_epi16(0x00ff);
+        const __m128i zero = _mm_setzero_si128();
+        for (; x + 16 <= w; x += 16) {
+            __m128i a0 = _mm_loadu_si128((const __m128i *)(r0 + x * 2));
+            __m128i a1 = _mm_loadu_si128((const __m128i *)(r0 + x * 2 + 16));
+            __m128i b0 = _mm_loadu_si128((const __m128i *)(r1 + x * 2));
+            __m128i b1 = _mm_loadu_si128((const __m128i *)(r1 + x * 2 + 16));
+            __m128i ya, yb, ca, cb;
+            if (yOffset) {
+                ya = _mm_packus_epi16(_mm_srli_epi16(a0, 8),
+                    _mm_srli_epi16(a1, 8));
+                yb = _mm_packus_epi16(_mm_srli_epi16(b0, 8),
+                    _mm_srli_epi16(b1, 8));
+                ca = _mm_packus_epi16(_mm_and_si128(a0, mask),
+                    _mm_and_si128(a1, mask));
+                cb = _mm_packus_epi16(_mm_and_si128(b0, mask),
+                    _mm_and_si128(b1, mask));
+            } else {
+                ya = _mm_packus_epi16(_mm_and_si128(a0, mask),
+                    _mm_and_si128(a1, mask));
+                yb = _mm_packus_epi16(_mm_and_si128(b0, mask),
+                    _mm_and_si128(b1, mask));
+                ca = _mm_packus_epi16(_mm_srli_epi16(a0, 8),
+                    _mm_srli_epi16(a1, 8));
+                cb = _mm_packus_epi16(_mm_srli_epi16(b0, 8),
+                    _mm_srli_epi16(b1, 8));
+            }
+            _mm_storeu_si128((__m128i *)(y0 + x), ya);
+            _mm_storeu_si128((__m128i *)(y1 + x), yb);
+            
+            /* U V U V ... averaged across the rows, then split */
+            __m128i c = _mm_avg_epu8(ca, cb);
+            _mm_storel_epi64((__m128i *)(u + x / 2),
+                _mm_packus_epi16(_mm_and_si128(c, mask), zero));
+            _mm_storel_epi64((__m128i *)(v + x / 2),
+                _mm_packus_epi16(_mm_srli_epi16(c, 8), zero));
+        }
+#endif
+        for (; x < w; x += 2) {
+            const unsigned char *p0 = r0 + x * 2;
+            const unsigned char *p1 = r1 + x * 2;
+            y0[x] = p0[yOffset];
+            y0[x + 1] = p0[yOffset + 2];
+            y1[x] = p1[yOffset];
+            y1[x + 1] = p1[yOffset + 2];
+            u[x / 2] = (p0[cOffset] + p1[cOffset] + 1) >> 1;
+            v[x / 2] = (p0[cOffset + 2] + p1[cOffset + 2] + 1) >> 1;
+        }
+    }
+}
+
+/*
+ * Luma of one row of B G R A pixels, BT.601 studio range:
+ * Y = ((66 R + 129 G + 25 B + 128) >> 8) + 16
+ */
+void
+VideoIngest::RGB32Luma(const unsigned char *in, int w, unsigned char *out)
+{
+    int x = 0;
+    
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i coef = _mm_setr_epi16(25, 129, 66, 0, 25, 129, 66, 0);
+    const __m128i round = _mm_set1_epi32(128 + (16 << 8));
+    for (; x + 8 <= w; x += 8) {
+        __m128i sums[2];
+        for (int half = 0; half < 2; half++) {
+            __m128i p = _mm_loadu_si128(
+                (const __m128i *)(in + (x + half * 4) * 4));
+            /* B*25 + G*129 and R*66 for each pixel, then add the pairs */
+            __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(p, zero), coef);
+            __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(p, zero), coef);
+            __m128i even = _mm_castps_si128(_mm_shuffle_ps(
+                _mm_castsi128_ps(lo), _mm_castsi128_ps(hi),
+                _MM_SHUFFLE(2, 0, 2, 0)));
+            __m128i odd = _mm_castps_si128(_mm_shuffle_ps(
+                _mm_castsi128_ps(lo), _mm_castsi128_ps(hi),
+                _MM_SHUFFLE(3, 1, 3, 1)));
+            sums[half] = _mm_srai_epi32(
+                _mm_add_epi32(_mm_add_epi32(even, odd), round), 8);
+        }
+        __m128i y = _mm_packs_epi32(sums[0], sums[1]);
+        _mm_storel_epi64((__m128i *)(out + x), _mm_packus_epi16(y, zero));
+    }
+#endif
+    for (; x < w; x++) {
+        const unsigned char *p = in + x * 4;
+        out[x] = ((66 * p[2] + 129 * p[1] + 25 * p[0] + 128) >> 8) + 16;
+    }
+}
+
+/*
+ * 24 or 32 bit B G R (A) to I420. RGB24 rows are widened into a scratch
+ * row first so both share the vector luma path; chroma is taken from the
+ * sum of each 2x2 block and costs a quarter as much, so it stays scalar.
+ */
+void
+VideoIngest::RGBToI420(const unsigned char *in, int w, int h,
+    int bpp, unsigned char *row, unsigned char *out)
+{
+    unsigned char *yp = out;
+    unsigned char *up = out + w * h;
+    unsigned char *vp = up + (w / 2) * (h / 2);
+    int stride = w * bpp;
+    
+    for (int line = 0; line < h; line++) {
+        const unsigned char *src = in + line * stride;
+        if (bpp == 3) {
+            for (int x = 0; x < w; x++) {
+                row[x * 4] = src[x * 3];
+                row[x * 4 + 1] = src[x * 3 + 1];
+                row[x * 4 + 2] = src[x * 3 + 2];
+                row[x * 4 + 3] = 0;
+            }
+            src = row;
+        }
+        RGB32Luma(src, w, yp + line * w);
+    }
+    
+    for (int line = 0; line < h; line += 2) {
+        const unsigned char *r0 = in + line * stride;
+        const unsigned char *r1 = r0 + stride;
+        unsigned char *u = up + (line / 2) * (w / 2);
+        unsigned char *v = vp + (line / 2) * (w / 2);
+        for (int x = 0; x < w; x += 2) {
+            const unsigned char *p = r0 + x * bpp;
+            const unsigned char *q = r1 + x * bpp;
+            int b = p[0] + p[bpp] + q[0] + q[bpp];
+            int g = p[1] + p[bpp + 1] + q[1] + q[bpp + 1];
+            int r = p[2] + p[bpp + 2] + q[2] + q[bpp + 2];
+            u[x / 2] = ((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128;
+            v[x / 2] = ((112 * r - 94 * g - 18 * b + 512) >> 10) + 128;
+        }
+    }
+}
+
+/*
+ * Resample one plane. Only exact halving in both directions, such as a
+ * 1280x960 camera feeding a 640x480 encode, takes the 2x2 box filter,
+ * eight output pixels at a time. Everything else, such as the 960x720
+ * middle of a 1280x720 camera, is bilinear in 8-bit fixed point: each
+ * output row is blended from its two source rows first, sixteen bytes
+ * at a time, then across from a table of positions and weights worked
+ * out once per call, eight pixels to a pmaddwd pair. The lookups that
+ * feed those are still loads of one byte each, SSE2 has no gather.
+ */
+void
+VideoIngest::ScalePlane(const unsigned char *src, int sw, int sh,
+    int stride, unsigned char *dst, int dw, int dh)
+{
+    if (sw == dw && sh == dh) {
+        for (int y = 0; y < sh; y++)
+            memcpy(dst + y * dw, src + y * stride, sw);
+        return;
+    }
+    
+    if (sw == dw * 2 && sh == dh * 2) {
+        for (int y = 0; y < dh; y++) {
+            const unsigned char *r0 = src + y * 2 * stride;
+            const unsigned char *r1 = r0 + stride;
+            unsigned char *d = dst + y * dw;
+            int x = 0;
+#ifdef __SSE2__
+            const __m128i mask = _mm_set1_epi16(0x00ff);
+            const __m128i zero = _mm_setzero_si128();
+            for (; x + 8 <= dw; x += 8) {
+                __m128i m = _mm_avg_epu8(
+                    _mm_loadu_si128((const __m128i *)(r0 + x * 2)),
+                    _mm_loadu_si128((const __m128i *)(r1 + x * 2)));
+                __m128i s = _mm_avg_epu16(_mm_and_si128(m, mask),
+                    _mm_srli_epi16(m, 8));
+                _mm_storel_epi64((__m128i *)(d + x),
+                    _mm_packus_epi16(s, zero));
+            }
+#endif
+            /* Round like the vector path so both give the same frame */
+            for (; x < dw; x++) {
+                int a = (r0[x * 2] + r1[x * 2] + 1) >> 1;
+                int b = (r0[x * 2 + 1] + r1[x * 2 + 1] + 1) >> 1;
+                d[x] = (a + b + 1) >> 1;
+            }
+        }
+        return;
+    }
+    
+    /* Sample at pixel centres so the image does not drift by half a pixel */
+    int xstep = (sw << 16) / dw;
+    int ystep = (sh << 16) / dh;
+    int ypos = ystep / 2 - 32768;
+#ifdef __SSE2__
+    /* Wider planes than this are rare enough to leave to the scalar loop
+       rather than put the tables on the heap */
+    PRUint16 offsets[SCALE_MAX_WIDTH];
+    PRInt16 weights[SCALE_MAX_WIDTH * 2];
+    unsigned char blend[SCALE_MAX_WIDTH];
+    PRBool vector = sw >= 2 && sw <= SCALE_MAX_WIDTH &&
+        dw <= SCALE_MAX_WIDTH;
+    if (vector) {
+        int xpos = xstep / 2 - 32768;
+        for (int x = 0; x < dw; x++, xpos += xstep) {
+            int sx = xpos < 0 ? 0 : xpos >> 16;
+            int fx = xpos < 0 ? 0 : (xpos >> 8) & 0xff;
+            /* All of the last pixel rather than none of the one past it,
+               so the pair never reads off the end of the row */
+            if (sx >= sw - 1) {
+                sx = sw - 2;
+                fx = 256;
+            }
+            offsets[x] = sx;
+            weights[x * 2] = 256 - fx;
+            weights[x * 2 + 1] = fx;
+        }
+    }
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi16(128);
+    const __m128i halfWide = _mm_set1_epi32(128);
+#endif
+    for (int y = 0; y < dh; y++, ypos += ystep) {
+        int sy = ypos < 0 ? 0 : ypos >> 16;
+        int fy = ypos < 0 ? 0 : (ypos >> 8) & 0xff;
+        if (sy >= sh - 1) {
+            sy = sh - 1;
+            fy = 0;
+        }
+        const unsigned char *r0 = src + sy * stride;
+        const unsigned char *r1 = fy ? r0 + stride : r0;
+        unsigned char *d = dst + y * dw;
+        int x = 0;
+#ifdef __SSE2__
+        if (vector) {
+            const unsigned char *line = r0;
+            if (fy) {
+                const __m128i w0 = _mm_set1_epi16(256 - fy);
+                const __m128i w1 = _mm_set1_epi16(fy);
+                int i = 0;
+                /* At most 255 * 256 + 128, which still fits unsigned */
+                for (; i + 8 <= sw; i += 8) {
+                    __m128i a = _mm_unpacklo_epi8(
+                        _mm_loadl_epi64((const __m128i *)(r0 + i)), zero);
+                    __m128i b = _mm_unpacklo_epi8(
+                        _mm_loadl_epi64((const __m128i *)(r1 + i)), zero);
+                    __m128i s = _mm_add_epi16(_mm_mullo_epi16(a, w0),
+                        _mm_mullo_epi16(b, w1));
+                    s = _mm_srli_epi16(_mm_add_epi16(s, half), 8);
+                    _mm_storel_epi64((__m128i *)(blend + i),
+                        _mm_packus_epi16(s, zero));
+                }
+                for (; i < sw; i++)
+                    blend[i] = (r0[i] * (256 - fy) + r1[i] * fy + 128) >> 8;
+                line = blend;
+            }
+            for (; x + 8 <= dw; x += 8) {
+                PRUint16 pairs[8];
+                for (int k = 0; k < 8; k++) {
+                    const unsigned char *p = line + offsets[x + k];
+                    pairs[k] = p[0] | (p[1] << 8);
+                }
+                __m128i p = _mm_loadu_si128((const __m128i *)pairs);
+                __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(p, zero),
+                    _mm_loadu_si128((const __m128i *)(weights + x * 2)));
+                __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(p, zero),
+                    _mm_loadu_si128((const __m128i *)(weights + x * 2 + 8)));
+                lo = _mm_srai_epi32(_mm_add_epi32(lo, halfWide), 8);
+                hi = _mm_srai_epi32(_mm_add_epi32(hi, halfWide), 8);
+                _mm_storel_epi64((__m128i *)(d + x),
+                    _mm_packus_epi16(_mm_packs_epi32(lo, hi), zero));
+            }
+        }
+#endif
+        /* Rows first then across, rounding after each, as the vector
+           path does */
+        int xpos = xstep / 2 - 32768 + x * xstep;
+        for (; x < dw; x++, xpos += xstep) {
+            int sx = xpos < 0 ? 0 : xpos >> 16;
+            int fx = xpos < 0 ? 0 : (xpos >> 8) & 0xff;
+            if (sx >= sw - 1) {
+                sx = sw - 1;
+                fx = 0;
+            }
+            int nx = fx ? sx + 1 : sx;
+            int left = (r0[sx] * (256 - fy) + r1[sx] * fy + 128) >> 8;
+            int right = (r0[nx] * (256 - fy) + r1[nx] * fy + 128) >> 8;
+            d[x] = (left * (256 - fx) + right * fx + 128) >> 8;
+        }
+    }
+}
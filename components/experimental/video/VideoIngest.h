@@ -0,0 +1,119 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef VideoIngest_h_
+#define VideoIngest_h_
+
+#include "prtypes.h"
+#include "nscore.h"
+
+#include <vidcap/vidcap.h>
+
+/*
+ * Turns whatever the camera delivers natively into I420 at the size the
+ * encoder wants. Asking vidcap for I420 directly makes it convert for us
+ * with plain C loops, or makes the driver scale, both of which cost more
+ * than doing it here with SSE2 on the capture thread. Packed 4:2:2
+ * (YUY2, UYVY/2VUY) and 24/32-bit RGB are understood; anything else is
+ * left to vidcap by binding I420 as before. A camera whose shape differs
+ * from the encode's, 16:9 feeding 4:3 say, is cropped about the centre
+ * rather than stretched.
+ */
+class VideoIngest
+{
+public:
+    VideoIngest();
+    ~VideoIngest();
+
+    /* Pick and bind the camera format closest to what we encode, out of
+       the ones the camera was found to offer */
+    nsresult Bind(vidcap_src *source, const struct vidcap_fmt_info *formats,
+        int count, int width, int height, int fpsN, int fpsD);
+    /* Set up for a known input format, without a camera */
+    nsresult Init(int fourcc, int inWidth, int inHeight,
+        int width, int height);
+
+    /* Bytes in one captured frame of the bound format */
+    int FrameSize() { return mFrameSize; }
+    int Fourcc() { return mFourcc; }
+    int InputWidth() { return mInWidth; }
+    int InputHeight() { return mInHeight; }
+
+    /* Convert one captured frame; the result stays valid until the next */
+    unsigned char *Convert(const unsigned char *in);
+
+    static PRBool Supported(int fourcc);
+    /* Resample one 8-bit plane, packed with no padding */
+    static void ScalePlane(const unsigned char *src, int sw, int sh,
+        unsigned char *dst, int dw, int dh)
+    {
+        ScalePlane(src, sw, sh, sw, dst, dw, dh);
+    }
+    /* The same, from an sw x sh window of rows stride bytes apart */
+    static void ScalePlane(const unsigned char *src, int sw, int sh,
+        int stride, unsigned char *dst, int dw, int dh);
+
+private:
+    static int Rank(int fourcc);
+    static int InputSize(int fourcc, int w, int h);
+
+    static void PackedToI420(const unsigned char *in, int w, int h,
+        int yOffset, unsigned char *out);
+    static void RGBToI420(const unsigned char *in, int w, int h,
+        int bpp, unsigned char *row, unsigned char *out);
+    static void RGB32Luma(const unsigned char *in, int w,
+        unsigned char *out);
+
+    void Free();
+
+    int mFourcc;
+    int mInWidth;
+    int mInHeight;
+    /* Part of the input that is scaled, even sized and placed */
+    int mCropX;
+    int mCropY;
+    int mCropWidth;
+    int mCropHeight;
+    int mWidth;
+    int mHeight;
+    int mFrameSize;
+    unsigned char *mConverted;
+    unsigned char *mScaled;
+    unsigned char *mRow;
+};
+
+#endif
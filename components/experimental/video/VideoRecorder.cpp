@@ -39,6 +39,169 @@
 
 NS_IMPL_ISUPPORTS1(VideoRecorder, IVideoRecorder)
 
+/*
+ * Starts one session, or stops any number of them, on the media thread,
+ * then tells the script's callback how it went. The preview canvases
+ * ride along so that they are only ever let go of on the main thread.
+ */
+class VideoTask : public MediaTask
+{
+public:
+    enum { START_FILE, START_STREAM, START_REPLAY, STOP, WARM_UP, REFRESH };
+
+    VideoTask(VideoRecorder *recorder, int op,
+        IVideoRecorderCallback *callback)
+        : mFile(NULL)
+        , mGeneration(0)
+        , mRecorder(recorder)
+        , mOp(op)
+        , mSessions(nsnull)
+        , mCanvases(nsnull)
+        , mCount(0)
+        , mCallback(callback)
+    {
+    }
+
+    ~VideoTask()
+    {
+        PR_Free(mSessions);
+        delete[] mCanvases;
+    }
+
+    nsresult Init(VideoSession **sessions, int count)
+    {
+        mSessions = (VideoSession **)
+            PR_Malloc(count * sizeof(VideoSession *));
+        mCanvases = new VideoCanvas[count];
+        if (!mSessions || !mCanvases)
+            return NS_ERROR_OUT_OF_MEMORY;
+        memcpy(mSessions, sessions, count * sizeof(VideoSession *));
+        mCount = count;
+        return NS_OK;
+    }
+
+    /* What a start records with and to */
+    VideoSettings mSettings;
+    FILE *mFile;
+    nsCString mPath;
+    nsCOMPtr<nsIAsyncOutputStream> mPipe;
+    PRUint32 mGeneration;
+
+    VideoCanvas *Canvas() { return &mCanvases[0]; }
+
+protected:
+    nsresult Perform()
+    {
+        nsresult rv = NS_OK;
+        
+        switch (mOp) {
+        case START_FILE:
+            return mSessions[0]->StartFile(&mSettings, &mCanvases[0],
+                mFile, mPath);
+        case START_STREAM:
+            return mSessions[0]->StartStream(&mSettings, &mCanvases[0],
+                mPipe);
+        case START_REPLAY:
+            return mSessions[0]->StartReplay(&mSettings, &mCanvases[0]);
+        case WARM_UP:
+        case REFRESH:
+            return mRecorder->UpdateSources(mOp == REFRESH);
+        }
+        
+        for (int i = 0; i < mCount; i++) {
+            nsresult srv = mSessions[i]->Stop(&mCanvases[i]);
+            if (NS_FAILED(srv))
+                rv = srv;
+        }
+        return rv;
+    }
+
+    void Complete(nsresult status)
+    {
+        nsCOMPtr<IVideoRecorderCallback> callback;
+        
+        if (mOp < STOP && NS_FAILED(status))
+            mSessions[0]->StartFailed(mGeneration);
+        delete[] mCanvases;
+        mCanvases = nsnull;
+        mPipe = nsnull;
+        callback.swap(mCallback);
+        if (callback)
+            callback->OnComplete(status);
+    }
+
+private:
+    VideoRecorder *mRecorder;
+    int mOp;
+    VideoSession **mSessions;
+    VideoCanvas *mCanvases;
+    int mCount;
+    nsCOMPtr<IVideoRecorderCallback> mCallback;
+};
+
+/*
+ * Times ingest on the media thread, which a few hundred frames at a
+ * large size would otherwise keep the main thread busy with
+ */
+class BenchmarkTask : public MediaTask
+{
+public:
+    BenchmarkTask(PRUint32 width, PRUint32 height, PRUint32 frames,
+        IVideoBenchmarkCallback *callback)
+        : mWidth(width)
+        , mHeight(height)
+        , mFrames(frames)
+        , mCallback(callback)
+    {
+    }
+
+protected:
+    nsresult Perform()
+    {
+        return VideoRecorder::MeasureIngest(mWidth, mHeight, mFrames,
+            mResult);
+    }
+
+    void Complete(nsresult status)
+    {
+        nsCOMPtr<IVideoBenchmarkCallback> callback;
+        
+        if (NS_FAILED(status))
+            mResult.Truncate();
+        callback.swap(mCallback);
+        if (callback)
+            callback->OnComplete(status, mResult);
+    }
+
+private:
+    PRUint32 mWidth;
+    PRUint32 mHeight;
+    PRUint32 mFrames;
+    nsCString mResult;
+    nsCOMPtr<IVideoBenchmarkCallback> mCallback;
+};
+
+/*
+ * vidcap tells us about cameras coming and going on a thread of its own;
+ * this gets a refresh queued from the main thread
+ */
+class SourcesChangedEvent : public nsRunnable
+{
+public:
+    SourcesChangedEvent(VideoRecorder *recorder) : mRecorder(recorder) {}
+
+    NS_IMETHOD Run()
+    {
+        /* The recorder may have gone away in the meantime */
+        if (VideoRecorder::GetService() == mRecorder)
+            mRecorder->RefreshSources(nsnull);
+        return NS_OK;
+    }
+
+private:
+    VideoRecorder *mRecorder;
+};
+
 VideoRecorder *VideoRecorder::gVideoRecordingService = nsnull;
 
 VideoRecorder *
@@ -59,11 +222,66 @@ VideoRecorder::GetSingleton()
     return gVideoRecordingService;
 }
 
+
 nsresult
 VideoRecorder::Init()
 {
-    recording = 0;
-    int num_devices = 0;
+    settings.threads = 1;
+    settings.flushInterval = FLUSH_INTERVAL;
+    settings.highWater = WRITE_HIGH_WATER;
+    settings.withAudio = PR_FALSE;
+    settings.staticThreshold = STATIC_THRESHOLD;
+    settings.adaptive = PR_TRUE;
+    settings.replaySeconds = REPLAY_SECONDS;
+    settings.replayMemory = REPLAY_MEMORY;
+    settings.thumbnails = PR_FALSE;
+    settings.thumbnailInterval = 0;
+    numSessions = 0;
+    sessions = nsnull;
+    last = 0;
+    state = NULL;
+    sapi = NULL;
+    
+    /* vidcap is brought up by warmUp(), or the first task that needs it */
+    backendTried = PR_FALSE;
+    backendStatus = NS_OK;
+    backendReady = 0;
+    return NS_OK;
+}
+
+/*
+ * Initialize vidcap and list the sources, once. Only the media thread
+ * does this: vidcap_initialize and listing the sources can take long
+ * enough to freeze the browser.
+ */
+nsresult
+VideoRecorder::EnsureBackend()
+{
+    if (!backendTried) {
+        backendStatus = InitBackend();
+        backendTried = PR_TRUE;
+        PR_AtomicSet(&backendReady, 1);
+    }
+    return backendStatus;
+}
+
+/*
+ * What the main thread goes by. Until the media thread has been round,
+ * the sources are not known and the answer is NS_ERROR_NOT_AVAILABLE;
+ * warmUp()'s callback says when to try again.
+ */
+nsresult
+VideoRecorder::BackendStatus()
+{
+    if (!PR_AtomicAdd(&backendReady, 0))
+        return NS_ERROR_NOT_AVAILABLE;
+    return backendStatus;
+}
+
+nsresult
+VideoRecorder::InitBackend()
+{
+    nsresult rv;
     struct vidcap_sapi_info sapi_info;
     
     if (!(state = vidcap_initialize())) {
@@ -81,365 +299,931 @@ VideoRecorder::Init()
 		return NS_ERROR_FAILURE;
 	}
 	
-	num_devices = vidcap_src_list_update(sapi);
-	if (num_devices < 0) {
-		fprintf(stderr, "Failed vidcap_src_list_update()\n");
-		return NS_ERROR_FAILURE;
-	} else if (num_devices == 0) {
-	    // FIXME: Not really a failure
+    /* Cameras are listed once here and kept track of from then on */
+    rv = registry.Init(sapi);
+    if (NS_FAILED(rv))
+        return rv;
+    if (!registry.Count())
         fprintf(stderr, "No video capture sources available\n");
-		return NS_ERROR_FAILURE;
-	}
-	
-	if (!(sources = (struct vidcap_src_info *)
-	    PR_Calloc(num_devices, sizeof(struct vidcap_src_info)))) {
-        return NS_ERROR_OUT_OF_MEMORY;
-	}
-	
-	if (vidcap_src_list_get(sapi, num_devices, sources)) {
-	    PR_Free(sources);
-		fprintf(stderr, "Failed vidcap_src_list_get()\n");
-		return NS_ERROR_FAILURE;
-	}
-    
-    ogg_state = (ogg_stream_state *)PR_Calloc(1, sizeof(ogg_stream_state));
-    size = WIDTH * HEIGHT * 3 / 2;
+    vidcap_srcs_notify(sapi, SourcesChanged, this);
     return NS_OK;
 }
 
-VideoRecorder::~VideoRecorder()
+int
+VideoRecorder::SourcesChanged(vidcap_sapi *sapi, void *data)
 {
-    vidcap_sapi_release(sapi);
-    vidcap_destroy(state);
-    PR_Free(sources);
-    PR_Free(ogg_state);
-    gVideoRecordingService = nsnull;
+    nsCOMPtr<nsIRunnable> event =
+        new SourcesChangedEvent(static_cast<VideoRecorder *>(data));
+    if (event)
+        NS_DispatchToMainThread(event);
+    return 0;
 }
 
-#define TABLE_SIZE 36
-static const char table[] = {
-    'a','b','c','d','e','f','g','h','i','j',
-    'k','l','m','n','o','p','q','r','s','t',
-    'u','v','w','x','y','z','0','1','2','3',
-    '4','5','6','7','8','9' 
-};
-
 /*
- * This code is ripped from profile/src/nsProfile.cpp and is further
- * duplicated in uriloader/exthandler.  this should probably be moved
- * into xpcom or some other shared library.
- */ 
-static void
-MakeRandomString(char *buf, PRInt32 bufLen)
+ * Media thread: relist the sources if asked to, and find out what
+ * formats the new ones offer before anyone wants to record from them
+ */
+nsresult
+VideoRecorder::UpdateSources(PRBool relist)
 {
-    // turn PR_Now() into milliseconds since epoch
-    // and salt rand with that.
-    double fpTime;
-    LL_L2D(fpTime, PR_Now());
+    nsresult rv = EnsureBackend();
+    if (NS_FAILED(rv)) return rv;
+    if (relist) {
+        rv = registry.Refresh();
+        if (NS_FAILED(rv)) return rv;
+    }
+    registry.Probe();
+    return NS_OK;
+}
 
-    // use 1e-6, granularity of PR_Now() on the mac is seconds
-    srand((uint)(fpTime * 1e-6 + 0.5));   
-    PRInt32 i;
-    for (i=0;i<bufLen;i++) {
-        *buf++ = table[rand()%TABLE_SIZE];
+VideoRecorder::~VideoRecorder()
+{
+    /* Sessions are only touched by the media thread while it runs */
+    media.Shutdown();
+    for (int i = 0; i < numSessions; i++)
+        delete sessions[i];
+    PR_Free(sessions);
+    if (sapi) {
+        vidcap_srcs_notify(sapi, NULL, NULL);
+        vidcap_sapi_release(sapi);
     }
-    *buf = 0;
+    if (state)
+        vidcap_destroy(state);
+    gVideoRecordingService = nsnull;
 }
 
-/*
- * This replaces \ with \\ so that Windows paths are sane
- */
-static void
-EscapeBackslash(nsACString& str)
-{
-	const char *sp;
-	const char *mp = "\\";
-	const char *np = "\\\\";
-
-	PRUint32 sl;
-	PRUint32 ml = 1;
-	PRUint32 nl = 2;
-
-	sl = NS_CStringGetData(str, &sp);
-	for (const char* iter = sp; iter <= sp + sl - ml; ++iter) {
-	    if (memcmp(iter, mp, ml) == 0) {
-            PRUint32 offset = iter - sp;
-            NS_CStringSetDataRange(str, offset, ml, np, nl);
-            sl = NS_CStringGetData(str, &sp);
-            iter = sp + offset + nl - 1;
-	    }
-	}
+PRBool
+VideoRecorder::Recording()
+{
+    for (int i = 0; i < numSessions; i++) {
+        if (sessions[i] && sessions[i]->Mode())
+            return PR_TRUE;
+    }
+    return PR_FALSE;
 }
 
-int
-VideoRecorder::RecordToFileCallback(vidcap_src *src, void *data,
-    struct vidcap_capture_info *video)
+/*
+ * Find (or create) the session for a source. An empty id means the
+ * first source, which is what the single-source methods record from.
+ * Sessions are indexed like the registry, whose indexes never change.
+ */
+nsresult
+VideoRecorder::GetSession(const nsACString &id, VideoSession **session)
 {
-    ogg_page og;
-    ogg_packet op;
-    th_ycbcr_buffer ycbcr;
-    
-    unsigned char *yuv = (unsigned char *)video->video_data;
-    VideoRecorder *vr = static_cast<VideoRecorder*>(data);
+    int i, count;
+    nsresult rv;
     
-    int frames = video->video_data_size / vr->size;
-    for (int i = 0; i < frames; i++) {
-        ycbcr[0].width = WIDTH;
-        ycbcr[0].stride = WIDTH;
-        ycbcr[0].height = HEIGHT;
-
-        ycbcr[1].width = (WIDTH >> 1);
-        ycbcr[1].height = (HEIGHT >> 1);
-        ycbcr[1].stride = ycbcr[1].width;
-
-        ycbcr[2].width = ycbcr[1].width;
-        ycbcr[2].height = ycbcr[1].height;
-        ycbcr[2].stride = ycbcr[1].stride;
-
-        ycbcr[0].data = yuv;
-        ycbcr[1].data = yuv + WIDTH * HEIGHT;
-        ycbcr[2].data = ycbcr[1].data + WIDTH * HEIGHT / 4;
-
-        if (th_encode_ycbcr_in(vr->encoder, ycbcr) != 0) {
-            fprintf(stderr, "Could not encode frame!\n");
-            return -1;
+    rv = BackendStatus();
+    if (NS_FAILED(rv)) return rv;
+    if ((i = registry.Find(id)) < 0) {
+        if (id.IsEmpty()) {
+            fprintf(stderr, "No video capture sources available\n");
+            return NS_ERROR_NOT_AVAILABLE;
         }
-        if (!th_encode_packetout(vr->encoder, 0, &op)) {
-            fprintf(stderr, "Could not read packet!\n");
-            return -1;
+        fprintf(stderr, "No such video source!\n");
+        return NS_ERROR_INVALID_ARG;
+    }
+    
+    if (i >= numSessions) {
+        count = registry.Count();
+        VideoSession **grown = (VideoSession **)
+            PR_Realloc(sessions, count * sizeof(VideoSession *));
+        if (!grown)
+            return NS_ERROR_OUT_OF_MEMORY;
+        memset(grown + numSessions, 0,
+            (count - numSessions) * sizeof(VideoSession *));
+        sessions = grown;
+        numSessions = count;
+    }
+    
+    if (!sessions[i]) {
+        VideoSession *s =
+            new VideoSession(sapi, &registry, registry.Source(i));
+        if (!s)
+            return NS_ERROR_OUT_OF_MEMORY;
+        nsresult rv = s->Init();
+        if (NS_FAILED(rv)) {
+            delete s;
+            return rv;
         }
+        sessions[i] = s;
+    }
+    
+    last = i;
+    *session = sessions[i];
+    return NS_OK;
+}
 
-        ogg_stream_packetin(vr->ogg_state, &op);
-        while (ogg_stream_pageout(vr->ogg_state, &og)) {
-            fwrite(og.header, og.header_len, 1, vr->outfile);
-            fwrite(og.body, og.body_len, 1, vr->outfile);
-        }
-        
-        if (vr->mCtx && vr->mThebes) {
-            unsigned char *rgb = (unsigned char *)
-                PR_Calloc(1, WIDTH * HEIGHT * 4);
-            vidcap_i420_to_rgb32(
-                WIDTH, HEIGHT,
-                (const char *)yuv, (char *)rgb
-            );
-            nsRefPtr<gfxImageSurface> img = new gfxImageSurface(
-                rgb, gfxIntSize(WIDTH, HEIGHT),
-                WIDTH * 4, gfxASurface::ImageFormatARGB32
-            );
-            if (!img || img->CairoStatus()) {
-                fprintf(stderr, "Could not setup gfxSurface!\n");
-            } else {
-                gfxContextPathAutoSaveRestore pathSR(vr->mThebes);
-                gfxContextAutoSaveRestore autoSR(vr->mThebes);
-                // ignore clipping region, as per spec
-                vr->mThebes->ResetClip();
-                vr->mThebes->IdentityMatrix();
-                vr->mThebes->Translate(gfxPoint(0, 0));
-                vr->mThebes->NewPath();
-                vr->mThebes->Rectangle(gfxRect(0, 0, WIDTH, HEIGHT));
-                vr->mThebes->SetSource(img, gfxPoint(0, 0));
-                vr->mThebes->SetOperator(gfxContext::OPERATOR_SOURCE);
-                vr->mThebes->Fill();
-            }
-            PR_Free((void *)rgb);
-        }
-        
-        yuv += vr->size;
+/*
+ * There is only one microphone, it goes to the first session asking
+ */
+void
+VideoRecorder::Prepare(VideoSettings *copy)
+{
+    *copy = settings;
+    for (int i = 0; i < numSessions && copy->withAudio; i++) {
+        if (sessions[i] && sessions[i]->WantsAudio())
+            copy->withAudio = PR_FALSE;
     }
-    return 0;
 }
 
 /*
- * Setup Ogg/Theora file
+ * Make a start task for a session: the settings and canvas are taken
+ * here, on the main thread, for the media thread to start with
  */
 nsresult
-VideoRecorder::SetupOggTheora(nsACString& file)
+VideoRecorder::StartTask(VideoSession *session, int op, VideoSettings *copy,
+    nsIDOMCanvasRenderingContext2D *ctx, IVideoRecorderCallback *callback,
+    nsRefPtr<VideoTask> &task)
 {
-    int ret;
-    th_info ti;
     nsresult rv;
-    char buf[13];
-    th_comment tc;
-    ogg_page page;
-    ogg_packet packet;
-    nsCAutoString path;
-    nsCOMPtr<nsIFile> o;
     
-    /* Assign temporary name */
-    rv = NS_GetSpecialDirectory(NS_OS_TEMP_DIR, getter_AddRefs(o));
-    if (NS_FAILED(rv)) return rv;
+    if (session->Mode()) {
+        fprintf(stderr, "Recording in progress!\n");
+        return NS_ERROR_FAILURE;
+    }
     
-    MakeRandomString(buf, 8);
-    memcpy(buf + 8, ".ogg", 5);
-    rv = o->AppendNative(nsDependentCString(buf, 12));
+    task = new VideoTask(this, op, callback);
+    if (!task)
+        return NS_ERROR_OUT_OF_MEMORY;
+    rv = task->Init(&session, 1);
     if (NS_FAILED(rv)) return rv;
-    rv = o->CreateUnique(nsIFile::NORMAL_FILE_TYPE, 0600);
+    rv = task->Canvas()->Init(ctx);
     if (NS_FAILED(rv)) return rv;
-    rv = o->GetNativePath(path);
+    task->mSettings = *copy;
+    return NS_OK;
+}
+
+/*
+ * Stop sessions on the media thread, in one go so the callback hears
+ * about all of them at once
+ */
+nsresult
+VideoRecorder::StopSessions(VideoSession **list, int count,
+    IVideoRecorderCallback *callback)
+{
+    nsresult rv;
+    nsRefPtr<VideoTask> task =
+        new VideoTask(this, VideoTask::STOP, callback);
+    
+    if (!task)
+        return NS_ERROR_OUT_OF_MEMORY;
+    rv = task->Init(list, count);
     if (NS_FAILED(rv)) return rv;
-    rv = o->Remove(PR_FALSE);
+    rv = media.Dispatch(task);
     if (NS_FAILED(rv)) return rv;
+    
+    for (int i = 0; i < count; i++)
+        list[i]->SetMode(0, PR_FALSE);
+    return NS_OK;
+}
 
-    /* Open file */
-    if (!(outfile = fopen(path.get(), "w+"))) {
-        fprintf(stderr, "Could not open OGG file\n");
-        return NS_ERROR_FAILURE;
-    }
-    EscapeBackslash(path);
-	file.Assign(path.get(), strlen(path.get()));
+/*
+ * Start recording to file
+ */
+NS_IMETHODIMP
+VideoRecorder::StartRecordToFile(
+    nsIDOMCanvasRenderingContext2D *ctx,
+    IVideoRecorderCallback *callback,
+    nsACString &file
+)
+{
+    return StartRecordSourceToFile(nsCString(), ctx, callback, file);
+}
+
+NS_IMETHODIMP
+VideoRecorder::StartRecordSourceToFile(
+    const nsACString &id,
+    nsIDOMCanvasRenderingContext2D *ctx,
+    IVideoRecorderCallback *callback,
+    nsACString &file
+)
+{
+    nsresult rv;
+    nsRefPtr<VideoTask> task;
+    VideoSession *session;
+    VideoSettings copy;
     
-    if (ogg_stream_init(ogg_state, rand())) {
-        fprintf(stderr, "Failed ogg_stream_init!\n");
-        return NS_ERROR_FAILURE;
-    }
+    rv = GetSession(id, &session);
+    if (NS_FAILED(rv)) return rv;
+    Prepare(&copy);
+    rv = StartTask(session, VideoTask::START_FILE, &copy, ctx, callback,
+        task);
+    if (NS_FAILED(rv)) return rv;
     
-    th_info_init(&ti);
-    /* Must be multiples of 16 */
-    ti.frame_width = ((WIDTH + 15) >> 4) << 4;
-    ti.frame_height = ((HEIGHT + 15) >> 4) << 4;
-    ti.pic_width = WIDTH;
-    ti.pic_height = HEIGHT;
-    ti.pic_x = 0;
-    ti.pic_y = 0;
-    
-    // Too fast? Why?
-    ti.fps_numerator = FPS_N - 5;
-    ti.fps_denominator = FPS_D;
-    ti.aspect_numerator = 0;
-    ti.aspect_denominator = 0;
-    ti.colorspace = TH_CS_UNSPECIFIED;
-    ti.pixel_fmt = TH_PF_420;
-    ti.target_bitrate = 0;
-    ti.quality = 48;
-    
-    encoder = th_encode_alloc(&ti);
-    th_info_clear(&ti);
-    
-    /* Header init */
-    th_comment_init(&tc);
-    if (th_encode_flushheader(encoder, &tc, &packet) <= 0) {
-        fprintf(stderr,"Internal Theora library error.\n");
-        return NS_ERROR_FAILURE;
+    /* The file is made here, the writer and encoder on the media thread */
+    rv = OutputFile::Create("video", ".ogg", VIDEO_RESERVE, task->mPath,
+        &task->mFile);
+    if (NS_FAILED(rv)) {
+        fprintf(stderr, "Could not open OGG file\n");
+        return rv;
     }
-    th_comment_clear(&tc);
+    nsCAutoString path(task->mPath);
     
-    ogg_stream_packetin(ogg_state, &packet);
-    if (ogg_stream_pageout(ogg_state, &page) != 1) {
-        fprintf(stderr,"Internal Ogg library error.\n");
-        return NS_ERROR_FAILURE;
-    }
-    fwrite(page.header, 1, page.header_len, outfile);
-    fwrite(page.body, 1, page.body_len, outfile);
-    
-    /* Create remaining headers */
-    for (;;) {
-        ret = th_encode_flushheader(encoder, &tc, &packet);
-        if (ret < 0){
-            fprintf(stderr,"Internal Theora library error.\n");
-            return NS_ERROR_FAILURE;
-        } else if (!ret) break;
-        ogg_stream_packetin(ogg_state, &packet);
-    }
-    
-    /* Flush the rest of our headers. This ensures the actual data in each 
-       stream will start on a new page, as per spec. */
-    for (;;) {
-        ret = ogg_stream_flush(ogg_state, &page);
-        if (ret < 0){
-            fprintf(stderr,"Internal Ogg library error.\n");
-            return NS_ERROR_FAILURE;
-        }
-        if (ret == 0) break;
-        fwrite(page.header, 1, page.header_len, outfile);
-        fwrite(page.body, 1, page.body_len, outfile);
+    task->mGeneration = session->SetMode(1, copy.withAudio);
+    rv = media.Dispatch(task);
+    if (NS_FAILED(rv)) {
+        session->SetMode(0, PR_FALSE);
+        OutputFile::Discard(task->mFile, path);
+        return rv;
     }
     
+    VideoSession::EscapePath(path);
+    file.Assign(path.get(), strlen(path.get()));
     return NS_OK;
 }
 
 /*
- * Start recording to file
+ * Start recording to a pipe
  */
 NS_IMETHODIMP
-VideoRecorder::StartRecordToFile(
+VideoRecorder::Start(
     nsIDOMCanvasRenderingContext2D *ctx,
-    nsACString &file
+    IVideoRecorderCallback *callback,
+    nsIAsyncInputStream **out
+)
+{
+    return StartSource(nsCString(), ctx, callback, out);
+}
+
+NS_IMETHODIMP
+VideoRecorder::StartSource(
+    const nsACString &id,
+    nsIDOMCanvasRenderingContext2D *ctx,
+    IVideoRecorderCallback *callback,
+    nsIAsyncInputStream **out
 )
 {
     nsresult rv;
-    if (recording) {
-        fprintf(stderr, "Recording in progress!\n");
-        return NS_ERROR_FAILURE;
-    }
+    nsRefPtr<VideoTask> task;
+    VideoSession *session;
+    VideoSettings copy;
+    nsCOMPtr<nsIAsyncInputStream> pipeIn;
     
-    rv = SetupOggTheora(file);
+    rv = GetSession(id, &session);
+    if (NS_FAILED(rv)) return rv;
+    Prepare(&copy);
+    rv = StartTask(session, VideoTask::START_STREAM, &copy, ctx, callback,
+        task);
     if (NS_FAILED(rv)) return rv;
-
-    /* Acquire camera */
-    if (!(source = vidcap_src_acquire(sapi, &sources[0]))) {
-        fprintf(stderr, "Failed vidcap_src_acquire()\n");
-        return NS_ERROR_FAILURE;
-    }
     
-    /* Acquire surface for callback */
-    if (ctx) {
-        gfxASurface **surface =
-            (gfxASurface **)PR_Malloc(sizeof(gfxASurface *));
-        mCtx = do_QueryInterface(ctx);
-        mCtx->GetThebesSurface(surface);
-        if (*surface != nsnull)
-            mThebes = new gfxContext(*surface);
-        PR_Free(surface);
-    }
+    rv = VideoSession::CreatePipe(copy.highWater, getter_AddRefs(pipeIn),
+        getter_AddRefs(task->mPipe));
+    if (NS_FAILED(rv)) return rv;
     
-    /* Start recording */
-    struct vidcap_fmt_info fmt_info;
-    fmt_info.width = WIDTH;
-    fmt_info.height = HEIGHT;
-    fmt_info.fourcc = VIDCAP_FOURCC_I420;
-    fmt_info.fps_numerator = FPS_N;
-    fmt_info.fps_denominator = FPS_D;
+    task->mGeneration = session->SetMode(2, copy.withAudio);
+    rv = media.Dispatch(task);
+    if (NS_FAILED(rv)) {
+        session->SetMode(0, PR_FALSE);
+        return rv;
+    }
     
-    if (vidcap_format_bind(source, &fmt_info)) {
-		fprintf(stderr, "Failed vidcap_format_bind()\n");
-		return NS_ERROR_FAILURE;
-	}
-	
-	if (vidcap_src_capture_start(source, this->RecordToFileCallback, this)) {
-		fprintf(stderr, "Failed vidcap_src_capture_start()\n");
-		return NS_ERROR_FAILURE;
-	}
-
-	recording = 1;
+    NS_ADDREF(*out = pipeIn);
     return NS_OK;
 }
 
 /*
- * Stop recording
+ * Stop every source that is recording
  */
 NS_IMETHODIMP
-VideoRecorder::Stop()
+VideoRecorder::Stop(IVideoRecorderCallback *callback)
 {
-    ogg_page page;
+    nsresult rv;
+    int count = 0;
+    VideoSession **list;
     
-    if (!recording) {
+    if (!Recording()) {
         fprintf(stderr, "No recording in progress!\n");
         return NS_ERROR_FAILURE;    
     }
-    if (vidcap_src_capture_stop(source)) {
-		fprintf(stderr, "Failed vidcap_src_capture_stop()\n");
-		return NS_ERROR_FAILURE;
-	}
-    vidcap_src_release(source);
+    if (!(list = (VideoSession **)
+        PR_Malloc(numSessions * sizeof(VideoSession *))))
+        return NS_ERROR_OUT_OF_MEMORY;
+    for (int i = 0; i < numSessions; i++) {
+        if (sessions[i] && sessions[i]->Mode())
+            list[count++] = sessions[i];
+    }
+    rv = StopSessions(list, count, callback);
+    PR_Free(list);
+    return rv;
+}
+
+NS_IMETHODIMP
+VideoRecorder::StopSource(const nsACString &id,
+    IVideoRecorderCallback *callback)
+{
+    nsresult rv;
+    VideoSession *session;
+    
+    rv = GetSession(id, &session);
+    if (NS_FAILED(rv)) return rv;
+    if (!session->Mode()) {
+        fprintf(stderr, "No recording in progress!\n");
+        return NS_ERROR_FAILURE;    
+    }
+    return StopSessions(&session, 1, callback);
+}
+
+NS_IMETHODIMP
+VideoRecorder::StartReplay(
+    const nsACString &id,
+    nsIDOMCanvasRenderingContext2D *ctx,
+    IVideoRecorderCallback *callback
+)
+{
+    nsresult rv;
+    nsRefPtr<VideoTask> task;
+    VideoSession *session;
+    VideoSettings copy;
+    
+    rv = GetSession(id, &session);
+    if (NS_FAILED(rv)) return rv;
+    Prepare(&copy);
+    if (!copy.replaySeconds)
+        return NS_ERROR_INVALID_ARG;
+    rv = StartTask(session, VideoTask::START_REPLAY, &copy, ctx, callback,
+        task);
+    if (NS_FAILED(rv)) return rv;
+    
+    task->mGeneration = session->SetMode(3, PR_FALSE);
+    rv = media.Dispatch(task);
+    if (NS_FAILED(rv)) {
+        session->SetMode(0, PR_FALSE);
+        return rv;
+    }
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::SaveReplay(const nsACString &id, nsACString &file)
+{
+    nsresult rv;
+    VideoSession *session;
+    
+    rv = GetSession(id, &session);
+    if (NS_FAILED(rv)) return rv;
+    return session->SaveReplay(file);
+}
+
+NS_IMETHODIMP
+VideoRecorder::SaveReplayToStream(const nsACString &id, nsIInputStream **out)
+{
+    nsresult rv;
+    VideoSession *session;
+    
+    rv = GetSession(id, &session);
+    if (NS_FAILED(rv)) return rv;
+    return session->SaveReplayToStream(out);
+}
+
+/*
+ * Open the output and hand both ends to the transcoder, which closes
+ * them when it is done
+ */
+nsresult
+VideoRecorder::StartTranscode(FILE *in, nsIInputStream *stream,
+    PRUint32 width, PRUint32 height, PRUint32 fpsN, PRUint32 fpsD,
+    IVideoTranscodeListener *listener, nsACString &file)
+{
+    nsresult rv;
+    FILE *out;
+    nsCAutoString path;
+    
+    if (transcoder.Running()) {
+        fprintf(stderr, "Transcode in progress!\n");
+        return NS_ERROR_FAILURE;
+    }
+    
+    rv = OutputFile::Create("video", ".ogg", VIDEO_RESERVE, path, &out);
+    if (NS_FAILED(rv)) {
+        fprintf(stderr, "Could not open OGG file\n");
+        return rv;
+    }
     
-    th_encode_free(encoder);
-    if (ogg_stream_flush(ogg_state, &page)) {
-        fwrite(page.header, page.header_len, 1, outfile);
-        fwrite(page.body, page.body_len, 1, outfile);
+    rv = transcoder.Start(in, stream, width, height, fpsN, fpsD,
+        settings.threads, out, listener);
+    if (NS_FAILED(rv)) {
+        OutputFile::Discard(out, path);
+        return rv;
     }
-    fclose(outfile);
-    ogg_stream_clear(ogg_state);
     
-    recording = 0;
+    VideoSession::EscapePath(path);
+    file.Assign(path.get(), strlen(path.get()));
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::Transcode(
+    const nsACString &input,
+    PRUint32 width, PRUint32 height,
+    PRUint32 fpsN, PRUint32 fpsD,
+    IVideoTranscodeListener *listener,
+    nsACString &file
+)
+{
+    FILE *in;
+    nsCString path(input);
+    
+    if (!(in = fopen(path.get(), "rb"))) {
+        fprintf(stderr, "Could not open transcode input\n");
+        return NS_ERROR_FILE_NOT_FOUND;
+    }
+    nsresult rv = StartTranscode(in, nsnull, width, height, fpsN, fpsD,
+        listener, file);
+    if (NS_FAILED(rv))
+        fclose(in);
+    return rv;
+}
+
+NS_IMETHODIMP
+VideoRecorder::TranscodeStream(
+    nsIInputStream *input,
+    PRUint32 width, PRUint32 height,
+    PRUint32 fpsN, PRUint32 fpsD,
+    IVideoTranscodeListener *listener,
+    nsACString &file
+)
+{
+    if (!input)
+        return NS_ERROR_INVALID_ARG;
+    /* It is read on the transcoder's thread, which script cannot run on */
+    nsCOMPtr<nsIXPConnectWrappedJS> wrapped = do_QueryInterface(input);
+    if (wrapped) {
+        fprintf(stderr, "Transcode input must be a native stream\n");
+        return NS_ERROR_INVALID_ARG;
+    }
+    return StartTranscode(nsnull, input, width, height, fpsN, fpsD,
+        listener, file);
+}
+
+NS_IMETHODIMP
+VideoRecorder::CancelTranscode()
+{
+    if (!transcoder.Running())
+        return NS_ERROR_NOT_AVAILABLE;
+    transcoder.Cancel();
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::BenchmarkIngest(PRUint32 width, PRUint32 height,
+    PRUint32 frames, IVideoBenchmarkCallback *callback)
+{
+    if (!frames || width < 2 || height < 2 || (width & 1) || (height & 1))
+        return NS_ERROR_INVALID_ARG;
+    
+    nsRefPtr<BenchmarkTask> task =
+        new BenchmarkTask(width, height, frames, callback);
+    if (!task)
+        return NS_ERROR_OUT_OF_MEMORY;
+    return media.Dispatch(task);
+}
+
+/*
+ * Time conversion from each capture format on synthetic frames. The
+ * frames are a gradient so the scaler does real work, but the numbers
+ * only mean anything relative to each other and to the frame rate.
+ */
+nsresult
+VideoRecorder::MeasureIngest(PRUint32 width, PRUint32 height,
+    PRUint32 frames, nsACString &retval)
+{
+    static const int formats[] = {
+        VIDCAP_FOURCC_I420, VIDCAP_FOURCC_YUY2, VIDCAP_FOURCC_UYVY,
+        VIDCAP_FOURCC_RGB32, VIDCAP_FOURCC_RGB24
+    };
+    char buf[64];
+    
+    retval.Assign("{");
+    for (unsigned int f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        VideoIngest ingest;
+        nsresult rv = ingest.Init(formats[f], width, height, WIDTH, HEIGHT);
+        if (NS_FAILED(rv))
+            return rv;
+        
+        unsigned char *in = (unsigned char *)PR_Malloc(ingest.FrameSize());
+        if (!in)
+            return NS_ERROR_OUT_OF_MEMORY;
+        for (int i = 0; i < ingest.FrameSize(); i++)
+            in[i] = (unsigned char)(i * 7 / 3);
+        
+        PRTime begin = PR_Now();
+        for (PRUint32 i = 0; i < frames; i++)
+            ingest.Convert(in);
+        PRTime elapsed = PR_Now() - begin;
+        PR_Free(in);
+        
+        if (f)
+            retval.Append(",");
+        SourceRegistry::AppendString(retval,
+            vidcap_fourcc_string_get(formats[f]));
+        PR_snprintf(buf, sizeof(buf), ":%.1f",
+            elapsed > 0 ? (double)frames * PR_USEC_PER_SEC / elapsed : 0.0);
+        retval.Append(buf);
+    }
+    retval.Append("}");
+    return NS_OK;
+}
+
+/*
+ * Bring vidcap up on the media thread, so that the first recording does
+ * not have to wait for it
+ */
+NS_IMETHODIMP
+VideoRecorder::WarmUp(IVideoRecorderCallback *callback)
+{
+    nsRefPtr<VideoTask> task =
+        new VideoTask(this, VideoTask::WARM_UP, callback);
+    if (!task)
+        return NS_ERROR_OUT_OF_MEMORY;
+    return media.Dispatch(task);
+}
+
+/*
+ * Relist the sources on the media thread, as happens by itself when
+ * vidcap notices a camera come or go
+ */
+NS_IMETHODIMP
+VideoRecorder::RefreshSources(IVideoRecorderCallback *callback)
+{
+    nsRefPtr<VideoTask> task =
+        new VideoTask(this, VideoTask::REFRESH, callback);
+    if (!task)
+        return NS_ERROR_OUT_OF_MEMORY;
+    return media.Dispatch(task);
+}
+
+NS_IMETHODIMP
+VideoRecorder::GetDevices(nsACString &retval)
+{
+    nsresult rv = BackendStatus();
+    if (NS_FAILED(rv)) return rv;
+    
+    retval.Truncate();
+    registry.AppendJSON(retval);
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::GetSources(PRUint32 *count, char ***retval)
+{
+    nsresult rv = BackendStatus();
+    if (NS_FAILED(rv)) return rv;
+    
+    return registry.GetIds(count, retval);
+}
+
+NS_IMETHODIMP
+VideoRecorder::GetSourceDescription(const nsACString &id, nsACString &retval)
+{
+    nsresult rv = BackendStatus();
+    if (NS_FAILED(rv)) return rv;
+    
+    return registry.GetDescription(id, retval);
+}
+
+NS_IMETHODIMP
+VideoRecorder::GetEncoderThreads(PRUint32 *retval)
+{
+    *retval = settings.threads;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::SetEncoderThreads(PRUint32 value)
+{
+    if (Recording()) {
+        fprintf(stderr, "Recording in progress!\n");
+        return NS_ERROR_FAILURE;
+    }
+    if (value < 1 || value > MAX_ENCODER_THREADS)
+        return NS_ERROR_INVALID_ARG;
+
+    settings.threads = value;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::GetFlushInterval(PRUint32 *retval)
+{
+    *retval = settings.flushInterval;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::SetFlushInterval(PRUint32 value)
+{
+    if (Recording()) {
+        fprintf(stderr, "Recording in progress!\n");
+        return NS_ERROR_FAILURE;
+    }
+    settings.flushInterval = value;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::GetWriteHighWater(PRUint32 *retval)
+{
+    *retval = settings.highWater;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::SetWriteHighWater(PRUint32 value)
+{
+    if (Recording()) {
+        fprintf(stderr, "Recording in progress!\n");
+        return NS_ERROR_FAILURE;
+    }
+    settings.highWater = value;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::GetCaptureAudio(PRBool *retval)
+{
+    *retval = settings.withAudio;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::SetCaptureAudio(PRBool value)
+{
+    if (Recording()) {
+        fprintf(stderr, "Recording in progress!\n");
+        return NS_ERROR_FAILURE;
+    }
+    settings.withAudio = value;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::GetStaticThreshold(PRUint32 *retval)
+{
+    *retval = settings.staticThreshold;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::SetStaticThreshold(PRUint32 value)
+{
+    if (Recording()) {
+        fprintf(stderr, "Recording in progress!\n");
+        return NS_ERROR_FAILURE;
+    }
+    settings.staticThreshold = value;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::GetAdaptiveSpeed(PRBool *retval)
+{
+    *retval = settings.adaptive;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::SetAdaptiveSpeed(PRBool value)
+{
+    if (Recording()) {
+        fprintf(stderr, "Recording in progress!\n");
+        return NS_ERROR_FAILURE;
+    }
+    settings.adaptive = value;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::GetEncoderSpeed(PRInt32 *retval)
+{
+    *retval = sessions && sessions[last] ? sessions[last]->Controller()->Speed() : 0;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::GetEncoderQuality(PRInt32 *retval)
+{
+    *retval = sessions && sessions[last] ? sessions[last]->Controller()->Quality() :
+        VIDEO_QUALITY;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::GetEncoderLoad(PRUint32 *retval)
+{
+    *retval = sessions && sessions[last] ? sessions[last]->Controller()->Load() : 0;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::GetReplaySeconds(PRUint32 *retval)
+{
+    *retval = settings.replaySeconds;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::SetReplaySeconds(PRUint32 value)
+{
+    if (Recording()) {
+        fprintf(stderr, "Recording in progress!\n");
+        return NS_ERROR_FAILURE;
+    }
+    settings.replaySeconds = value;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::GetReplayMemory(PRUint32 *retval)
+{
+    *retval = settings.replayMemory;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::SetReplayMemory(PRUint32 value)
+{
+    if (Recording()) {
+        fprintf(stderr, "Recording in progress!\n");
+        return NS_ERROR_FAILURE;
+    }
+    settings.replayMemory = value;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::GetThumbnails(PRBool *retval)
+{
+    *retval = settings.thumbnails;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::SetThumbnails(PRBool value)
+{
+    if (Recording()) {
+        fprintf(stderr, "Recording in progress!\n");
+        return NS_ERROR_FAILURE;
+    }
+    settings.thumbnails = value;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::GetThumbnailInterval(PRUint32 *retval)
+{
+    *retval = settings.thumbnailInterval;
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::SetThumbnailInterval(PRUint32 value)
+{
+    if (Recording()) {
+        fprintf(stderr, "Recording in progress!\n");
+        return NS_ERROR_FAILURE;
+    }
+    settings.thumbnailInterval = value;
+    return NS_OK;
+}
+
+/*
+ * Describe the thumbnails recorded alongside 'file'
+ */
+NS_IMETHODIMP
+VideoRecorder::ThumbnailIndex(const nsACString &file, nsACString &retval)
+{
+    nsCAutoString path(file);
+    path.Append(".thumbs");
+    return ThumbnailSidecar::Index(path.get(), retval);
+}
+
+/*
+ * Paint one thumbnail onto a canvas, the way the preview is painted
+ */
+NS_IMETHODIMP
+VideoRecorder::DrawThumbnail(const nsACString &file, PRUint32 index,
+    nsIDOMCanvasRenderingContext2D *ctx, PRInt32 x, PRInt32 y)
+{
+    nsresult rv;
+    nsCAutoString path(file);
+    path.Append(".thumbs");
+    
+    nsCOMPtr<nsICanvasRenderingContextInternal> canvas =
+        do_QueryInterface(ctx);
+    if (!canvas)
+        return NS_ERROR_INVALID_ARG;
+    nsRefPtr<gfxASurface> surface;
+    canvas->GetThebesSurface(getter_AddRefs(surface));
+    if (!surface)
+        return NS_ERROR_FAILURE;
+    
+    unsigned char *yuv = (unsigned char *)
+        PR_Malloc(ThumbnailSidecar::ThumbSize());
+    unsigned char *rgb = (unsigned char *)
+        PR_Malloc(THUMB_WIDTH * THUMB_HEIGHT * 4);
+    if (!yuv || !rgb) {
+        PR_Free(yuv);
+        PR_Free(rgb);
+        return NS_ERROR_OUT_OF_MEMORY;
+    }
+    rv = ThumbnailSidecar::Read(path.get(), index, yuv);
+    if (NS_SUCCEEDED(rv)) {
+        vidcap_i420_to_rgb32(THUMB_WIDTH, THUMB_HEIGHT,
+            (const char *)yuv, (char *)rgb);
+        nsRefPtr<gfxImageSurface> img = new gfxImageSurface(
+            rgb, gfxIntSize(THUMB_WIDTH, THUMB_HEIGHT),
+            THUMB_WIDTH * 4, gfxASurface::ImageFormatARGB32
+        );
+        nsRefPtr<gfxContext> thebes = new gfxContext(surface);
+        if (!img || img->CairoStatus()) {
+            fprintf(stderr, "Could not setup gfxSurface!\n");
+            rv = NS_ERROR_FAILURE;
+        } else {
+            thebes->ResetClip();
+            thebes->IdentityMatrix();
+            thebes->Translate(gfxPoint(x, y));
+            thebes->NewPath();
+            thebes->Rectangle(gfxRect(0, 0, THUMB_WIDTH, THUMB_HEIGHT));
+            thebes->SetSource(img, gfxPoint(0, 0));
+            thebes->SetOperator(gfxContext::OPERATOR_SOURCE);
+            thebes->Fill();
+        }
+    }
+    PR_Free(yuv);
+    PR_Free(rgb);
+    return rv;
+}
+
+/*
+ * Everything we know about each source's last (or current) recording,
+ * as a JSON array
+ */
+NS_IMETHODIMP
+VideoRecorder::GetStats(nsACString &retval)
+{
+    PRBool first = PR_TRUE;
+    
+    retval.Assign("[");
+    for (int i = 0; i < numSessions; i++) {
+        if (!sessions[i])
+            continue;
+        if (!first)
+            retval.Append(",");
+        sessions[i]->AppendStats(retval);
+        first = PR_FALSE;
+    }
+    retval.Append("]");
+    return NS_OK;
+}
+
+/*
+ * The budget every pipe, chunk and write queue shares, and what each of
+ * them holds
+ */
+NS_IMETHODIMP
+VideoRecorder::GetMemoryBudget(PRUint32 *retval)
+{
+    *retval = BufferArena::Budget();
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::SetMemoryBudget(PRUint32 value)
+{
+    BufferArena::SetBudget(value);
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::GetMemoryStats(nsACString &retval)
+{
+    retval.Truncate();
+    BufferArena::AppendStats(retval);
+    return NS_OK;
+}
+
+/*
+ * Trace each frame through capture, conversion, encoding and writing
+ */
+NS_IMETHODIMP
+VideoRecorder::StartTrace()
+{
+    TraceRing::Start();
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::StopTrace()
+{
+    TraceRing::Stop();
+    return NS_OK;
+}
+
+NS_IMETHODIMP
+VideoRecorder::GetTrace(nsACString &retval)
+{
+    retval.Truncate();
+    TraceRing::AppendJSON(retval);
     return NS_OK;
 }
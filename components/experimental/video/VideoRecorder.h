@@ -39,34 +39,18 @@
 #define VideoRecorder_h_
 
 #include "IVideoRecorder.h"
-
-#include <time.h>
-#include <ogg/ogg.h>
-#include <vidcap/vidcap.h>
-#include <vidcap/converters.h>
-#include <theora/theoraenc.h>
-
-#include "prmem.h"
-#include "gfxContext.h"
-#include "gfxPattern.h"
-#include "gfxASurface.h"
-#include "gfxImageSurface.h"
-#include "nsStringAPI.h"
-#include "nsDirectoryServiceDefs.h"
-#include "nsDirectoryServiceUtils.h"
-#include "nsComponentManagerUtils.h"
-#include "nsICanvasRenderingContextInternal.h"
+#include "VideoSession.h"
+#include "Transcoder.h"
+#include "nsMemory.h"
+#include "nsIXPConnect.h"
+#include "pratom.h"
 
 #define VIDEO_RECORDER_CONTRACTID "@labs.mozilla.com/video/recorder;1"
 #define VIDEO_RECORDER_CLASSNAME  "Video Recording Capability"
 #define VIDEO_RECORDER_CID { 0xb3ee26b3, 0xe935, 0x4c56, \
                            { 0x83, 0xa1, 0x5e, 0x88, 0x55, 0xd7, 0x11, 0x4b }}
 
-
-#define WIDTH 640
-#define HEIGHT 480
-#define FPS_N 15
-#define FPS_D 1
+class VideoTask;
 
 class VideoRecorder : public IVideoRecorder
 {
@@ -76,29 +60,49 @@ public:
 
     nsresult Init();
     static VideoRecorder *GetSingleton();
+    static VideoRecorder *GetService() { return gVideoRecordingService; }
+    /* Media thread */
+    nsresult EnsureBackend();
+    nsresult UpdateSources(PRBool relist);
+    static nsresult MeasureIngest(PRUint32 width, PRUint32 height,
+        PRUint32 frames, nsACString &result);
     virtual ~VideoRecorder();
     VideoRecorder(){}
 
 private:
-    int size;
-    int recording;
-    FILE *outfile;
+    VideoSettings settings;
     
     vidcap_sapi *sapi;
-    vidcap_src *source;
     vidcap_state *state;
-    th_enc_ctx *encoder;
-    ogg_stream_state *ogg_state;
+    PRBool backendTried;
+    nsresult backendStatus;
+    /* Set once backendStatus is final, for the main thread to look at
+       without waiting on vidcap */
+    PRInt32 backendReady;
     
-    struct vidcap_src_info *sources;
+    SourceRegistry registry;
+    int numSessions;
+    VideoSession **sessions;
+    /* Session the single-valued attributes report on */
+    int last;
+    Transcoder transcoder;
+    MediaThread media;
     static VideoRecorder *gVideoRecordingService;
-    
-    nsRefPtr<gfxContext> mThebes;
-    nsCOMPtr<nsICanvasRenderingContextInternal> mCtx;
 protected:
-    nsresult SetupOggTheora(nsACString& file);
-    static int RecordToFileCallback(vidcap_src *src,
-	    void *data, struct vidcap_capture_info *video);
+    nsresult InitBackend();
+    nsresult BackendStatus();
+    static int SourcesChanged(vidcap_sapi *sapi, void *data);
+    PRBool Recording();
+    nsresult GetSession(const nsACString &id, VideoSession **session);
+    void Prepare(VideoSettings *copy);
+    nsresult StartTask(VideoSession *session, int op, VideoSettings *copy,
+        nsIDOMCanvasRenderingContext2D *ctx,
+        IVideoRecorderCallback *callback, nsRefPtr<VideoTask> &task);
+    nsresult StopSessions(VideoSession **list, int count,
+        IVideoRecorderCallback *callback);
+    nsresult StartTranscode(FILE *in, nsIInputStream *stream,
+        PRUint32 width, PRUint32 height, PRUint32 fpsN, PRUint32 fpsD,
+        IVideoTranscodeListener *listener, nsACString &file);
 };
 
 #endif
@@ -0,0 +1,1253 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "VideoSession.h"
+
+VideoSession::VideoSession(vidcap_sapi *sapi, SourceRegistry *registry,
+    VideoSource *device)
+    : recordingLock(NULL)
+    , sapi(sapi)
+    , registry(registry)
+    , device(device)
+    , info(&device->info)
+{
+}
+
+nsresult
+VideoSession::Init()
+{
+    mode = 0;
+    modeAudio = PR_FALSE;
+    generation = 0;
+    recording = 0;
+    threads = 1;
+    chunked = nsnull;
+    encoder = NULL;
+    flushInterval = FLUSH_INTERVAL;
+    highWater = WRITE_HIGH_WATER;
+    withAudio = PR_FALSE;
+    muxing = PR_FALSE;
+    lowLatency = PR_FALSE;
+    replaying = PR_FALSE;
+    indexing = PR_FALSE;
+    withThumbs = PR_FALSE;
+    outfile = NULL;
+    held = NULL;
+    haveHeld = PR_FALSE;
+    adaptive = PR_TRUE;
+    shed = 0;
+    source = NULL;
+    audioStream = NULL;
+    vorbis = nsnull;
+    
+    if (!(recordingLock = PR_NewLock()))
+        return NS_ERROR_OUT_OF_MEMORY;
+    if (NS_FAILED(stats.Init()))
+        return NS_ERROR_OUT_OF_MEMORY;
+    writer.SetStats(&stats);
+    
+    if (!(ogg_state = (ogg_stream_state *)
+        PR_Calloc(1, sizeof(ogg_stream_state))))
+        return NS_ERROR_OUT_OF_MEMORY;
+    size = WIDTH * HEIGHT * 3 / 2;
+    return NS_OK;
+}
+
+VideoSession::~VideoSession()
+{
+    if (recording)
+        Stop(nsnull);
+    PR_Free(ogg_state);
+    if (recordingLock)
+        PR_DestroyLock(recordingLock);
+}
+
+void
+VideoSession::Configure(VideoSettings *settings)
+{
+    threads = settings->threads;
+    flushInterval = settings->flushInterval;
+    highWater = settings->highWater;
+    withAudio = settings->withAudio;
+    adaptive = settings->adaptive;
+    scene.SetThreshold(settings->staticThreshold);
+    replayFrames = settings->replaySeconds * FPS_N / FPS_D;
+    replayMemory = settings->replayMemory;
+    withThumbs = settings->thumbnails;
+    thumbInterval = settings->thumbnailInterval * FPS_N / FPS_D;
+}
+
+/*
+ * This replaces \ with \\ so that Windows paths are sane
+ */
+static void
+EscapeBackslash(nsACString& str)
+{
+	const char *sp;
+	const char *mp = "\\";
+	const char *np = "\\\\";
+
+	PRUint32 sl;
+	PRUint32 ml = 1;
+	PRUint32 nl = 2;
+
+	sl = NS_CStringGetData(str, &sp);
+	for (const char* iter = sp; iter <= sp + sl - ml; ++iter) {
+	    if (memcmp(iter, mp, ml) == 0) {
+            PRUint32 offset = iter - sp;
+            NS_CStringSetDataRange(str, offset, ml, np, nl);
+            sl = NS_CStringGetData(str, &sp);
+            iter = sp + offset + nl - 1;
+	    }
+	}
+}
+
+/*
+ * Encode one frame, followed by 'dups' repeats of it. With chunked
+ * encoding the frame is lost if every chunk is busy, unless 'wait' is set.
+ */
+nsresult
+VideoSession::EncodeFrame(unsigned char *yuv, int dups, PRBool wait)
+{
+    ogg_packet op;
+    th_ycbcr_buffer ycbcr;
+
+    ycbcr[0].width = WIDTH;
+    ycbcr[0].stride = WIDTH;
+    ycbcr[0].height = HEIGHT;
+
+    ycbcr[1].width = (WIDTH >> 1);
+    ycbcr[1].height = (HEIGHT >> 1);
+    ycbcr[1].stride = ycbcr[1].width;
+
+    ycbcr[2].width = ycbcr[1].width;
+    ycbcr[2].height = ycbcr[1].height;
+    ycbcr[2].stride = ycbcr[1].stride;
+
+    ycbcr[0].data = yuv;
+    ycbcr[1].data = yuv + WIDTH * HEIGHT;
+    ycbcr[2].data = ycbcr[1].data + WIDTH * HEIGHT / 4;
+
+    PRInt64 frame = position;
+    position += 1 + dups;
+    if (chunked) {
+        if (thumbs.Due(frame, dups, pushed % chunked->ChunkFrames() == 0))
+            thumbs.Add(yuv, frame, dups);
+        pushed++;
+        return chunked->PushFrame(ycbcr, dups, wait);
+    }
+
+    /* Repeats are coded as empty packets, so they cost next to nothing */
+    if (dups > 0 &&
+        th_encode_ctl(encoder, TH_ENCCTL_SET_DUP_COUNT, &dups, sizeof(dups))) {
+        fprintf(stderr, "Could not set duplicate count!\n");
+        return NS_ERROR_FAILURE;
+    }
+    PRTime begin = PR_Now();
+    if (th_encode_ycbcr_in(encoder, ycbcr) != 0) {
+        fprintf(stderr, "Could not encode frame!\n");
+        return NS_ERROR_FAILURE;
+    }
+
+    PRTime encoded = PR_Now();
+    int packets = 0;
+    PRBool keyframe = PR_FALSE;
+    while (th_encode_packetout(encoder, 0, &op) > 0) {
+        if (!packets && th_packet_iskeyframe(&op) > 0)
+            keyframe = PR_TRUE;
+        WritePacket(&op);
+        packets++;
+    }
+    stats.Time(PipelineStats::STAGE_ENCODE, encoded - begin);
+    stats.Time(PipelineStats::STAGE_PACKET, PR_Now() - encoded);
+    if (!packets) {
+        fprintf(stderr, "Could not read packet!\n");
+        return NS_ERROR_FAILURE;
+    }
+    if (thumbs.Due(frame, dups, keyframe))
+        thumbs.Add(yuv, frame, dups);
+    return NS_OK;
+}
+
+/*
+ * Encode a frame that fills 'count' slots. With static scene detection
+ * on, each frame is held back until the next one has been looked at: if
+ * that one is unchanged it is folded into the held frame as a repeat,
+ * which costs an empty packet instead of a full encode. Repeats are
+ * capped so the keyframe interval is still honoured.
+ */
+nsresult
+VideoSession::QueueFrame(unsigned char *yuv, int count)
+{
+    nsresult rv;
+
+    if (!held)
+        return EncodeFrame(yuv, count - 1, PR_FALSE);
+
+    if (haveHeld && heldDups + count < KEYFRAME_FREQ &&
+        scene.IsStatic(yuv, held)) {
+        heldDups += count;
+        return NS_OK;
+    }
+
+    if (haveHeld) {
+        rv = EncodeFrame(held, heldDups, PR_FALSE);
+        if (NS_FAILED(rv))
+            return rv;
+    }
+    memcpy(held, yuv, size);
+    heldDups = count - 1;
+    haveHeld = PR_TRUE;
+    return NS_OK;
+}
+
+/*
+ * Page out an encoded packet
+ */
+void
+VideoSession::WritePacket(ogg_packet *op)
+{
+    ogg_page og;
+
+    if (replaying) {
+        replay.AddPacket(op);
+        return;
+    }
+    /* An indexed keyframe starts a page of its own, so the index can
+     * point a player straight at it */
+    if (indexing && th_packet_iskeyframe(op) > 0) {
+        while (ogg_stream_flush(ogg_state, &og))
+            WritePage(&og);
+        skeleton.Keyframe(ogg_state->serialno, ogg_state->pageno,
+            (op->granulepos >> granuleShift) - 1);
+    }
+    TRACE_BEGIN("page out", (PRUint32)op->packetno);
+    ogg_stream_packetin(ogg_state, op);
+    if (lowLatency) {
+        while (ogg_stream_flush(ogg_state, &og))
+            WritePage(&og);
+    } else {
+        while (ogg_stream_pageout(ogg_state, &og))
+            WritePage(&og);
+    }
+    TRACE_END("page out", (PRUint32)op->packetno);
+}
+
+/*
+ * Theora pages go straight to the file, unless they have to be
+ * interleaved with audio
+ */
+void
+VideoSession::WritePage(ogg_page *og)
+{
+    if (muxing)
+        muxer.VideoPage(og);
+    else
+        writer.WritePage(og);
+}
+
+void
+VideoSession::OnPacket(void *data, ogg_packet *op)
+{
+    static_cast<VideoSession*>(data)->WritePacket(op);
+}
+
+/*
+ * Paint a frame onto the preview canvas, if we have one
+ */
+void
+VideoSession::PaintFrame(unsigned char *yuv)
+{
+    gfxContext *thebes = canvas.thebes;
+    if (!canvas.ctx || !thebes)
+        return;
+
+    PRTime begin = PR_Now();
+    unsigned char *rgb = (unsigned char *)
+        PR_Calloc(1, WIDTH * HEIGHT * 4);
+    vidcap_i420_to_rgb32(
+        WIDTH, HEIGHT,
+        (const char *)yuv, (char *)rgb
+    );
+    nsRefPtr<gfxImageSurface> img = new gfxImageSurface(
+        rgb, gfxIntSize(WIDTH, HEIGHT),
+        WIDTH * 4, gfxASurface::ImageFormatARGB32
+    );
+    if (!img || img->CairoStatus()) {
+        fprintf(stderr, "Could not setup gfxSurface!\n");
+    } else {
+        gfxContextPathAutoSaveRestore pathSR(thebes);
+        gfxContextAutoSaveRestore autoSR(thebes);
+        // ignore clipping region, as per spec
+        thebes->ResetClip();
+        thebes->IdentityMatrix();
+        thebes->Translate(gfxPoint(0, 0));
+        thebes->NewPath();
+        thebes->Rectangle(gfxRect(0, 0, WIDTH, HEIGHT));
+        thebes->SetSource(img, gfxPoint(0, 0));
+        thebes->SetOperator(gfxContext::OPERATOR_SOURCE);
+        thebes->Fill();
+    }
+    PR_Free((void *)rgb);
+    stats.Time(PipelineStats::STAGE_PAINT, PR_Now() - begin);
+}
+
+/*
+ * Frames are paced by their capture time rather than by how fast vidcap
+ * happens to hand them to us: early frames are dropped, late ones are
+ * repeated, so the file plays back at FPS_N/FPS_D regardless of jitter.
+ */
+int
+VideoSession::RecordToFileCallback(vidcap_src *src, void *data,
+    struct vidcap_capture_info *video)
+{
+    const unsigned char *raw = (const unsigned char *)video->video_data;
+    VideoSession *vr = static_cast<VideoSession*>(data);
+    PRTime when = (PRTime)video->capture_time_sec * PR_USEC_PER_SEC +
+        video->capture_time_usec;
+    
+    int frames = video->video_data_size / vr->ingest.FrameSize();
+    TRACE_THREAD("capture");
+    for (int i = 0; i < frames; i++) {
+        PRTime begin = PR_Now();
+        PRUint32 id = (PRUint32)vr->pacer.Frames();
+        int count = 0;
+        TRACE_BEGIN("frame", id);
+        vr->stats.Time(PipelineStats::STAGE_CAPTURE, begin - when);
+        TRACE_BEGIN("convert", id);
+        unsigned char *yuv = vr->ingest.Convert(raw);
+        TRACE_END("convert", id);
+        vr->stats.Time(PipelineStats::STAGE_CONVERT, PR_Now() - begin);
+        /* Video starts on the clock shared with the audio */
+        if (vr->withAudio && !vr->pacer.Started())
+            vr->pacer.SetLead(begin - vr->startTime);
+        /* Shed load while the encoders or the disk are behind */
+        if ((vr->chunked && !vr->chunked->CanAccept()) ||
+            vr->writer.Congested()) {
+            vr->pacer.Skip();
+            vr->shed++;
+            TRACE_INSTANT("shed", id);
+        } else
+            count = vr->pacer.Schedule(when);
+        if (count > 0) {
+            TRACE_BEGIN("queue", id);
+            nsresult rv = vr->QueueFrame(yuv, count);
+            TRACE_END("queue", id);
+            if (NS_FAILED(rv)) {
+                TRACE_END("frame", id);
+                return -1;
+            }
+            TRACE_BEGIN("paint", id);
+            vr->PaintFrame(yuv);
+            TRACE_END("paint", id);
+        }
+        PRTime busy = PR_Now() - begin;
+        vr->pacer.Account(busy);
+        vr->AdaptEffort(busy);
+        if (vr->chunked)
+            vr->stats.Depth(PipelineStats::QUEUE_CHUNKS,
+                vr->chunked->Pending());
+        vr->stats.Depth(PipelineStats::QUEUE_WRITE, vr->writer.Queued() >> 10);
+        TRACE_END("frame", id);
+        
+        raw += vr->ingest.FrameSize();
+    }
+    return 0;
+}
+
+/*
+ * How full the fullest queue behind the encoder is, in percent. Chunks
+ * beyond one per thread are work the encoders have not started on.
+ */
+PRUint32
+VideoSession::Backlog()
+{
+    PRUint32 backlog = 0;
+    
+    if (chunked) {
+        PRUint32 pending = chunked->Pending();
+        if (pending > (PRUint32)threads)
+            backlog = (pending - threads) * 100 / threads;
+    }
+    if (highWater) {
+        PRUint32 queued = (PRUint32)
+            (((PRUint64)writer.Queued() * 100) / highWater);
+        if (queued > backlog)
+            backlog = queued;
+    }
+    return backlog;
+}
+
+/*
+ * Feed the speed controller and pass its decisions on to the encoder(s)
+ */
+void
+VideoSession::AdaptEffort(PRTime busy)
+{
+    if (!adaptive)
+        return;
+    /* Chunked encoding happens elsewhere, only the backlog tells */
+    if (chunked)
+        busy = 0;
+    if (!speed.Update(busy, pacer.Interval(), Backlog()))
+        return;
+    
+    int sp = speed.Speed();
+    int q = speed.Quality();
+    if (chunked) {
+        chunked->SetEffort(sp, q);
+    } else {
+        th_encode_ctl(encoder, TH_ENCCTL_SET_SPLEVEL, &sp, sizeof(sp));
+        th_encode_ctl(encoder, TH_ENCCTL_SET_QUALITY, &q, sizeof(q));
+    }
+}
+
+void
+VideoSession::OnAudioPage(void *data, ogg_page *og)
+{
+    VideoSession *vr = static_cast<VideoSession*>(data);
+    if (vr->muxing)
+        vr->muxer.AudioPage(og);
+    else
+        vr->writer.WritePage(og);
+}
+
+int
+VideoSession::AudioCallback(const void *input, void *output,
+        unsigned long framesPerBuffer,
+        const PaStreamCallbackTimeInfo* timeInfo,
+        PaStreamCallbackFlags statusFlags,
+        void *userData)
+{
+    VideoSession *vr = static_cast<VideoSession*>(userData);
+
+    /* Only queued here, Vorbis runs on the queue's thread. Pad the start
+     * so audio begins on the clock shared with the video. */
+    if (!vr->audioStarted) {
+        PRTime lead = PR_Now() - vr->startTime;
+        if (lead > 0)
+            vr->audioQueue.Write(nsnull,
+                (long)(lead * AUDIO_SAMPLE_RATE / PR_USEC_PER_SEC));
+        vr->audioStarted = PR_TRUE;
+    }
+
+    /* Keep the audio clock running through dropouts */
+    vr->audioQueue.Write((const int *)input, framesPerBuffer);
+
+    return paContinue;
+}
+
+/*
+ * Open and start the default audio input
+ */
+nsresult
+VideoSession::StartAudio()
+{
+    PaError err;
+    PaDeviceIndex dev;
+    PaStreamParameters inputParameters;
+
+    if ((err = Pa_Initialize()) != paNoError) {
+        fprintf(stderr, "Could not initialize PortAudio! %d\n", err);
+        return NS_ERROR_FAILURE;
+    }
+
+    if ((dev = Pa_GetDefaultInputDevice()) == paNoDevice) {
+        fprintf(stderr, "Could not find audio input device!\n");
+        Pa_Terminate();
+        return NS_ERROR_UNEXPECTED;
+    }
+
+    inputParameters.device = dev;
+    inputParameters.channelCount = AUDIO_CHANNELS;
+    inputParameters.sampleFormat = paInt32;
+    inputParameters.suggestedLatency =
+        Pa_GetDeviceInfo(dev)->defaultLowInputLatency;
+    inputParameters.hostApiSpecificStreamInfo = NULL;
+
+    audioStarted = PR_FALSE;
+    err = Pa_OpenStream(
+            &audioStream,
+            &inputParameters,
+            NULL,
+            AUDIO_SAMPLE_RATE,
+            AUDIO_FRAMES_PER_BUFFER,
+            paClipOff,
+            this->AudioCallback,
+            this
+    );
+    if (err != paNoError) {
+        fprintf(stderr, "Could not open audio stream! %d\n", err);
+        audioStream = NULL;
+        Pa_Terminate();
+        return NS_ERROR_FAILURE;
+    }
+
+    if ((err = Pa_StartStream(audioStream)) != paNoError) {
+        fprintf(stderr, "Could not start audio stream! %d\n", err);
+        Pa_CloseStream(audioStream);
+        audioStream = NULL;
+        Pa_Terminate();
+        return NS_ERROR_FAILURE;
+    }
+    return NS_OK;
+}
+
+void
+VideoSession::StopAudio()
+{
+    if (!audioStream)
+        return;
+
+    Pa_StopStream(audioStream);
+    Pa_CloseStream(audioStream);
+    audioStream = NULL;
+    Pa_Terminate();
+}
+
+void
+VideoSession::EscapePath(nsACString& path)
+{
+    EscapeBackslash(path);
+}
+
+/*
+ * Look up the surface behind a canvas, on the main thread
+ */
+nsresult
+VideoCanvas::Init(nsIDOMCanvasRenderingContext2D *canvas)
+{
+    nsRefPtr<gfxASurface> surface;
+    
+    if (!canvas)
+        return NS_OK;
+    ctx = do_QueryInterface(canvas);
+    if (!ctx)
+        return NS_ERROR_INVALID_ARG;
+    ctx->GetThebesSurface(getter_AddRefs(surface));
+    if (surface)
+        thebes = new gfxContext(surface);
+    return NS_OK;
+}
+
+/*
+ * A pipe for StartStream(), on the main thread: NS_NewPipe2 is not
+ * exported by XPCOM. The pipe is what bounds how far a slow reader may
+ * fall behind.
+ */
+nsresult
+VideoSession::CreatePipe(PRUint32 highWater, nsIAsyncInputStream **in,
+    nsIAsyncOutputStream **out)
+{
+    nsresult rv;
+    nsCOMPtr<nsIPipe> pipe = do_CreateInstance("@mozilla.org/pipe;1");
+    if (!pipe)
+        return NS_ERROR_OUT_OF_MEMORY;
+    
+    nsCOMPtr<nsIMemory> arena = new ArenaMemory(BufferArena::ARENA_PIPE);
+    if (!arena)
+        return NS_ERROR_OUT_OF_MEMORY;
+    
+    PRUint32 segments = highWater / STREAM_SEGMENT_SIZE;
+    if (segments < 4)
+        segments = 4;
+    rv = pipe->Init(PR_TRUE, PR_TRUE, STREAM_SEGMENT_SIZE, segments, arena);
+    if (NS_FAILED(rv)) return rv;
+    
+    pipe->GetInputStream(in);
+    pipe->GetOutputStream(out);
+    return NS_OK;
+}
+
+PRUint32
+VideoSession::SetMode(int m, PRBool audio)
+{
+    mode = m;
+    modeAudio = audio;
+    return ++generation;
+}
+
+/*
+ * Nothing to stop after a failed start, unless script has asked for
+ * something else in the meantime
+ */
+void
+VideoSession::StartFailed(PRUint32 gen)
+{
+    if (gen == generation)
+        mode = 0;
+}
+
+/*
+ * Media thread, once a start has set everything up or a stop has torn
+ * it down
+ */
+void
+VideoSession::SetRecording(int r)
+{
+    PR_Lock(recordingLock);
+    recording = r;
+    PR_Unlock(recordingLock);
+}
+
+/*
+ * Any thread. Mode() changes as soon as script asks, long before the
+ * media thread gets round to it; this only once it has.
+ */
+int
+VideoSession::Recording()
+{
+    PR_Lock(recordingLock);
+    int r = recording;
+    PR_Unlock(recordingLock);
+    return r;
+}
+
+/*
+ * Open the writer on a file made on the main thread
+ */
+nsresult
+VideoSession::OpenOggFile(FILE *file, const nsACString &path)
+{
+    nsresult rv;
+    
+    outfile = file;
+    outPath.Assign(path);
+    rv = writer.Open(outfile, flushInterval, highWater);
+    if (NS_FAILED(rv)) {
+        OutputFile::Discard(outfile, path);
+        outfile = NULL;
+        return rv;
+    }
+    
+    /* Thumbnails are a nicety, record without them if we must */
+    if (withThumbs) {
+        nsCAutoString thumbPath(path);
+        thumbPath.Append(".thumbs");
+        if (NS_FAILED(thumbs.Open(thumbPath.get(), WIDTH, HEIGHT,
+            FPS_N, FPS_D, thumbInterval)))
+            fprintf(stderr, "Recording without thumbnails\n");
+    }
+    return NS_OK;
+}
+
+/*
+ * Setup Ogg/Theora stream, the writer must already be open
+ */
+nsresult
+VideoSession::SetupOggTheora()
+{
+    int ret;
+    th_info ti;
+    nsresult rv;
+    th_comment tc;
+    ogg_page page;
+    ogg_packet packet;
+    
+    if (ogg_stream_init(ogg_state, rand())) {
+        fprintf(stderr, "Failed ogg_stream_init!\n");
+        return NS_ERROR_FAILURE;
+    }
+    
+    th_info_init(&ti);
+    /* Must be multiples of 16 */
+    ti.frame_width = ((WIDTH + 15) >> 4) << 4;
+    ti.frame_height = ((HEIGHT + 15) >> 4) << 4;
+    ti.pic_width = WIDTH;
+    ti.pic_height = HEIGHT;
+    ti.pic_x = 0;
+    ti.pic_y = 0;
+    
+    ti.fps_numerator = FPS_N;
+    ti.fps_denominator = FPS_D;
+    ti.aspect_numerator = 0;
+    ti.aspect_denominator = 0;
+    ti.colorspace = TH_CS_UNSPECIFIED;
+    ti.pixel_fmt = TH_PF_420;
+    ti.target_bitrate = 0;
+    ti.quality = VIDEO_QUALITY;
+    
+    if (!(encoder = th_encode_alloc(&ti))) {
+        fprintf(stderr, "Failed th_encode_alloc!\n");
+        th_info_clear(&ti);
+        return NS_ERROR_FAILURE;
+    }
+    int shift = ti.keyframe_granule_shift;
+    granuleShift = shift;
+    
+    ogg_uint32_t kf = KEYFRAME_FREQ;
+    th_encode_ctl(encoder, TH_ENCCTL_SET_KEYFRAME_FREQUENCY_FORCE,
+        &kf, sizeof(kf));
+    pacer.Init(FPS_N, FPS_D, KEYFRAME_FREQ);
+    position = 0;
+    pushed = 0;
+    
+    /* Give the controller a second of frames between decisions */
+    int splmax = 0;
+    if (!adaptive || th_encode_ctl(encoder, TH_ENCCTL_GET_SPLEVEL_MAX,
+            &splmax, sizeof(splmax)))
+        splmax = 0;
+    speed.Init(splmax, VIDEO_QUALITY,
+        adaptive ? MIN_VIDEO_QUALITY : VIDEO_QUALITY, FPS_N / FPS_D);
+    
+    scene.Init(WIDTH, HEIGHT, WIDTH);
+    scene.Reset();
+    stats.Reset();
+    shed = 0;
+    haveHeld = PR_FALSE;
+    if (scene.Enabled() && !(held = (unsigned char *)PR_Malloc(size))) {
+        th_info_clear(&ti);
+        return NS_ERROR_OUT_OF_MEMORY;
+    }
+    
+    /* One second chunks, one queued behind each busy thread */
+    if (threads > 1) {
+        chunked = new ChunkedEncoder();
+        if (!chunked) {
+            th_info_clear(&ti);
+            return NS_ERROR_OUT_OF_MEMORY;
+        }
+        rv = chunked->Init(&ti, threads, FPS_N / FPS_D, threads * 2,
+            OnPacket, this);
+        chunked->SetStats(&stats);
+        if (NS_FAILED(rv)) {
+            delete chunked;
+            chunked = nsnull;
+            th_info_clear(&ti);
+            return rv;
+        }
+    }
+    th_info_clear(&ti);
+    
+    /* Header init */
+    th_comment_init(&tc);
+    if (th_encode_flushheader(encoder, &tc, &packet) <= 0) {
+        fprintf(stderr,"Internal Theora library error.\n");
+        return NS_ERROR_FAILURE;
+    }
+    th_comment_clear(&tc);
+    
+    /* The ring frames its own stream when saved, it only needs the
+     * header packets */
+    if (replaying) {
+        rv = replay.Init(shift, replayFrames, replayMemory);
+        if (NS_SUCCEEDED(rv))
+            rv = replay.AddHeader(&packet);
+        if (NS_FAILED(rv))
+            return rv;
+    }
+    
+    if (withAudio) {
+        vorbis = new VorbisEncoder();
+        if (!vorbis)
+            return NS_ERROR_OUT_OF_MEMORY;
+        rv = vorbis->Init(AUDIO_CHANNELS, AUDIO_SAMPLE_RATE, AUDIO_QUALITY,
+            OnAudioPage, this);
+        if (NS_FAILED(rv))
+            return rv;
+        vorbis->SetLowLatency(lowLatency);
+    }
+    
+    /* Files get a skeleton track with a seek index, written first */
+    indexing = (outfile != NULL && !replaying);
+    if (indexing) {
+        rv = skeleton.Init();
+        if (NS_SUCCEEDED(rv))
+            rv = skeleton.AddStream(ogg_state->serialno, FPS_N, FPS_D,
+                shift, 0, 3, "video/theora", PR_TRUE);
+        if (NS_SUCCEEDED(rv) && vorbis)
+            rv = skeleton.AddStream(vorbis->Serial(), AUDIO_SAMPLE_RATE, 1,
+                0, 2, 3, "audio/vorbis", PR_FALSE);
+        if (NS_FAILED(rv)) {
+            fprintf(stderr, "Recording without a seek index\n");
+            indexing = PR_FALSE;
+        } else {
+            writer.SetSkeleton(&skeleton);
+            skeleton.WriteBOS(&writer);
+        }
+    }
+    
+    ogg_stream_packetin(ogg_state, &packet);
+    if (ogg_stream_pageout(ogg_state, &page) != 1) {
+        fprintf(stderr,"Internal Ogg library error.\n");
+        return NS_ERROR_FAILURE;
+    }
+    writer.WritePage(&page);
+    
+    /* All BOS pages come first, so Vorbis goes right after Theora's */
+    if (vorbis)
+        vorbis->WriteBOS();
+    
+    /* Create remaining headers */
+    for (;;) {
+        ret = th_encode_flushheader(encoder, &tc, &packet);
+        if (ret < 0){
+            fprintf(stderr,"Internal Theora library error.\n");
+            return NS_ERROR_FAILURE;
+        } else if (!ret) break;
+        if (replaying && NS_FAILED(rv = replay.AddHeader(&packet)))
+            return rv;
+        ogg_stream_packetin(ogg_state, &packet);
+    }
+    
+    /* Flush the rest of our headers. This ensures the actual data in each 
+       stream will start on a new page, as per spec. */
+    for (;;) {
+        ret = ogg_stream_flush(ogg_state, &page);
+        if (ret < 0){
+            fprintf(stderr,"Internal Ogg library error.\n");
+            return NS_ERROR_FAILURE;
+        }
+        if (ret == 0) break;
+        writer.WritePage(&page);
+    }
+    
+    if (indexing)
+        skeleton.WriteHeaders(&writer);
+    if (withAudio)
+        vorbis->WriteHeaders();
+    if (indexing)
+        skeleton.WriteEOS(&writer);
+    
+    /* From here on pages from both streams are interleaved by time */
+    if (withAudio) {
+        rv = muxer.Init(&writer, shift, FPS_N, FPS_D, AUDIO_SAMPLE_RATE);
+        if (NS_FAILED(rv))
+            return rv;
+        muxing = PR_TRUE;
+        rv = audioQueue.Start(vorbis, AUDIO_CHANNELS);
+        if (NS_FAILED(rv))
+            return rv;
+    }
+    
+    return NS_OK;
+}
+
+/*
+ * Acquire the camera (and microphone) and start feeding the encoder
+ */
+nsresult
+VideoSession::StartCapture(VideoCanvas *preview)
+{
+    int count;
+    nsresult rv;
+    struct vidcap_fmt_info *formats;
+    
+    /* Acquire camera */
+    if (!(source = vidcap_src_acquire(sapi, info))) {
+        fprintf(stderr, "Failed vidcap_src_acquire()\n");
+        return NS_ERROR_FAILURE;
+    }
+    
+    /* Start recording in whatever the camera does best. Its formats are
+     * normally known by now; if not, this is the time to find out. */
+    if (!device->probed)
+        registry->Learn(device, source);
+    count = registry->CopyFormats(device, &formats);
+    rv = ingest.Bind(source, formats, count, WIDTH, HEIGHT, FPS_N, FPS_D);
+    PR_Free(formats);
+    if (NS_FAILED(rv)) {
+		vidcap_src_release(source);
+		return NS_ERROR_FAILURE;
+	}
+	
+	startTime = PR_Now();
+	if (withAudio && NS_FAILED(StartAudio())) {
+		vidcap_src_release(source);
+		return NS_ERROR_FAILURE;
+	}
+	
+	/* The capture thread paints onto the canvas from now on */
+	canvas.Swap(preview);
+	if (vidcap_src_capture_start(source, this->RecordToFileCallback, this)) {
+		fprintf(stderr, "Failed vidcap_src_capture_start()\n");
+		canvas.Swap(preview);
+		StopAudio();
+		vidcap_src_release(source);
+		return NS_ERROR_FAILURE;
+	}
+	return NS_OK;
+}
+
+/*
+ * Drain the encoders and close the Ogg file
+ */
+nsresult
+VideoSession::FinishOggTheora()
+{
+    nsresult rv;
+    ogg_page page;
+    
+    /* The last frame must not be lost to busy chunks, wait for one */
+    if (haveHeld) {
+        EncodeFrame(held, heldDups, PR_TRUE);
+        haveHeld = PR_FALSE;
+    }
+    PR_Free(held);
+    held = NULL;
+    thumbs.Close();
+    if (chunked) {
+        chunked->Finish();
+        delete chunked;
+        chunked = nsnull;
+    }
+    th_encode_free(encoder);
+    encoder = NULL;
+    if (ogg_stream_flush(ogg_state, &page))
+        WritePage(&page);
+    if (vorbis) {
+        /* The audio stream has stopped, encode what it left queued */
+        audioQueue.Stop();
+        vorbis->Finish();
+        delete vorbis;
+        vorbis = nsnull;
+    }
+    if (muxing) {
+        muxer.Finish();
+        muxing = PR_FALSE;
+    }
+    rv = writer.Close();
+    writer.SetSkeleton(nsnull);
+    if (indexing && outfile && NS_SUCCEEDED(rv) &&
+        NS_FAILED(skeleton.Finish(outfile)))
+        fprintf(stderr, "Could not write the seek index\n");
+    indexing = PR_FALSE;
+    if (outfile) {
+        if (NS_FAILED(OutputFile::Close(outfile)) && NS_SUCCEEDED(rv))
+            rv = NS_ERROR_FAILURE;
+        outfile = NULL;
+    }
+    ogg_stream_clear(ogg_state);
+    return rv;
+}
+
+/*
+ * Undo a SetupOggTheora() that failed part way, or whose capture never
+ * started: free whatever it got to without encoding anything more, and
+ * remove the file and its thumbnails, which hold nothing worth keeping
+ */
+void
+VideoSession::AbortOggTheora()
+{
+    PR_Free(held);
+    held = NULL;
+    haveHeld = PR_FALSE;
+    thumbs.Close();
+    if (chunked) {
+        chunked->Finish();
+        delete chunked;
+        chunked = nsnull;
+    }
+    if (encoder) {
+        th_encode_free(encoder);
+        encoder = NULL;
+    }
+    audioQueue.Stop();
+    if (vorbis) {
+        delete vorbis;
+        vorbis = nsnull;
+    }
+    if (muxing) {
+        muxer.Finish();
+        muxing = PR_FALSE;
+    }
+    writer.Close();
+    writer.SetSkeleton(nsnull);
+    indexing = PR_FALSE;
+    if (outfile) {
+        nsCAutoString thumbPath(outPath);
+        thumbPath.Append(".thumbs");
+        OutputFile::Discard(outfile, outPath);
+        OutputFile::Discard(NULL, thumbPath);
+        outfile = NULL;
+    }
+    ogg_stream_clear(ogg_state);
+}
+
+/*
+ * Start recording to file
+ */
+nsresult
+VideoSession::StartFile(VideoSettings *settings, VideoCanvas *preview,
+    FILE *file, const nsACString &path)
+{
+    nsresult rv;
+    if (recording) {
+        fprintf(stderr, "Recording in progress!\n");
+        OutputFile::Discard(file, path);
+        return NS_ERROR_FAILURE;
+    }
+    
+    Configure(settings);
+    lowLatency = PR_FALSE;
+    rv = OpenOggFile(file, path);
+    if (NS_FAILED(rv)) return rv;
+    rv = SetupOggTheora();
+    if (NS_FAILED(rv)) {
+        AbortOggTheora();
+        return rv;
+    }
+    
+    rv = StartCapture(preview);
+    if (NS_FAILED(rv)) {
+        AbortOggTheora();
+        return rv;
+    }
+
+    SetRecording(1);
+    return NS_OK;
+}
+
+/*
+ * Start recording to a pipe
+ */
+nsresult
+VideoSession::StartStream(VideoSettings *settings, VideoCanvas *preview,
+    nsIAsyncOutputStream *pipe)
+{
+    nsresult rv;
+    if (recording) {
+        fprintf(stderr, "Recording in progress!\n");
+        pipe->Close();
+        return NS_ERROR_FAILURE;
+    }
+    
+    Configure(settings);
+    mPipeOut = pipe;
+    
+    /* Each packet gets a page of its own so the reader sees it at once */
+    lowLatency = PR_TRUE;
+    outfile = NULL;
+    rv = writer.OpenStream(mPipeOut, highWater);
+    if (NS_SUCCEEDED(rv)) {
+        rv = SetupOggTheora();
+        if (NS_FAILED(rv))
+            AbortOggTheora();
+    }
+    if (NS_SUCCEEDED(rv)) {
+        rv = StartCapture(preview);
+        if (NS_FAILED(rv))
+            FinishOggTheora();
+    }
+    if (NS_FAILED(rv)) {
+        /* The reader sees the end of the stream */
+        mPipeOut->Close();
+        mPipeOut = nsnull;
+        return rv;
+    }
+    
+    SetRecording(2);
+    return NS_OK;
+}
+
+/*
+ * Start keeping the last replaySeconds in memory. Nothing is written
+ * until SaveReplay, and audio is not recorded in this mode.
+ */
+nsresult
+VideoSession::StartReplay(VideoSettings *settings, VideoCanvas *preview)
+{
+    nsresult rv;
+    if (recording) {
+        fprintf(stderr, "Recording in progress!\n");
+        return NS_ERROR_FAILURE;
+    }
+    
+    Configure(settings);
+    if (!replayFrames)
+        return NS_ERROR_INVALID_ARG;
+    withAudio = PR_FALSE;
+    lowLatency = PR_FALSE;
+    replaying = PR_TRUE;
+    outfile = NULL;
+    rv = SetupOggTheora();
+    if (NS_FAILED(rv)) {
+        AbortOggTheora();
+        replay.Clear();
+        replaying = PR_FALSE;
+        return rv;
+    }
+    
+    rv = StartCapture(preview);
+    if (NS_FAILED(rv)) {
+        FinishOggTheora();
+        replay.Clear();
+        replaying = PR_FALSE;
+        return rv;
+    }
+    
+    SetRecording(3);
+    return NS_OK;
+}
+
+/*
+ * Write what the replay ring holds to a new file, capture carries on
+ */
+nsresult
+VideoSession::SaveReplay(nsACString &file)
+{
+    nsresult rv;
+    FILE *f;
+    PRUint32 len;
+    unsigned char *data;
+    nsCAutoString path;
+    
+    /* The ring is only set up once the media thread has started it */
+    if (Recording() != 3)
+        return NS_ERROR_NOT_AVAILABLE;
+    
+    rv = replay.Save(&data, &len);
+    if (NS_FAILED(rv)) return rv;
+    
+    rv = OutputFile::Create("video", ".ogg", len, path, &f);
+    if (NS_FAILED(rv)) {
+        fprintf(stderr, "Could not open OGG file\n");
+        PR_Free(data);
+        return rv;
+    }
+    if (fwrite(data, 1, len, f) != len) {
+        fprintf(stderr, "Could not write to file!\n");
+        rv = NS_ERROR_FAILURE;
+    }
+    PR_Free(data);
+    if (NS_FAILED(rv)) {
+        OutputFile::Discard(f, path);
+        return rv;
+    }
+    rv = OutputFile::Close(f);
+    if (NS_FAILED(rv)) return rv;
+    
+    EscapeBackslash(path);
+    file.Assign(path.get(), strlen(path.get()));
+    return NS_OK;
+}
+
+/*
+ * Same as SaveReplay, but into a stream that holds the whole clip
+ */
+nsresult
+VideoSession::SaveReplayToStream(nsIInputStream **out)
+{
+    nsresult rv;
+    PRUint32 len;
+    unsigned char *data;
+    
+    /* The ring is only set up once the media thread has started it */
+    if (Recording() != 3)
+        return NS_ERROR_NOT_AVAILABLE;
+    
+    nsCOMPtr<nsIStringInputStream> stream =
+        do_CreateInstance("@mozilla.org/io/string-input-stream;1");
+    if (!stream)
+        return NS_ERROR_OUT_OF_MEMORY;
+    
+    rv = replay.Save(&data, &len);
+    if (NS_FAILED(rv)) return rv;
+    rv = stream->SetData((const char *)data, len);
+    PR_Free(data);
+    if (NS_FAILED(rv)) return rv;
+    
+    NS_ADDREF(*out = stream);
+    return NS_OK;
+}
+
+/*
+ * Stop recording and hand the preview canvas back, to be let go of on
+ * the main thread
+ */
+nsresult
+VideoSession::Stop(VideoCanvas *preview)
+{
+    nsresult rv;
+    
+    if (!recording) {
+        fprintf(stderr, "No recording in progress!\n");
+        return NS_ERROR_FAILURE;    
+    }
+    if (vidcap_src_capture_stop(source)) {
+		fprintf(stderr, "Failed vidcap_src_capture_stop()\n");
+		return NS_ERROR_FAILURE;
+	}
+    vidcap_src_release(source);
+    source = NULL;
+    StopAudio();
+    
+    rv = FinishOggTheora();
+    if (recording == 2) {
+        mPipeOut->Close();
+        mPipeOut = nsnull;
+    }
+    if (replaying) {
+        replay.Clear();
+        replaying = PR_FALSE;
+    }
+    if (preview)
+        canvas.Swap(preview);
+    canvas.ctx = nsnull;
+    canvas.thebes = nsnull;
+    SetRecording(0);
+    return rv;
+}
+
+void
+VideoSession::AppendStats(nsACString &out)
+{
+    char buf[512];
+    
+    /* Names come from the driver and may hold anything */
+    out.Append("{\"source\":");
+    SourceRegistry::AppendString(out, info->identifier);
+    PR_snprintf(buf, sizeof(buf), "%s %dx%d",
+        vidcap_fourcc_string_get(ingest.Fourcc()),
+        ingest.InputWidth(), ingest.InputHeight());
+    out.Append(",\"format\":");
+    SourceRegistry::AppendString(out, buf);
+    
+    PR_snprintf(buf, sizeof(buf),
+        ",\"recording\":%s,"
+        "\"frames\":%lld,\"dropped\":%u,\"duplicated\":%u,"
+        "\"static\":%u,\"shed\":%u,\"thumbnails\":%u,\"lostPages\":%u,"
+        "\"speed\":%d,\"quality\":%d,"
+        "\"load\":%u,\"raised\":%u,\"lowered\":%u,",
+        recording ? "true" : "false",
+        pacer.Frames(), pacer.Dropped(), pacer.Duplicated(),
+        scene.Static(), shed, thumbs.Count(), writer.Dropped(),
+        speed.Speed(), speed.Quality(), speed.Load(), speed.Raised(), speed.Lowered());
+    out.Append(buf);
+    stats.Append(out);
+    out.Append("}");
+}
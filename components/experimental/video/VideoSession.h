@@ -0,0 +1,276 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is Video for Jetpack.
+ *
+ * The Initial Developer of the Original Code is
+ * Mozilla Labs
+ * Portions created by the Initial Developer are Copyright (C) 2009
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Anant Narayanan <anant@kix.in>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef VideoSession_h_
+#define VideoSession_h_
+
+#include "FramePacer.h"
+#include "VideoIngest.h"
+#include "ThumbnailSidecar.h"
+#include "StaticSceneDetector.h"
+#include "SpeedController.h"
+#include "PipelineStats.h"
+#include "BufferArena.h"
+#include "ReplayRing.h"
+#include "SourceRegistry.h"
+#include "ChunkedEncoder.h"
+#include "OggWriter.h"
+#include "OutputFile.h"
+#include "MediaThread.h"
+#include "OggSkeleton.h"
+#include "OggMuxer.h"
+#include "VorbisEncoder.h"
+#include "VorbisQueue.h"
+#include "portaudio.h"
+
+#include <time.h>
+#include <ogg/ogg.h>
+#include <vidcap/vidcap.h>
+#include <vidcap/converters.h>
+#include <theora/theoraenc.h>
+
+#include "prmem.h"
+#include "prprf.h"
+#include "nsIPipe.h"
+#include "nsIAsyncInputStream.h"
+#include "nsIAsyncOutputStream.h"
+#include "nsIStringStream.h"
+#include "nsIDOMCanvasRenderingContext2D.h"
+#include "gfxContext.h"
+#include "gfxPattern.h"
+#include "gfxASurface.h"
+#include "gfxImageSurface.h"
+#include "nsStringAPI.h"
+#include "nsDirectoryServiceDefs.h"
+#include "nsDirectoryServiceUtils.h"
+#include "nsComponentManagerUtils.h"
+#include "nsICanvasRenderingContextInternal.h"
+
+#define WIDTH 640
+#define HEIGHT 480
+#define FPS_N 15
+#define FPS_D 1
+#define KEYFRAME_FREQ 64
+#define VIDEO_QUALITY 48
+#define MIN_VIDEO_QUALITY 16
+#define MAX_ENCODER_THREADS 16
+#define FLUSH_INTERVAL 1000
+#define WRITE_HIGH_WATER (4 * 1024 * 1024)
+#define STREAM_SEGMENT_SIZE 4096
+#define STATIC_THRESHOLD 2
+#define REPLAY_SECONDS 30
+#define REPLAY_MEMORY (32 * 1024 * 1024)
+#define VIDEO_RESERVE (8 * 1024 * 1024)
+
+#define AUDIO_SAMPLE_RATE 44000
+#define AUDIO_CHANNELS 2
+#define AUDIO_FRAMES_PER_BUFFER 512
+#define AUDIO_QUALITY 0.3f
+
+/* What the recorder's attributes were when a session started */
+struct VideoSettings {
+    int threads;
+    PRUint32 flushInterval;
+    PRUint32 highWater;
+    PRBool withAudio;
+    PRUint32 staticThreshold;
+    PRBool adaptive;
+    PRUint32 replaySeconds;
+    PRUint32 replayMemory;
+    PRBool thumbnails;
+    PRUint32 thumbnailInterval;
+};
+
+/*
+ * The preview canvas. It is looked up and let go of on the main thread,
+ * in between it belongs to the session and is painted from the capture
+ * thread.
+ */
+struct VideoCanvas {
+    nsCOMPtr<nsICanvasRenderingContextInternal> ctx;
+    nsRefPtr<gfxContext> thebes;
+
+    nsresult Init(nsIDOMCanvasRenderingContext2D *canvas);
+    void Swap(VideoCanvas *other)
+    {
+        ctx.swap(other->ctx);
+        thebes.swap(other->thebes);
+    }
+};
+
+/*
+ * One source being recorded: its capture callback, encoder(s), writer
+ * and output. Sessions share nothing but the vidcap sapi, so several can
+ * run side by side, each on its own capture and encoder threads.
+ *
+ * Starting and stopping happen on the recorder's media thread; the main
+ * thread only keeps track of what it last asked for (Mode()), creates
+ * the file or pipe to record to, and saves replays.
+ */
+class VideoSession
+{
+public:
+    VideoSession(vidcap_sapi *sapi, SourceRegistry *registry,
+        VideoSource *device);
+    ~VideoSession();
+
+    nsresult Init();
+    
+    /* Media thread. The preview canvas is taken over on success and
+     * handed back by Stop(), or left where it is on failure. */
+    nsresult StartFile(VideoSettings *settings, VideoCanvas *preview,
+        FILE *file, const nsACString &path);
+    nsresult StartStream(VideoSettings *settings, VideoCanvas *preview,
+        nsIAsyncOutputStream *pipe);
+    /* Keep the last few seconds in memory only, until saved */
+    nsresult StartReplay(VideoSettings *settings, VideoCanvas *preview);
+    nsresult Stop(VideoCanvas *preview);
+    
+    /* Main thread */
+    nsresult SaveReplay(nsACString &file);
+    nsresult SaveReplayToStream(nsIInputStream **out);
+    /* What was last asked for, one of recording's values below; returns
+     * the generation a start's failure has to match */
+    PRUint32 SetMode(int m, PRBool audio);
+    void StartFailed(PRUint32 gen);
+    /* What has actually started, as opposed to what was asked for */
+    int Recording();
+    int Mode() { return mode; }
+    PRBool WantsAudio() { return mode && modeAudio; }
+    static nsresult CreatePipe(PRUint32 highWater,
+        nsIAsyncInputStream **in, nsIAsyncOutputStream **out);
+
+    const char *Id() { return info->identifier; }
+    SpeedController *Controller() { return &speed; }
+    /* Append this session's counters and histograms as a JSON object */
+    void AppendStats(nsACString &out);
+
+    /* The form of a path that is handed back to script */
+    static void EscapePath(nsACString& path);
+
+private:
+    int mode;
+    PRBool modeAudio;
+    PRUint32 generation;
+    
+    int size;
+    /* Set on the media thread once a start has got going, through
+     * SetRecording() so that the main thread can read it under
+     * recordingLock */
+    int recording;
+    PRLock *recordingLock;
+    FILE *outfile;
+    /* Where outfile is, for removing it if the start fails */
+    nsCString outPath;
+    OggWriter writer;
+    PRUint32 flushInterval;
+    PRUint32 highWater;
+    PRBool lowLatency;
+    PRBool replaying;
+    ReplayRing replay;
+    PRUint32 replayFrames;
+    PRUint32 replayMemory;
+    nsCOMPtr<nsIAsyncOutputStream> mPipeOut;
+    
+    vidcap_sapi *sapi;
+    vidcap_src *source;
+    SourceRegistry *registry;
+    VideoSource *device;
+    struct vidcap_src_info *info;
+    VideoIngest ingest;
+    th_enc_ctx *encoder;
+    ogg_stream_state *ogg_state;
+    int granuleShift;
+    OggSkeleton skeleton;
+    PRBool indexing;
+    FramePacer pacer;
+    StaticSceneDetector scene;
+    unsigned char *held;
+    PRBool haveHeld;
+    int heldDups;
+    SpeedController speed;
+    PRBool adaptive;
+    PipelineStats stats;
+    PRUint32 shed;
+    int threads;
+    ChunkedEncoder *chunked;
+    ThumbnailSidecar thumbs;
+    PRBool withThumbs;
+    int thumbInterval;
+    PRInt64 position;
+    PRUint32 pushed;
+    
+    PRBool withAudio;
+    PRBool muxing;
+    PRBool audioStarted;
+    PRTime startTime;
+    PaStream *audioStream;
+    VorbisEncoder *vorbis;
+    /* Between the audio callback and the encoder */
+    VorbisQueue audioQueue;
+    OggMuxer muxer;
+    
+    VideoCanvas canvas;
+
+    void Configure(VideoSettings *settings);
+    nsresult OpenOggFile(FILE *file, const nsACString &path);
+    nsresult SetupOggTheora();
+    nsresult StartCapture(VideoCanvas *preview);
+    nsresult FinishOggTheora();
+    void AbortOggTheora();
+    void SetRecording(int r);
+    nsresult EncodeFrame(unsigned char *yuv, int dups, PRBool wait);
+    nsresult QueueFrame(unsigned char *yuv, int count);
+    PRUint32 Backlog();
+    void AdaptEffort(PRTime busy);
+    void PaintFrame(unsigned char *yuv);
+    void WritePacket(ogg_packet *op);
+    void WritePage(ogg_page *og);
+    static void OnPacket(void *data, ogg_packet *op);
+    nsresult StartAudio();
+    void StopAudio();
+    static void OnAudioPage(void *data, ogg_page *og);
+    static int AudioCallback(const void *input, void *output,
+        unsigned long framesPerBuffer,
+        const PaStreamCallbackTimeInfo* timeInfo,
+        PaStreamCallbackFlags statusFlags,
+        void *userData);
+    static int RecordToFileCallback(vidcap_src *src,
+        void *data, struct vidcap_capture_info *video);
+};
+
+#endif
@@ -49,11 +49,8 @@ var EXPORTED_SYMBOLS = ["AudioModule"];
 
 const Cc = Components.classes;
 const Ci = Components.interfaces;
+const Cr = Components.results;
 const CC = Components.Constructor;
-const Fi = CC(
-            "@mozilla.org/file/local;1",
-            "nsILocalFile",
-            "initWithPath");
 const Ff = CC(
             "@mozilla.org/file/local;1",
             "nsILocalFile",
@@ -99,16 +96,96 @@ function AudioModule() {
       return {};
     }
   }
+  
+  // Getting the service is cheap, PortAudio starts up in the
+  // background from here on.
+  this.warmUp();
 }
 AudioModule.prototype = {
+  // === {{{AudioModule.warmUp(done)}}} ===
+  //
+  // Gets the audio devices ready ahead of the first
+  // recording. {{{done}}}, if given, is called with
+  // whether that worked. Recording before then is
+  // fine, it just waits.
+  //
+  warmUp: function(done) {
+    try {
+      Re.warmUp(function(status) {
+        if (done)
+          done(status == Cr.NS_OK);
+      });
+    } catch (e) {
+      if (done)
+        done(false);
+    }
+  },
+
+  // === {{{AudioModule.devices}}} ===
+  //
+  // The input devices found so far, each with its
+  // {{{name}}}, {{{hostApi}}}, {{{channels}}},
+  // {{{sampleRate}}} and whether it is the
+  // {{{default}}} one recorded from. {{{null}}} until
+  // they have been looked for, see {{{warmUp}}}.
+  //
+  get devices() {
+    try {
+      return JSON.parse(Re.devices);
+    } catch (e) {
+      return null;
+    }
+  },
+
+  // === {{{AudioModule.refreshDevices(done)}}} ===
+  //
+  // Looks for devices again, for when one has been
+  // plugged in or out. Not while recording.
+  //
+  refreshDevices: function(done) {
+    try {
+      Re.refreshDevices(function(status) {
+        if (done)
+          done(status == Cr.NS_OK);
+      });
+    } catch (e) {
+      if (done)
+        done(false);
+    }
+  },
+
+  // === {{{AudioModule.setProcessing(opts)}}} ===
+  //
+  // Cleans up the microphone natively before any
+  // recording sees it. {{{opts}}} may set {{{gain}}}
+  // (dB), {{{highPass}}} (Hz, also removes DC) and
+  // {{{noiseGate}}} (dBFS); 0 turns each one off.
+  // Not while recording.
+  //
+  setProcessing: function(opts) {
+    try {
+      if ("gain" in opts)
+        Re.inputGain = opts.gain;
+      if ("highPass" in opts)
+        Re.highPassFrequency = opts.highPass;
+      if ("noiseGate" in opts)
+        Re.noiseGateThreshold = opts.noiseGate;
+    } catch (e) {
+      return false;
+    }
+    return true;
+  },
+
   // === {{{AudioModule.recordToFile()}}} ===
   //
   // Starts recording audio and encoding it into
-  // and Ogg/Vorbis file.
+  // and Ogg/Vorbis file. The microphone is opened
+  // in the background; {{{done}}}, if given, is
+  // called with whether that worked.
   //
-  recordToFile: function() {
+  recordToFile: function(done) {
     try {
-      this._path = Re.startRecordToFile();
+      this._path = Re.startRecordToFile(started(this, done));
     } catch (e) {
       return false;
     }
@@ -123,10 +200,16 @@ AudioModule.prototype = {
   // (PCM float sampled at 44000Hz) to the output
   // end of an nsIPipe.
   //
-  recordToPipe: function(cb) {
+  recordToPipe: function(cb, done) {
+    return this._recordToPipe(cb, "raw", done);
+  },
+
+  _recordToPipe: function(cb, format, done) {
     Cb = cb;
     try {
-      this._pipe = Re.start();
+      Re.voiceMode = (format == "voice");
+      Re.compressStream = (format == "vorbis");
+      this._pipe = Re.start(started(this, done));
       this._pipe.asyncWait(new inputStreamListener(), 0, 0, CT);
       this.isRecording = 2;
     } catch (e) {
@@ -135,31 +218,65 @@ AudioModule.prototype = {
     
     return true;
   },
-  
+
+  // === {{{AudioModule.recordVoiceToPipe()}}} ===
+  //
+  // Like {{{recordToPipe}}}, but for speech: the
+  // pipe carries mono Ogg/Opus, one small packet
+  // per page as soon as it is captured. {{{opts}}}
+  // may set {{{bitrate}}} (bits per second) and
+  // {{{frameMs}}} (10 or 20).
+  //
+  recordVoiceToPipe: function(cb, opts, done) {
+    try {
+      if (opts && opts.bitrate)
+        Re.voiceBitrate = opts.bitrate;
+      if (opts && opts.frameMs)
+        Re.voiceFrameMs = opts.frameMs;
+    } catch (e) {
+      return false;
+    }
+    return this._recordToPipe(cb, "voice", done);
+  },
+
+  // === {{{AudioModule.recordCompressedToPipe()}}} ===
+  //
+  // Like {{{recordToPipe}}}, but the pipe carries
+  // Ogg/Vorbis pages, about a tenth of the bytes.
+  // {{{flushMs}}}, if given, bounds how long audio
+  // may wait on a part-filled page; 0 sends every
+  // packet as soon as it is encoded.
+  //
+  recordCompressedToPipe: function(cb, flushMs, done) {
+    try {
+      if (flushMs !== undefined && flushMs !== null)
+        Re.streamFlushInterval = flushMs;
+    } catch (e) {
+      return false;
+    }
+    return this._recordToPipe(cb, "vorbis", done);
+  },
+
   // === {{{AudioModule.stopRecording()}}} ===
   //
   // Stops recording. If recording was started
   // with {{{recordToFile}}} then this routine will
   // return the full (local) path of the Ogg/Vorbis
-  // file that the audio was saved to.
+  // file that the audio was saved to. The file is
+  // complete once {{{done}}}, if given, is called
+  // with that same path.
   //
-  stopRecording: function() {
+  stopRecording: function(done) {
     switch (this.isRecording) {
       case 0:
         throw "Not recording!";
         break;
       case 1:
-        Re.stop();
+        Re.stop(stopped(this._path, done));
         this.isRecording = 0;
-        let src = new Fi(this._path);
-        let dst = getOrCreateDirectory();
-
-        src.copyTo(dst, '');
-        dst.append(src.leafName);
-
-        return dst.path;
+        return this._path;
       case 2:
-        Re.stop();
+        Re.stop(stopped(null, done));
         this.isRecording = 0;
         break;
     }
@@ -181,26 +298,24 @@ AudioModule.prototype = {
   }
 }
 
-function ensureDirectoryExists(aFile) {
-  if (aFile.exists()) {
-    if (!aFile.isDirectory()) {
-      throw new Error("File " + aFile.path + 
-      " exists but is not a directory");
+function started(module, done) {
+  return function(status) {
+    let ok = (status == Cr.NS_OK);
+    // A file that failed to start has been removed again
+    if (!ok) {
+      module.isRecording = 0;
+      module._path = null;
     }
-  } else {
-    aFile.create(aFile.DIRECTORY_TYPE, 0755);
-  }
+    if (done)
+      done(ok);
+  };
 }
 
-function getOrCreateDirectory() {
-  let file = Ds.get("ProfD", Ci.nsIFile);
-
-  file.append("jetpack");
-  ensureDirectoryExists(file);
-  file.append("audio");
-  ensureDirectoryExists(file);
-
-  return file;
+function stopped(path, done) {
+  return function(status) {
+    if (done)
+      done(status == Cr.NS_OK ? path : null);
+  };
 }
 
 function getWindowsComponentDir() {
@@ -46,11 +46,13 @@ const Ci = Components.interfaces;
 
 function MusicModule() {
   // Don't fail if the binary music component is missing.
-  // FIXME: Get the appropriate component based on platform
-  // Currently, only iTunes on Mac is supported.
+  // iTunes on Mac, a folder of audio files elsewhere.
+  let os = Cc["@mozilla.org/xre/app-info;1"].
+           getService(Ci.nsIXULRuntime).OS;
+  let contract = (os == "Darwin") ? "@labs.mozilla.com/music/itunes;1"
+                                  : "@labs.mozilla.com/music/library;1";
   try {
-    Mu = Cc["@labs.mozilla.com/music/itunes;1"].
-         getService(Ci.IMusicPlayer);
+    Mu = Cc[contract].getService(Ci.IMusicPlayer);
   } catch (e) {
     return {};
   }
@@ -119,5 +121,31 @@ MusicModule.prototype = {
   //
   getCurrentTrack: function() {
     return Mu.getCurrentTrack();
+  },
+
+  // === {{{MusicModule.folder}}} ===
+  //
+  // Where audio files are looked for, when the
+  // library is kept here rather than by a player
+  // application. Setting it looks through the new
+  // folder in the background.
+  //
+  get folder() {
+    return (Mu instanceof Ci.IMusicLibrary) ? Mu.folder : null;
+  },
+
+  set folder(path) {
+    if (Mu instanceof Ci.IMusicLibrary)
+      Mu.folder = path;
+  },
+
+  // === {{{MusicModule.rescan()}}} ===
+  //
+  // Looks for audio files again, if the library
+  // is kept here.
+  //
+  rescan: function() {
+    if (Mu instanceof Ci.IMusicLibrary)
+      Mu.rescan();
   }
 }
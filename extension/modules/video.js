@@ -43,16 +43,17 @@
 Components.utils.import("resource://jetpack/modules/init.js");
 
 var Re;
+var Cb;
+var CT;
 var EXPORTED_SYMBOLS = ["VideoModule"];
 
 const Cc = Components.classes;
 const Ci = Components.interfaces;
-const Fi = Components.Constructor(
-            "@mozilla.org/file/local;1",
-            "nsILocalFile",
-            "initWithPath");
-const Ds = Cc["@mozilla.org/file/directory_service;1"].
-           getService(Ci.nsIProperties);
+const Cr = Components.results;
+const Bi = Components.Constructor(
+            "@mozilla.org/binaryinputstream;1",
+            "nsIBinaryInputStream",
+            "setInputStream");
 
 function VideoModule() {
   // Don't fail if the binary component is missing.
@@ -60,12 +61,58 @@ function VideoModule() {
     this.isRecording = 0;
     Re = Cc["@labs.mozilla.com/video/recorder;1"].
          getService(Ci.IVideoRecorder);
+    CT = Cc["@mozilla.org/thread-manager;1"].
+         getService().currentThread;
   } catch (e) { return {}; }
+  
+  // Getting the service is cheap, the cameras are looked for in the
+  // background from here on.
+  this.warmUp();
 }
 VideoModule.prototype = {
-  recordToFile: function() {
+  // done, if given, is called with whether the cameras could be
+  // looked at. Until then there are no devices and recording fails.
+  warmUp: function(done) {
     try {
-      this._path = Re.startRecordToFile();
+      Re.warmUp(function(status) {
+        if (done)
+          done(status == Cr.NS_OK);
+      });
+    } catch (e) {
+      if (done)
+        done(false);
+    }
+  },
+
+  // Every camera seen so far: its id, description, whether it is
+  // plugged in and the formats it offers.
+  get devices() {
+    try {
+      return JSON.parse(Re.devices);
+    } catch (e) {
+      return [];
+    }
+  },
+
+  // Cameras coming and going are noticed by themselves where the
+  // platform says so; this looks again by hand.
+  refreshDevices: function(done) {
+    try {
+      Re.refreshSources(function(status) {
+        if (done)
+          done(status == Cr.NS_OK);
+      });
+    } catch (e) {
+      if (done)
+        done(false);
+    }
+  },
+
+  // The camera is started and stopped in the background. done, if given,
+  // is called with whether it actually started.
+  recordToFile: function(done) {
+    try {
+      this._path = Re.startRecordToFile(null, started(this, done));
     } catch (e) {
       return false;
     }
@@ -74,19 +121,37 @@ VideoModule.prototype = {
     return true;
   },
   
-  stopRecording: function() {
-    if (this.isRecording) {
-      Re.stop();
-      this.isRecording = 0;
-      let src = new Fi(this._path);
-      let dst = getOrCreateDirectory();
-
-      src.moveTo(dst, '');
-      dst.append(src.leafName);
-
-      return dst.path;
-    } else {
-      throw "Not recording!";
+  // Starts recording and hands Ogg/Theora data to cb as it is encoded,
+  // one byte array per call. The data is a complete Ogg stream that can
+  // be sent over the network as is.
+  recordToPipe: function(cb, done) {
+    Cb = cb;
+    try {
+      this._pipe = Re.start(null, started(this, done));
+      this._pipe.asyncWait(new inputStreamListener(), 0, 0, CT);
+      this.isRecording = 2;
+    } catch (e) {
+      return false;
+    }
+    
+    return true;
+  },
+  
+  // Returns the path of the file when recording to one. It is complete
+  // once done, if given, is called with that same path.
+  stopRecording: function(done) {
+    switch (this.isRecording) {
+      case 0:
+        throw "Not recording!";
+        break;
+      case 1:
+        Re.stop(stopped(this._path, done));
+        this.isRecording = 0;
+        return this._path;
+      case 2:
+        Re.stop(stopped(null, done));
+        this.isRecording = 0;
+        break;
     }
   },
 
@@ -99,24 +164,48 @@ VideoModule.prototype = {
   }
 }
 
-function ensureDirectoryExists(aFile) {
-  if (aFile.exists()) {
-    if (!aFile.isDirectory()) {
-      throw new Error("File " + aFile.path + 
-      " exists but is not a directory");
+function started(module, done) {
+  return function(status) {
+    let ok = (status == Cr.NS_OK);
+    // A file that failed to start has been removed again
+    if (!ok) {
+      module.isRecording = 0;
+      module._path = null;
     }
-  } else {
-    aFile.create(aFile.DIRECTORY_TYPE, 0755);
-  }
+    if (done)
+      done(ok);
+  };
 }
 
-function getOrCreateDirectory() {
-  let file = Ds.get("ProfD", Ci.nsIFile);
+function stopped(path, done) {
+  return function(status) {
+    if (done)
+      done(status == Cr.NS_OK ? path : null);
+  };
+}
 
-  file.append("jetpack");
-  ensureDirectoryExists(file);
-  file.append("video");
-  ensureDirectoryExists(file);
+function inputStreamListener() {
+}
+inputStreamListener.prototype = {
+  onInputStreamReady: function(input) {
+    let data;
+    try {
+      data = new Bi(input).readByteArray(input.available());
+    } catch (e) {
+      // Closed by Re.stop()
+      return;
+    }
+    
+    // Ogg pages can be split anywhere, no need to hold anything back
+    if (data.length)
+      Cb(data, data.length);
+    input.asyncWait(this, 0, 0, CT);
+  },
 
-  return file;
+  QueryInterface: function(aIID) {
+    if (aIID.equals(Ci.nsIInputStreamCallback) ||
+        aIID.equals(Ci.nsISupports))
+        return this;
+    throw Components.results.NS_ERROR_NO_INTERFACE;
+  }
 }